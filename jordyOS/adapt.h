@@ -0,0 +1,81 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+// Spin-or-park policy for adaptive locks, after locks/spinlockvsAI.py. Kept
+// free of kernel headers so bench/lockbench.c can build it for the host.
+//
+// A waiter that finds the lock taken spins for up to `threshold` cycles
+// when the predicted wait (an EWMA, weight 1/2^ADAPT_SHIFT) is at most the
+// threshold, and otherwise parks at once. Parking costs `park` cycles, the
+// measured delay from the release to the parked waiter running.
+//
+// The simulation picks its threshold offline by sweeping T over a recorded
+// trace. Here the sweep runs online: after each contended acquisition the
+// wait it actually needed (release time minus arrival, known whether the
+// waiter spun or parked) is charged to every candidate threshold as the
+// cost it would have had (w if w <= T, else T + park; park if the
+// prediction said not to spin). Every ADAPT_EPOCH waits the cheapest
+// candidate becomes the threshold and the totals are halved, so old
+// behaviour fades. Candidates are park * 2^(k - 2): a quarter of the park
+// cost up to sixteen times it. All state changes happen with the lock held.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ADAPT_SHIFT 3   // EWMA weight 1/8; the simulation uses 0.1
+#define ADAPT_NT 7      // candidate thresholds
+#define ADAPT_EPOCH 64  // contended acquisitions between choices
+#define ADAPT_MAX (1u << 30)  // samples are clamped to this many cycles
+
+typedef struct {
+  uint32_t ewma;       // predicted wait, cycles
+  uint32_t park;       // cost of parking, cycles
+  uint32_t threshold;  // spin budget, cycles
+  bool tune;           // false: threshold stays at park (spin, then park)
+  uint32_t n;          // waits this epoch
+  uint32_t spun, parked;  // how contended acquisitions went
+  uint64_t cost[ADAPT_NT];
+} adapt_t;
+
+static inline void adapt_init(adapt_t *a, uint32_t park, bool tune) {
+  *a = (adapt_t){.park = park, .threshold = park, .tune = tune};
+}
+
+static inline uint32_t adapt_candidate(const adapt_t *a, int k) {
+  return k >= 2 ? a->park << (k - 2) : a->park >> (2 - k);
+}
+
+// Cycles a waiter should spin before parking; 0 means park right away.
+static inline uint32_t adapt_spin_limit(const adapt_t *a) {
+  return a->ewma <= a->threshold ? a->threshold : 0;
+}
+
+// Reported by a waiter once it holds the lock: the wait it needed, whether
+// it parked, and if so how long after the release it got to run.
+static inline void adapt_wait(adapt_t *a, uint32_t wait, bool parked,
+                              uint32_t wake) {
+  if (wait > ADAPT_MAX) wait = ADAPT_MAX;
+  if (parked) {
+    a->parked++;
+    if (wake > ADAPT_MAX) wake = ADAPT_MAX;
+    a->park += (int32_t)(wake - a->park) >> ADAPT_SHIFT;
+    if (a->park == 0) a->park = 1;
+  } else {
+    a->spun++;
+  }
+  for (int k = 0; k < ADAPT_NT; k++) {
+    uint32_t t = adapt_candidate(a, k);
+    a->cost[k] += a->ewma > t ? a->park : wait <= t ? wait : t + a->park;
+  }
+  a->ewma += (int32_t)(wait - a->ewma) >> ADAPT_SHIFT;
+  if (++a->n < ADAPT_EPOCH) return;
+  int best = 2;  // threshold = park
+  for (int k = 0; k < ADAPT_NT; k++) {
+    if (a->cost[k] < a->cost[best]) best = k;
+    a->cost[k] >>= 1;
+  }
+  a->threshold = a->tune ? adapt_candidate(a, best) : a->park;
+  a->n = 0;
+}
+
+#endif
@@ -0,0 +1,64 @@
+; Application processor trampoline. smp_boot() copies ap_boot..ap_boot_end
+; to AP_BOOT, fills in ap_params and sends the AP a SIPI with vector
+; AP_BOOT >> 12, so the AP starts here in real mode at AP_BOOT:0000. Like
+; kernel_entry.asm it switches to protected mode on a flat GDT of its own,
+; then takes the BSP's CR4 and page directory, turns paging on and calls
+; ap_main(cpu) on the stack it was given. Everything is addressed relative
+; to AP_BOOT, since this copy is not where the code was linked.
+BITS 16
+GLOBAL ap_boot, ap_boot_end, ap_params
+
+AP_BOOT equ 0x91000             ; AP_BOOT in smp.c; page aligned, below 1 MB
+%define AT(label) (AP_BOOT + ((label) - ap_boot))
+
+ap_boot:
+    cli
+    cld
+    mov  ax, cs                 ; 0x9100
+    mov  ds, ax
+    o32 lgdt [ap_gdtr - ap_boot]
+    mov  eax, cr0
+    and  eax, 0x9FFFFFFF        ; INIT leaves the caches off (CD, NW)
+    or   eax, 1                 ; PE
+    mov  cr0, eax
+    jmp  dword 0x08:AT(ap_pm)
+
+BITS 32
+ap_pm:
+    mov  ax, 0x10
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
+    mov  ss, ax
+    mov  eax, [AT(ap_params) + 4]   ; cr4: global pages as on the BSP
+    mov  cr4, eax
+    mov  eax, [AT(ap_params)]       ; cr3: kernel_pd
+    mov  cr3, eax
+    mov  eax, cr0
+    or   eax, 0x80000000            ; PG
+    mov  cr0, eax
+    mov  esp, [AT(ap_params) + 8]
+    push dword [AT(ap_params) + 12] ; cpu
+    call [AT(ap_params) + 16]       ; ap_main(cpu); doesn't return
+.hang:
+    hlt
+    jmp  .hang
+
+align 8
+ap_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF       ; 0x08: code, base 0, limit 4 GB
+    dq 0x00CF92000000FFFF       ; 0x10: data
+ap_gdtr:
+    dw ap_gdtr - ap_gdt - 1
+    dd AT(ap_gdt)
+
+align 4
+ap_params:                      ; ap_params_t in smp.c
+    dd 0                        ; cr3
+    dd 0                        ; cr4
+    dd 0                        ; esp
+    dd 0                        ; cpu
+    dd 0                        ; entry
+ap_boot_end:
@@ -0,0 +1,471 @@
+#include "ape.h"
+#include "util.h"
+
+// apelang VM. ape_load() decodes the bytecode once into fixed-size
+// instructions: constants go into a table, strings and global names are
+// interned (so globals are array slots and string equality is an index
+// compare) and jump offsets become instruction indices. It also works out
+// the stack depth at every instruction and rejects code that could
+// underflow or overflow, so the handlers never check.
+//
+// ape_run() uses threaded dispatch (GCC's labels as values): the first run
+// stores each handler's address in its instructions, and every handler
+// ends by jumping straight to the next one's. -DAPE_SWITCH builds the same
+// handlers as a switch loop instead, for comparison. Only util.h is
+// included so the host benchmark can build this file.
+
+// Operand kinds; 0 marks an opcode we don't know.
+enum { K_NONE = 1, K_CONST, K_NAME, K_JUMP, K_LOOP };
+
+static const struct {
+  uint8_t operand, pops, pushes;
+} ops[APE_NOPS] = {
+    [APE_CONST] = {K_CONST, 0, 1},         [APE_NIL] = {K_NONE, 0, 1},
+    [APE_TRUE] = {K_NONE, 0, 1},           [APE_FALSE] = {K_NONE, 0, 1},
+    [APE_POP] = {K_NONE, 1, 0},            [APE_NEGATE] = {K_NONE, 1, 1},
+    [APE_ADD] = {K_NONE, 2, 1},            [APE_SUB] = {K_NONE, 2, 1},
+    [APE_MUL] = {K_NONE, 2, 1},            [APE_DIV] = {K_NONE, 2, 1},
+    [APE_EQUAL] = {K_NONE, 2, 1},          [APE_GREATER] = {K_NONE, 2, 1},
+    [APE_LESS] = {K_NONE, 2, 1},           [APE_JUMP_IF_FALSE] = {K_JUMP, 1, 1},
+    [APE_JUMP] = {K_JUMP, 0, 0},           [APE_LOOP] = {K_LOOP, 0, 0},
+    [APE_NOT] = {K_NONE, 1, 1},            [APE_PRINT] = {K_NONE, 1, 0},
+    [APE_INPUT] = {K_NONE, 0, 1},          [APE_GET_GLOBAL] = {K_NAME, 0, 1},
+    [APE_SET_GLOBAL] = {K_NAME, 1, 0},     [APE_RETURN] = {K_NONE, 0, 0},
+};
+
+// ---- loading ----
+static uint32_t be16(const uint8_t *c) { return (uint32_t)c[0] << 8 | c[1]; }
+
+// Index of the interned copy of the `n` bytes at `s`, added if new. Every
+// string in the code costs at least n + 1 bytes there, so a pool as big as
+// the code always has room.
+static uint32_t intern(ape_prog_t *p, const uint8_t *s, uint32_t n,
+                       uint32_t *pool_used) {
+  for (uint32_t i = 0; i < p->nstrs; i++)
+    if (strlen(p->strs[i]) == n && !memcmp(p->strs[i], s, n)) return i;
+  char *d = p->pool + *pool_used;
+  memcpy(d, s, n);
+  d[n] = '\0';
+  *pool_used += n + 1;
+  p->strs[p->nstrs] = d;
+  return p->nstrs++;
+}
+
+// Decodes one constant at c[*pos] into the table; false if it's malformed.
+static bool load_const(ape_prog_t *p, const uint8_t *c, uint32_t len,
+                       uint32_t *pos, uint32_t *pool_used) {
+  ape_value_t *v = &p->consts[p->nconsts];
+  if (*pos >= len) return false;
+  uint8_t tag = c[(*pos)++];
+  uint32_t left = len - *pos;
+  if (tag == APE_TAG_NIL) {
+    v->type = APE_VNIL;
+  } else if (tag == APE_TAG_BOOL && left >= 1) {
+    v->type = APE_VBOOL;
+    v->as.b = c[(*pos)++];
+  } else if (tag == APE_TAG_NUM && left >= 8) {
+    v->type = APE_VNUM;
+    memcpy(&v->as.num, c + *pos, 8);  // both little-endian
+    *pos += 8;
+  } else if (tag == APE_TAG_STR && left >= 2 && left - 2 >= be16(c + *pos)) {
+    uint32_t n = be16(c + *pos);
+    v->type = APE_VSTR;
+    v->as.str = intern(p, c + *pos + 2, n, pool_used);
+    *pos += 2 + n;
+  } else {
+    return false;
+  }
+  p->nconsts++;
+  return true;
+}
+
+// Follows every path from the first instruction, giving each one the
+// stack depth it starts at. Paths that meet must agree.
+static int check_stack(ape_prog_t *p) {
+  int16_t *depth = sys_malloc(p->ncode * sizeof *depth);
+  uint32_t *work = sys_malloc(p->ncode * sizeof *work), nwork = 0;
+  int err = depth && work ? 0 : APE_ENOMEM;
+  for (uint32_t i = 0; !err && i < p->ncode; i++) depth[i] = -1;
+  if (!err) {
+    depth[0] = 0;
+    work[nwork++] = 0;
+  }
+  while (!err && nwork) {
+    uint32_t i = work[--nwork], op = p->code[i].op.code;
+    int d = depth[i];
+    if (d < ops[op].pops) {
+      err = APE_ESTACK;
+      break;
+    }
+    d += ops[op].pushes - ops[op].pops;
+    if (d > APE_STACK) {
+      err = APE_ESTACK;
+      break;
+    }
+    uint32_t next[2];
+    int n = 0;
+    if (op != APE_JUMP && op != APE_LOOP && op != APE_RETURN) next[n++] = i + 1;
+    if (ops[op].operand == K_JUMP || ops[op].operand == K_LOOP)
+      next[n++] = p->code[i].arg;
+    for (int k = 0; k < n; k++) {
+      if (depth[next[k]] < 0) {
+        depth[next[k]] = d;
+        work[nwork++] = next[k];
+      } else if (depth[next[k]] != d) {
+        err = APE_ESTACK;
+      }
+    }
+  }
+  sys_free(depth);
+  sys_free(work);
+  return err;
+}
+
+int ape_load(ape_prog_t *p, const uint8_t *c, uint32_t len) {
+  memset(p, 0, sizeof *p);
+  uint32_t cap = len / 2 + 1;  // every constant and name takes 2+ bytes
+  int32_t *at = sys_malloc((len + 1) * sizeof *at);  // byte -> insn, or -1
+  p->code = sys_malloc((len + 1) * sizeof *p->code);
+  p->consts = sys_malloc(cap * sizeof *p->consts);
+  p->strs = sys_malloc(cap * sizeof *p->strs);
+  p->pool = sys_malloc(len + 1);
+  int err = 0;
+  if (!at || !p->code || !p->consts || !p->strs || !p->pool) {
+    err = APE_ENOMEM;
+    goto out;
+  }
+  for (uint32_t i = 0; i <= len; i++) at[i] = -1;
+
+  uint32_t pos = 0, pool_used = 0;
+  while (pos < len) {
+    ape_insn_t *in = &p->code[p->ncode];
+    at[pos] = p->ncode++;
+    uint8_t op = c[pos++];
+    uint8_t kind = op < APE_NOPS ? ops[op].operand : 0;
+    in->op.code = op;
+    in->arg = 0;
+    if (kind == K_CONST) {
+      in->arg = p->nconsts;
+      if (!load_const(p, c, len, &pos, &pool_used)) kind = 0;
+    } else if (kind == K_NAME) {
+      if (pos >= len || len - pos - 1 < c[pos]) {
+        kind = 0;
+      } else {
+        in->arg = intern(p, c + pos + 1, c[pos], &pool_used);
+        pos += 1 + c[pos];
+      }
+    } else if (kind == K_JUMP || kind == K_LOOP) {
+      if (len - pos < 2) {
+        kind = 0;
+      } else {
+        // Byte offset of the target for now.
+        int32_t off = be16(c + pos);
+        in->arg = (int32_t)pos + 2 + (kind == K_JUMP ? off : -off);
+        pos += 2;
+      }
+    }
+    if (!kind) {
+      err = APE_EBADCODE;
+      goto out;
+    }
+  }
+  // Falling off the end returns, so the handlers never check for it.
+  at[len] = p->ncode;
+  p->code[p->ncode].op.code = APE_RETURN;
+  p->code[p->ncode++].arg = 0;
+
+  for (uint32_t i = 0; i < p->ncode; i++) {
+    uint8_t kind = ops[p->code[i].op.code].operand;
+    if (kind != K_JUMP && kind != K_LOOP) continue;
+    int32_t t = p->code[i].arg;
+    if (t < 0 || (uint32_t)t > len || at[t] < 0) {
+      err = APE_EBADCODE;  // outside the code or inside an instruction
+      goto out;
+    }
+    p->code[i].arg = at[t];
+  }
+  p->globals = sys_malloc((p->nstrs + 1) * sizeof *p->globals);
+  if (!p->globals) {
+    err = APE_ENOMEM;
+    goto out;
+  }
+  memset(p->globals, 0, (p->nstrs + 1) * sizeof *p->globals);
+  err = check_stack(p);
+out:
+  sys_free(at);
+  if (err) ape_free(p);
+  return err;
+}
+
+void ape_free(ape_prog_t *p) {
+  sys_free(p->code);
+  sys_free(p->consts);
+  sys_free(p->strs);
+  sys_free(p->pool);
+  sys_free(p->globals);
+  p->code = NULL;
+  p->consts = NULL;
+  p->strs = NULL;
+  p->pool = NULL;
+  p->globals = NULL;
+}
+
+const char *ape_strerror(int err) {
+  if (err == APE_EBADCODE) return "malformed bytecode";
+  if (err == APE_ENOMEM) return "out of memory";
+  if (err == APE_ESTACK) return "unbalanced stack";
+  if (err == APE_ETYPE) return "operand is not a number";
+  if (err == APE_EUNDEF) return "undefined variable";
+  return "error";
+}
+
+// ---- running ----
+
+// Integers print exactly, others with up to six decimals; magnitudes from
+// 1e9 up as d.dddddde+N. `out` needs 24 bytes.
+static void fmt_num(double n, char *out) {
+  if (n != n) {
+    strcpy(out, "nan");
+    return;
+  }
+  if (n < 0) {
+    *out++ = '-';
+    n = -n;
+  }
+  if (n > 1.7976931348623157e308) {
+    strcpy(out, "inf");
+    return;
+  }
+  int e = 0;
+  if (n >= 1e9)
+    while (n >= 10) {
+      n /= 10;
+      e++;
+    }
+  uint32_t whole = (uint32_t)n, frac = (uint32_t)((n - whole) * 1e6 + 0.5);
+  if (frac >= 1000000) {
+    whole++;
+    frac -= 1000000;
+  }
+  itoa((int32_t)whole, out);
+  out += strlen(out);
+  if (frac) {
+    *out++ = '.';
+    for (uint32_t d = 100000; d && frac; d /= 10) {
+      *out++ = '0' + frac / d;
+      frac %= d;
+    }
+  }
+  *out = '\0';
+  if (e) {
+    *out++ = 'e';
+    *out++ = '+';
+    itoa(e, out);
+  }
+}
+
+static double parse_num(const char *s) {
+  while (*s == ' ') s++;
+  bool neg = *s == '-';
+  if (neg || *s == '+') s++;
+  double n = 0, scale = 1;
+  while (*s >= '0' && *s <= '9') n = n * 10 + (*s++ - '0');
+  if (*s == '.')
+    for (s++; *s >= '0' && *s <= '9'; s++) {
+      scale /= 10;
+      n += (*s - '0') * scale;
+    }
+  return neg ? -n : n;
+}
+
+static void print_value(const ape_prog_t *p, const ape_value_t *v) {
+  char nb[24];
+  if (v->type == APE_VNUM) {
+    fmt_num(v->as.num, nb);
+    sys_write(nb);
+  } else if (v->type == APE_VSTR) {
+    sys_write(p->strs[v->as.str]);
+  } else if (v->type == APE_VBOOL) {
+    sys_write(v->as.b ? "true" : "false");
+  } else {
+    sys_write("nil");
+  }
+  sys_write("\n");
+}
+
+static bool falsey(const ape_value_t *v) {
+  return v->type == APE_VNIL || (v->type == APE_VBOOL && !v->as.b);
+}
+
+static bool equal(const ape_value_t *a, const ape_value_t *b) {
+  if (a->type != b->type) return false;
+  if (a->type == APE_VNUM) return a->as.num == b->as.num;
+  if (a->type == APE_VSTR) return a->as.str == b->as.str;  // interned
+  if (a->type == APE_VBOOL) return a->as.b == b->as.b;
+  return true;
+}
+
+#define ARG (ip[-1].arg)
+#define NUMS() \
+  if (sp[-1].type != APE_VNUM || sp[-2].type != APE_VNUM) goto type_error
+#define ARITH(op)                           \
+  NUMS();                                   \
+  sp--;                                     \
+  sp[-1].as.num = sp[-1].as.num op sp->as.num
+#define COMPARE(op)                            \
+  NUMS();                                      \
+  sp--;                                        \
+  sp[-1].as.b = sp[-1].as.num op sp->as.num; \
+  sp[-1].type = APE_VBOOL
+
+// Runs the program from the top; globals keep their values between runs.
+int ape_run(ape_prog_t *p) {
+  ape_value_t stack[APE_STACK], *sp = stack;
+  const ape_insn_t *ip = p->code;
+  uint64_t steps = 0;
+  char line[32];
+  int err = 0;
+
+#ifdef APE_SWITCH
+#define OP(name) case name:
+#define NEXT() continue
+  for (;;) {
+    steps++;
+    switch ((ip++)->op.code) {
+#else
+#define OP(name) L_##name:
+#define NEXT()                \
+  do {                        \
+    steps++;                  \
+    goto *(ip++)->op.label; \
+  } while (0)
+  static const void *const labels[APE_NOPS] = {
+      [APE_CONST] = &&L_APE_CONST,   [APE_NIL] = &&L_APE_NIL,
+      [APE_TRUE] = &&L_APE_TRUE,     [APE_FALSE] = &&L_APE_FALSE,
+      [APE_POP] = &&L_APE_POP,       [APE_NEGATE] = &&L_APE_NEGATE,
+      [APE_ADD] = &&L_APE_ADD,       [APE_SUB] = &&L_APE_SUB,
+      [APE_MUL] = &&L_APE_MUL,       [APE_DIV] = &&L_APE_DIV,
+      [APE_EQUAL] = &&L_APE_EQUAL,   [APE_GREATER] = &&L_APE_GREATER,
+      [APE_LESS] = &&L_APE_LESS,     [APE_JUMP_IF_FALSE] = &&L_APE_JUMP_IF_FALSE,
+      [APE_JUMP] = &&L_APE_JUMP,     [APE_LOOP] = &&L_APE_LOOP,
+      [APE_NOT] = &&L_APE_NOT,       [APE_PRINT] = &&L_APE_PRINT,
+      [APE_INPUT] = &&L_APE_INPUT,   [APE_GET_GLOBAL] = &&L_APE_GET_GLOBAL,
+      [APE_SET_GLOBAL] = &&L_APE_SET_GLOBAL, [APE_RETURN] = &&L_APE_RETURN,
+  };
+  if (!p->threaded) {
+    for (uint32_t i = 0; i < p->ncode; i++)
+      p->code[i].op.label = labels[p->code[i].op.code];
+    p->threaded = true;
+  }
+  NEXT();
+#endif
+
+  OP(APE_CONST) {
+    *sp++ = p->consts[ARG];
+    NEXT();
+  }
+  OP(APE_NIL) {
+    sp++->type = APE_VNIL;
+    NEXT();
+  }
+  OP(APE_TRUE) {
+    sp->type = APE_VBOOL;
+    sp++->as.b = true;
+    NEXT();
+  }
+  OP(APE_FALSE) {
+    sp->type = APE_VBOOL;
+    sp++->as.b = false;
+    NEXT();
+  }
+  OP(APE_POP) {
+    sp--;
+    NEXT();
+  }
+  OP(APE_NEGATE) {
+    if (sp[-1].type != APE_VNUM) goto type_error;
+    sp[-1].as.num = -sp[-1].as.num;
+    NEXT();
+  }
+  OP(APE_ADD) {
+    ARITH(+);
+    NEXT();
+  }
+  OP(APE_SUB) {
+    ARITH(-);
+    NEXT();
+  }
+  OP(APE_MUL) {
+    ARITH(*);
+    NEXT();
+  }
+  OP(APE_DIV) {
+    ARITH(/);
+    NEXT();
+  }
+  OP(APE_EQUAL) {
+    sp--;
+    sp[-1].as.b = equal(&sp[-1], sp);
+    sp[-1].type = APE_VBOOL;
+    NEXT();
+  }
+  OP(APE_GREATER) {
+    COMPARE(>);
+    NEXT();
+  }
+  OP(APE_LESS) {
+    COMPARE(<);
+    NEXT();
+  }
+  OP(APE_JUMP_IF_FALSE) {
+    if (falsey(&sp[-1])) ip = p->code + ARG;
+    NEXT();
+  }
+  OP(APE_JUMP)
+  OP(APE_LOOP) {
+    ip = p->code + ARG;
+    NEXT();
+  }
+  OP(APE_NOT) {
+    sp[-1].as.b = falsey(&sp[-1]);
+    sp[-1].type = APE_VBOOL;
+    NEXT();
+  }
+  OP(APE_PRINT) {
+    print_value(p, --sp);
+    NEXT();
+  }
+  OP(APE_INPUT) {
+    read_line(line, sizeof line);
+    sp->type = APE_VNUM;
+    sp++->as.num = parse_num(line);
+    NEXT();
+  }
+  OP(APE_GET_GLOBAL) {
+    if ((*sp = p->globals[ARG]).type == APE_UNDEF) {
+      err = APE_EUNDEF;
+      goto fail;
+    }
+    sp++;
+    NEXT();
+  }
+  OP(APE_SET_GLOBAL) {
+    p->globals[ARG] = *--sp;
+    NEXT();
+  }
+  OP(APE_RETURN) {
+    goto done;
+  }
+#ifdef APE_SWITCH
+    }
+  }
+#endif
+
+type_error:
+  err = APE_ETYPE;
+fail:
+  p->err_pc = ip - p->code - 1;
+done:
+  p->steps += steps;
+  return err;
+}
@@ -0,0 +1,95 @@
+#ifndef APE_H
+#define APE_H
+
+// apelang bytecode (.apb) and the VM that runs it (ape.c). Kept free of
+// kernel headers so bench/apebench.c can build the VM for the host.
+//
+// An .apb file is a flat instruction stream with no header. Operands are
+// inline: constants carry a type tag (numbers are little-endian doubles,
+// strings a big-endian 16-bit length and the bytes), global names an
+// 8-bit length and the bytes, and jumps a big-endian 16-bit offset from
+// the end of the jump. The opcodes below marked "calc" appear in
+// romfs.h's calc_apb; the others follow the same compiler's layout and
+// are what bench/apebench.c uses for its loops.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define APE_CONST 0x00          // calc; tag, value
+#define APE_NIL 0x01            // calc
+#define APE_TRUE 0x02
+#define APE_FALSE 0x03
+#define APE_POP 0x04            // calc
+#define APE_NEGATE 0x05
+#define APE_ADD 0x06            // calc
+#define APE_SUB 0x07            // calc
+#define APE_MUL 0x08            // calc
+#define APE_DIV 0x09            // calc
+#define APE_EQUAL 0x0A          // calc
+#define APE_GREATER 0x0B
+#define APE_LESS 0x0C
+#define APE_JUMP_IF_FALSE 0x0D  // calc; leaves the condition on the stack
+#define APE_JUMP 0x0E           // calc
+#define APE_LOOP 0x0F           // backward jump
+#define APE_NOT 0x10
+#define APE_PRINT 0x11          // calc; value and a newline
+#define APE_INPUT 0x12          // calc; reads a line, pushes it as a number
+#define APE_GET_GLOBAL 0x13     // calc; name
+#define APE_SET_GLOBAL 0x14     // calc; name, pops the value
+#define APE_RETURN 0x18         // calc; ends the program
+#define APE_NOPS 0x19
+
+#define APE_TAG_NIL 0x00
+#define APE_TAG_BOOL 0x01
+#define APE_TAG_NUM 0x02
+#define APE_TAG_STR 0x03
+
+#define APE_STACK 64  // deepest value stack a program may need
+
+typedef enum { APE_UNDEF, APE_VNIL, APE_VBOOL, APE_VNUM, APE_VSTR } ape_type_t;
+
+typedef struct {
+  ape_type_t type;
+  union {
+    double num;
+    uint32_t str;  // index into the string table
+    bool b;
+  } as;
+} ape_value_t;
+
+// A decoded instruction. `arg` is a constant index, a string-table index
+// (globals) or the index of a jump's target instruction.
+typedef struct {
+  union {
+    uint32_t code;      // opcode, as loaded
+    const void *label;  // its handler, once threaded
+  } op;
+  int32_t arg;
+} ape_insn_t;
+
+typedef struct {
+  ape_insn_t *code;      // ends with an APE_RETURN of our own
+  uint32_t ncode;
+  ape_value_t *consts;
+  uint32_t nconsts;
+  char **strs;           // interned: constant strings and global names
+  uint32_t nstrs;
+  char *pool;            // their bytes
+  ape_value_t *globals;  // by name's string index
+  bool threaded;
+  int32_t err_pc;        // instruction of the last runtime error
+  uint64_t steps;        // instructions executed, all runs
+} ape_prog_t;
+
+#define APE_EBADCODE -1  // malformed bytecode
+#define APE_ENOMEM -2
+#define APE_ESTACK -3    // stack would underflow, overflow or not add up
+#define APE_ETYPE -4     // operand of the wrong type
+#define APE_EUNDEF -5    // read of an undefined global
+
+int ape_load(ape_prog_t *p, const uint8_t *code, uint32_t len);
+int ape_run(ape_prog_t *p);
+void ape_free(ape_prog_t *p);
+const char *ape_strerror(int err);
+
+#endif
@@ -33,7 +33,7 @@ static int parse(const char *ln, char *op, int32_t *a, int32_t *b) {
     return 3;
 }
 
-void app_calc(void) {
+int main(void) {
     char ln[64];
     char op[OP_BUF_SIZE]; 
     char out[12];        
@@ -51,8 +51,7 @@ void app_calc(void) {
         // Check for exit commands first
         if (parse_result == 1 && (!strcmp(op, "exit") || !strcmp(op, "quit"))) {
             sys_write("Exiting calculator...\n");
-            sys_exit_task(); 
-            return; 
+            return 0;
         }
 
         if (parse_result != 3) {
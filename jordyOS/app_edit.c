@@ -2,85 +2,106 @@
 #include <stdbool.h>
 #include "util.h" 
 
-#define EDIT_BUFFER_SIZE 512 
+#define EDIT_BUFFER_SIZE 512 // initial size; the buffer doubles as needed
 #define COMMAND_BUFFER_SIZE 64
 
+// Per-instance editor state, so several editors can run at once.
+typedef struct {
+    char *buf;
+    int len;
+    int cap;
+    int clean; // buf[0..clean) is known to match the file on disk
+    char filename[MAX_FILENAME_LEN];
+    bool open;
+} edit_t;
 
-static char file_content_buffer[EDIT_BUFFER_SIZE];
-static int current_content_length = 0;
-
-static char current_filename[MAX_FILENAME_LEN];
-static bool file_is_open = false;
-
+static void clear_file_buffer(edit_t *e) {
+    memset(e->buf, 0, e->cap);
+    e->len = 0;
+    e->clean = 0;
+}
 
-static void clear_file_buffer() {
-    memset(file_content_buffer, 0, EDIT_BUFFER_SIZE);
-    current_content_length = 0;
+static void clear_current_filename(edit_t *e) {
+    e->filename[0] = '\0';
+    e->open = false;
 }
 
-static void clear_current_filename() {
-    current_filename[0] = '\0';
-    file_is_open = false;
+// Makes room for `need` bytes plus the terminating NUL.
+static bool ensure_capacity(edit_t *e, int need) {
+    if (need < e->cap) return true;
+    int cap = e->cap;
+    while (cap <= need) cap *= 2;
+    char *nb = sys_malloc(cap);
+    if (!nb) return false;
+    memcpy(nb, e->buf, e->len);
+    memset(nb + e->len, 0, cap - e->len);
+    sys_free(e->buf);
+    e->buf = nb;
+    e->cap = cap;
+    return true;
 }
 
-static void enter_text_edit_mode() {
+static void enter_text_edit_mode(edit_t *e) {
     sys_write("--- Text Edit Mode (Press ESC to finish) ---\n");
 
-    file_content_buffer[current_content_length] = '\0';
-    if (current_content_length > 0) {
-        sys_write(file_content_buffer);
+    e->buf[e->len] = '\0';
+    if (e->len > 0) {
+        sys_write(e->buf);
     }
 
     int line_start_col = 0;
-    if (current_content_length > 0) {
-        if (file_content_buffer[current_content_length - 1] == '\n') {
+    if (e->len > 0) {
+        if (e->buf[e->len - 1] == '\n') {
             line_start_col = 0;
         } else {
             int last_newline_idx = -1;
-            for (int k = current_content_length - 1; k >= 0; k--) {
-                if (file_content_buffer[k] == '\n') {
+            for (int k = e->len - 1; k >= 0; k--) {
+                if (e->buf[k] == '\n') {
                     last_newline_idx = k;
                     break;
                 }
             }
-            line_start_col = current_content_length - (last_newline_idx + 1);
+            line_start_col = e->len - (last_newline_idx + 1);
         }
     }
 
 
-    while (current_content_length < EDIT_BUFFER_SIZE -1) { 
+    bool full = false;
+    while (!full) {
         char c = sys_getc(); 
 
         if (c == 27) { // ASCII 27 is Escape key
             sys_write("\n--- Exiting Text Edit Mode ---\n");
             break; 
         } else if (c == '\n') { 
-            if (current_content_length < EDIT_BUFFER_SIZE - 1) {
-                file_content_buffer[current_content_length++] = '\n';
+            if (ensure_capacity(e, e->len + 1)) {
+                e->buf[e->len++] = '\n';
                 sys_write("\n");
                 line_start_col = 0;
             } else {
                  sys_write("\nBuffer full. Cannot add newline.\n");
+                 full = true;
             }
         } else if (c == 8 || c == 127) { // Backspace or DEL
-            if (current_content_length > 0) {
-                current_content_length--;
+            if (e->len > 0) {
+                e->len--;
+                if (e->len < e->clean) e->clean = e->len;
                 sys_write("\b \b"); // Erase char on screen
                 if (line_start_col > 0) {
                     line_start_col--;
                 } else {
-                    if (current_content_length > 0) {
-                        if (file_content_buffer[current_content_length - 1] == '\n') {
+                    if (e->len > 0) {
+                        if (e->buf[e->len - 1] == '\n') {
                             line_start_col = 0;
                         } else {
                             int last_newline_idx = -1;
-                            for (int k = current_content_length - 1; k >= 0; k--) {
-                                if (file_content_buffer[k] == '\n') {
+                            for (int k = e->len - 1; k >= 0; k--) {
+                                if (e->buf[k] == '\n') {
                                     last_newline_idx = k;
                                     break;
                                 }
                             }
-                            line_start_col = current_content_length - (last_newline_idx + 1);
+                            line_start_col = e->len - (last_newline_idx + 1);
                         }
                     } else {
                         line_start_col = 0; 
@@ -88,8 +109,8 @@ static void enter_text_edit_mode() {
                 }
             }
         } else if (c >= 32 && c < 127) {
-            if (current_content_length < EDIT_BUFFER_SIZE - 1) {
-                file_content_buffer[current_content_length++] = c;
+            if (ensure_capacity(e, e->len + 1)) {
+                e->buf[e->len++] = c;
                 char echo[2] = {c, 0};
                 sys_write(echo);
                 line_start_col++;
@@ -97,33 +118,41 @@ static void enter_text_edit_mode() {
                     //do stuff
                 }
             } else {
-                    //do stuff
-
+                full = true;
             }
         }
     }
-    file_content_buffer[current_content_length] = '\0';
+    e->buf[e->len] = '\0';
 
-    if (current_content_length >= EDIT_BUFFER_SIZE -1) {
-        sys_write("Warning: Edit buffer is full. Some input may have been lost.\n");
+    if (full) {
+        sys_write("Warning: Out of memory. Some input may have been lost.\n");
     }
 }
 
 
-void app_edit(void) {
+int main(void) {
     char command_line[COMMAND_BUFFER_SIZE];
     char command[COMMAND_BUFFER_SIZE];
     char argument[COMMAND_BUFFER_SIZE];
 
-    sys_write("Editor v0.4 (In-Memory FS)\n");
+    edit_t *e = sys_malloc(sizeof *e);
+    if (e) e->buf = sys_malloc(EDIT_BUFFER_SIZE);
+    if (!e || !e->buf) {
+        sys_write("Editor: out of memory.\n");
+        sys_free(e);
+        return 1;
+    }
+    e->cap = EDIT_BUFFER_SIZE;
+
+    sys_write("Editor v0.5 (Disk FS)\n");
     sys_write("Commands: list, new <fn>, open <fn>, edit, save [fn], delete <fn>, quit\n");
 
-    clear_file_buffer();
-    clear_current_filename();
+    clear_file_buffer(e);
+    clear_current_filename(e);
 
     while (1) {
-        if (file_is_open) {
-            sys_write("edit ["); sys_write(current_filename); sys_write("]# ");
+        if (e->open) {
+            sys_write("edit ["); sys_write(e->filename); sys_write("]# ");
         } else {
             sys_write("edit# ");
         }
@@ -138,7 +167,9 @@ void app_edit(void) {
         argument[j] = '\0';
 
         if (strcmp(command, "quit") == 0) {
-            sys_write("Exiting editor...\n"); sys_exit_task(); return; 
+            sys_write("Exiting editor...\n");
+            sys_free(e->buf); sys_free(e);
+            return 0;
         } else if (strcmp(command, "list") == 0) {
             char list_buffer[MAX_FILES * MAX_FILENAME_LEN + MAX_FILES];
             memset(list_buffer, 0, sizeof(list_buffer)); 
@@ -153,58 +184,72 @@ void app_edit(void) {
         } else if (strcmp(command, "new") == 0) {
             if (argument[0] == '\0') sys_write("Usage: new <filename>\n");
             else {
-                clear_file_buffer(); 
-                strncpy(current_filename, argument, MAX_FILENAME_LEN -1);
-                current_filename[MAX_FILENAME_LEN-1] = '\0'; 
-                file_is_open = true;
-                current_content_length = 0; 
-                sys_write("New file '"); sys_write(current_filename); sys_write("' in buffer. Use 'edit', then 'save'.\n");
+                clear_file_buffer(e); 
+                strncpy(e->filename, argument, MAX_FILENAME_LEN -1);
+                e->filename[MAX_FILENAME_LEN-1] = '\0'; 
+                e->open = true;
+                e->len = 0; 
+                sys_write("New file '"); sys_write(e->filename); sys_write("' in buffer. Use 'edit', then 'save'.\n");
             }
         } else if (strcmp(command, "open") == 0) {
             if (argument[0] == '\0') sys_write("Usage: open <filename>\n");
             else {
-                clear_file_buffer();
-                int bytes_read = sys_read_file(argument, file_content_buffer, EDIT_BUFFER_SIZE -1);
+                clear_file_buffer(e);
+                int bytes_read;
+                while ((bytes_read = sys_read_file(argument, e->buf, e->cap - 1)) == -2 &&
+                       ensure_capacity(e, e->cap))
+                    ;
                 if (bytes_read >= 0) {
-                    current_content_length = bytes_read;
-                    file_content_buffer[current_content_length] = '\0';
-                    strncpy(current_filename, argument, MAX_FILENAME_LEN -1);
-                    current_filename[MAX_FILENAME_LEN-1] = '\0';
-                    file_is_open = true;
-                    sys_write("File '"); sys_write(current_filename); sys_write("' opened (");
+                    e->len = bytes_read;
+                    e->clean = bytes_read;
+                    e->buf[e->len] = '\0';
+                    strncpy(e->filename, argument, MAX_FILENAME_LEN -1);
+                    e->filename[MAX_FILENAME_LEN-1] = '\0';
+                    e->open = true;
+                    sys_write("File '"); sys_write(e->filename); sys_write("' opened (");
                     char num_buf[12]; itoa(bytes_read, num_buf); sys_write(num_buf);
                     sys_write(" bytes).\nUse 'edit' to modify/view.\n");
-                } else if (bytes_read == -1) { sys_write("Error: File '"); sys_write(argument); sys_write("' not found.\n"); clear_current_filename(); }
-                else if (bytes_read == -2) { sys_write("Error: Buffer too small for '"); sys_write(argument); sys_write("'. File exceeds editor capacity.\n"); clear_current_filename(); }
-                else { sys_write("Error reading file.\n"); clear_current_filename(); }
+                } else if (bytes_read == -1) { sys_write("Error: File '"); sys_write(argument); sys_write("' not found.\n"); clear_current_filename(e); }
+                else if (bytes_read == -2) { sys_write("Error: Buffer too small for '"); sys_write(argument); sys_write("'. File exceeds editor capacity.\n"); clear_current_filename(e); }
+                else { sys_write("Error reading file.\n"); clear_current_filename(e); }
             }
         } else if (strcmp(command, "edit") == 0) {
-            if (!file_is_open && current_filename[0] == '\0') {
+            if (!e->open && e->filename[0] == '\0') {
                  sys_write("No file. Use 'new <fn>' or 'open <fn>' first.\n");
             } else {
-                enter_text_edit_mode();
+                enter_text_edit_mode(e);
             }
         } else if (strcmp(command, "save") == 0) {
             const char* filename_to_save = NULL;
-            if (argument[0] != '\0') { 
+            if (argument[0] != '\0' && strcmp(argument, e->filename) != 0) {
+                e->clean = 0; // different file: write all of it
                 filename_to_save = argument;
-                strncpy(current_filename, argument, MAX_FILENAME_LEN -1);
-                current_filename[MAX_FILENAME_LEN-1] = '\0';
-                file_is_open = true;
-            } else if (file_is_open && current_filename[0] != '\0') {
-                filename_to_save = current_filename;
+                strncpy(e->filename, argument, MAX_FILENAME_LEN -1);
+                e->filename[MAX_FILENAME_LEN-1] = '\0';
+                e->open = true;
+            } else if (e->open && e->filename[0] != '\0') {
+                filename_to_save = e->filename;
             } else {
                 sys_write("Usage: save <filename> (or open/new a file first to save without filename argument)\n");
                 continue;
             }
 
             if (filename_to_save) {
-                file_content_buffer[current_content_length] = '\0'; // Ensure null-termination before saving
-                int result = sys_write_file(filename_to_save, file_content_buffer, current_content_length);
+                e->buf[e->len] = '\0'; // Ensure null-termination before saving
+                // Text is only ever appended or erased at the end, so
+                // everything before `clean` is already on disk: write the
+                // rest and trim the file to the new length.
+                if (sys_file_size(filename_to_save) < e->clean) e->clean = 0;
+                int written = e->len - e->clean;
+                int result = sys_pwrite(filename_to_save, e->buf + e->clean, written, e->clean);
+                if (result >= 0) result = sys_truncate(filename_to_save, e->len);
                 if (result == 0) {
+                    e->clean = e->len;
+                    char num_buf[12];
                     sys_write("File '"); sys_write(filename_to_save); sys_write("' saved (");
-                    char num_buf[12]; itoa(current_content_length, num_buf); sys_write(num_buf);
-                    sys_write(" bytes).\n");
+                    itoa(e->len, num_buf); sys_write(num_buf);
+                    sys_write(" bytes, "); itoa(written, num_buf); sys_write(num_buf);
+                    sys_write(" written).\n");
                 } else {
                     sys_write("Error saving file '"); sys_write(filename_to_save); sys_write("'. Code: ");
                     char num_buf[12]; itoa(result, num_buf); sys_write(num_buf); sys_write(".\n");
@@ -216,8 +261,8 @@ void app_edit(void) {
                 int result = sys_delete_file(argument);
                 if (result == 0) {
                     sys_write("File '"); sys_write(argument); sys_write("' deleted.\n");
-                    if (file_is_open && strcmp(current_filename, argument) == 0) {
-                        clear_file_buffer(); clear_current_filename(); 
+                    if (e->open && strcmp(e->filename, argument) == 0) {
+                        clear_file_buffer(e); clear_current_filename(e); 
                     }
                 } else { sys_write("Error deleting '"); sys_write(argument); sys_write("'. Not found?\n"); }
             }
@@ -0,0 +1,103 @@
+#include "kernel.h"
+
+// ATA PIO driver for the primary master (QEMU's first IDE disk): LBA28,
+// polled, with the drive's interrupt masked.
+
+#define ATA_DATA 0x1F0
+#define ATA_COUNT 0x1F2
+#define ATA_LBA0 0x1F3
+#define ATA_LBA1 0x1F4
+#define ATA_LBA2 0x1F5
+#define ATA_DRIVE 0x1F6
+#define ATA_CMD 0x1F7   // status when read
+#define ATA_CTRL 0x3F6  // alternate status when read
+
+#define ST_ERR 0x01
+#define ST_DRQ 0x08
+#define ST_DF 0x20
+#define ST_BSY 0x80
+
+#define CMD_READ 0x20
+#define CMD_WRITE 0x30
+#define CMD_FLUSH 0xE7
+#define CMD_IDENTIFY 0xEC
+
+uint32_t ata_sectors;  // 0 if there is no disk
+
+static void ata_delay(void) {  // ~400 ns for the status to become valid
+  for (int i = 0; i < 4; i++) inb(ATA_CTRL);
+}
+
+// Waits for BSY to drop and, with `drq`, for the drive to want data.
+static int ata_wait(bool drq) {
+  for (uint32_t n = 0; n < 1000000; n++) {
+    uint8_t s = inb(ATA_CMD);
+    if (s & ST_BSY) continue;
+    if (s & (ST_ERR | ST_DF)) return -1;
+    if (!drq || (s & ST_DRQ)) return 0;
+  }
+  return -1;
+}
+
+static void ata_select(uint32_t lba, uint32_t count) {
+  outb(ATA_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));  // master, LBA
+  outb(ATA_COUNT, count & 0xFF);                  // 0 means 256
+  outb(ATA_LBA0, lba);
+  outb(ATA_LBA1, lba >> 8);
+  outb(ATA_LBA2, lba >> 16);
+}
+
+bool ata_init(void) {
+  outb(ATA_CTRL, 0x02);  // nIEN
+  ata_select(0, 0);
+  ata_delay();
+  if (inb(ATA_CMD) == 0xFF) return false;  // floating bus
+  outb(ATA_CMD, CMD_IDENTIFY);
+  ata_delay();
+  if (inb(ATA_CMD) == 0) return false;  // no drive
+  for (uint32_t n = 0; n < 1000000 && (inb(ATA_CMD) & ST_BSY); n++)
+    ;
+  if (inb(ATA_LBA1) || inb(ATA_LBA2)) return false;  // ATAPI, not a disk
+  if (ata_wait(true) < 0) return false;
+  uint16_t id[256];
+  uint16_t *p = id;
+  uint32_t n = 256;
+  __asm__ volatile("rep insw" : "+D"(p), "+c"(n) : "d"(ATA_DATA) : "memory");
+  ata_sectors = id[60] | (uint32_t)id[61] << 16;  // LBA28 capacity
+  return ata_sectors != 0;
+}
+
+// Transfers `count` (<= 256) sectors from `lba`. Sector i lives at
+// seg[i / per_seg] + (i % per_seg) * 512, so one command can gather
+// several cache buffers.
+int ata_rw(uint32_t lba, uint32_t count, uint8_t *const *seg,
+           uint32_t per_seg, bool write) {
+  if (count == 0 || count > 256 || lba + count > ata_sectors) return -1;
+  if (ata_wait(false) < 0) return -1;
+  ata_select(lba, count);
+  outb(ATA_CMD, write ? CMD_WRITE : CMD_READ);
+  for (uint32_t i = 0; i < count; i++) {
+    ata_delay();
+    if (ata_wait(true) < 0) return -1;
+    uint16_t *p = (uint16_t *)(seg[i / per_seg] + (i % per_seg) * 512);
+    uint32_t n = 256;
+    if (write)
+      __asm__ volatile("rep outsw" : "+S"(p), "+c"(n) : "d"(ATA_DATA));
+    else
+      __asm__ volatile("rep insw"
+                       : "+D"(p), "+c"(n)
+                       : "d"(ATA_DATA)
+                       : "memory");
+  }
+  ata_delay();
+  return ata_wait(false);
+}
+
+// Empties the drive's own write cache.
+int ata_flush(void) {
+  if (!ata_sectors || ata_wait(false) < 0) return -1;
+  outb(ATA_DRIVE, 0xE0);
+  outb(ATA_CMD, CMD_FLUSH);
+  ata_delay();
+  return ata_wait(false);
+}
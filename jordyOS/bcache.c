@@ -0,0 +1,202 @@
+#include "kernel.h"
+
+// Write-back block cache: NBUF buffers hashed by block number and kept in
+// LRU order. A write only dirties its buffer; dirty blocks go to the disk
+// when evicted or in bsync(), which writes them in block order and merges
+// neighbours into one multi-sector command. Without an IDE disk the blocks
+// are kept in RAM instead, so nothing survives a reboot.
+//
+// bcache_lock covers the buffer headers and the device, so the bflush
+// thread can sync while a file system call runs. Buffer contents belong to
+// fs.c, which reads and writes them under its own lock; bsync() clears a
+// buffer's dirty bit before writing it out, so a write that lands during
+// the transfer redirties it through bdirty() and goes out next time.
+//
+// A failed write leaves its buffer dirty, to be retried, and such a buffer
+// is never recycled. A failed read leaves the buffer invalid and makes
+// bread() return NULL. Either one counts in bcache_stats.errors.
+
+#define NBUF 64
+#define NHASH 64  // power of two
+
+static buf_t bufs[NBUF];
+static buf_t *hash[NHASH];
+static buf_t lru;  // sentinel; lru.next is the most recently used
+bcache_stats_t bcache_stats;
+uint32_t bcache_nblocks;
+const char *bcache_dev = "ram";
+static mutex_t bcache_lock;
+
+// ---- RAM fallback device; pages come in on first write ----
+#define BLOCKS_PER_PAGE (PAGE_SIZE / FS_BLOCK_SIZE)
+static uint8_t *ram_pages[FS_NBLOCKS / BLOCKS_PER_PAGE];
+
+static uint8_t *ram_block(uint32_t blk, bool write) {
+  uint8_t **pg = &ram_pages[blk / BLOCKS_PER_PAGE];
+  if (!*pg && write && (*pg = pmm_alloc_page()) != NULL)
+    memset(*pg, 0, PAGE_SIZE);
+  return *pg ? *pg + (blk % BLOCKS_PER_PAGE) * FS_BLOCK_SIZE : NULL;
+}
+
+static int dev_rw(uint32_t blk, uint32_t n, uint8_t *const *seg, bool write) {
+  if (ata_sectors)
+    return ata_rw(blk * FS_SECTORS_PER_BLOCK, n * FS_SECTORS_PER_BLOCK, seg,
+                  FS_SECTORS_PER_BLOCK, write);
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t *r = ram_block(blk + i, write);
+    if (write && !r) return -1;
+    if (write)
+      memcpy(r, seg[i], FS_BLOCK_SIZE);
+    else if (r)
+      memcpy(seg[i], r, FS_BLOCK_SIZE);
+    else
+      memset(seg[i], 0, FS_BLOCK_SIZE);
+  }
+  return 0;
+}
+
+static void lru_unlink(buf_t *b) {
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+}
+static void lru_push(buf_t *b) {
+  b->next = lru.next;
+  b->prev = &lru;
+  lru.next->prev = b;
+  lru.next = b;
+}
+
+void bcache_init(void) {
+  mutex_init(&bcache_lock, "bcache");
+  lru.next = lru.prev = &lru;
+  for (int i = 0; i < NBUF; i++) lru_push(&bufs[i]);
+  if (ata_init()) {
+    bcache_dev = "ata0";
+    bcache_nblocks = ata_sectors / FS_SECTORS_PER_BLOCK;
+  } else {
+    bcache_nblocks = FS_NBLOCKS;
+  }
+}
+
+static int bwrite(buf_t *b) {
+  uint8_t *seg = b->data;
+  bcache_stats.writes++;
+  if (dev_rw(b->blk, 1, &seg, true) < 0) {
+    bcache_stats.errors++;
+    return -1;
+  }
+  b->dirty = false;
+  bcache_stats.writebacks++;
+  return 0;
+}
+
+static void unhash(buf_t *b) {
+  buf_t **q = &hash[b->blk & (NHASH - 1)];
+  while (*q != b) q = &(*q)->hnext;
+  *q = b->hnext;
+  b->valid = false;
+}
+
+// Buffer for blk, made most recently used. On a miss it recycles the least
+// recently used buffer that is clean or can be written back; NULL if none.
+static buf_t *bget(uint32_t blk) {
+  buf_t **pp = &hash[blk & (NHASH - 1)], *b;
+  for (b = *pp; b; b = b->hnext)
+    if (b->valid && b->blk == blk) {
+      lru_unlink(b);
+      lru_push(b);
+      return b;
+    }
+  for (b = lru.prev; b != &lru && b->dirty && bwrite(b) < 0; b = b->prev) {}
+  if (b == &lru) return NULL;
+  if (b->valid) unhash(b);
+  b->blk = blk;
+  b->valid = false;
+  b->hnext = *pp;
+  *pp = b;
+  lru_unlink(b);
+  lru_push(b);
+  return b;
+}
+
+buf_t *bread(uint32_t blk) {
+  mutex_lock(&bcache_lock);
+  buf_t *b = bget(blk);
+  if (b && b->valid) {
+    bcache_stats.hits++;
+  } else if (b) {
+    uint8_t *seg = b->data;
+    bcache_stats.misses++;
+    if (dev_rw(blk, 1, &seg, false) < 0) {
+      unhash(b);
+      bcache_stats.errors++;
+      b = NULL;
+    } else {
+      b->valid = true;
+    }
+  }
+  mutex_unlock(&bcache_lock);
+  return b;
+}
+
+// A zero-filled dirty buffer for blk, without reading the old contents;
+// NULL if no buffer could be freed.
+buf_t *bclear(uint32_t blk) {
+  mutex_lock(&bcache_lock);
+  buf_t *b = bget(blk);
+  if (b) {
+    memset(b->data, 0, FS_BLOCK_SIZE);
+    b->valid = true;
+    b->dirty = true;
+  }
+  mutex_unlock(&bcache_lock);
+  return b;
+}
+
+void bdirty(buf_t *b) {
+  mutex_lock(&bcache_lock);
+  b->dirty = true;
+  mutex_unlock(&bcache_lock);
+}
+
+uint32_t bcache_ndirty(void) {
+  uint32_t n = 0;
+  for (int i = 0; i < NBUF; i++) n += bufs[i].dirty;
+  return n;
+}
+
+// Writes every dirty block; returns how many, or -1 if any write failed.
+// The blocks that failed stay dirty.
+int bsync(void) {
+  buf_t *d[NBUF];
+  uint8_t *seg[NBUF];
+  int n = 0;
+  bool failed = false;
+  mutex_lock(&bcache_lock);
+  for (int i = 0; i < NBUF; i++)
+    if (bufs[i].dirty) {
+      bufs[i].dirty = false;
+      int j = n++;
+      for (; j > 0 && d[j - 1]->blk > bufs[i].blk; j--) d[j] = d[j - 1];
+      d[j] = &bufs[i];
+    }
+  for (int i = 0, j; i < n; i = j) {
+    for (j = i; j < n && d[j]->blk == d[i]->blk + (j - i); j++)
+      seg[j - i] = d[j]->data;
+    bcache_stats.writes++;
+    if (dev_rw(d[i]->blk, j - i, seg, true) < 0) {
+      for (int k = i; k < j; k++) d[k]->dirty = true;
+      bcache_stats.errors++;
+      failed = true;
+    } else {
+      bcache_stats.writebacks += j - i;
+    }
+  }
+  if (n && ata_sectors && ata_flush() < 0) {
+    bcache_stats.errors++;
+    failed = true;
+  }
+  bcache_stats.syncs++;
+  mutex_unlock(&bcache_lock);
+  return failed ? -1 : n;
+}
@@ -0,0 +1,227 @@
+// Host benchmark for the apelang VM: builds ape.c for Linux and reports
+// instructions per second on romfs.h's calc_apb (scripted input, output
+// thrown away) and on synthetic loops assembled below.
+//
+//   make apebench && ./apebench
+//   make apebench-switch && ./apebench-switch   # same, switch dispatch
+//
+// Each program's results are checked before it is timed.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../ape.c"
+#include "../romfs.h"
+
+// ---- what the kernel provides ----
+static char out[4096];
+static size_t out_len;
+static const char *const *input;
+static int input_pos, input_len;
+
+void sys_write(const char *s) {
+  size_t n = strlen(s);
+  if (out_len + n < sizeof out) {
+    memcpy(out + out_len, s, n + 1);
+    out_len += n;
+  }
+}
+void read_line(char *buf, int max) {
+  snprintf(buf, max, "%s", input[input_pos++ % input_len]);
+}
+void *sys_malloc(size_t n) { return malloc(n); }
+void sys_free(void *p) { free(p); }
+void itoa(int32_t n, char *buf) { sprintf(buf, "%d", n); }
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ---- a tiny assembler for the synthetic programs ----
+static uint8_t code[256];
+static uint32_t code_len;
+
+static void emit(uint8_t b) { code[code_len++] = b; }
+static void emit_num(double n) {
+  emit(APE_CONST);
+  emit(APE_TAG_NUM);
+  memcpy(code + code_len, &n, 8);
+  code_len += 8;
+}
+static void emit_name(uint8_t op, const char *name) {
+  emit(op);
+  emit(strlen(name));
+  for (; *name; name++) emit(*name);
+}
+// Emits a forward jump; returns where to patch its offset.
+static uint32_t emit_jump(uint8_t op) {
+  emit(op);
+  emit(0);
+  emit(0);
+  return code_len - 2;
+}
+static void patch(uint32_t at) {
+  uint32_t off = code_len - (at + 2);
+  code[at] = off >> 8;
+  code[at + 1] = off;
+}
+static void emit_loop(uint32_t start) {
+  uint32_t off = code_len + 3 - start;
+  emit(APE_LOOP);
+  emit(off >> 8);
+  emit(off);
+}
+
+// sum = 0; i = 0; while (i < n) { sum = sum + i; i = i + 1; }
+static void asm_count(double n) {
+  code_len = 0;
+  emit_num(0);
+  emit_name(APE_SET_GLOBAL, "sum");
+  emit_num(0);
+  emit_name(APE_SET_GLOBAL, "i");
+  uint32_t top = code_len;
+  emit_name(APE_GET_GLOBAL, "i");
+  emit_num(n);
+  emit(APE_LESS);
+  uint32_t exit = emit_jump(APE_JUMP_IF_FALSE);
+  emit(APE_POP);
+  emit_name(APE_GET_GLOBAL, "sum");
+  emit_name(APE_GET_GLOBAL, "i");
+  emit(APE_ADD);
+  emit_name(APE_SET_GLOBAL, "sum");
+  emit_name(APE_GET_GLOBAL, "i");
+  emit_num(1);
+  emit(APE_ADD);
+  emit_name(APE_SET_GLOBAL, "i");
+  emit_loop(top);
+  patch(exit);
+  emit(APE_POP);
+}
+
+// x = 1; i = 0; while (i < n) { if (x == 1) x = x * 3 + 1; else x = 1;
+// i = i + 1; }: a branch each way per two trips.
+static void asm_branch(double n) {
+  code_len = 0;
+  emit_num(1);
+  emit_name(APE_SET_GLOBAL, "x");
+  emit_num(0);
+  emit_name(APE_SET_GLOBAL, "i");
+  uint32_t top = code_len;
+  emit_name(APE_GET_GLOBAL, "i");
+  emit_num(n);
+  emit(APE_LESS);
+  uint32_t exit = emit_jump(APE_JUMP_IF_FALSE);
+  emit(APE_POP);
+  emit_name(APE_GET_GLOBAL, "x");
+  emit_num(1);
+  emit(APE_EQUAL);
+  uint32_t other = emit_jump(APE_JUMP_IF_FALSE);
+  emit(APE_POP);
+  emit_name(APE_GET_GLOBAL, "x");
+  emit_num(3);
+  emit(APE_MUL);
+  emit_num(1);
+  emit(APE_ADD);
+  emit_name(APE_SET_GLOBAL, "x");
+  uint32_t join = emit_jump(APE_JUMP);
+  patch(other);
+  emit(APE_POP);
+  emit_num(1);
+  emit_name(APE_SET_GLOBAL, "x");
+  patch(join);
+  emit_name(APE_GET_GLOBAL, "i");
+  emit_num(1);
+  emit(APE_ADD);
+  emit_name(APE_SET_GLOBAL, "i");
+  emit_loop(top);
+  patch(exit);
+  emit(APE_POP);
+}
+
+static double global(const ape_prog_t *p, const char *name) {
+  for (uint32_t i = 0; i < p->nstrs; i++)
+    if (!strcmp(p->strs[i], name)) return p->globals[i].as.num;
+  return -1;
+}
+
+static int load(ape_prog_t *p, const uint8_t *c, uint32_t len,
+                const char *what) {
+  int err = ape_load(p, c, len);
+  if (err) fprintf(stderr, "apebench: %s: %s\n", what, ape_strerror(err));
+  return err;
+}
+
+// Best of three, each at least `runs` runs of the program.
+static void report(ape_prog_t *p, const char *what, int runs) {
+  double best = 1e30;
+  uint64_t steps = 0;
+  for (int rep = 0; rep < 3; rep++) {
+    uint64_t s0 = p->steps;
+    double t = now();
+    for (int i = 0; i < runs; i++) {
+      out_len = 0;
+      ape_run(p);
+    }
+    t = now() - t;
+    if (t < best) {
+      best = t;
+      steps = p->steps - s0;
+    }
+  }
+  printf("%-8s %12llu %10.3f %10.1f %8.2f\n", what, (unsigned long long)steps,
+         best * 1e3, steps / best / 1e6, best * 1e9 / steps);
+}
+
+int main(void) {
+  // op, a, b per run; calc quits early on 0 and complains about the rest.
+  static const char *const calc_in[] = {"1", "7",  "5",  "2", "7", "5",
+                                        "3", "7",  "5",  "4", "7", "2",
+                                        "4", "7",  "0",  "9", "1", "1"};
+  static const char *const calc_want[] = {
+      "Result:\n12\n", "Result:\n2\n", "Result:\n35\n", "Result:\n3.5\n",
+      "Division by zero.\n", "Unknown operation.\n"};
+  ape_prog_t p;
+  input = calc_in;
+  input_len = sizeof calc_in / sizeof *calc_in;
+  if (load(&p, calc_apb, calc_apb_len, "calc")) return 1;
+  for (int i = 0; i < 6; i++) {
+    out_len = 0;
+    int err = ape_run(&p);
+    if (err || !strstr(out, calc_want[i])) {
+      fprintf(stderr, "apebench: calc run %d: %s\n%s", i,
+              err ? ape_strerror(err) : "wrong output", out);
+      return 1;
+    }
+  }
+  printf("calc_apb: %u bytes -> %u instructions, %u constants, %u strings\n",
+         calc_apb_len, p.ncode, p.nconsts, p.nstrs);
+  printf("%-8s %12s %10s %10s %8s\n", "program", "insns", "ms", "Minsn/s",
+         "ns/insn");
+  report(&p, "calc", 200000);
+  ape_free(&p);
+
+  const double n = 1000000;
+  asm_count(n);
+  if (load(&p, code, code_len, "count")) return 1;
+  if (ape_run(&p) || global(&p, "sum") != n * (n - 1) / 2) {
+    fprintf(stderr, "apebench: count: wrong sum\n");
+    return 1;
+  }
+  report(&p, "count", 5);
+  ape_free(&p);
+
+  asm_branch(n);
+  if (load(&p, code, code_len, "branch")) return 1;
+  if (ape_run(&p) || global(&p, "x") != 1 || global(&p, "i") != n) {
+    fprintf(stderr, "apebench: branch: wrong result\n");
+    return 1;
+  }
+  report(&p, "branch", 5);
+  ape_free(&p);
+  return 0;
+}
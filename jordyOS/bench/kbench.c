@@ -0,0 +1,316 @@
+// Host benchmarks for the portable kernel code in libkhost.a (hal.h): the
+// file system through the block cache, string.c, line editing and the
+// scheduling classes' pick-next, all running the kernel's own code.
+//
+//   make kbench && ./kbench [--benchmark_filter=text]
+//       [--benchmark_min_time=seconds] [--benchmark_format=console|csv]
+//       [--disk=image]
+//
+// Modelled on Google Benchmark: each benchmark runs with growing
+// iteration counts until one run lasts --benchmark_min_time (0.2 s by
+// default), and reports wall and CPU time per iteration plus bytes or
+// items per second. The filter is a plain substring of the full name,
+// such as "fs_pread/4096". The file system sits on bcache.c's RAM device
+// unless --disk names an image, which is then used as the disk (and
+// formatted if it holds no file system).
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../kernel.h"
+
+typedef struct {
+  int64_t iterations;  // times the body must run
+  int64_t arg;
+  int64_t bytes;  // per iteration, for bytes_per_second
+  int64_t items;  // per iteration, for items_per_second
+  double wall0, cpu0, wall, cpu;
+  bool started, stopped;
+} state_t;
+
+typedef struct {
+  const char *name;
+  void (*fn)(state_t *s);
+  int64_t args[8];  // one run per argument; none means a single run
+} bench_t;
+
+static double wall_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+static double cpu_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Everything before this is setup and isn't timed.
+static void start(state_t *s) {
+  s->started = true;
+  s->wall0 = wall_now();
+  s->cpu0 = cpu_now();
+}
+// Everything after this is teardown.
+static void stop(state_t *s) {
+  s->wall = wall_now() - s->wall0;
+  s->cpu = cpu_now() - s->cpu0;
+  s->stopped = true;
+}
+
+// Keeps the compiler from dropping a result nothing reads.
+static void keep(const void *p) { __asm__ volatile("" : : "r"(p) : "memory"); }
+
+// ---- string.c and line.c ----
+static uint8_t src_buf[65536 + 64], dst_buf[65536 + 64];
+
+static void bm_memcpy(state_t *s) {
+  s->bytes = s->arg;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    memcpy(dst_buf, src_buf, s->arg);
+    keep(dst_buf);
+  }
+}
+
+static void bm_strcmp(state_t *s) {
+  memset(src_buf, 'a', s->arg);
+  memset(dst_buf, 'a', s->arg);
+  src_buf[s->arg] = dst_buf[s->arg] = '\0';
+  s->bytes = s->arg;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    int r = strcmp((const char *)src_buf, (const char *)dst_buf);
+    keep(&r);
+  }
+}
+
+static void bm_itoa_atoi(state_t *s) {
+  char nb[12];
+  s->items = 1;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    itoa((int32_t)(i * 7919 - 1000000), nb);
+    int32_t v = atoi(nb);
+    keep(&v);
+  }
+}
+
+static void bm_line_key(state_t *s) {
+  static const char keys[] = "trace on sw\bswitch syscall\n";
+  char buf[32];
+  s->items = sizeof keys - 1;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    int len = 0;
+    for (const char *k = keys; *k; k++) line_key(buf, &len, sizeof buf, *k);
+    const char *arg = cmd_arg(buf, "trace");
+    keep(arg);
+  }
+}
+
+// ---- fs.c through bcache.c ----
+static void bm_fs_pwrite(state_t *s) {
+  sys_pwrite("bench", src_buf, (int)s->arg, 0);
+  s->bytes = s->arg;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++)
+    sys_pwrite("bench", src_buf, (int)s->arg, 0);
+  stop(s);
+  sys_delete_file("bench");
+}
+
+static void bm_fs_pread(state_t *s) {
+  sys_pwrite("bench", src_buf, (int)s->arg, 0);
+  s->bytes = s->arg;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    sys_pread("bench", dst_buf, (int)s->arg, 0);
+    keep(dst_buf);
+  }
+  stop(s);
+  sys_delete_file("bench");
+}
+
+// A write that goes all the way to the device, as bflush would push it.
+static void bm_fs_pwrite_sync(state_t *s) {
+  sys_pwrite("bench", src_buf, (int)s->arg, 0);
+  s->bytes = s->arg;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    sys_pwrite("bench", src_buf, (int)s->arg, 0);
+    bsync();
+  }
+  stop(s);
+  sys_delete_file("bench");
+}
+
+// Name lookups with arg files in the directory.
+static void bm_fs_file_size(state_t *s) {
+  char name[16];
+  for (int i = 0; i < s->arg; i++) {
+    sprintf(name, "f%d", i);
+    sys_pwrite(name, "x", 1, 0);
+  }
+  s->items = 1;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    sprintf(name, "f%d", (int)(i % s->arg));
+    int r = sys_file_size(name);
+    keep(&r);
+  }
+  stop(s);
+  for (int i = 0; i < s->arg; i++) {
+    sprintf(name, "f%d", i);
+    sys_delete_file(name);
+  }
+}
+
+static void bm_fs_create_delete(state_t *s) {
+  s->items = 1;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    sys_pwrite("tmp", src_buf, (int)s->arg, 0);
+    sys_delete_file("tmp");
+  }
+}
+
+// ---- sched.c: one CPU's queue holding arg runnable tasks; each
+// iteration picks the next, charges it a tick and puts it back ----
+static task_t tasks[MAX_TASKS];
+
+static void bm_sched(state_t *s, const char *cls) {
+  const sched_class_t *c = sched_find(cls);
+  memset(tasks, 0, sizeof tasks);
+  for (int i = 0; i < s->arg; i++) {
+    tasks[i].tid = i;
+    tasks[i].prio = PRIO_DEFAULT - 4 + i % 8;
+    tasks[i].state = TASK_RUNNABLE;
+    c->enqueue(&tasks[i]);
+  }
+  s->items = 1;
+  start(s);
+  for (int64_t i = 0; i < s->iterations; i++) {
+    task_t *t = c->pick_next(0);
+    c->tick(t);
+    c->enqueue(t);
+  }
+  stop(s);
+  while (c->pick_next(0)) {}
+}
+static void bm_sched_rr(state_t *s) { bm_sched(s, "rr"); }
+static void bm_sched_cfs(state_t *s) { bm_sched(s, "cfs"); }
+
+static const bench_t benches[] = {
+    {"memcpy", bm_memcpy, {8, 64, 512, 4096, 65536}},
+    {"strcmp", bm_strcmp, {8, 64, 512, 4096}},
+    {"itoa_atoi", bm_itoa_atoi, {0}},
+    {"line_key", bm_line_key, {0}},
+    {"fs_pwrite", bm_fs_pwrite, {64, 4096, 65536}},
+    {"fs_pread", bm_fs_pread, {64, 4096, 65536}},
+    {"fs_pwrite_sync", bm_fs_pwrite_sync, {4096}},
+    {"fs_file_size", bm_fs_file_size, {1, 32}},
+    {"fs_create_delete", bm_fs_create_delete, {1, 4096}},
+    {"sched_rr", bm_sched_rr, {2, 8, MAX_TASKS}},
+    {"sched_cfs", bm_sched_cfs, {2, 8, MAX_TASKS}},
+};
+
+// ---- runner ----
+static double min_time = 0.2;
+static bool csv;
+static const char *filter = "";
+
+static void run_once(const bench_t *b, state_t *s) {
+  s->started = s->stopped = false;
+  b->fn(s);
+  if (!s->started) start(s);  // nothing to set up: time the whole call
+  if (!s->stopped) stop(s);
+}
+
+// Like Google Benchmark: grow the count by what the last run predicts
+// would reach min_time, with 40% to spare, but at most 10x at a time.
+static void run(const bench_t *b, int64_t arg, bool has_arg) {
+  char name[64];
+  if (has_arg)
+    snprintf(name, sizeof name, "%s/%lld", b->name, (long long)arg);
+  else
+    snprintf(name, sizeof name, "%s", b->name);
+  if (!strstr(name, filter)) return;
+  state_t s = {.iterations = 1, .arg = arg};
+  for (;;) {
+    run_once(b, &s);
+    if (s.wall >= min_time || s.iterations >= 1000000000) break;
+    double mul = s.wall > 0 ? min_time * 1.4 / s.wall : 10;
+    if (mul > 10) mul = 10;
+    int64_t next = (int64_t)(s.iterations * mul);
+    s.iterations = next > s.iterations ? next : s.iterations + 1;
+  }
+  double ns = s.wall * 1e9 / s.iterations, cpu_ns = s.cpu * 1e9 / s.iterations;
+  double bps = s.bytes && s.cpu > 0 ? s.bytes * s.iterations / s.cpu : 0;
+  double ips = s.items && s.cpu > 0 ? s.items * s.iterations / s.cpu : 0;
+  if (csv) {
+    printf("\"%s\",%lld,%.3f,%.3f,ns,", name, (long long)s.iterations, ns,
+           cpu_ns);
+    if (bps) printf("%.0f", bps);
+    printf(",");
+    if (ips) printf("%.0f", ips);
+    printf("\n");
+    return;
+  }
+  printf("%-28s %12.1f ns %12.1f ns %12lld", name, ns, cpu_ns,
+         (long long)s.iterations);
+  if (bps) printf(" bytes_per_second=%.2fM/s", bps / (1 << 20));
+  if (ips) printf(" items_per_second=%.2fM/s", ips / 1e6);
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  const char *disk = NULL;
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    if (!strncmp(a, "--benchmark_filter=", 19)) {
+      filter = a + 19;
+    } else if (!strncmp(a, "--benchmark_min_time=", 21)) {
+      min_time = atof(a + 21);
+    } else if (!strcmp(a, "--benchmark_format=csv")) {
+      csv = true;
+    } else if (!strcmp(a, "--benchmark_format=console")) {
+      csv = false;
+    } else if (!strncmp(a, "--disk=", 7)) {
+      disk = a + 7;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--benchmark_filter=text] "
+              "[--benchmark_min_time=s] [--benchmark_format=console|csv] "
+              "[--disk=image]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (disk && hal_disk_open(disk) < 0) {
+    perror(disk);
+    return 1;
+  }
+  bcache_init();
+  fs_init();
+  for (size_t i = 0; i < sizeof src_buf; i++) src_buf[i] = (uint8_t)(i * 31);
+
+  if (csv) {
+    printf("name,iterations,real_time,cpu_time,time_unit,bytes_per_second,"
+           "items_per_second\n");
+  } else {
+    printf("%-28s %15s %15s %12s\n", "Benchmark", "Time", "CPU",
+           "Iterations");
+    printf("------------------------------------------------------------"
+           "--------------\n");
+  }
+  for (size_t i = 0; i < sizeof benches / sizeof benches[0]; i++) {
+    const bench_t *b = &benches[i];
+    if (!b->args[0]) run(b, 0, false);
+    for (int k = 0; k < 8 && b->args[k]; k++) run(b, b->args[k], true);
+  }
+  return 0;
+}
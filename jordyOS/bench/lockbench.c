@@ -0,0 +1,183 @@
+// Host benchmark for adapt.h: N pthreads take one lock in a loop and hold it
+// for the simulation's mix of hold times (80% exponential with mean H, 20%
+// with mean 5H), then work outside it for an exponential think time.
+//
+//   make lockbench && ./lockbench [max_threads] [H cycles] [think cycles]
+//
+// Each thread count (1, 2, 4, .. max_threads; default 8) runs for half a
+// second per lock:
+//   spin      ticket spinlock, as sync.c's spin_lock()
+//   park      futex mutex that sleeps as soon as the lock is taken
+//   fixed     spins up to the measured park cost, then sleeps
+//   adaptive  adapt.h with online threshold tuning, as sync.c's amutex
+// and prints lock acquisitions per second, the mean cycles from calling
+// lock to holding it, and for the adaptive locks how contended
+// acquisitions went and where the threshold ended up.
+
+#define _GNU_SOURCE
+#include <linux/futex.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../adapt.h"
+
+enum { SPIN, PARK, FIXED, ADAPTIVE, NKINDS };
+static const char *const kind_name[NKINDS] = {"spin", "park", "fixed",
+                                              "adaptive"};
+
+#define PARK_INIT 20000  // cycles, until the first parked waiter is timed
+#define RUN_NS 500000000L
+
+static inline uint64_t rdtsc(void) { return __builtin_ia32_rdtsc(); }
+static inline void cpu_relax(void) { __builtin_ia32_pause(); }
+
+// ---- ticket spinlock ----
+static _Atomic uint32_t tk_next, tk_owner;
+
+static void tk_lock(void) {
+  uint32_t me = atomic_fetch_add_explicit(&tk_next, 1, memory_order_relaxed);
+  while (atomic_load_explicit(&tk_owner, memory_order_acquire) != me)
+    cpu_relax();
+}
+static void tk_unlock(void) {
+  atomic_store_explicit(&tk_owner, atomic_load(&tk_owner) + 1,
+                        memory_order_release);
+}
+
+// ---- futex mutex (0 free, 1 held, 2 held with sleepers) with an optional
+// spin phase before it sleeps ----
+static _Atomic int fx_state;
+static uint64_t fx_released;  // rdtsc at the last unlock
+static adapt_t fx_adapt;
+static int fx_kind;
+
+static void futex(_Atomic int *addr, int op, int val) {
+  syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+static void fx_lock(uint64_t t0) {
+  int c = 0;
+  if (atomic_compare_exchange_strong(&fx_state, &c, 1)) return;
+  uint32_t limit = fx_kind == PARK ? 0 : adapt_spin_limit(&fx_adapt);
+  bool slept = false;
+  while (rdtsc() - t0 < limit) {
+    c = 0;
+    if (atomic_load_explicit(&fx_state, memory_order_relaxed) == 0 &&
+        atomic_compare_exchange_weak(&fx_state, &c, 1))
+      goto held;
+    cpu_relax();
+  }
+  while ((c = atomic_exchange(&fx_state, 2)) != 0) {
+    futex(&fx_state, FUTEX_WAIT_PRIVATE, 2);
+    slept = true;
+  }
+held:;
+  uint64_t now = rdtsc(), rel = fx_released;
+  adapt_wait(&fx_adapt, rel > t0 ? rel - t0 : 0, slept,
+             now > rel ? now - rel : 0);
+}
+
+static void fx_unlock(void) {
+  fx_released = rdtsc();
+  if (atomic_exchange(&fx_state, 0) == 2)
+    futex(&fx_state, FUTEX_WAKE_PRIVATE, 1);
+}
+
+// ---- workload ----
+static double hold_mean, think_mean;
+static atomic_bool stop;
+
+typedef struct {
+  pthread_t th;
+  uint64_t rng;
+  uint64_t ops, wait;
+} worker_t;
+
+static double uniform(uint64_t *s) {  // xorshift64*, in (0, 1]
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return ((*s * 2685821657736338717ull) >> 11) * 0x1p-53 + 0x1p-53;
+}
+
+static void busy(uint64_t cycles) {
+  uint64_t t0 = rdtsc();
+  while (rdtsc() - t0 < cycles) cpu_relax();
+}
+
+static void *worker(void *arg) {
+  worker_t *w = arg;
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    double mean = uniform(&w->rng) < 0.8 ? hold_mean : 5 * hold_mean;
+    uint64_t hold = -mean * log(uniform(&w->rng));
+    uint64_t think = -think_mean * log(uniform(&w->rng));
+    uint64_t t0 = rdtsc();
+    if (fx_kind == SPIN)
+      tk_lock();
+    else
+      fx_lock(t0);
+    w->wait += rdtsc() - t0;
+    busy(hold);
+    if (fx_kind == SPIN)
+      tk_unlock();
+    else
+      fx_unlock();
+    w->ops++;
+    busy(think);
+  }
+  return NULL;
+}
+
+static void run(int kind, int nthreads) {
+  worker_t w[64] = {0};
+  fx_kind = kind;
+  fx_state = 0;
+  fx_released = 0;
+  adapt_init(&fx_adapt, PARK_INIT, kind == ADAPTIVE);
+  atomic_store(&stop, false);
+  for (int i = 0; i < nthreads; i++) {
+    w[i].rng = 0x9E3779B97F4A7C15ull * (i + 1);
+    pthread_create(&w[i].th, NULL, worker, &w[i]);
+  }
+  struct timespec ts = {0, RUN_NS};
+  nanosleep(&ts, NULL);
+  atomic_store(&stop, true);
+  uint64_t ops = 0, wait = 0;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(w[i].th, NULL);
+    ops += w[i].ops;
+    wait += w[i].wait;
+  }
+  printf("%-9s %7d %10.3f %12.0f", kind_name[kind], nthreads,
+         ops / (RUN_NS * 1e-9) / 1e6, ops ? (double)wait / ops : 0.0);
+  if (kind == FIXED || kind == ADAPTIVE)
+    printf(" %8u %8u %10u %10u %8u", fx_adapt.spun, fx_adapt.parked,
+           fx_adapt.threshold, fx_adapt.park, fx_adapt.ewma);
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  hold_mean = argc > 2 ? atof(argv[2]) : 1000;
+  think_mean = argc > 3 ? atof(argv[3]) : 4000;
+  if (max_threads < 1 || max_threads > 64 || hold_mean <= 0 ||
+      think_mean < 0) {
+    fprintf(stderr, "usage: %s [max_threads<=64] [H cycles] [think cycles]\n",
+            argv[0]);
+    return 1;
+  }
+  printf("%ld CPUs, H = %.0f cycles, think = %.0f cycles\n",
+         sysconf(_SC_NPROCESSORS_ONLN), hold_mean, think_mean);
+  printf("%-9s %7s %10s %12s %8s %8s %10s %10s %8s\n", "lock", "threads",
+         "Mops/s", "wait cyc", "spun", "parked", "spin lim", "park cyc",
+         "ewma");
+  for (int n = 1; n <= max_threads; n *= 2)
+    for (int k = 0; k < NKINDS; k++) run(k, n);
+  return 0;
+}
@@ -0,0 +1,197 @@
+// Host microbenchmark for string.c: builds the kernel's routines for Linux
+// under k_* names and times them against the byte loops they replaced and
+// against libc, for sizes 1 B to 64 KB.
+//
+//   make strbench && ./strbench
+//
+// Prints MB/s per routine and size; every result is checked against libc
+// first.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define memcpy k_memcpy
+#define memset k_memset
+#define memmove k_memmove
+#define memcmp k_memcmp
+#define strlen k_strlen
+#define strcmp k_strcmp
+#define strcpy k_strcpy
+#define strncpy k_strncpy
+#include "../string.c"
+#undef memcpy
+#undef memset
+#undef memmove
+#undef memcmp
+#undef strlen
+#undef strcmp
+#undef strcpy
+#undef strncpy
+
+// ---- the previous kernel.c versions ----
+static void *old_memcpy(void *dest, const void *src, size_t n) {
+  char *d = dest;
+  const char *s = src;
+  while (n--) *d++ = *s++;
+  return dest;
+}
+static void *old_memset(void *s, int c, size_t n) {
+  unsigned char *p = (unsigned char *)s;
+  while (n--) *p++ = (unsigned char)c;
+  return s;
+}
+static void *old_memmove(void *dest, const void *src, size_t n) {
+  char *d = dest;
+  const char *s = src;
+  if (d < s)
+    while (n--) *d++ = *s++;
+  else
+    while (n--) d[n] = s[n];
+  return dest;
+}
+static int old_memcmp(const void *a, const void *b, size_t n) {
+  const unsigned char *p = a, *q = b;
+  for (; n; n--, p++, q++)
+    if (*p != *q) return *p - *q;
+  return 0;
+}
+static size_t old_strlen(const char *s) {
+  size_t i = 0;
+  while (s[i]) i++;
+  return i;
+}
+static int old_strcmp(const char *a, const char *b) {
+  while (*a && (*a == *b)) {
+    a++;
+    b++;
+  }
+  return *(const unsigned char *)a - *(const unsigned char *)b;
+}
+
+// ---- harness ----
+#define MAXN (64 * 1024)
+#define ALIGN_OFF 1  // odd offset so the alignment prologues run
+
+static char *bufa, *bufb;
+static volatile size_t sink;
+
+enum { MEMCPY, MEMSET, MEMMOVE, MEMCMP, STRLEN, STRCMP, NOPS };
+static const char *op_name[NOPS] = {"memcpy", "memset", "memmove",
+                                    "memcmp", "strlen", "strcmp"};
+enum { IMPL_OLD, IMPL_NEW, IMPL_LIBC, NIMPL };
+
+static size_t run(int op, int impl, size_t n) {
+  char *a = bufa + ALIGN_OFF, *b = bufb + ALIGN_OFF;
+  switch (op) {
+    case MEMCPY:
+      return (size_t)(impl == IMPL_OLD   ? old_memcpy(a, b, n)
+                      : impl == IMPL_NEW ? k_memcpy(a, b, n)
+                                         : memcpy(a, b, n));
+    case MEMSET:
+      return (size_t)(impl == IMPL_OLD   ? old_memset(a, 'x', n)
+                      : impl == IMPL_NEW ? k_memset(a, 'x', n)
+                                         : memset(a, 'x', n));
+    case MEMMOVE:  // overlapping, dst above src: the backward path
+      return (size_t)(impl == IMPL_OLD   ? old_memmove(a + 3, a, n)
+                      : impl == IMPL_NEW ? k_memmove(a + 3, a, n)
+                                         : memmove(a + 3, a, n));
+    case MEMCMP:
+      return impl == IMPL_OLD   ? (size_t)old_memcmp(a, b, n)
+             : impl == IMPL_NEW ? (size_t)k_memcmp(a, b, n)
+                                : (size_t)memcmp(a, b, n);
+    case STRLEN:
+      return impl == IMPL_OLD   ? old_strlen(a)
+             : impl == IMPL_NEW ? k_strlen(a)
+                                : strlen(a);
+    default:
+      return impl == IMPL_OLD   ? (size_t)old_strcmp(a, b)
+             : impl == IMPL_NEW ? (size_t)k_strcmp(a, b)
+                                : (size_t)strcmp(a, b);
+  }
+}
+
+// Equal n-byte strings in both buffers (the compare routines must scan it
+// all), with the terminator at n for the str* routines.
+static void prepare(size_t n) {
+  for (size_t i = 0; i < n; i++) bufa[ALIGN_OFF + i] = 'a' + i % 26;
+  bufa[ALIGN_OFF + n] = 0;
+  memcpy(bufb, bufa, MAXN + 64);
+}
+
+static int check(size_t n) {
+  char *a = bufa + ALIGN_OFF, *b = bufb + ALIGN_OFF;
+  static char ref[MAXN + 64];
+  int bad = 0;
+  prepare(n);
+  bad |= k_strlen(a) != n;
+  bad |= k_strcmp(a, b) != 0 || k_memcmp(a, b, n) != 0;
+  if (n) {
+    b[n - 1]++;
+    bad |= (k_strcmp(a, b) < 0) != (strcmp(a, b) < 0);
+    bad |= (k_memcmp(a, b, n) < 0) != (memcmp(a, b, n) < 0);
+    b[n - 1]--;
+  }
+  memcpy(ref, bufa, sizeof ref);
+  memmove(ref + ALIGN_OFF + 3, ref + ALIGN_OFF, n);
+  k_memmove(a + 3, a, n);
+  bad |= memcmp(ref, bufa, sizeof ref) != 0;
+  memmove(ref + ALIGN_OFF, ref + ALIGN_OFF + 3, n);
+  k_memmove(a, a + 3, n);
+  bad |= memcmp(ref, bufa, sizeof ref) != 0;
+  memset(ref + ALIGN_OFF, 'x', n);
+  k_memset(a, 'x', n);
+  bad |= memcmp(ref, bufa, sizeof ref) != 0;
+  memcpy(ref + ALIGN_OFF, b, n);
+  k_memcpy(a, b, n);
+  bad |= memcmp(ref, bufa, sizeof ref) != 0;
+  if (bad) fprintf(stderr, "strbench: wrong result at n=%zu\n", n);
+  return bad;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  static const size_t sizes[] = {1,    4,    16,   64,    256,
+                                 1024, 4096, 16384, 65536};
+  const int nsizes = sizeof sizes / sizeof sizes[0];
+  bufa = malloc(MAXN + 64);
+  bufb = malloc(MAXN + 64);
+  if (!bufa || !bufb) return 1;
+  memset(bufa, 0, MAXN + 64);
+  for (int i = 0; i < nsizes; i++)
+    if (check(sizes[i])) return 1;
+
+  printf("%-8s %8s %12s %12s %12s %8s\n", "op", "bytes", "old MB/s",
+         "new MB/s", "libc MB/s", "new/old");
+  for (int op = 0; op < NOPS; op++)
+    for (int i = 0; i < nsizes; i++) {
+      size_t n = sizes[i];
+      // ~64 MB per measurement, at least a thousand calls
+      size_t iters = (64u << 20) / n;
+      if (iters < 1000) iters = 1000;
+      double mbs[NIMPL];
+      for (int impl = 0; impl < NIMPL; impl++) {
+        prepare(n);
+        double best = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+          if (op == MEMSET || op == MEMCPY || op == MEMMOVE) prepare(n);
+          double t = now();
+          for (size_t k = 0; k < iters; k++) sink += run(op, impl, n);
+          t = now() - t;
+          if (t < best) best = t;
+        }
+        mbs[impl] = (double)n * iters / best / 1e6;
+      }
+      printf("%-8s %8zu %12.0f %12.0f %12.0f %7.1fx\n", op_name[op], n,
+             mbs[IMPL_OLD], mbs[IMPL_NEW], mbs[IMPL_LIBC],
+             mbs[IMPL_NEW] / mbs[IMPL_OLD]);
+    }
+  return 0;
+}
@@ -3,52 +3,174 @@
  %error "assemble with -DKERNEL_SECTORS=<number>"
 %endif
 
+; The boot sector first moves itself to 0x90000 so the kernel, loaded at
+; 0x0800, may run past 0x7C00. The kernel is read a track at a time (CHS)
+; or up to 127 sectors per call with the EDD packet interface when the BIOS
+; has it, never across a 64 KB DMA boundary, with a reset and retry on error.
+
 BITS 16
-ORG 0x7C00
+ORG 0
+
+KERNEL_SEG  equ 0x0080        ; kernel at 0x0800
+RELOC_SEG   equ 0x9000        ; this sector runs from 0x90000
+E820_MAX    equ 31            ; entries that fit between 0x504 and 0x800
+BOOT_INFO   equ 0x04F0        ; boot_info_t in kernel.c
+RETRIES     equ 3
+SPT         equ 18            ; CHS geometry of a 1.44 MB floppy
+HEADS       equ 2
+
+%if 0x800 + KERNEL_SECTORS * 512 > RELOC_SEG * 16
+ %error "kernel would overwrite the relocated boot sector"
+%endif
 
 start:
-    mov  [Drive], dl          ; save boot drive #
+    cli
+    cld
     xor  ax, ax
+    mov  fs, ax                ; FS = 0 for BIOS data / boot info from here on
+    mov  eax, [fs:0x046C]      ; BIOS tick count (PIT at 18.2 Hz)
+    mov  [fs:BOOT_INFO], eax
+    mov  dword [fs:BOOT_INFO+4], 0
+    mov  ax, 0x07C0
     mov  ds, ax
+    mov  ax, RELOC_SEG
     mov  es, ax
+    xor  si, si
+    xor  di, di
+    mov  cx, 256
+    rep  movsw
+    jmp  RELOC_SEG:relocated
+
+relocated:
+    mov  ds, ax
     mov  ss, ax
-    mov  sp, 0x7C00
+    mov  sp, 0xF000            ; stack at 0x9F000, below the EBDA
+    sti
+    mov  [Drive], dl
 
-    mov  bx, 0x0800           ; load addr
-    mov  cx, KERNEL_SECTORS
-    mov  byte [Sec], 2
-    mov  byte [Head], 0
-    mov  byte [Cyl],  0
+    ; BIOS E820 memory map -> dword count at 0x500, 24-byte entries at 0x504
+    xor  ax, ax
+    mov  es, ax
+    xor  ebx, ebx
+    xor  ebp, ebp
+    mov  di, 0x0504
+.e820:
+    mov  eax, 0xE820
+    mov  edx, 0x534D4150      ; 'SMAP'
+    mov  ecx, 24
+    mov  dword [es:di+20], 1  ; ACPI 3.x attrs: "valid" unless BIOS says otherwise
+    int  0x15
+    jc   .e820_done
+    cmp  eax, 0x534D4150
+    jne  .e820_done
+    inc  bp
+    add  di, 24
+    test ebx, ebx
+    jz   .e820_done
+    cmp  bp, E820_MAX
+    jb   .e820
+.e820_done:
+    mov  [es:0x0500], ebp
+
+    ; EDD: AH=41h says whether the AH=42h packet interface is there. Only
+    ; tried for hard disks; floppy reads stay within a track.
+    test byte [Drive], 0x80
+    jz   .next
+    mov  ah, 0x41
+    mov  bx, 0x55AA
+    mov  dl, [Drive]
+    int  0x13
+    jc   .next
+    cmp  bx, 0xAA55
+    jne  .next
+    test cl, 1
+    jz   .next
+    mov  byte [UseLba], 1
+    mov  byte [fs:BOOT_INFO+6], 1
 
 .next:
+    ; n = min(left, sectors up to the next 64 KB boundary, per-call limit)
+    mov  ax, [DapSeg]
+    shl  ax, 4
+    neg  ax                    ; bytes to the boundary, 0 meaning 64 KB
+    shr  ax, 9
+    jnz  .have_room
+    mov  al, 128
+.have_room:
+    cmp  ax, [Left]
+    jbe  .fits
+    mov  ax, [Left]
+.fits:
+    mov  cx, 127
+    cmp  byte [UseLba], 0
+    jne  .limit
+    ; CHS: split the LBA, and stop at the end of the track
+    push ax
+    mov  ax, [DapLba]
+    xor  dx, dx
+    mov  bx, SPT
+    div  bx                    ; ax = track, dx = sector - 1
+    mov  cx, bx
+    sub  cx, dx                ; sectors left on this track
+    inc  dx
+    mov  [Sec], dl
+    xor  dx, dx
+    mov  bl, HEADS
+    div  bx                    ; ax = cylinder, dx = head
+    mov  [Head], dl
+    mov  [Cyl], ax
+    pop  ax
+.limit:
+    cmp  ax, cx
+    jbe  .counted
+    mov  ax, cx
+.counted:
+    mov  [DapCount], ax
+    mov  byte [Tries], RETRIES
+
+.try:
     mov  dl, [Drive]
-    mov  ch, [Cyl]
+    cmp  byte [UseLba], 0
+    je   .chs
+    mov  si, Dap
+    mov  ah, 0x42
+    int  0x13
+    jmp  .called
+.chs:
+    mov  ax, [Cyl]
+    mov  ch, al
+    mov  cl, ah
+    shl  cl, 6                 ; cylinder bits 8-9 go in CL[7:6]
+    or   cl, [Sec]
     mov  dh, [Head]
-    mov  cl, [Sec]
-    mov  ah, 2
-    mov  al, 1
+    les  bx, [DapOff]
+    mov  al, [DapCount]
+    mov  ah, 0x02
     int  0x13
-    jc   .err
+.called:
+    inc  word [fs:BOOT_INFO+4]
+    jnc  .ok
+    inc  byte [fs:BOOT_INFO+7]
+    xor  ah, ah                ; reset the drive, then retry
+    mov  dl, [Drive]
+    int  0x13
+    dec  byte [Tries]
+    jnz  .try
+    jmp  .err
 
-    ; dot for progress
-    mov  al, '.'
-    mov  ah, 0x0E
+.ok:
+    mov  ax, 0x0E2E            ; a dot per BIOS call
+    xor  bx, bx
     int  0x10
+    mov  ax, [DapCount]
+    add  [DapLba], ax
+    sub  [Left], ax
+    shl  ax, 5                 ; sectors -> paragraphs
+    add  [DapSeg], ax
+    cmp  word [Left], 0
+    jne  .next
 
-    add  bx, 512
-    inc  byte [Sec]
-    cmp  byte [Sec], 19
-    jne  .adv_ok
-    mov  byte [Sec], 1
-    inc  byte [Head]
-    cmp  byte [Head], 2
-    jne  .adv_ok
-    mov  byte [Head], 0
-    inc  byte [Cyl]
-.adv_ok:
-    dec  cx
-    jnz  .next
-
+    cli
     jmp  0000h:0800h          ; jump to kernel
 
 .err:
@@ -57,13 +179,24 @@ start:
      or  al, al
      jz  $
      mov ah,0x0E
+     xor bx,bx
      int 0x10
      jmp .pr
 
-Drive db 0
-Sec   db 0
-Head  db 0
-Cyl   db 0
-msg   db 'ERR',0
+Dap:                          ; EDD disk address packet; CHS reuses the fields
+      db 16, 0
+DapCount dw 0
+DapOff   dw 0
+DapSeg   dw KERNEL_SEG
+DapLba   dd 1, 0              ; kernel starts right after this sector
+
+Left   dw KERNEL_SECTORS
+Drive  db 0
+Sec    db 0
+Head   db 0
+Cyl    dw 0
+Tries  db 0
+UseLba db 0
+msg    db 'ERR',0
 times 510-($-$$) db 0
 dw 0xAA55
@@ -0,0 +1,223 @@
+#include "kernel.h"
+
+// VGA text console with NVT virtual terminals. Each terminal writes into
+// its own RAM buffer laid out like the 32 KB text memory, so buffer row i
+// is shown from VRAM row i. Only the foreground terminal touches VRAM: it
+// copies out the rows it dirtied, once per write call. Background
+// terminals just update their buffer and are redrawn when switched to.
+//
+// Scrolling moves the CRTC start address down a row instead of copying the
+// screen. Rows above the top of the screen are the terminal's scrollback;
+// when the buffer is full its last KEEP rows are moved to the front.
+
+#define COLS 80
+#define ROWS 25
+#define VRAM_ROWS 204  // 16 K cells at 0xB8000
+#define KEEP 100       // rows kept when the buffer wraps, screen included
+#define ALL_ROWS ((1u << ROWS) - 1)
+#define CRTC_INDEX 0x3D4
+#define CRTC_DATA 0x3D5
+#define CRTC_START_HI 0x0C
+#define CRTC_START_LO 0x0D
+#define CRTC_CURSOR_HI 0x0E
+#define CRTC_CURSOR_LO 0x0F
+
+typedef struct {
+  uint16_t buf[VRAM_ROWS * COLS];
+  uint32_t top;    // buffer row at the top of the screen
+  uint32_t view;   // rows scrolled back from top (Shift+PgUp)
+  uint32_t dirty;  // bit r: screen row r not yet copied to VRAM
+  uint8_t row, col, attr;
+} vt_t;
+
+static volatile uint16_t *const vga = (uint16_t *)0xB8000;
+static vt_t vts[NVT];
+static spinlock_t con_lock;  // vts[] and the CRTC; taken from IRQs too
+static uint32_t shown_base = ~0u;  // CRTC start row last programmed
+int con_fg;
+bool con_direct;  // write through and scroll by copying, the old way
+con_stats_t con_stats;
+
+static void crtc_write(uint8_t reg, uint8_t v) {
+  outb(CRTC_INDEX, reg);
+  outb(CRTC_DATA, v);
+}
+
+static void blank_row(vt_t *v, uint32_t r) {
+  uint16_t *p = v->buf + r * COLS;
+  for (int c = 0; c < COLS; c++) p[c] = (v->attr << 8) | ' ';
+}
+
+static bool is_fg(const vt_t *v) { return v == &vts[con_fg]; }
+
+static void scroll(vt_t *v) {
+  if (con_direct) {
+    uint16_t *b = v->buf + v->top * COLS;
+    memmove(b, b + COLS, (ROWS - 1) * COLS * 2);
+    blank_row(v, v->top + ROWS - 1);
+    // On screen, the cell-by-cell volatile loop the console started with;
+    // conbench times it as the baseline.
+    if (is_fg(v)) {
+      volatile uint16_t *s = vga + v->top * COLS;
+      for (int i = 0; i < (ROWS - 1) * COLS; i++) s[i] = s[i + COLS];
+      for (int i = (ROWS - 1) * COLS; i < ROWS * COLS; i++)
+        s[i] = (v->attr << 8) | ' ';
+    }
+    return;
+  }
+  if (v->top + ROWS == VRAM_ROWS) {
+    memcpy(v->buf, v->buf + (VRAM_ROWS - KEEP) * COLS, KEEP * COLS * 2);
+    v->top = KEEP - ROWS;
+    v->dirty = ALL_ROWS;
+    con_stats.wraps++;
+  }
+  v->top++;
+  v->dirty = v->dirty >> 1 | 1u << (ROWS - 1);
+  blank_row(v, v->top + ROWS - 1);
+  con_stats.scrolls++;
+}
+
+static void put(vt_t *v, char c) {
+  if (serial_con && v == &vts[0]) serial_con_putc(c);
+  if (v->view) {  // output snaps back from the scrollback
+    v->view = 0;
+    v->dirty = ALL_ROWS;
+  }
+  if (c == '\b') {
+    if (v->col > 0) v->col--;
+    return;
+  }
+  if (c == '\n' || v->col >= COLS) {
+    v->col = 0;
+    if (++v->row == ROWS) {
+      scroll(v);
+      v->row = ROWS - 1;
+    }
+  }
+  if (c == '\n') return;
+  uint32_t i = (v->top + v->row) * COLS + v->col++;
+  v->buf[i] = (v->attr << 8) | (uint8_t)c;
+  if (con_direct && is_fg(v))
+    vga[i] = v->buf[i];
+  else
+    v->dirty |= 1u << v->row;
+}
+
+// Copies the foreground terminal's dirty rows out and moves the display
+// start and the cursor. Background terminals stay in memory.
+static void flush(vt_t *v) {
+  if (!is_fg(v)) return;
+  uint32_t base = v->top - v->view;
+  for (uint32_t d = v->dirty, r = 0; d; d >>= 1, r++)
+    if (d & 1) {
+      memcpy((uint16_t *)vga + (base + r) * COLS, v->buf + (base + r) * COLS,
+             COLS * 2);
+      con_stats.rows++;
+    }
+  v->dirty = 0;
+  if (base != shown_base) {
+    crtc_write(CRTC_START_HI, base * COLS >> 8);
+    crtc_write(CRTC_START_LO, base * COLS);
+    shown_base = base;
+  }
+  uint32_t pos = (v->top + v->row) * COLS + v->col;
+  crtc_write(CRTC_CURSOR_HI, pos >> 8);
+  crtc_write(CRTC_CURSOR_LO, pos);
+  con_stats.flushes++;
+}
+
+void con_putc(int vt, char c) {
+  uint32_t f = spin_lock_irqsave(&con_lock);
+  put(&vts[vt], c);
+  flush(&vts[vt]);
+  spin_unlock_irqrestore(&con_lock, f);
+}
+
+// "\b \b" erases the previous character.
+static void write_locked(vt_t *v, const char *s) {
+  while (*s) {
+    if (s[0] == '\b' && s[1] == ' ' && s[2] == '\b') {
+      if (v->col > 0) {
+        put(v, '\b');
+        put(v, ' ');
+        put(v, '\b');
+      }
+      s += 3;
+    } else {
+      put(v, *s++);
+    }
+  }
+  flush(v);
+}
+
+void con_write(int vt, const char *s) {
+  uint32_t f = spin_lock_irqsave(&con_lock);
+  write_locked(&vts[vt], s);
+  spin_unlock_irqrestore(&con_lock, f);
+}
+
+// For reports from fault handlers, which may have interrupted a holder of
+// con_lock on this CPU and so must not wait for it.
+bool con_try_write(int vt, const char *s) {
+  uint32_t f = irq_save();
+  bool ok = spin_trylock(&con_lock);
+  if (ok) {
+    write_locked(&vts[vt], s);
+    spin_unlock(&con_lock);
+  }
+  irq_restore(f);
+  return ok;
+}
+
+// Also drops the scrollback.
+void con_clear(int vt) {
+  vt_t *v = &vts[vt];
+  uint32_t f = spin_lock_irqsave(&con_lock);
+  v->top = v->view = v->row = v->col = 0;
+  for (int r = 0; r < ROWS; r++) blank_row(v, r);
+  v->dirty = ALL_ROWS;
+  flush(v);
+  spin_unlock_irqrestore(&con_lock, f);
+}
+
+void con_init(void) {
+  spin_init(&con_lock, "console");
+  for (int i = 0; i < NVT; i++) {
+    vts[i].attr = 0x0F;
+    con_clear(i);
+  }
+}
+
+// Alt+Fn, from the keyboard IRQ: redraws the terminal's screen.
+void con_switch(int vt) {
+  uint32_t f = spin_lock_irqsave(&con_lock);
+  if (vt != con_fg && vt >= 0 && vt < NVT) {
+    con_fg = vt;
+    vts[vt].dirty = ALL_ROWS;
+    flush(&vts[vt]);
+  }
+  spin_unlock_irqrestore(&con_lock, f);
+}
+
+// Shift+PgUp/PgDn: moves the foreground view `rows` back (or forward, if
+// negative) through the scrollback.
+void con_scrollback(int rows) {
+  vt_t *v = &vts[con_fg];
+  uint32_t f = spin_lock_irqsave(&con_lock);
+  int32_t view = (int32_t)v->view + rows;
+  if (view < 0) view = 0;
+  if ((uint32_t)view > v->top) view = v->top;
+  if ((uint32_t)view != v->view) {
+    v->view = view;
+    v->dirty = ALL_ROWS;
+    flush(v);
+  }
+  spin_unlock_irqrestore(&con_lock, f);
+}
+
+// Switching starts the foreground terminal from a clear screen at the top
+// of VRAM, where the write-through path expects it.
+void con_set_direct(bool on) {
+  con_direct = on;
+  con_clear(con_fg);
+}
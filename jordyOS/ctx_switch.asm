@@ -1,4 +1,4 @@
-; ctx_switch(old_sp_ptr, new_sp)
+; ctx_switch(old_sp_ptr, new_sp, new_pd); new_pd is NULL if CR3 stays
 BITS 32
 GLOBAL ctx_switch
 ctx_switch:
@@ -10,11 +10,50 @@ ctx_switch:
     ; *old_sp_ptr = current ESP
     mov  esi, [esp+20]
     mov  [esi], esp
+    ; Every task's stack sits at the same virtual address, so the old one
+    ; is unreachable once CR3 changes: fetch both args first.
+    mov  ecx, [esp+24]
+    mov  eax, [esp+28]
+    test eax, eax
+    jz   .same_space            ; kernel threads share kernel_pd
+    mov  cr3, eax
+.same_space:
     ; load new ESP
-    mov  esp, [esp+24]
+    mov  esp, ecx
     ; restore regs of next task
     pop  edi
     pop  esi
     pop  ebx
     pop  ebp
     ret
+
+; First ret target of a task built by task_create(): ctx_switch has just
+; popped the entry point into EBX. schedule_tail() drops the scheduler
+; lock that the switch was made under. Tasks start with IRQs on.
+GLOBAL task_start
+EXTERN sys_exit_task, schedule_tail
+task_start:
+    call schedule_tail
+    sti
+    call ebx
+    call sys_exit_task          ; entry returned without exiting
+
+; First ret target of a ring-3 task: EBX is the entry point and ESI the
+; user stack pointer. Drops to ring 3 with IRQs on; the task comes back
+; into the kernel only through interrupts and int 0x80.
+GLOBAL user_start
+UCODE equ 0x1B                  ; GDT_UCODE/GDT_UDATA in kernel.h
+UDATA equ 0x23
+user_start:
+    call schedule_tail          ; keeps EBX and ESI
+    mov  ax, UDATA
+    mov  ds, ax
+    mov  es, ax
+    mov  fs, ax
+    mov  gs, ax
+    push dword UDATA            ; ss
+    push esi                    ; esp
+    push dword 0x202            ; eflags: IF
+    push dword UCODE            ; cs
+    push ebx                    ; eip
+    iret
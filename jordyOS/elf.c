@@ -0,0 +1,84 @@
+#include "kernel.h"
+#include "syscall.h"
+
+// Program loader: maps an ELF32 i386 executable from the file system into
+// a ring-3 address space. Each PT_LOAD segment gets fresh zeroed pages
+// between USER_BASE and USER_END, read straight from the file into them,
+// so the part past p_filesz (.bss) is left zero. Pages are writable only
+// if the segment is. Every instance gets its own copy, so programs can be
+// run any number of times at once.
+
+#define EI_NIDENT 16
+#define ET_EXEC 2
+#define EM_386 3
+#define PT_LOAD 1
+#define PF_W 2
+#define ELF_MAX_PHDRS 16
+
+typedef struct {
+  uint8_t ident[EI_NIDENT];  // \x7f E L F, class, data, version, ...
+  uint16_t type, machine;
+  uint32_t version, entry, phoff, shoff, flags;
+  uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+} elf_hdr_t;
+
+typedef struct {
+  uint32_t type, offset, vaddr, paddr, filesz, memsz, flags, align;
+} elf_phdr_t;
+
+static bool elf_ok(const elf_hdr_t *h) {
+  return !memcmp(h->ident, "\x7f" "ELF", 4) && h->ident[4] == 1 &&  // 32-bit
+         h->ident[5] == 1 &&  // little-endian
+         h->type == ET_EXEC && h->machine == EM_386 &&
+         h->phentsize == sizeof(elf_phdr_t) && h->phnum > 0 &&
+         h->phnum <= ELF_MAX_PHDRS;
+}
+
+static int load_segment(uint32_t *pd, const char *name, const elf_phdr_t *ph) {
+  uint32_t end = ph->vaddr + ph->memsz, fend = ph->vaddr + ph->filesz;
+  if (ph->filesz > ph->memsz || ph->vaddr < USER_BASE || end < ph->vaddr ||
+      end > USER_END)
+    return ELF_ENOEXEC;
+  for (uint32_t a = ph->vaddr & ~(PAGE_SIZE - 1); a < end; a += PAGE_SIZE) {
+    uint8_t *pg = vm_map_user(pd, a, ph->flags & PF_W);
+    if (!pg) return ELF_ENOMEM;
+    // The part of this page that comes from the file.
+    uint32_t lo = a > ph->vaddr ? a : ph->vaddr;
+    uint32_t hi = a + PAGE_SIZE < fend ? a + PAGE_SIZE : fend;
+    if (lo < hi &&
+        sys_pread(name, pg + (lo - a), hi - lo, ph->offset + (lo - ph->vaddr)) !=
+            (int)(hi - lo))
+      return ELF_ENOEXEC;
+  }
+  return 0;
+}
+
+// Loads `name` into the address space `pd` and sets *entry. On failure the
+// pages already mapped are left for vm_destroy().
+int elf_load(uint32_t *pd, const char *name, uint32_t *entry) {
+  elf_hdr_t h;
+  elf_phdr_t ph[ELF_MAX_PHDRS];
+  int n = sys_pread(name, &h, sizeof h, 0);
+  if (n < 0) return ELF_ENOENT;
+  if (n != sizeof h || !elf_ok(&h)) return ELF_ENOEXEC;
+  int len = h.phnum * sizeof *ph;
+  if (sys_pread(name, ph, len, h.phoff) != len) return ELF_ENOEXEC;
+  bool entry_ok = false;
+  for (int i = 0; i < h.phnum; i++) {
+    if (ph[i].type != PT_LOAD || ph[i].memsz == 0) continue;
+    int r = load_segment(pd, name, &ph[i]);
+    if (r < 0) return r;
+    if (h.entry >= ph[i].vaddr && h.entry - ph[i].vaddr < ph[i].memsz)
+      entry_ok = true;
+  }
+  if (!entry_ok) return ELF_ENOEXEC;
+  *entry = h.entry;
+  return 0;
+}
+
+const char *elf_strerror(int err) {
+  if (err == ELF_ENOENT) return "not found";
+  if (err == ELF_ENOEXEC) return "not an executable";
+  if (err == ELF_ENOMEM) return "out of memory";
+  return "error";
+}
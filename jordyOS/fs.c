@@ -0,0 +1,451 @@
+#include "kernel.h"
+
+// The file system, on top of the block cache. Names hash into an
+// open-addressed directory that points at inodes; an inode maps its file
+// onto up to FS_NEXTENTS runs of blocks. Files grow by extending their last
+// extent in place when the next block is free, so appends never copy what's
+// already written. The layout is in fs.h. Metadata is also kept in core;
+// every change is copied into its cached block, which bsync() (the shell's
+// `sync`, or the flusher task) or eviction writes back.
+//
+// A block the cache can't read or hold sets io_err, and the call fails with
+// FS_EIO. A disk whose metadata can't be read is left unmounted, and is
+// never formatted over.
+
+#if MAX_FILES != FS_NINODES || MAX_FILENAME_LEN != FS_NAME_LEN
+#error "util.h limits don't match the on-disk format"
+#endif
+
+static fs_super_t sb;
+static uint32_t inode_bitmap[FS_NINODES / 32];
+static uint32_t blk_bitmap[FS_NBLOCKS / 32];
+static fs_inode_t inodes[FS_NINODES];
+static fs_dirent_t dir[FS_DIR_SLOTS];
+static amutex_t fs_lock;
+static bool mounted;
+static bool io_err;  // in the current call; fs_lock held
+uint32_t fs_free_blocks;
+
+// Tables are arrays of `size`-byte records starting at block `first`,
+// `per_blk` to a block.
+static void meta_put(uint32_t first, uint32_t per_blk, uint32_t size,
+                     uint32_t i, const void *rec) {
+  buf_t *b = bread(first + i / per_blk);
+  if (!b) {
+    io_err = true;
+    return;
+  }
+  memcpy(b->data + (i % per_blk) * size, rec, size);
+  bdirty(b);
+}
+static bool meta_load(uint32_t first, uint32_t per_blk, uint32_t size,
+                      uint32_t n, void *table) {
+  for (uint32_t i = 0; i < n; i++) {
+    buf_t *b = bread(first + i / per_blk);
+    if (!b) return false;
+    memcpy((uint8_t *)table + i * size, b->data + (i % per_blk) * size, size);
+  }
+  return true;
+}
+
+static void inode_put(int ino) {
+  meta_put(sb.inode_start, FS_INODES_PER_BLOCK, sizeof *inodes, ino,
+           &inodes[ino]);
+}
+static void dirent_put(int slot) {
+  meta_put(sb.dir_start, FS_DIRENTS_PER_BLOCK, sizeof *dir, slot, &dir[slot]);
+}
+static void blk_bitmap_put(uint32_t b) {
+  meta_put(sb.block_bitmap, FS_BLOCK_SIZE / 4, 4, b >> 5, &blk_bitmap[b >> 5]);
+}
+static void inode_bitmap_put(int ino) {
+  meta_put(sb.inode_bitmap, FS_BLOCK_SIZE / 4, 4, ino >> 5,
+           &inode_bitmap[ino >> 5]);
+}
+
+static bool blk_used(uint32_t b) {
+  return blk_bitmap[b >> 5] & (1u << (b & 31));
+}
+
+// New blocks start zeroed in the cache; their old contents are never read.
+static void blk_take(uint32_t b) {
+  blk_bitmap[b >> 5] |= 1u << (b & 31);
+  blk_bitmap_put(b);
+  fs_free_blocks--;
+  if (!bclear(b)) io_err = true;
+}
+
+static void blk_release(uint32_t b) {
+  blk_bitmap[b >> 5] &= ~(1u << (b & 31));
+  blk_bitmap_put(b);
+  fs_free_blocks++;
+}
+
+// First run of `want` free blocks, or failing that the longest one seen.
+static uint32_t blk_find_run(uint32_t want, uint32_t *start) {
+  uint32_t best = 0, run = 0;
+  for (uint32_t b = sb.data_start; b < sb.nblocks; b++) {
+    if (blk_used(b)) {
+      run = 0;
+      continue;
+    }
+    if (++run > best) {
+      best = run;
+      *start = b + 1 - run;
+      if (best == want) break;
+    }
+  }
+  return best;
+}
+
+static uint32_t fnv1a(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+  return h;
+}
+
+// Slot holding `name`, or -1. With `insert`, returns the slot a new entry
+// should go in instead (the first tombstone on the chain, if any).
+static int dir_slot(const char *name, bool insert) {
+  uint32_t i = fnv1a(name) & (FS_DIR_SLOTS - 1);
+  int tomb = -1;
+  for (int n = 0; n < FS_DIR_SLOTS; n++, i = (i + 1) & (FS_DIR_SLOTS - 1)) {
+    if (dir[i].ino == FS_DIR_EMPTY)
+      return insert ? (tomb >= 0 ? tomb : (int)i) : -1;
+    if (dir[i].ino == FS_DIR_DELETED) {
+      if (tomb < 0) tomb = i;
+    } else if (!insert && !strcmp(dir[i].name, name)) {
+      return i;
+    }
+  }
+  return insert ? tomb : -1;
+}
+
+static int fs_lookup(const char *fn) {
+  int s = dir_slot(fn, false);
+  return s < 0 ? -1 : dir[s].ino;
+}
+
+static int fs_create(const char *fn) {
+  int ino = 0;
+  while (ino < FS_NINODES && (inode_bitmap[ino >> 5] & (1u << (ino & 31))))
+    ino++;
+  int s = ino < FS_NINODES ? dir_slot(fn, true) : -1;
+  if (s < 0) return -1;
+  inode_bitmap[ino >> 5] |= 1u << (ino & 31);
+  inode_bitmap_put(ino);
+  memset(&inodes[ino], 0, sizeof inodes[ino]);
+  inode_put(ino);
+  memset(&dir[s], 0, sizeof dir[s]);
+  strncpy(dir[s].name, fn, FS_NAME_LEN - 1);
+  dir[s].ino = ino;
+  dirent_put(s);
+  return ino;
+}
+
+static uint32_t fs_nblocks(const fs_inode_t *ip) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < ip->nextents; i++) n += ip->ext[i].len;
+  return n;
+}
+
+// Disk block holding byte `off` of the file, which must be allocated.
+static uint32_t fs_bmap(const fs_inode_t *ip, uint32_t off) {
+  uint32_t fb = off / FS_BLOCK_SIZE;
+  const fs_extent_t *e = ip->ext;
+  while (fb >= e->len) fb -= e++->len;
+  return e->start + fb;
+}
+
+// Adds zeroed blocks until the file has `want`. The caller writes the
+// inode back.
+static int fs_grow(fs_inode_t *ip, uint32_t want) {
+  uint32_t have = fs_nblocks(ip);
+  while (have < want) {
+    fs_extent_t *last = ip->nextents ? &ip->ext[ip->nextents - 1] : NULL;
+    uint32_t next = last ? last->start + last->len : sb.nblocks;
+    if (next < sb.nblocks && !blk_used(next)) {
+      blk_take(next);
+      last->len++;
+      have++;
+      continue;
+    }
+    uint32_t start, len;
+    if (ip->nextents == FS_NEXTENTS ||
+        (len = blk_find_run(want - have, &start)) == 0)
+      return -3;
+    for (uint32_t i = 0; i < len; i++) blk_take(start + i);
+    ip->ext[ip->nextents].start = start;
+    ip->ext[ip->nextents++].len = len;
+    have += len;
+  }
+  return 0;
+}
+
+// Frees the blocks past `size` and zeroes the rest of the last one, so
+// bytes beyond the end of a file are always zero.
+static void fs_shrink(fs_inode_t *ip, uint32_t size) {
+  uint32_t want = (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+  uint32_t have = fs_nblocks(ip);
+  while (have > want) {
+    fs_extent_t *last = &ip->ext[ip->nextents - 1];
+    blk_release(last->start + --last->len);
+    have--;
+    if (last->len == 0) ip->nextents--;
+  }
+  if (size % FS_BLOCK_SIZE) {
+    buf_t *b = bread(fs_bmap(ip, size));
+    if (b) {
+      memset(b->data + size % FS_BLOCK_SIZE, 0,
+             FS_BLOCK_SIZE - size % FS_BLOCK_SIZE);
+      bdirty(b);
+    } else {
+      io_err = true;
+    }
+  }
+  ip->size = size;
+}
+
+// Returns false if the new file system couldn't be written out.
+static bool fs_format(uint32_t nblocks) {
+  memset(&sb, 0, sizeof sb);
+  sb.magic = FS_MAGIC;
+  sb.version = FS_VERSION;
+  sb.nblocks = nblocks;
+  sb.ninodes = FS_NINODES;
+  sb.inode_bitmap = 1;
+  sb.block_bitmap = 2;
+  sb.inode_start =
+      sb.block_bitmap + (nblocks + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+  sb.dir_start = sb.inode_start + (FS_NINODES + FS_INODES_PER_BLOCK - 1) /
+                                      FS_INODES_PER_BLOCK;
+  sb.data_start = sb.dir_start + (FS_DIR_SLOTS + FS_DIRENTS_PER_BLOCK - 1) /
+                                     FS_DIRENTS_PER_BLOCK;
+  io_err = false;
+  for (uint32_t b = 0; b < sb.data_start; b++)
+    if (!bclear(b)) io_err = true;
+  buf_t *super = bread(0);
+  if (!super) return false;
+  memcpy(super->data, &sb, sizeof sb);
+  bdirty(super);
+  for (int i = 0; i < FS_DIR_SLOTS; i++) {
+    dir[i].ino = FS_DIR_EMPTY;
+    dirent_put(i);
+  }
+  for (uint32_t b = 0; b < sb.data_start; b++) {
+    blk_bitmap[b >> 5] |= 1u << (b & 31);
+    blk_bitmap_put(b);
+  }
+  return bsync() >= 0 && !io_err;
+}
+
+static void fs_fail(const char *what) {
+  sys_write("fs: can't ");
+  sys_write(what);
+  sys_write(" ");
+  sys_write(bcache_dev);
+  sys_write(", not mounted\n");
+}
+
+// Mounts the file system on the cache's device, formatting it if there is
+// none (always the case for the RAM fallback). Only a superblock that reads
+// back as someone else's is formatted over, never one that didn't read.
+void fs_init(void) {
+  amutex_init(&fs_lock, "fs");
+  mounted = false;
+  uint32_t nblocks =
+      bcache_nblocks < FS_NBLOCKS ? bcache_nblocks : FS_NBLOCKS;
+  buf_t *super = bread(0);
+  if (!super) {
+    fs_fail("read");
+    return;
+  }
+  memcpy(&sb, super->data, sizeof sb);
+  bool fresh = sb.magic != FS_MAGIC || sb.version != FS_VERSION ||
+               sb.ninodes != FS_NINODES || sb.nblocks > nblocks;
+  if (fresh && !fs_format(nblocks)) {
+    fs_fail("format");
+    return;
+  }
+  if (!meta_load(sb.inode_bitmap, FS_BLOCK_SIZE / 4, 4, FS_NINODES / 32,
+                 inode_bitmap) ||
+      !meta_load(sb.block_bitmap, FS_BLOCK_SIZE / 4, 4,
+                 (sb.nblocks + 31) / 32, blk_bitmap) ||
+      !meta_load(sb.inode_start, FS_INODES_PER_BLOCK, sizeof *inodes,
+                 FS_NINODES, inodes) ||
+      !meta_load(sb.dir_start, FS_DIRENTS_PER_BLOCK, sizeof *dir,
+                 FS_DIR_SLOTS, dir)) {
+    fs_fail("read");
+    return;
+  }
+  mounted = true;
+  fs_free_blocks = 0;
+  for (uint32_t b = sb.data_start; b < sb.nblocks; b++)
+    fs_free_blocks += !blk_used(b);
+
+  char nb[12];
+  sys_write(fresh ? "fs: formatted " : "fs: mounted ");
+  sys_write(bcache_dev);
+  sys_write(", ");
+  itoa((int32_t)fs_free_blocks, nb);
+  sys_write(nb);
+  sys_write(" KB free\n");
+}
+
+// ---- file system calls. fs_lock keeps a preempted task from observing a
+// half-updated inode; unlike holding IRQs off, it lets the rest of the
+// system run during disk transfers. ----
+// fs_begin/fs_end bracket each one, lock wait included, as a TR_FS span.
+// fs_begin fails, with the lock already dropped, if nothing is mounted.
+static void fs_end(uint32_t op) {
+  amutex_unlock(&fs_lock);
+  trace(TR_FS | TR_END, op);
+}
+static bool fs_begin(uint32_t op) {
+  trace(TR_FS, op);
+  amutex_lock(&fs_lock);
+  io_err = false;
+  if (mounted) return true;
+  fs_end(op);
+  return false;
+}
+
+int sys_list_files(char *ob, int bl) {
+  if (!ob || bl <= 0) return -1;
+  memset(ob, 0, bl);
+  int cp = 0;
+  if (!fs_begin(TR_FS_LIST)) return FS_EIO;
+  for (int i = 0; i < FS_DIR_SLOTS; i++) {
+    if (dir[i].ino < 0) continue;
+    size_t nl = strlen(dir[i].name);
+    if (cp + (cp > 0) + nl >= (size_t)bl) break;
+    if (cp > 0) ob[cp++] = '\n';
+    strcpy(ob + cp, dir[i].name);
+    cp += nl;
+  }
+  fs_end(TR_FS_LIST);
+  return cp;
+}
+
+int sys_file_size(const char *fn) {
+  if (!fn) return -1;
+  if (!fs_begin(TR_FS_SIZE)) return FS_EIO;
+  int ino = fs_lookup(fn);
+  int r = ino >= 0 ? (int)inodes[ino].size : -1;
+  fs_end(TR_FS_SIZE);
+  return r;
+}
+
+int sys_pread(const char *fn, void *buf, int len, int off) {
+  if (!fn || !buf || len < 0 || off < 0) return -1;
+  if (!fs_begin(TR_FS_PREAD)) return FS_EIO;
+  int ino = fs_lookup(fn);
+  if (ino < 0) {
+    fs_end(TR_FS_PREAD);
+    return -1;
+  }
+  fs_inode_t *ip = &inodes[ino];
+  uint32_t end = (uint32_t)off + len;
+  if (end > ip->size) end = ip->size;
+  uint8_t *dst = buf;
+  for (uint32_t pos = off; pos < end;) {
+    uint32_t n = FS_BLOCK_SIZE - pos % FS_BLOCK_SIZE;
+    if (n > end - pos) n = end - pos;
+    buf_t *b = bread(fs_bmap(ip, pos));
+    if (!b) {
+      io_err = true;
+      break;
+    }
+    memcpy(dst, b->data + pos % FS_BLOCK_SIZE, n);
+    dst += n;
+    pos += n;
+  }
+  int r = io_err ? FS_EIO : end > (uint32_t)off ? (int)(end - off) : 0;
+  fs_end(TR_FS_PREAD);
+  return r;
+}
+
+// Creates the file if needed; a hole before `off` reads back as zeros.
+int sys_pwrite(const char *fn, const void *buf, int len, int off) {
+  if (!fn || !buf || len < 0 || off < 0) return -1;
+  if (strlen(fn) >= MAX_FILENAME_LEN) return -2;
+  if (!fs_begin(TR_FS_PWRITE)) return FS_EIO;
+  int ino = fs_lookup(fn);
+  if (ino < 0 && (ino = fs_create(fn)) < 0) {
+    fs_end(TR_FS_PWRITE);
+    return -4;
+  }
+  fs_inode_t *ip = &inodes[ino];
+  uint32_t end = (uint32_t)off + len;
+  int r = fs_grow(ip, (end + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+  const uint8_t *src = buf;
+  for (uint32_t pos = off; r == 0 && !io_err && pos < end;) {
+    uint32_t n = FS_BLOCK_SIZE - pos % FS_BLOCK_SIZE;
+    if (n > end - pos) n = end - pos;
+    buf_t *b = bread(fs_bmap(ip, pos));
+    if (!b) {
+      io_err = true;
+      break;
+    }
+    memcpy(b->data + pos % FS_BLOCK_SIZE, src, n);
+    bdirty(b);
+    src += n;
+    pos += n;
+  }
+  if (r == 0 && !io_err && end > ip->size) ip->size = end;
+  inode_put(ino);
+  r = io_err ? FS_EIO : r < 0 ? r : len;
+  fs_end(TR_FS_PWRITE);
+  return r;
+}
+
+int sys_truncate(const char *fn, int size) {
+  if (!fn || size < 0) return -1;
+  if (!fs_begin(TR_FS_TRUNCATE)) return FS_EIO;
+  int ino = fs_lookup(fn), r = -1;
+  fs_inode_t *ip = ino >= 0 ? &inodes[ino] : NULL;
+  if (ip && (uint32_t)size <= ip->size) {
+    fs_shrink(ip, size);
+    r = 0;
+  } else if (ip) {
+    r = fs_grow(ip, (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE);
+    if (r == 0) ip->size = size;
+  }
+  if (ip) inode_put(ino);
+  if (io_err) r = FS_EIO;
+  fs_end(TR_FS_TRUNCATE);
+  return r;
+}
+
+int sys_read_file(const char *fn, char *ub, int us) {
+  if (!fn || !ub || us <= 0) return -1;
+  int size = sys_file_size(fn);
+  if (size < 0) return -1;
+  if (us < size) return -2;
+  return sys_pread(fn, ub, size, 0);
+}
+
+// Overwrites in place, then trims whatever the old contents had beyond dl.
+int sys_write_file(const char *fn, const char *d, int dl) {
+  if (!d || dl < 0) return -1;
+  int r = sys_pwrite(fn, d, dl, 0);
+  return r < 0 ? r : sys_truncate(fn, dl);
+}
+
+int sys_delete_file(const char *fn) {
+  if (!fn) return -1;
+  if (!fs_begin(TR_FS_DELETE)) return FS_EIO;
+  int s = dir_slot(fn, false);
+  if (s >= 0) {
+    int ino = dir[s].ino;
+    fs_shrink(&inodes[ino], 0);
+    inode_put(ino);
+    inode_bitmap[ino >> 5] &= ~(1u << (ino & 31));
+    inode_bitmap_put(ino);
+    dir[s].ino = FS_DIR_DELETED;
+    dirent_put(s);
+  }
+  int r = io_err ? FS_EIO : s < 0 ? -1 : 0;
+  fs_end(TR_FS_DELETE);
+  return r;
+}
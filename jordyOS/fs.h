@@ -0,0 +1,58 @@
+#ifndef FS_H
+#define FS_H
+
+// On-disk layout of the jordyOS file system, counted in FS_BLOCK_SIZE
+// blocks, little-endian:
+//
+//   0               superblock
+//   inode_bitmap    one bit per inode
+//   block_bitmap    one bit per block, metadata blocks included
+//   inode_start     inode table
+//   dir_start       directory: a hash table of (name, inode) slots
+//   data_start      file data
+//
+// Records never straddle a block. Kept free of kernel headers so host
+// tools can use it too.
+
+#include <stdint.h>
+
+#define FS_MAGIC 0x53464F4Au  // "JOFS"
+#define FS_VERSION 1
+#define FS_BLOCK_SIZE 1024
+#define FS_SECTORS_PER_BLOCK (FS_BLOCK_SIZE / 512)
+#define FS_NBLOCKS 8192   // largest file system: 8 MB
+#define FS_NINODES 64
+#define FS_NEXTENTS 8     // block runs per inode
+#define FS_DIR_SLOTS 128  // power of two, well above FS_NINODES
+#define FS_NAME_LEN 16
+
+typedef struct {
+  uint32_t magic, version;
+  uint32_t nblocks, ninodes;
+  uint32_t inode_bitmap, block_bitmap, inode_start, dir_start, data_start;
+} fs_super_t;
+
+typedef struct {
+  uint32_t start, len;
+} fs_extent_t;
+
+typedef struct {
+  uint32_t size;
+  uint32_t nextents;
+  fs_extent_t ext[FS_NEXTENTS];
+} fs_inode_t;
+
+#define FS_DIR_EMPTY -1
+#define FS_DIR_DELETED -2  // tombstone: keeps probe chains through it intact
+
+typedef struct {
+  char name[FS_NAME_LEN];
+  int16_t ino;  // or FS_DIR_EMPTY / FS_DIR_DELETED
+  uint16_t _pad;
+} fs_dirent_t;
+
+#define FS_INODES_PER_BLOCK (FS_BLOCK_SIZE / sizeof(fs_inode_t))
+#define FS_DIRENTS_PER_BLOCK (FS_BLOCK_SIZE / sizeof(fs_dirent_t))
+#define FS_BITS_PER_BLOCK (FS_BLOCK_SIZE * 8)
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HAL_H
+#define HAL_H
+
+// The machine instructions kernel.h's inline helpers are built from. The
+// kernel gets the i386 ones. A HOSTED build (make libkhost.a) gets stand-ins
+// instead, so that the portable files (string.c, line.c, sched.c, bcache.c,
+// fs.c) compile as a Linux library, with hal_host.c supplying the rest of
+// what they call; bench/kbench.c times them there.
+
+#include <stdint.h>
+
+#ifndef HOSTED
+static inline uint8_t inb(uint16_t p) {
+  uint8_t r;
+  __asm__ volatile("inb %1,%0" : "=a"(r) : "Nd"(p));
+  return r;
+}
+static inline void outb(uint16_t p, uint8_t v) {
+  __asm__ volatile("outb %0,%1" : : "a"(v), "Nd"(p));
+}
+static inline uint32_t irq_save(void) {
+  uint32_t f;
+  __asm__ volatile("pushf; pop %0; cli" : "=r"(f) : : "memory");
+  return f;
+}
+static inline void irq_restore(uint32_t f) {
+  if (f & 0x200) __asm__ volatile("sti" : : : "memory");
+}
+static inline uint64_t rdtsc(void) {
+  uint64_t t;
+  __asm__ volatile("rdtsc" : "=A"(t));
+  return t;
+}
+// The task register: which TSS, and so which CPU, this is (this_cpu()).
+static inline uint16_t task_register(void) {
+  uint16_t tr;
+  __asm__ volatile("str %0" : "=r"(tr));
+  return tr;
+}
+#else
+// One CPU, no devices, nothing to mask.
+static inline uint8_t inb(uint16_t p) {
+  (void)p;
+  return 0xFF;
+}
+static inline void outb(uint16_t p, uint8_t v) {
+  (void)p;
+  (void)v;
+}
+static inline uint32_t irq_save(void) { return 0; }
+static inline void irq_restore(uint32_t f) { (void)f; }
+static inline uint64_t rdtsc(void) { return __builtin_ia32_rdtsc(); }
+static inline uint16_t task_register(void) { return 0; }
+
+// hal_host.c: use an image file as the disk instead of RAM; 0 on success.
+// Call before bcache_init().
+int hal_disk_open(const char *path);
+#endif
+
+#endif
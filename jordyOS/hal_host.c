@@ -0,0 +1,79 @@
+// Host side of the HAL (hal.h, HOSTED): what string.c, line.c, sched.c,
+// bcache.c and fs.c call in the rest of the kernel, rebuilt on libc for
+// the Linux library libkhost.a. There is one thread and one CPU, so the
+// locks do nothing; pages come from the C heap; and the disk is an image
+// file opened with hal_disk_open(), or without one bcache.c's RAM device.
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernel.h"
+
+cpu_t cpus[MAX_CPUS];
+int ncpus = 1;
+uint32_t trace_mask;
+
+bool task_movable(const task_t *t) { return !t->pinned; }
+
+void trace_emit(uint32_t type, uint32_t arg) {
+  (void)type;
+  (void)arg;
+}
+
+void sys_write(const char *s) { fputs(s, stderr); }
+
+void *pmm_alloc_page(void) {
+  void *p;
+  return posix_memalign(&p, PAGE_SIZE, PAGE_SIZE) ? NULL : p;
+}
+
+// ---- locks: nothing to exclude ----
+void spin_init(spinlock_t *l, const char *name) { l->stats.name = name; }
+void spin_lock(spinlock_t *l) { l->stats.acquires++; }
+void spin_unlock(spinlock_t *l) { (void)l; }
+uint32_t spin_lock_irqsave(spinlock_t *l) {
+  spin_lock(l);
+  return 0;
+}
+void spin_unlock_irqrestore(spinlock_t *l, uint32_t f) {
+  (void)f;
+  spin_unlock(l);
+}
+void mutex_init(mutex_t *m, const char *name) { m->stats.name = name; }
+void mutex_lock(mutex_t *m) { m->stats.acquires++; }
+void mutex_unlock(mutex_t *m) { (void)m; }
+void amutex_init(amutex_t *m, const char *name) { m->stats.name = name; }
+void amutex_lock(amutex_t *m) { m->stats.acquires++; }
+void amutex_unlock(amutex_t *m) { (void)m; }
+
+// ---- disk: ata.c's interface on an image file ----
+uint32_t ata_sectors;
+static int disk_fd = -1;
+
+int hal_disk_open(const char *path) {
+  struct stat st;
+  disk_fd = open(path, O_RDWR);
+  if (disk_fd < 0 || fstat(disk_fd, &st) < 0) return -1;
+  ata_sectors = st.st_size / 512;
+  return 0;
+}
+
+bool ata_init(void) { return ata_sectors != 0; }
+
+int ata_rw(uint32_t lba, uint32_t count, uint8_t *const *seg, uint32_t per_seg,
+           bool write) {
+  for (uint32_t i = 0; i * per_seg < count; i++) {
+    size_t n = (size_t)per_seg * 512;
+    off_t off = (off_t)(lba + i * per_seg) * 512;
+    ssize_t r = write ? pwrite(disk_fd, seg[i], n, off)
+                      : pread(disk_fd, seg[i], n, off);
+    if (r != (ssize_t)n) return -1;
+  }
+  return 0;
+}
+
+int ata_flush(void) { return fsync(disk_fd); }
@@ -0,0 +1,126 @@
+; Interrupt entry stubs for vectors 0-63 (CPU exceptions, remapped ISA IRQs
+; and the local APIC's timer, IPI and spurious vectors) and the int 0x80
+; system call gate. Every stub normalises the stack to
+; [vector, error] and jumps to isr_common, which hands a regs_t* to
+; isr_dispatch() in kernel.c.
+BITS 32
+GLOBAL isr_table, syscall_entry, pf_task
+EXTERN isr_dispatch, pf_dispatch
+
+KDATA equ 0x10                  ; GDT_KDATA in kernel.h
+
+%macro ISR_NOERR 1
+isr%1:
+    push dword 0                ; fake error code
+    push dword %1
+    jmp  isr_common
+%endmacro
+
+%macro ISR_ERR 1
+isr%1:
+    push dword %1               ; CPU already pushed the error code
+    jmp  isr_common
+%endmacro
+
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR 8
+ISR_NOERR 9
+ISR_ERR 10
+ISR_ERR 11
+ISR_ERR 12
+ISR_ERR 13
+ISR_ERR 14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR 17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR 21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR 29
+ISR_ERR 30
+ISR_NOERR 31
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+ISR_NOERR 48
+ISR_NOERR 49
+ISR_NOERR 50
+ISR_NOERR 51
+ISR_NOERR 52
+ISR_NOERR 53
+ISR_NOERR 54
+ISR_NOERR 55
+ISR_NOERR 56
+ISR_NOERR 57
+ISR_NOERR 58
+ISR_NOERR 59
+ISR_NOERR 60
+ISR_NOERR 61
+ISR_NOERR 62
+ISR_NOERR 63
+
+syscall_entry:                  ; int 0x80, through a DPL 3 trap gate
+    push dword 0
+    push dword 0x80
+    jmp  isr_common
+
+isr_common:
+    pushad
+    push ds                     ; ring 3 may have loaded anything here
+    push es
+    mov  ax, KDATA
+    mov  ds, ax
+    mov  es, ax
+    push esp                    ; regs_t *
+    call isr_dispatch
+    add  esp, 4
+    pop  es
+    pop  ds
+    popad
+    add  esp, 8                 ; drop vector + error code
+    iret
+
+isr_table:
+%assign i 0
+%rep 64
+    dd isr%+i
+ %assign i i+1
+%endrep
+
+; #PF is delivered through a task gate: the CPU switches to its pf_tss (own
+; stack, kernel CR3), saving the faulting context in its main TSS, and
+; pushes the error code here. iret follows the back link to resume it; the
+; next fault re-enters after the iret, hence the jmp.
+pf_task:
+    call pf_dispatch            ; error code is the argument
+    add  esp, 4
+    iret
+    jmp  pf_task
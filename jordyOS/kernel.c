@@ -2,59 +2,39 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "ape.h"
+#include "kernel.h"
+#include "romfs.h"
+#include "syscall.h"
 #include "util.h"
-static volatile uint16_t *const vga = (uint16_t *)0xB8000;
-static uint8_t row = 0, col = 0;
-static uint8_t attr = 0x0F;
-
-static void clear_screen_internal(void) {
-  for (int r = 0; r < 25; r++) {
-    for (int c = 0; c < 80; c++) {
-      vga[r * 80 + c] = (attr << 8) | ' ';
-    }
-  }
-  row = 0;
-  col = 0;
+// Console output goes to the current task's terminal.
+static int cur_vt(void) {
+  task_t *t = current();
+  return t ? t->vt : 0;
 }
+static void putc(char c) { con_putc(cur_vt(), c); }
+static void puts(const char *s) { con_write(cur_vt(), s); }
 
-static void putc(char c) {
-  if (c == '\b') {
-    if (col > 0) col--;
-    return;
-  }
-  if (c == '\n' || col >= 80) {
-    col = 0;
-    row++;
-  }
-  if (row >= 25) {  // Screen is full, scroll up
-    // Move all lines up by one
-    for (int i = 0; i < 24 * 80; i++) vga[i] = vga[i + 80];
-    // Clear the last line
-    for (int i = 24 * 80; i < 25 * 80; i++) vga[i] = (attr << 8) | ' ';
-    row = 24;  // Reset row to the new last line
-  }
-  if (c != '\n') vga[row * 80 + col++] = (attr << 8) | (uint8_t)c;
+static char *hex(uint32_t v, char b[9]) {
+  for (int i = 7; i >= 0; i--, v >>= 4) b[i] = "0123456789abcdef"[v & 15];
+  b[8] = '\0';
+  return b;
 }
 
-static void puts(const char *s) {
-  while (*s) {
-    if (s[0] == '\b' && s[1] == ' ' && s[2] == '\b') {
-      if (col > 0) {
-        col--;
-        vga[row * 80 + col] = (attr << 8) | ' ';
-      }
-      s += 3;
-    } else {
-      putc(*s++);
-    }
-  }
+// Copies `s` to `p` and returns the end, for building a line in a buffer.
+static char *append(char *p, const char *s) {
+  while ((*p = *s++)) p++;
+  return p;
 }
 
-static inline uint8_t inb(uint16_t p) {
-  uint8_t r;
-  __asm__ volatile("inb %1,%0" : "=a"(r) : "Nd"(p));
-  return r;
-}
+// Scancodes from IRQ1, one ring per terminal; keys go to the one on
+// screen. Single producer (kbd_irq) / single consumer (get_ch): each side
+// only ever writes its own index, so no lock is needed.
+#define KBD_BUF_SIZE 256  // power of two
+static volatile uint8_t kbd_buf[NVT][KBD_BUF_SIZE];
+static volatile uint32_t kbd_head[NVT], kbd_tail[NVT];
+static uint32_t kbd_dropped = 0;
+static void kbd_wait(int vt);
 
 static char get_ch(void) {
   static const char map[0x3A] = {
@@ -64,286 +44,1324 @@ static char get_ch(void) {
       'j', 'k', 'l', ';',  '\'', '`', 0,   '\\', 'z', 'x', 'c', 'v',
       'b', 'n', 'm', ',',  '.',  '/', 0,   '*',  0,   ' '};
   uint8_t sc;
+  int vt = cur_vt();
   for (;;) {
-    if (inb(0x64) & 0x01) {
-      sc = inb(0x60);
-      if (sc & 0x80) continue;
-      if (sc < 0x3A && map[sc] != 0) return map[sc];
-    }
+    if (kbd_tail[vt] == kbd_head[vt]) kbd_wait(vt);
+    sc = kbd_buf[vt][kbd_tail[vt]];
+    __asm__ volatile("" : : : "memory");
+    kbd_tail[vt] = (kbd_tail[vt] + 1) & (KBD_BUF_SIZE - 1);
+    if (sc & 0x80) continue;
+    if (sc < 0x3A && map[sc] != 0) return map[sc];
   }
 }
 
 void read_line(char *buf, int max) {
-  int len = 0;
-  for (;;) {
-    char c = get_ch();
-    if (c == '\n') {
-      putc('\n');
-      break;
-    }
-    if ((c == 8 || c == 127) && len > 0) {
-      len--;
-      puts("\b \b");
-    } else if (c >= 32 && c < 127 && len < max - 1) {
-      buf[len++] = c;
-      putc(c);
-    }
+  int len = 0, r;
+  while ((r = line_key(buf, &len, max, get_ch())) != LINE_DONE) {
+    if (r == LINE_ECHO) putc(buf[len - 1]);
+    if (r == LINE_ERASE) puts("\b \b");
   }
-  buf[len] = 0;
-}
-
-size_t strlen(const char *s) {
-  size_t i = 0;
-  while (s[i]) i++;
-  return i;
-}
-int strcmp(const char *a, const char *b) {
-  while (*a && (*a == *b)) {
-    a++;
-    b++;
-  }
-  return *(const unsigned char *)a - *(const unsigned char *)b;
-}
-char *strcpy(char *dst, const char *src) {
-  char *orig_dst = dst;
-  while ((*dst++ = *src++));
-  return orig_dst;
-}
-char *strncpy(char *dst, const char *src, size_t n) {
-  size_t i;
-  for (i = 0; i < n && src[i] != '\0'; i++) {
-    dst[i] = src[i];
-  }
-  for (; i < n; i++) {
-    dst[i] = '\0';
-  }
-  return dst;
-}
-void *memset(void *s, int c, size_t n) {
-  unsigned char *p = (unsigned char *)s;
-  while (n--) *p++ = (unsigned char)c;
-  return s;
-}
-void *memcpy(void *dest, const void *src, size_t n) {
-  char *d = dest;
-  const char *s = src;
-  while (n--) *d++ = *s++;
-  return dest;
-}
-int32_t atoi(const char *s) {
-  bool neg = false;
-  if (*s == '-') {
-    neg = true;
-    s++;
-  }
-  int32_t v = 0;
-  while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
-  return neg ? -v : v;
-}
-void itoa(int32_t n, char *buf) {
-  bool neg = n < 0;
-  if (neg) n = -n;
-  char t[12];
-  int i = 0;
-  do {
-    t[i++] = '0' + (n % 10);
-    n /= 10;
-  } while (n > 0);
-  if (i == 0) t[i++] = '0';
-  if (neg) t[i++] = '-';
-  int j = 0;
-  while (i > 0) buf[j++] = t[--i];
-  buf[j] = 0;
-}
-
-#define MAX_FILE_SIZE 512
-typedef struct {
-  char name[MAX_FILENAME_LEN];
-  char data[MAX_FILE_SIZE];
-  size_t size;
-  bool in_use;
-} file_t;
-static file_t fs_files[MAX_FILES];
-
-void fs_init(void) {
-  for (int i = 0; i < MAX_FILES; i++) {
-    fs_files[i].in_use = false;
-    fs_files[i].name[0] = '\0';
-    fs_files[i].size = 0;
-    memset(fs_files[i].data, 0, MAX_FILE_SIZE);
-  }
-}
-static int fs_find_file(const char *fn) {
-  for (int i = 0; i < MAX_FILES; i++)
-    if (fs_files[i].in_use && !strcmp(fs_files[i].name, fn)) return i;
-  return -1;
-}
-static int fs_find_empty_slot(void) {
-  for (int i = 0; i < MAX_FILES; i++)
-    if (!fs_files[i].in_use) return i;
-  return -1;
-}
-
-#define MAX_TASKS 6
-typedef struct {
-  uint32_t *sp;
-  void (*entry)(void);
-} task_t;
+  putc('\n');
+}
+
 static task_t tasks[MAX_TASKS];
-static int cur = -1;
-extern void ctx_switch(uint32_t **old_sp_ptr_location, uint32_t *new_sp);
+static task_t *free_tasks = NULL;
+static task_t *reap_list = NULL;  // exited detached tasks
+spinlock_t sched_lock;
+// new_pd is NULL when CR3 stays as it is.
+extern void ctx_switch(uint32_t **old_sp_ptr_location, uint32_t *new_sp,
+                       uint32_t *new_pd);
+extern void task_start(void);
+extern void user_start(void);
 
-static void yield(void) {
-  if (cur == -1) return;
-  int p = cur;
-  int n = (cur + 1) % MAX_TASKS;
-  while (tasks[n].sp == NULL && n != p) n = (n + 1) % MAX_TASKS;
-  if (tasks[n].sp == NULL || n == p) return;
-  uint32_t **o;
-  uint32_t *d;
-  if (tasks[p].sp == NULL)
-    o = &d;
+static const char *const state_names[] = {"unused", "ready", "run",
+                                          "block",  "sleep", "zombie"};
+
+// Completed-task latency, same metrics as the cpu/ simulator reports.
+static struct {
+  uint32_t done;
+  uint32_t sum_turn;  // exit - created
+  uint32_t sum_wait;  // first_run - created
+  uint32_t max_turn;
+} sched_stats;
+
+// ---- lazy FPU switching: CR0.TS is set while any task but the FPU's
+// owner runs, so its first x87 instruction traps (#NM). Only then is the
+// owner's state saved and the new task's loaded; tasks that never touch
+// the FPU (all but the apelang VM) never pay for it. Each CPU has its own
+// FPU and owner; a task whose state is still in one stays on that CPU. ----
+#define CR0_TS 0x8
+#define VEC_NM 7
+
+static void fpu_set_ts(bool on) {
+  cpu_t *c = this_cpu();
+  if (on == c->fpu_ts) return;
+  uint32_t cr0;
+  __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+  __asm__ volatile("mov %0, %%cr0" : : "r"(on ? cr0 | CR0_TS : cr0 & ~CR0_TS));
+  c->fpu_ts = on;
+}
+
+// #NM means TS is set whatever fpu_ts says, so clear it outright rather
+// than through the cache.
+static void fpu_trap(void) {
+  cpu_t *c = this_cpu();
+  task_t *o = c->fpu_owner, *self = c->running;  // IRQs are off
+  __asm__ volatile("clts");
+  c->fpu_ts = false;
+  if (o == self) return;
+  // Saved before the owner changes: from then on another CPU may take
+  // the old owner and load this state.
+  if (o) __asm__ volatile("fnsave %0" : "=m"(o->fpu) : : "memory");
+  if (self->fpu_used)
+    __asm__ volatile("frstor %0" : : "m"(self->fpu));
   else
-    o = &tasks[p].sp;
-  cur = n;
-  ctx_switch(o, tasks[cur].sp);
-}
-static void task_create(void (*fn)(void), uint8_t *s_bot,
-                        size_t s_sz) { 
-  int si = -1;
-  for (int i = 0; i < MAX_TASKS; i++)
-    if (tasks[i].sp == NULL &&
-        (tasks[i].entry == NULL || tasks[i].entry == fn)) {
-      si = i;
-      break;
-    }
-  if (si == -1)
-    for (int i = 0; i < MAX_TASKS; i++)
-      if (tasks[i].sp == NULL) {
-        si = i;
+    __asm__ volatile("fninit");
+  self->fpu_used = true;
+  c->fpu_owner = self;
+}
+
+// A queued task may run on another CPU unless it is pinned or its x87
+// state is still live in its CPU's FPU.
+bool task_movable(const task_t *t) {
+  return !t->pinned && cpus[t->cpu].fpu_owner != t;
+}
+
+static void task_free(task_t *t) {
+  // A compare-and-swap, as fpu_trap() on t's CPU may be replacing it.
+  task_t *o = t;
+  __atomic_compare_exchange_n(&cpus[t->cpu].fpu_owner, &o, NULL, false,
+                              __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+  if (t->pd && t->pd != kernel_pd)
+    vm_destroy(t->pd);
+  else if (t->stack_lo)
+    pmm_free_pages_at(t->stack_lo, (t->stack_hi - t->stack_lo) / PAGE_SIZE);
+  if (t->kstack) pmm_free_pages_at(t->kstack, KSTACK_PAGES);
+  t->kstack = NULL;
+  t->pd = NULL;
+  t->stack_lo = t->stack_hi = NULL;
+  t->state = TASK_UNUSED;
+  t->next = free_tasks;
+  free_tasks = t;
+}
+
+static void make_runnable(task_t *t) {
+  t->state = TASK_RUNNABLE;
+  sched->enqueue(t);
+  cpus[t->cpu].nr_ready++;
+}
+
+// Gets CPU c to reschedule if t, just queued there, should run now. Other
+// CPUs hear about it by IPI.
+static void kick(cpu_t *c, task_t *t) {
+  task_t *r = c->running;
+  if (!r || (r != &c->idle && !sched->preempt(t, r))) return;
+  c->need_resched = true;
+  if (c != this_cpu()) lapic_ipi(c->apic_id, VEC_RESCHED);
+}
+
+// Queues a task that can run again on its last CPU, whose cache it may
+// still have warm, unless that one is busy and another sits idle.
+static void place(task_t *t) {
+  cpu_t *c = &cpus[t->cpu];
+  if (c->running != &c->idle && task_movable(t))
+    for (int i = 0; i < ncpus; i++)
+      if (cpus[i].online && cpus[i].running == &cpus[i].idle &&
+          !cpus[i].nr_ready) {
+        c = &cpus[i];
+        t->cpu = i;
         break;
       }
-  if (si != -1) {
-    uint32_t *sp = (uint32_t *)(s_bot + s_sz);
+  make_runnable(t);
+  kick(c, t);
+}
+
+// Work stealing: takes a task off the queue of the CPU with the most ready
+// tasks, if that is at least `margin` more than c has.
+static task_t *steal(cpu_t *c, uint32_t margin) {
+  cpu_t *v = NULL;
+  for (int i = 0; i < ncpus; i++) {
+    cpu_t *o = &cpus[i];
+    if (o != c && o->online && o->nr_ready >= c->nr_ready + margin &&
+        (!v || o->nr_ready > v->nr_ready))
+      v = o;
+  }
+  task_t *t = v ? sched->steal(v->id) : NULL;
+  if (!t) return NULL;
+  v->nr_ready--;
+  t->cpu = c->id;
+  c->steals++;
+  return t;
+}
+
+// Core of every context switch; sched_lock must be held. The caller has
+// already set its state if it is giving up the CPU for a reason other than
+// yield. With nothing runnable here or on a busier CPU, the CPU's
+// idle task runs. Returns, holding the lock again, once something switches
+// back to the caller, which may be on another CPU by then.
+static void schedule(void) {
+  cpu_t *c = this_cpu();
+  task_t *prev = c->running;
+  while (reap_list && reap_list != prev) {
+    task_t *z = reap_list;
+    reap_list = z->next;
+    task_free(z);
+  }
+  if (prev->state == TASK_RUNNING && prev != &c->idle) make_runnable(prev);
+  task_t *next = sched->pick_next(c->id);
+  if (next)
+    c->nr_ready--;
+  else if ((next = steal(c, 1)) == NULL)
+    next = &c->idle;
+  next->state = TASK_RUNNING;
+  c->slice_left = sched->slice(next);
+  c->need_resched = false;
+  if (next == prev) return;
+  trace(TR_SWITCH, next->tid);
+  c->running = next;
+  if (next->switches++ == 0) next->first_run = ticks;
+  c->switches++;
+  if (next->kstack)
+    c->tss.esp0 = (uint32_t)(next->kstack + KSTACK_PAGES * PAGE_SIZE);
+  fpu_set_ts(next != c->fpu_owner);
+  uint32_t *pd = next->pd != c->active_pd ? next->pd : NULL;
+  c->active_pd = next->pd;
+  ctx_switch(&prev->sp, next->sp, pd);
+}
+
+// A new task's first call (task_start/user_start in ctx_switch.asm): the
+// schedule() that switched to it still holds the lock.
+void schedule_tail(void) { spin_unlock(&sched_lock); }
+
+static void yield(void) {
+  if (current() == NULL) return;
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  schedule();
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// What a CPU runs when it has nothing else: schedule() looks for work,
+// stealing from busier CPUs, and if there is none the CPU halts until the
+// next interrupt. sti holds off interrupts for one more instruction, so a
+// wakeup IPI sent after the check still ends the hlt.
+static void idle_loop(void) {
+  for (;;) {
+    spin_lock_irqsave(&sched_lock);
+    schedule();
+    spin_unlock(&sched_lock);
+    __asm__ volatile("sti; hlt" : : : "memory");
+  }
+}
+
+// Takes the current task off the CPU until task_wake(); sched_lock held.
+void task_block(void) {
+  current()->state = TASK_BLOCKED;
+  schedule();
+}
+
+void task_wake(task_t *t) {
+  if (!t || (t->state != TASK_BLOCKED && t->state != TASK_SLEEPING)) return;
+  place(t);
+}
+
+// Sleep queue, sorted by wake_tick so the timer only ever looks at the head.
+static task_t *sleepers = NULL;
+volatile uint32_t ticks = 0;
+
+static void task_sleep(uint32_t nticks) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *self = current();
+  self->wake_tick = ticks + nticks;
+  task_t **pp = &sleepers;
+  while (*pp && (int32_t)((*pp)->wake_tick - self->wake_tick) <= 0)
+    pp = &(*pp)->next;
+  self->next = *pp;
+  *pp = self;
+  self->state = TASK_SLEEPING;
+  schedule();
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// Blocks the caller until t has exited, then releases its slot.
+static void task_join(task_t *t) {
+  task_t *self = current();
+  if (!t || t == self || t->detached) return;
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  while (t->state != TASK_ZOMBIE) {
+    t->waiter = self;
+    task_block();
+  }
+  task_free(t);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+static void task_exit(void) {
+  spin_lock_irqsave(&sched_lock);
+  task_t *self = current();
+  uint32_t turn = ticks - self->created;
+  sched_stats.done++;
+  sched_stats.sum_turn += turn;
+  sched_stats.sum_wait += self->first_run - self->created;
+  if (turn > sched_stats.max_turn) sched_stats.max_turn = turn;
+  self->state = TASK_ZOMBIE;
+  if (self->detached) {
+    self->next = reap_list;
+    reap_list = self;
+  }
+  task_wake(self->waiter);
+  schedule();
+}
+
+static void task_set_prio(task_t *t, uint8_t prio) {
+  if (prio >= NPRIO) prio = NPRIO - 1;
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  if (t->state == TASK_RUNNABLE) {
+    sched->dequeue(t);
+    t->prio = prio;
+    sched->enqueue(t);
+    kick(&cpus[t->cpu], t);
+  } else
+    t->prio = prio;
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// Moves every runnable task over to another scheduling class, each on the
+// CPU it was queued on.
+static void sched_set_class(const sched_class_t *c) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *list = NULL, *t;
+  for (int i = 0; i < ncpus; i++)
+    while ((t = sched->pick_next(i)) != NULL) {
+      t->next = list;
+      list = t;
+    }
+  sched = c;
+  while (list) {
+    t = list;
+    list = t->next;
+    sched->enqueue(t);
+  }
+  for (int i = 0; i < ncpus; i++) cpus[i].need_resched = true;
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+static task_t *kbd_waiter[NVT];
+
+// Called by get_ch() on an empty buffer; the emptiness check is repeated
+// under sched_lock so a key arriving in between can't be missed.
+static void kbd_wait(int vt) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  while (kbd_tail[vt] == kbd_head[vt]) {
+    kbd_waiter[vt] = current();
+    task_block();
+  }
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+#define SC_LSHIFT 0x2A
+#define SC_RSHIFT 0x36
+#define SC_ALT 0x38  // right Alt is the same after an 0xE0 prefix
+#define SC_F1 0x3B
+#define SC_PGUP 0x49
+#define SC_PGDN 0x51
+
+// Alt+F1..F4 and Shift+PgUp/PgDn are handled here and never queued.
+static void kbd_irq(void) {
+  static bool alt, shift;
+  uint8_t sc = inb(0x60);
+  if ((sc & 0x7F) == SC_ALT) alt = !(sc & 0x80);
+  if ((sc & 0x7F) == SC_LSHIFT || (sc & 0x7F) == SC_RSHIFT)
+    shift = !(sc & 0x80);
+  if (alt && sc >= SC_F1 && sc < SC_F1 + NVT) {
+    con_switch(sc - SC_F1);
+    return;
+  }
+  if (shift && (sc == SC_PGUP || sc == SC_PGDN)) {
+    con_scrollback(sc == SC_PGUP ? 12 : -12);
+    return;
+  }
+  int vt = con_fg;
+  uint32_t next = (kbd_head[vt] + 1) & (KBD_BUF_SIZE - 1);
+  if (next != kbd_tail[vt]) {
+    kbd_buf[vt][kbd_head[vt]] = sc;
+    kbd_head[vt] = next;
+  } else
+    kbd_dropped++;
+  spin_lock(&sched_lock);
+  task_wake(kbd_waiter[vt]);
+  kbd_waiter[vt] = NULL;
+  spin_unlock(&sched_lock);
+}
+
+static void tasks_init(void) {
+  spin_init(&sched_lock, "sched");
+  for (int i = MAX_TASKS - 1; i >= 0; i--) {
+    tasks[i].tid = i;
+    task_free(&tasks[i]);
+  }
+  for (int i = 0; i < MAX_CPUS; i++) {
+    task_t *idle = &cpus[i].idle;
+    idle->tid = -1;
+    strcpy(idle->name, "idle");
+    idle->state = TASK_RUNNING;
+    idle->pd = kernel_pd;
+    idle->prio = NPRIO - 1;
+    idle->cpu = i;
+    idle->pinned = true;
+  }
+}
+
+#define TASK_DETACHED 1  // reaped by the scheduler rather than task_join()
+#define TASK_KTHREAD 2   // runs in kernel_pd on an identity-mapped stack
+#define TASK_USER 4      // the program `name`, run in ring 3 (fn unused)
+#define TASK_PINNED 8    // stays on the creator's CPU
+#define TASK_PAUSED 16   // not queued until task_resume(), so the creator
+                         // can hand it data before another CPU runs it
+
+// Lets a task created with TASK_PAUSED run.
+static void task_resume(task_t *t) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_wake(t);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// A task normally gets its own address space whose stack reserves
+// `stack_pages` pages, committed on demand. Kernel threads get all of them
+// up front from the page allocator and skip the CR3 reload on switches.
+// Ring-3 tasks have their program loaded from the file system by
+// elf_load(), and also get a small kernel stack, which holds their saved
+// context while they are switched out. The slot comes off the free list
+// first: elf_load() may sleep on the file system lock.
+static task_t *task_create(const char *name, void (*fn)(void),
+                           uint32_t stack_pages, uint8_t prio, int flags) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *t = free_tasks;
+  if (t) free_tasks = t->next;
+  spin_unlock_irqrestore(&sched_lock, f);
+  size_t s_sz = stack_pages * PAGE_SIZE;
+  uint32_t *pd = NULL;
+  uint8_t *s_bot = NULL, *s_top = NULL;  // s_top: kernel view of the top
+  uint8_t *kstack = NULL;
+  uint32_t entry = 0;
+  int err = 0;
+  if (t && (flags & TASK_KTHREAD)) {
+    pd = kernel_pd;
+    s_bot = pmm_alloc_pages(stack_pages);
+    s_top = s_bot + s_sz;
+  } else if (t && (pd = vm_create(stack_pages, flags & TASK_USER)) != NULL) {
+    if (stack_pages > STACK_MAX_PAGES) s_sz = STACK_MAX_PAGES * PAGE_SIZE;
+    s_bot = (uint8_t *)(STACK_TOP - s_sz);
+    s_top = (uint8_t *)vm_phys(pd, STACK_TOP - PAGE_SIZE) + PAGE_SIZE;
+    if ((flags & TASK_USER) &&
+        (!(kstack = pmm_alloc_pages(KSTACK_PAGES)) ||
+         (err = elf_load(pd, name, &entry)) < 0)) {
+      if (kstack) pmm_free_pages_at(kstack, KSTACK_PAGES);
+      vm_destroy(pd);
+      s_bot = NULL;
+    }
+  }
+  if (!s_bot) {
+    if (t) {
+      f = spin_lock_irqsave(&sched_lock);
+      t->next = free_tasks;
+      free_tasks = t;
+      spin_unlock_irqrestore(&sched_lock, f);
+    }
+    if (err) {
+      puts(name);
+      puts(": ");
+      puts(elf_strerror(err));
+      puts("\n");
+    } else
+      puts(t ? "E:NOMEM\n" : "E:MAX_TASKS\n");
+    return NULL;
+  }
+  // Frame popped by ctx_switch: edi, esi, ebx (= entry), ebp, ret.
+  if (kstack) {
+    // user_start irets to the program's entry on the user stack (esi).
+    // _start (usys.c) exits rather than returning to the 0 above it.
+    fn = (void (*)(void))entry;
+    ((uint32_t *)s_top)[-1] = 0;
+    uint32_t *sp = (uint32_t *)(kstack + KSTACK_PAGES * PAGE_SIZE);
+    *(--sp) = (uint32_t)user_start;
+    *(--sp) = 0;
     *(--sp) = (uint32_t)fn;
+    *(--sp) = STACK_TOP - 4;
     *(--sp) = 0;
+    t->sp = sp;
+  } else {
+    uint32_t *sp = (uint32_t *)s_top;
+    *(--sp) = (uint32_t)task_start;
     *(--sp) = 0;
+    *(--sp) = (uint32_t)fn;
     *(--sp) = 0;
     *(--sp) = 0;
-    tasks[si].sp = sp;
-    tasks[si].entry = fn;
-  } else
-    puts("E:MAX_TASKS\n");
+    // Written through the kernel's view of the top page; the task finds
+    // the frame at the top of its own stack.
+    t->sp = (uint32_t *)(s_bot + s_sz) - ((uint32_t *)s_top - sp);
+  }
+  t->kstack = kstack;
+  t->brk = USER_HEAP;
+  t->fpu_used = false;
+  t->pd = pd;
+  t->vt = cur_vt();
+  t->entry = fn;
+  strncpy(t->name, name, TASK_NAME_LEN - 1);
+  t->name[TASK_NAME_LEN - 1] = '\0';
+  t->prio = prio < NPRIO ? prio : NPRIO - 1;
+  t->detached = flags & TASK_DETACHED;
+  t->stack_lo = s_bot;
+  t->stack_hi = s_bot + s_sz;
+  t->vruntime = 0;
+  t->ticks = 0;
+  t->switches = 0;
+  t->created = ticks;
+  t->first_run = ticks;
+  t->waiter = NULL;
+  t->cpu = this_cpu()->id;
+  t->pinned = flags & TASK_PINNED;
+  t->state = TASK_BLOCKED;
+  if (!(flags & TASK_PAUSED)) task_resume(t);
+  return t;
+}
+
+// ---- interrupts: IDT, 8259 PIC, 8253 PIT; the APICs are in smp.c ----
+typedef struct __attribute__((packed)) {
+  uint16_t off_lo;
+  uint16_t sel;
+  uint8_t zero;
+  uint8_t type;
+  uint16_t off_hi;
+} idt_entry_t;
+
+// One per CPU: they differ only in the #PF task gate.
+static idt_entry_t idts[MAX_CPUS][SYSCALL_VECTOR + 1];
+extern uint32_t isr_table[NVECTORS];
+extern void syscall_entry(void);
+
+#define PIC1 0x20
+#define PIC2 0xA0
+
+static void idt_init(int cpu) {
+  idt_entry_t *idt = idts[cpu];
+  for (int i = 0; i < NVECTORS; i++) {
+    idt[i].off_lo = isr_table[i] & 0xFFFF;
+    idt[i].sel = 0x08;
+    idt[i].zero = 0;
+    idt[i].type = 0x8E;  // present, ring 0, 32-bit interrupt gate
+    idt[i].off_hi = isr_table[i] >> 16;
+  }
+  // #PF switches to the CPU's own #PF task; see pf_task in isr.asm.
+  idt[14].off_lo = idt[14].off_hi = 0;
+  idt[14].sel = GDT_PF_TSS + 16 * cpu;
+  idt[14].type = 0x85;  // present, task gate
+  idt[SYSCALL_VECTOR].off_lo = (uint32_t)syscall_entry & 0xFFFF;
+  idt[SYSCALL_VECTOR].sel = GDT_KCODE;
+  idt[SYSCALL_VECTOR].type = 0xEF;  // present, ring 3 may call, trap gate
+  idt[SYSCALL_VECTOR].off_hi = (uint32_t)syscall_entry >> 16;
+  struct __attribute__((packed)) {
+    uint16_t limit;
+    uint32_t base;
+  } idtr = {sizeof idts[0] - 1, (uint32_t)idt};
+  __asm__ volatile("lidt %0" : : "m"(idtr));
+}
+
+static void pic_remap(void) {
+  outb(PIC1, 0x11);  // ICW1: init, expect ICW4
+  outb(PIC2, 0x11);
+  outb(PIC1 + 1, IRQ_BASE);      // ICW2: vector offsets
+  outb(PIC2 + 1, IRQ_BASE + 8);
+  outb(PIC1 + 1, 0x04);  // ICW3: slave on IRQ2
+  outb(PIC2 + 1, 0x02);
+  outb(PIC1 + 1, 0x01);  // ICW4: 8086 mode
+  outb(PIC2 + 1, 0x01);
+  outb(PIC1 + 1, 0xFC);  // unmask IRQ0 (PIT) and IRQ1 (keyboard)
+  outb(PIC2 + 1, 0xFF);
+}
+
+static void pit_init(uint32_t hz) {
+  uint32_t div = PIT_BASE_HZ / hz;
+  outb(0x43, 0x34);  // channel 0, lo/hi, rate generator
+  outb(0x40, div & 0xFF);
+  outb(0x40, div >> 8);
+}
+
+// A CPU's own tick, from the PIT on the BSP and the LAPIC timer on the
+// APs; sched_lock held. Every BALANCE_TICKS a busy CPU also looks for
+// one with at least two more tasks waiting than it has (idle ones steal
+// whatever there is, in schedule()).
+#define BALANCE_TICKS 50
+
+static void cpu_tick(cpu_t *c) {
+  c->ticks++;
+  task_t *t = c->running;
+  if (t == NULL) return;
+  if (t == &c->idle) {
+    c->idle_ticks++;
+    return;
+  }
+  t->ticks++;
+  sched->tick(t);
+  if (c->slice_left > 0) c->slice_left--;
+  if (c->slice_left == 0) c->need_resched = true;
+  if (c->ticks % BALANCE_TICKS == 0 && (t = steal(c, 2)) != NULL) {
+    make_runnable(t);
+    kick(c, t);
+  }
+}
+
+// IRQ0 goes to the BSP only; it keeps the global clock and the sleepers.
+static void timer_irq(void) {
+  spin_lock(&sched_lock);
+  ticks++;
+  while (sleepers && (int32_t)(ticks - sleepers->wake_tick) >= 0) {
+    task_t *t = sleepers;
+    sleepers = t->next;
+    task_wake(t);
+  }
+  cpu_tick(this_cpu());
+  spin_unlock(&sched_lock);
+}
+
+static const char *const exc_names[] = {
+    "#DE", "#DB", "NMI", "#BP", "#OF", "#BR", "#UD", "#NM",
+    "#DF", "CSO", "#TS", "#NP", "#SS", "#GP", "#PF", "?",
+    "#MF", "#AC", "#MC", "#XM"};
+
+void isr_dispatch(regs_t *r) {
+  if (r->vector == SYSCALL_VECTOR) {
+    syscall_dispatch(r);
+    if (this_cpu()->need_resched) yield();
+    return;
+  }
+  if (r->vector == VEC_NM && current()) {
+    fpu_trap();
+    return;
+  }
+  if (r->vector < 32) {
+    char nb[12];
+    puts("\nException ");
+    puts(r->vector < 20 ? exc_names[r->vector] : "?");
+    puts(" err=");
+    itoa((int32_t)r->err, nb);
+    puts(nb);
+    puts(" eip=");
+    itoa((int32_t)r->eip, nb);
+    puts(nb);
+    puts(" - killing task\n");
+    if (current() == NULL)
+      for (;;) __asm__("hlt");
+    task_exit();
+    for (;;) __asm__("hlt");
+  }
+  if (r->vector == VEC_SPURIOUS) return;  // no EOI for these
+  trace(TR_IRQ, r->vector);
+  uint32_t irq = r->vector - IRQ_BASE;
+  if (irq == 0 || r->vector == VEC_LAPIC_TIMER) trace_sample(r);
+  if (r->vector == VEC_LAPIC_TIMER) {
+    spin_lock(&sched_lock);
+    cpu_tick(this_cpu());
+    spin_unlock(&sched_lock);
+  }
+  // VEC_RESCHED needs nothing more: the sender set need_resched.
+  if (irq == 0) timer_irq();
+  if (irq == 1) kbd_irq();
+  if (ioapic_ok || r->vector >= VEC_LAPIC_TIMER) {
+    lapic_eoi();
+  } else {
+    if (irq >= 8) outb(PIC2, 0x20);
+    outb(PIC1, 0x20);
+  }
+  trace(TR_IRQ | TR_END, r->vector);
+  // EOI is already sent, so the next tick can arrive in the task we pick.
+  if (this_cpu()->need_resched && current() != NULL) yield();
+}
+
+static void pf_kill(void) { task_exit(); }
+
+// Runs as the CPU's #PF task with IRQs off. The faulting context is in
+// the CPU's main TSS.
+void pf_dispatch(uint32_t err) {
+  cpu_t *c = this_cpu();
+  task_t *t = c->running;
+  tss_t *tss = &c->tss;
+  uint32_t addr;
+  __asm__ volatile("mov %%cr2, %0" : "=r"(addr));
+  tss->cr3 = (uint32_t)c->active_pd;  // the switch doesn't save it
+  // Both task switches, here and back, set CR0.TS behind fpu_set_ts().
+  c->fpu_ts = true;
+  if (vm_fault(addr)) return;
+
+  // The fault may have hit with con_lock held on this CPU (sys_write
+  // touching a user page it can't commit), so waiting for it would hang.
+  // The report is built first and goes to a serial port if it can't have
+  // the console at once.
+  char msg[96], b[12], *p = msg;
+  p = append(p, "\nPage fault at 0x");
+  p = append(p, hex(addr, b));
+  if (t && addr < (uint32_t)t->stack_lo &&
+      addr >= (uint32_t)t->stack_lo - PAGE_SIZE)
+    p = append(p, " (stack overflow)");
+  p = append(p, " err=");
+  itoa((int32_t)err, b);
+  p = append(p, b);
+  p = append(p, " eip=0x");
+  p = append(p, hex(tss->eip, b));
+  append(p, " - killing task\n");
+  if (!con_try_write(t ? t->vt : 0, msg)) serial_write_polled(msg);
+  if (t == NULL)
+    for (;;) __asm__("hlt");
+  // Resume it in task_exit() on the top of its (kernel) stack, which is
+  // always mapped, instead of at the faulting instruction. The task switch
+  // back takes the privilege level from cs, so ring 3 comes back in ring 0.
+  tss->eip = (uint32_t)pf_kill;
+  tss->esp = t->kstack ? (uint32_t)(t->kstack + KSTACK_PAGES * PAGE_SIZE)
+                       : (uint32_t)t->stack_hi;
+  tss->cs = GDT_KCODE;
+  tss->ss = tss->ds = tss->es = tss->fs = tss->gs = GDT_KDATA;
 }
 
-void sys_write(const char *s) { puts(s); }
+void sys_write(const char *s) {
+  uint32_t f = irq_save();
+  puts(s);
+  irq_restore(f);
+}
 char sys_getc(void) { return get_ch(); }
 void sys_yield(void) { yield(); }
 void sys_exit_task(void) {
-  if (cur != -1) tasks[cur].sp = NULL;
-  yield();
+  if (current() != NULL) task_exit();
   puts("\nExited task resumed. Halting.\n");
   for (;;) __asm__("hlt");
 }
-void sys_clear_screen(void) { clear_screen_internal(); }
-
-int sys_list_files(char *ob, int bl) {
-  if (!ob || bl <= 0) return -1;
-  memset(ob, 0, bl);
-  int cp = 0;
-  bool ff = true;
-  for (int i = 0; i < MAX_FILES; i++) {
-    if (fs_files[i].in_use) {
-      if (!ff) {
-        if (cp < bl - 1)
-          ob[cp++] = '\n';
-        else
-          return cp;
+void sys_sleep(uint32_t ms) {
+  uint32_t n = ms * PIT_HZ / 1000;
+  task_sleep(n ? n : 1);
+}
+void sys_clear_screen(void) { con_clear(cur_vt()); }
+void *sys_malloc(size_t n) { return kmalloc(n); }
+void sys_free(void *p) { kfree(p); }
+
+static void put_col(const char *s, int w) {
+  sys_write(s);
+  for (int n = (int)strlen(s); n < w; n++) sys_write(" ");
+}
+static void put_num_col(uint32_t v, int w) {
+  char nb[12];
+  itoa((int32_t)v, nb);
+  put_col(nb, w);
+}
+
+const char *task_name(int tid) {
+  return tid >= 0 && tid < MAX_TASKS ? tasks[tid].name : "";
+}
+
+static uint32_t nr_switches(void) {
+  uint32_t n = 0;
+  for (int i = 0; i < ncpus; i++) n += cpus[i].switches;
+  return n;
+}
+
+static void shell_ps(void) {
+  put_col("TID", 5);
+  put_col("NAME", TASK_NAME_LEN);
+  put_col("STATE", 8);
+  put_col("PRI", 5);
+  put_col("VT", 4);
+  put_col("CPU", 5);
+  put_col("TICKS", 10);
+  sys_write("SWITCHES\n");
+  for (int i = 0; i < MAX_TASKS; i++) {
+    task_t *t = &tasks[i];
+    if (t->state == TASK_UNUSED) continue;
+    put_num_col(t->tid, 5);
+    put_col(t->name, TASK_NAME_LEN);
+    put_col(state_names[t->state], 8);
+    put_num_col(t->prio, 5);
+    put_num_col(t->vt + 1, 4);
+    put_num_col(t->cpu, 5);
+    put_num_col(t->ticks, 10);
+    put_num_col(t->switches, 0);
+    sys_write("\n");
+  }
+  uint32_t idle = 0;
+  for (int i = 0; i < ncpus; i++) idle += cpus[i].idle_ticks;
+  sys_write("uptime ");
+  put_num_col(ticks, 0);
+  sys_write(" ticks, idle ");
+  put_num_col(idle, 0);
+  sys_write(" CPU ticks, context switches ");
+  put_num_col(nr_switches(), 0);
+  sys_write("\n");
+}
+
+// ---- cpus: per-CPU run queues and where their ticks went ----
+static void shell_cpus(void) {
+  sys_write(ioapic_ok ? "IRQs through the IOAPIC" : "IRQs through the 8259");
+  if (lapic_base) {
+    sys_write(", LAPIC timer ");
+    put_num_col(lapic_timer_count, 0);
+    sys_write(" counts/tick");
+  }
+  sys_write("\n");
+  put_col("CPU", 5);
+  put_col("APIC", 6);
+  put_col("RUNNING", TASK_NAME_LEN);
+  put_col("READY", 7);
+  put_col("TICKS", 10);
+  put_col("IDLE", 10);
+  put_col("SWITCHES", 10);
+  sys_write("STEALS\n");
+  for (int i = 0; i < ncpus; i++) {
+    const cpu_t *c = &cpus[i];
+    put_num_col(i, 5);
+    put_num_col(c->apic_id, 6);
+    put_col(c->online ? c->running->name : "(offline)", TASK_NAME_LEN);
+    put_num_col(c->nr_ready, 7);
+    put_num_col(c->ticks, 10);
+    put_num_col(c->idle_ticks, 10);
+    put_num_col(c->switches, 10);
+    put_num_col(c->steals, 0);
+    sys_write("\n");
+  }
+}
+
+static void shell_meminfo(void) {
+  sys_write("pages: ");
+  put_num_col(pmm_free_pages, 0);
+  sys_write(" free of ");
+  put_num_col(pmm_total_pages, 0);
+  sys_write(" (");
+  put_num_col(pmm_free_pages * (PAGE_SIZE / 1024), 0);
+  sys_write(" KB free), kmalloc big ");
+  put_num_col(kmalloc_big_pages, 0);
+  sys_write(" pages\n");
+  put_col("CLASS", 8);
+  put_col("SLABS", 8);
+  sys_write("OBJECTS\n");
+  for (int c = 0; c < NSLAB_CLASSES; c++) {
+    put_num_col(slab_class_size(c), 8);
+    put_num_col(slab_stats[c].slabs, 8);
+    put_num_col(slab_stats[c].inuse, 0);
+    sys_write("\n");
+  }
+}
+
+static void shell_iostat(void) {
+  bcache_stats_t *s = &bcache_stats;
+  uint32_t lookups = s->hits + s->misses;
+  sys_write("device ");
+  sys_write(bcache_dev);
+  sys_write(", ");
+  put_num_col(fs_free_blocks, 0);
+  sys_write(" blocks free\ncache: hits ");
+  put_num_col(s->hits, 0);
+  sys_write(", misses ");
+  put_num_col(s->misses, 0);
+  if (lookups) {
+    sys_write(" (");
+    put_num_col(s->hits * 100 / lookups, 0);
+    sys_write("% hit)");
+  }
+  sys_write(", dirty ");
+  put_num_col(bcache_ndirty(), 0);
+  sys_write("\nwritebacks ");
+  put_num_col(s->writebacks, 0);
+  sys_write(" blocks in ");
+  put_num_col(s->writes, 0);
+  sys_write(" writes, ");
+  put_num_col(s->syncs, 0);
+  sys_write(" syncs, ");
+  put_num_col(s->errors, 0);
+  sys_write(" errors\n");
+}
+
+// Writes dirty cache blocks back every few seconds, so an unclean
+// shutdown loses at most that much.
+#define BFLUSH_MS 5000
+static void bflush(void) {
+  for (;;) {
+    sys_sleep(BFLUSH_MS);
+    bsync();
+  }
+}
+
+static void shell_sched(const char *arg) {
+  if (*arg) {
+    const sched_class_t *c = sched_find(arg);
+    if (!c) {
+      sys_write("Usage: sched [");
+      sys_write(sched_names());
+      sys_write("]\n");
+      return;
+    }
+    sched_set_class(c);
+  }
+  sys_write("class ");
+  sys_write(sched->name);
+  sys_write(", completed ");
+  put_num_col(sched_stats.done, 0);
+  if (sched_stats.done) {
+    sys_write(", avg turnaround ");
+    put_num_col(sched_stats.sum_turn / sched_stats.done, 0);
+    sys_write(", max ");
+    put_num_col(sched_stats.max_turn, 0);
+    sys_write(", avg wait ");
+    put_num_col(sched_stats.sum_wait / sched_stats.done, 0);
+  }
+  sys_write(" (ticks)\n");
+}
+
+// ---- schedbench: replays the "bursty" workload of cpu/CFS-vs-RRML1-sim.py
+// on real tasks so kernel numbers can be held against the model's ----
+#define BENCH_MAX 24
+static uint32_t bench_burst[MAX_TASKS];  // by tid
+static uint32_t bench_turn[MAX_TASKS], bench_wait[MAX_TASKS];
+
+static uint32_t xorshift32(uint32_t *s) {
+  uint32_t x = *s;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *s = x;
+}
+// Exponential variate with the given mean: mean * -ln(u), with log2 taken
+// from the bit position plus a quadratic fit of the mantissa.
+static uint32_t rand_exp(uint32_t *s, uint32_t mean) {
+  uint32_t x = xorshift32(s) | 1;
+  int msb = 31 - __builtin_clz(x);
+  uint32_t m = msb >= 16 ? (x >> (msb - 16)) & 0xFFFF : (x << (16 - msb)) & 0xFFFF;
+  uint32_t frac = m + (((m * (65536 - m)) >> 16) * 22 >> 6);  // log2(1+m)
+  uint32_t nlog2 = ((uint32_t)(32 - msb) << 16) - frac;      // 16.16
+  uint32_t nln = (uint32_t)(((uint64_t)nlog2 * 45426) >> 16);  // * ln 2
+  return (mean * nln) >> 16;
+}
+
+static void bench_worker(void) {
+  task_t *self = current();
+  uint32_t burst = bench_burst[self->tid];
+  while (*(volatile uint32_t *)&self->ticks < burst) __asm__ volatile("pause");
+  bench_turn[self->tid] = ticks - self->created;
+  bench_wait[self->tid] = self->first_run - self->created;
+}
+
+static void shell_schedbench(const char *arg) {
+  task_t *w[BENCH_MAX];
+  uint32_t turn[BENCH_MAX];
+  int n = *arg ? atoi(arg) : 16;
+  if (n < 1 || n > BENCH_MAX) n = BENCH_MAX;
+  while (*arg && *arg != ' ') arg++;
+  uint32_t seed = *arg ? (uint32_t)atoi(arg + 1) : 1;
+  if (!seed) seed = 1;
+
+  for (int i = 0; i < n; i++) {
+    task_sleep(rand_exp(&seed, 30));  // inter-arrival ~30
+    uint32_t burst = xorshift32(&seed) % 10 < 9 ? rand_exp(&seed, 30)
+                                                 : rand_exp(&seed, 300);
+    if (burst < 1) burst = 1;
+    w[i] = task_create("bench", bench_worker, 4, PRIO_DEFAULT, TASK_PAUSED);
+    if (!w[i]) {
+      n = i;
+      break;
+    }
+    bench_burst[w[i]->tid] = burst;
+    task_resume(w[i]);
+  }
+  uint32_t sum_turn = 0, sum_wait = 0;
+  for (int i = 0; i < n; i++) {
+    int tid = w[i]->tid;
+    task_join(w[i]);
+    turn[i] = bench_turn[tid];
+    sum_turn += turn[i];
+    sum_wait += bench_wait[tid];
+    for (int j = i; j > 0 && turn[j - 1] > turn[j]; j--) {
+      uint32_t t = turn[j];
+      turn[j] = turn[j - 1];
+      turn[j - 1] = t;
+    }
+  }
+  if (!n) return;
+  sys_write(sched->name);
+  sys_write(": avg_turn ");
+  put_num_col(sum_turn / n, 0);
+  sys_write("  p95_turn ");
+  put_num_col(turn[(n * 95 - 1) / 100], 0);
+  sys_write("  avg_wait ");
+  put_num_col(sum_wait / n, 0);
+  sys_write(" (ticks)\n");
+}
+
+// ---- switchbench: two tasks yielding to each other, first as kernel
+// threads sharing kernel_pd, then in their own address spaces. The
+// difference is what the CR3 reload and the TLB refill after it cost.
+// Both are pinned to this CPU, or each would just get a CPU to itself. ----
+static uint32_t sb_rounds;
+
+static void sb_worker(void) {
+  for (uint32_t i = 0; i < sb_rounds; i++) yield();
+}
+
+static uint32_t sb_run(int flags) {
+  uint32_t sw = nr_switches();
+  uint64_t t0 = rdtsc();
+  flags |= TASK_PINNED;
+  task_t *a = task_create("switch", sb_worker, 1, PRIO_DEFAULT, flags);
+  task_t *b = task_create("switch", sb_worker, 1, PRIO_DEFAULT, flags);
+  task_join(a);
+  task_join(b);
+  uint32_t cyc = (uint32_t)(rdtsc() - t0);
+  sw = nr_switches() - sw;
+  return sw ? cyc / sw : 0;
+}
+
+static void shell_switchbench(const char *arg) {
+  int32_t n = *arg ? atoi(arg) : 10000;
+  sb_rounds = n > 0 && n <= 100000 ? (uint32_t)n : 10000;
+  uint32_t shared = sb_run(TASK_KTHREAD), own = sb_run(0);
+  sys_write("cycles/switch: shared cr3 ");
+  put_num_col(shared, 0);
+  sys_write(", own address space ");
+  put_num_col(own, 0);
+  sys_write(vm_pge ? " (global kernel pages)\n" : " (no global pages)\n");
+}
+
+// ---- syscalls: per-call counts and rdtsc histograms from syscall.c ----
+static uint32_t avg_cycles(uint64_t c, uint32_t n) {
+  int sh = 0;
+  while (c >> 32) {  // no 64-bit division in a freestanding build
+    c >>= 1;
+    sh++;
+  }
+  return n ? ((uint32_t)c / n) << sh : 0;
+}
+
+static void shell_syscalls(const char *arg) {
+  if (!strcmp(arg, "reset")) {
+    memset(syscall_stats, 0, NSYSCALLS * sizeof(syscall_stats_t));
+    return;
+  }
+  put_col("SYSCALL", 12);
+  put_col("CALLS", 8);
+  put_col("AVG CYC", 10);
+  put_col("MAX CYC", 11);
+  sys_write("<2^k CYCLES:CALLS\n");
+  for (int n = 0; n < NSYSCALLS; n++) {
+    const syscall_stats_t *s = &syscall_stats[n];
+    if (!s->calls) continue;
+    put_col(syscall_name(n), 12);
+    put_num_col(s->calls, 8);
+    put_num_col(avg_cycles(s->cycles, s->calls), 10);
+    put_num_col(s->max, 11);
+    for (int b = 0; b < SYSCALL_HIST; b++)
+      if (s->hist[b]) {
+        put_num_col(b + SYSCALL_HIST_MIN + 1, 0);
+        sys_write(":");
+        put_num_col(s->hist[b], 0);
+        sys_write(" ");
       }
-      size_t nl = strlen(fs_files[i].name);
-      if (cp + nl < (size_t)bl) {
-        strcpy(ob + cp, fs_files[i].name);
-        cp += nl;
-        ff = false;
-      } else
-        return cp;
+    sys_write("\n");
+  }
+}
+
+// ---- locks: contention counters from sync.c ----
+static void shell_locks(const char *arg) {
+  if (!strcmp(arg, "reset")) {
+    lock_stats_reset();
+    return;
+  }
+  put_col("LOCK", 9);
+  put_col("KIND", 6);
+  put_col("ACQUIRES", 10);
+  put_col("WAITED", 8);
+  put_col("SPINS", 9);
+  put_col("SLEEPS", 8);
+  put_col("AVG HOLD", 10);
+  sys_write("MAX HOLD\n");
+  for (const lock_stats_t *s = lock_stats_list(); s; s = s->next) {
+    put_col(s->name, 9);
+    put_col(s->kind, 6);
+    put_num_col(s->acquires, 10);
+    put_num_col(s->contended, 8);
+    put_num_col(s->spins, 9);
+    put_num_col(s->sleeps, 8);
+    put_num_col(avg_cycles(s->hold_cycles, s->acquires), 10);
+    put_num_col(s->hold_max, 0);
+    sys_write("\n");
+    if (s->adapt) {
+      sys_write("  predicted wait ");
+      put_num_col(s->adapt->ewma, 0);
+      sys_write(", spin limit ");
+      put_num_col(s->adapt->threshold, 0);
+      sys_write(", park cost ");
+      put_num_col(s->adapt->park, 0);
+      sys_write(" cycles; spun ");
+      put_num_col(s->adapt->spun, 0);
+      sys_write(", parked ");
+      put_num_col(s->adapt->parked, 0);
+      sys_write("\n");
     }
   }
-  return cp;
-}
-int sys_read_file(const char *fn, char *ub, int us) { 
-  if (!fn || !ub || us <= 0) return -1;
-  int fi = fs_find_file(fn);
-  if (fi == -1) return -1;
-  if ((size_t)us < fs_files[fi].size) return -2;
-  memcpy(ub, fs_files[fi].data, fs_files[fi].size);
-  return (int)fs_files[fi].size;
-}
-int sys_write_file(const char *fn, const char *d, int dl) { 
-  if (!fn || !d || dl < 0) return -1;
-  if (strlen(fn) >= MAX_FILENAME_LEN) return -2;
-  if (dl > MAX_FILE_SIZE) return -3;
-  int fi = fs_find_file(fn);
-  if (fi == -1) {
-    fi = fs_find_empty_slot();
-    if (fi == -1) return -4;
-    fs_files[fi].in_use = true;
-    strncpy(fs_files[fi].name, fn, MAX_FILENAME_LEN - 1);
-    fs_files[fi].name[MAX_FILENAME_LEN - 1] = '\0';
-  }
-  memcpy(fs_files[fi].data, d, dl);
-  fs_files[fi].size = dl;
-  return 0;
-}
-int sys_delete_file(const char *fn) { 
-  if (!fn) return -1;
-  int fi = fs_find_file(fn);
-  if (fi == -1) return -1;
-  fs_files[fi].in_use = false;
-  fs_files[fi].name[0] = '\0';
-  fs_files[fi].size = 0;
-  return 0;
-}
-
-void app_calc(void);
-void app_edit(void);
+}
+
+// ---- trace: per-CPU event rings and the sampling profiler (trace.c);
+// `trace dump` sends them over COM1 for tools/ktrace.c ----
+
+static void shell_trace(const char *arg) {
+  const char *cats;
+  char w[12];
+  if ((cats = cmd_arg(arg, "on")) != NULL) {
+    uint32_t mask = *cats ? 0 : trace_category("all");
+    while (*cats) {
+      cats = next_word(cats, w, sizeof w);
+      uint32_t m = trace_category(w);
+      if (!m) {
+        sys_write("trace: categories are ");
+        sys_write(trace_categories());
+        sys_write("\n");
+        return;
+      }
+      mask |= m;
+    }
+    trace_mask = mask;
+  } else if (!strcmp(arg, "off")) {
+    trace_mask = 0;
+  } else if (!strcmp(arg, "clear")) {
+    trace_clear();
+  } else if (!strcmp(arg, "dump")) {
+    sys_write(trace_dump() ? "trace: sent to COM1\n" : "trace: no COM1\n");
+  } else if (*arg) {
+    sys_write("Usage: trace [on [category..]|off|clear|dump]\n");
+    return;
+  }
+  sys_write("recording:");
+  for (const char *c = trace_categories(); *c;) {
+    c = next_word(c, w, sizeof w);
+    if ((trace_mask & trace_category(w)) == trace_category(w)) {
+      sys_write(" ");
+      sys_write(w);
+    }
+  }
+  sys_write(trace_mask ? "\n" : " nothing\n");
+  for (int i = 0; i < ncpus; i++) {
+    sys_write("cpu");
+    put_num_col(i, 0);
+    sys_write(": ");
+    put_num_col(trace_count(i), 0);
+    sys_write(" events\n");
+  }
+}
+
+// ---- conbench: prints n lines through the old write-through path (VGA
+// writes, a volatile cell loop to scroll) and through the shadow buffer. ----
+static uint32_t cb_run(uint32_t n, bool direct) {
+  char line[80] = "conbench line ";
+  con_set_direct(direct);
+  uint32_t t0 = ticks;
+  for (uint32_t i = 0; i < n; i++) {
+    itoa((int32_t)i, line + 14);
+    strcpy(line + strlen(line), ": the quick brown fox jumps over the lazy dog\n");
+    sys_write(line);
+  }
+  return ticks - t0;
+}
+
+static void shell_conbench(const char *arg) {
+  int32_t n = *arg ? atoi(arg) : 2000;
+  uint32_t lines = n > 0 && n <= 100000 ? (uint32_t)n : 2000;
+  con_stats_t before = con_stats;
+  uint32_t direct = cb_run(lines, true);
+  uint32_t scrolls = con_stats.scrolls, rows = con_stats.rows;
+  uint32_t shadow = cb_run(lines, false);
+  scrolls = con_stats.scrolls - scrolls;
+  rows = con_stats.rows - rows;
+  con_set_direct(false);
+  put_num_col(lines, 0);
+  sys_write(" lines: write-through ");
+  put_num_col(direct, 0);
+  sys_write(" ticks, shadow + hw scroll ");
+  put_num_col(shadow, 0);
+  sys_write(" ticks\n");
+  put_num_col(rows, 0);
+  sys_write(" rows copied, ");
+  put_num_col(scrolls, 0);
+  sys_write(" hw scrolls, ");
+  put_num_col(con_stats.wraps - before.wraps, 0);
+  sys_write(" wraps\n");
+}
+
+// ---- apelang: bytecode from romfs.h, or any file, run by a VM task ----
+static const struct {
+  const char *name;
+  const uint8_t *code;
+  uint32_t len;
+} romfs[] = {{"calc", calc_apb, sizeof calc_apb}};
+
+static ape_prog_t *ape_progs[MAX_TASKS];  // by tid, for ape_task()
+
+static void ape_task(void) {
+  ape_prog_t *p = ape_progs[current()->tid];
+  int err = ape_run(p);
+  if (err) {
+    sys_write("ape: ");
+    sys_write(ape_strerror(err));
+    sys_write(" at instruction ");
+    put_num_col(p->err_pc, 0);
+    sys_write("\n");
+  }
+}
+
+static void shell_ape(const char *arg) {
+  const char *name = *arg ? arg : "calc";
+  const uint8_t *code = NULL;
+  uint8_t *file = NULL;
+  int len = 0;
+  for (size_t i = 0; i < sizeof romfs / sizeof *romfs; i++)
+    if (!strcmp(romfs[i].name, name)) {
+      code = romfs[i].code;
+      len = romfs[i].len;
+    }
+  if (!code && (len = sys_file_size(name)) > 0 && (file = kmalloc(len)) &&
+      sys_read_file(name, (char *)file, len) == len)
+    code = file;
+  if (!code) {
+    sys_write("Usage: ape [program]; built in: calc\n");
+    kfree(file);
+    return;
+  }
+  ape_prog_t *p = kmalloc(sizeof *p);
+  int err = p ? ape_load(p, code, len) : APE_ENOMEM;
+  kfree(file);
+  if (err) {
+    sys_write("ape: ");
+    sys_write(ape_strerror(err));
+    sys_write("\n");
+    kfree(p);
+    return;
+  }
+  task_t *t = task_create(name, ape_task, STACK_PAGES_DEFAULT, PRIO_DEFAULT,
+                          TASK_PAUSED);
+  if (t) {
+    ape_progs[t->tid] = p;
+    task_resume(t);
+    task_join(t);
+    sys_write("ape: ");
+    put_num_col(p->steps, 0);
+    sys_write(" instructions\n");
+  }
+  ape_free(p);
+  kfree(p);
+}
+
+static void shell_vm(const char *arg) {
+  if (!strcmp(arg, "pge on"))
+    vm_set_pge(true);
+  else if (!strcmp(arg, "pge off"))
+    vm_set_pge(false);
+  else if (*arg) {
+    sys_write("Usage: vm [pge on|off]\n");
+    return;
+  }
+  sys_write("address spaces ");
+  put_num_col(vm_spaces, 0);
+  sys_write(", private pages ");
+  put_num_col(vm_private_pages, 0);
+  sys_write(", demand-zero faults ");
+  put_num_col(vm_faults, 0);
+  sys_write(vm_pge ? ", global pages on\n" : ", global pages off\n");
+}
 
 static void shell(void) {
   char shell_cmd_buffer[32];
+  const char *arg;
 
+  sys_write("\nvt");
+  put_num_col(current()->vt + 1, 0);
+  sys_write(": Alt+F1..F4 switches terminals, Shift+PgUp/PgDn scrolls back\n");
   for (;;) {
     sys_write("\nsh> ");
     read_line(shell_cmd_buffer, sizeof(shell_cmd_buffer));
 
-    if (!strcmp(shell_cmd_buffer, "calc")) {
-      bool running = false;
-      for (int i = 0; i < MAX_TASKS; ++i)
-        if (tasks[i].entry == app_calc && tasks[i].sp != NULL) running = true;
-      if (running)
-        sys_write("calc is already running.\n");
-      else {
-        static uint8_t st[1024];
-        task_create(app_calc, st, sizeof st);
-      }
-    } else if (!strcmp(shell_cmd_buffer, "edit")) {
-      bool running = false;
-      for (int i = 0; i < MAX_TASKS; ++i)
-        if (tasks[i].entry == app_edit && tasks[i].sp != NULL) running = true;
-      if (running)
-        sys_write("edit is already running.\n");
-      else {
-        static uint8_t st[2048];
-        task_create(app_edit, st, sizeof st);
-      }
-    } else if (!strcmp(shell_cmd_buffer, "help")) {
+    if (!strcmp(shell_cmd_buffer, "help")) {
       sys_write("Available commands:\n");
-      sys_write("  calc    - Run the calculator app\n");
-      sys_write("  edit    - Run the text editor app\n");
+      sys_write("  <file>  - Run a program from the disk: calc, edit\n");
       sys_write("  clear   - Clear the screen\n");
+      sys_write("  ps      - List tasks with state and CPU time\n");
+      sys_write("  cpus    - Show per-CPU run queues, ticks and steals\n");
+      sys_write("  meminfo - Show page and slab allocator usage\n");
+      sys_write("  sync    - Write dirty cached blocks to disk\n");
+      sys_write("  iostat  - Show block cache hits/misses/writebacks\n");
+      sys_write("  vm [pge on|off] - Show paging stats/toggle global pages\n");
+      sys_write("  switchbench [n] - Time context switches with/without CR3\n");
+      sys_write("  conbench [n] - Time printing n lines, direct vs buffered\n");
+      sys_write("  syscalls [reset] - Show int 0x80 counts and cycle histograms\n");
+      sys_write("  locks [reset] - Show lock contention and hold cycles\n");
+      sys_write("  trace [on [cat..]|off|clear|dump] - Trace events to COM1\n");
+      sys_write("  ape [prog] - Run apelang bytecode (built-in calc or a file)\n");
+      sys_write("  nice <tid> <prio> - Set task priority (0 = highest)\n");
+      sys_write("  quantum [n] - Show/set the time slice in ticks\n");
+      sys_write("  sched [rr|cfs] - Show stats/switch scheduling class\n");
+      sys_write("  schedbench [n] [seed] - Run the simulator's bursty load\n");
       sys_write("  help    - Show this help message\n");
     } else if (!strcmp(shell_cmd_buffer, "clear") ||
                !strcmp(shell_cmd_buffer, "cls")) {
       sys_clear_screen();
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "quantum")) != NULL) {
+      char nb[12];
+      if (*arg) {
+        int32_t q = atoi(arg);
+        if (q > 0) sched_quantum = (uint32_t)q;
+      }
+      sys_write("quantum: ");
+      itoa((int32_t)sched_quantum, nb);
+      sys_write(nb);
+      sys_write(" ticks @ ");
+      itoa(PIT_HZ, nb);
+      sys_write(nb);
+      sys_write(" Hz\n");
+    } else if (!strcmp(shell_cmd_buffer, "ps")) {
+      shell_ps();
+    } else if (!strcmp(shell_cmd_buffer, "cpus")) {
+      shell_cpus();
+    } else if (!strcmp(shell_cmd_buffer, "meminfo")) {
+      shell_meminfo();
+    } else if (!strcmp(shell_cmd_buffer, "sync")) {
+      int n = bsync();
+      if (n < 0) {
+        sys_write("sync: write error, blocks kept dirty\n");
+      } else {
+        put_num_col(n, 0);
+        sys_write(" blocks written\n");
+      }
+    } else if (!strcmp(shell_cmd_buffer, "iostat")) {
+      shell_iostat();
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "vm")) != NULL) {
+      shell_vm(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "syscalls")) != NULL) {
+      shell_syscalls(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "locks")) != NULL) {
+      shell_locks(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "trace")) != NULL) {
+      shell_trace(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "ape")) != NULL) {
+      shell_ape(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "conbench")) != NULL) {
+      shell_conbench(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "switchbench")) != NULL) {
+      shell_switchbench(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "sched")) != NULL) {
+      shell_sched(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "schedbench")) != NULL) {
+      shell_schedbench(arg);
+    } else if ((arg = cmd_arg(shell_cmd_buffer, "nice")) != NULL) {
+      int32_t tid = atoi(arg);
+      while (*arg && *arg != ' ') arg++;
+      if (!*arg || tid < 0 || tid >= MAX_TASKS ||
+          tasks[tid].state == TASK_UNUSED)
+        sys_write("Usage: nice <tid> <prio>\n");
+      else
+        task_set_prio(&tasks[tid], (uint8_t)atoi(arg + 1));
+    } else if (sys_file_size(shell_cmd_buffer) >= 0) {
+      task_join(task_create(shell_cmd_buffer, NULL, STACK_PAGES_DEFAULT,
+                            PRIO_DEFAULT, TASK_USER));
     } else if (shell_cmd_buffer[0] != 0) {
       sys_write("Unknown command: '");
       sys_write(shell_cmd_buffer);
@@ -353,25 +1371,90 @@ static void shell(void) {
   }
 }
 
+// Left by bootloader.asm in the BIOS inter-application area.
+extern const struct {
+  uint32_t start_tick;  // bios_ticks when the boot sector started
+  uint16_t calls;       // int 0x13 reads, retries included
+  uint8_t lba;          // loaded with EDD AH=42h rather than CHS
+  uint8_t retries;
+} boot_info;
+extern const volatile uint32_t bios_ticks;
+
+// Time from boot sector to kmain, in ticks of the BIOS's 18.2 Hz PIT.
+static void boot_report(void) {
+  char nb[12];
+  uint32_t t = bios_ticks - boot_info.start_tick;
+  puts("boot: kernel loaded in ");
+  itoa(boot_info.calls, nb);
+  puts(nb);
+  puts(boot_info.lba ? " EDD reads" : " CHS reads");
+  if (boot_info.retries) {
+    puts(", ");
+    itoa(boot_info.retries, nb);
+    puts(nb);
+    puts(" retried");
+  }
+  puts("; ");
+  itoa((int32_t)t, nb);
+  puts(nb);
+  puts(" PIT ticks (~");
+  itoa((int32_t)(t * 10000 / 182), nb);
+  puts(nb);
+  puts(" ms) to kmain\n");
+}
+
+// An AP's first C code, on the stack smp_boot() gave it, which becomes
+// its idle task's.
+void ap_main(int id) {
+  cpu_t *c = &cpus[id];
+  vm_cpu_init(id);
+  idt_init(id);
+  fpu_set_ts(true);
+  lapic_init(true);
+  c->running = &c->idle;
+  c->online = true;
+  idle_loop();
+}
+
 void kmain(void) {
+  con_init();
+  serial_init();
+  boot_report();
+  pmm_init();
+  smp_detect();
+  vm_init();
+  idt_init(0);
+  fpu_set_ts(true);
+  pic_remap();
+  pit_init(PIT_HZ);
+  apic_init();
+  trace_init();
+  syscall_init();
+  tasks_init();
+  if (sched_find(SCHED_DEFAULT)) sched = sched_find(SCHED_DEFAULT);
+  bcache_init();
   fs_init();
-  puts("\n*** jordyOS multitask w/ In-Memory FS ***\n");
-
-  static uint8_t sh_stack[1024];
-  task_create(shell, sh_stack, sizeof sh_stack);
-  cur = -1;
-  for (int i = 0; i < MAX_TASKS; ++i)
-    if (tasks[i].sp) {
-      cur = i;
-      break;
-    }
-  if (cur == -1) {
-    puts("Error: No initial task. Halting.\n");
-    for (;;) __asm__("hlt");
+  puts("\n*** jordyOS multitask w/ Disk FS ***\n");
+
+  for (int i = 0; i < NVT; i++) {
+    task_t *sh = task_create("shell", shell, STACK_PAGES_DEFAULT, PRIO_DEFAULT,
+                             TASK_DETACHED);
+    if (sh) sh->vt = i;
   }
-  uint32_t *dummy_sp_kmain = NULL;
-  ctx_switch(&dummy_sp_kmain, tasks[cur].sp);
+  task_create("bflush", bflush, 1, PRIO_DEFAULT,
+              TASK_KTHREAD | TASK_DETACHED);
 
-  puts("\nkmain: ctx_switch from initial task returned. Halting.\n");
-  for (;;) __asm__("hlt");
+  // The boot stack becomes the BSP's idle task. The APs start stealing
+  // from its queue as soon as they are up; IRQs come on in idle_loop().
+  cpus[0].running = &cpus[0].idle;
+  cpus[0].online = true;
+  smp_boot();
+  int up = 0;
+  for (int i = 0; i < ncpus; i++) up += cpus[i].online;
+  char nb[12];
+  itoa(up, nb);
+  puts("smp: ");
+  puts(nb);
+  puts(up == 1 ? " CPU\n" : " CPUs\n");
+  idle_loop();
 }
@@ -0,0 +1,431 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+// Kernel-internal interfaces shared between kernel.c and the other kernel
+// translation units. Apps only ever see util.h.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "adapt.h"
+#include "fs.h"
+#include "hal.h"
+#include "trace.h"
+#include "util.h"
+
+#define PIT_HZ 1000
+#define PIT_BASE_HZ 1193182
+#define IRQ_BASE 0x20  // ISA IRQs 0-15, from the 8259s or the IOAPIC
+
+// ---- console (console.c) ----
+#define NVT 4  // virtual terminals, Alt+F1..F4
+
+typedef struct {
+  uint32_t flushes;  // write calls copied out to VRAM
+  uint32_t rows;     // rows copied
+  uint32_t scrolls;  // lines scrolled in the shadow buffer
+  uint32_t wraps;    // times the window went back to the top of VRAM
+} con_stats_t;
+
+extern int con_fg;  // terminal on screen
+extern bool con_direct;
+extern con_stats_t con_stats;
+
+void con_init(void);
+void con_putc(int vt, char c);
+void con_write(int vt, const char *s);
+bool con_try_write(int vt, const char *s);  // false if the console is busy
+void con_clear(int vt);
+void con_switch(int vt);
+void con_scrollback(int rows);
+void con_set_direct(bool on);
+
+// ---- memory (mm.c) ----
+#define PAGE_SIZE 4096u
+#define PAGE_SHIFT 12
+#define NSLAB_CLASSES 8  // 16 .. 2048 bytes
+
+typedef struct {
+  uint32_t slabs;  // pages held by the class
+  uint32_t inuse;  // live objects
+} slab_stats_t;
+
+extern uint32_t pmm_npages;  // pages up to the top of usable RAM
+extern uint32_t pmm_total_pages, pmm_free_pages;
+extern slab_stats_t slab_stats[NSLAB_CLASSES];
+extern uint32_t kmalloc_big_pages;
+
+void pmm_init(void);
+void *pmm_alloc_page(void);
+void *pmm_alloc_pages(uint32_t count);
+void pmm_free_pages_at(void *p, uint32_t count);
+void *kmalloc(size_t n);
+void kfree(void *p);
+void *krealloc(void *p, size_t n);
+size_t ksize(const void *p);
+uint32_t slab_class_size(int c);
+
+// ---- paging (vm.c) ----
+#define GDT_KCODE 0x08
+#define GDT_KDATA 0x10
+#define GDT_UCODE 0x1B  // ring 3, RPL included
+#define GDT_UDATA 0x23
+#define GDT_TSS 0x28     // CPU n's TSS is at GDT_TSS + 16 * n
+#define GDT_PF_TSS 0x30  // and its #PF task gate's target 8 above that
+
+// Every address space has its stack at the same place, just under the 4 MB
+// slot covered by its private page table. Ring-3 tasks keep their heap at
+// the bottom of the same table (USER_HEAP in syscall.h), so the stack
+// leaves its first two pages alone.
+#define STACK_TOP 0xFFC00000u
+#define STACK_MAX_PAGES 1021
+
+typedef struct __attribute__((packed)) {
+  uint16_t link, _r0;
+  uint32_t esp0;
+  uint16_t ss0, _r1;
+  uint32_t esp1;
+  uint16_t ss1, _r2;
+  uint32_t esp2;
+  uint16_t ss2, _r3;
+  uint32_t cr3, eip, eflags, eax, ecx, edx, ebx, esp, ebp, esi, edi;
+  uint16_t es, _r4, cs, _r5, ss, _r6, ds, _r7, fs, _r8, gs, _r9;
+  uint16_t ldt, _r10, trap, iomap;
+} tss_t;
+
+extern uint32_t *kernel_pd;
+extern bool vm_pge;
+extern uint32_t vm_spaces, vm_private_pages, vm_faults;
+
+void vm_init(void);
+void vm_cpu_init(int cpu);
+void *vm_mmio(uint32_t pa);
+void vm_set_pge(bool on);
+uint32_t *vm_create(uint32_t stack_pages, bool user);
+void vm_destroy(uint32_t *pd);
+void *vm_map_user(uint32_t *pd, uint32_t va, bool write);
+void *vm_phys(uint32_t *pd, uint32_t va);
+bool vm_fault(uint32_t addr);
+void vm_reserve(uint32_t *pd, uint32_t from, uint32_t to);
+bool vm_user_ok(uint32_t *pd, uint32_t va, uint32_t len, bool write);
+int32_t vm_user_strlen(uint32_t *pd, uint32_t va, uint32_t max);
+
+// ---- disk (ata.c), block cache (bcache.c), filesystem (fs.c) ----
+extern uint32_t ata_sectors;
+bool ata_init(void);
+int ata_rw(uint32_t lba, uint32_t count, uint8_t *const *seg, uint32_t per_seg,
+           bool write);
+int ata_flush(void);
+
+typedef struct buf {
+  uint32_t blk;
+  bool valid, dirty;
+  struct buf *hnext;        // hash chain
+  struct buf *next, *prev;  // LRU list
+  uint8_t data[FS_BLOCK_SIZE];
+} buf_t;
+
+typedef struct {
+  uint32_t hits, misses;
+  uint32_t writebacks;  // blocks written
+  uint32_t writes;      // disk commands they took
+  uint32_t syncs;
+  uint32_t errors;  // failed reads, writes and flushes
+} bcache_stats_t;
+
+extern bcache_stats_t bcache_stats;
+extern uint32_t bcache_nblocks;
+extern const char *bcache_dev;
+void bcache_init(void);
+buf_t *bread(uint32_t blk);
+buf_t *bclear(uint32_t blk);
+void bdirty(buf_t *b);
+int bsync(void);
+uint32_t bcache_ndirty(void);
+
+extern uint32_t fs_free_blocks;
+void fs_init(void);
+
+// ---- programs (elf.c) ----
+#define ELF_ENOENT -1   // no such file
+#define ELF_ENOEXEC -2  // not an i386 executable we can load
+#define ELF_ENOMEM -3
+
+int elf_load(uint32_t *pd, const char *name, uint32_t *entry);
+const char *elf_strerror(int err);
+
+#define MAX_TASKS 64
+#define NPRIO 32          // priority levels, 0 = highest
+#define PRIO_DEFAULT 16
+#define TASK_NAME_LEN 12
+#define STACK_PAGES_DEFAULT 16  // reserved; committed as the stack grows
+#define KSTACK_PAGES 2  // ring-3 tasks' kernel stack
+
+typedef enum {
+  TASK_UNUSED,
+  TASK_RUNNABLE,  // on a run queue
+  TASK_RUNNING,
+  TASK_BLOCKED,   // waiting for an event (key, child exit)
+  TASK_SLEEPING,  // waiting for a tick deadline
+  TASK_ZOMBIE,    // exited, not yet joined/reaped
+} task_state_t;
+
+typedef struct task {
+  uint32_t *sp;
+  void (*entry)(void);
+  task_state_t state;
+  uint8_t prio;
+  bool detached;  // reaped by the scheduler rather than task_join()
+  int tid;
+  char name[TASK_NAME_LEN];
+  uint32_t *pd;  // page directory, kernel_pd for kernel threads
+  uint8_t vt;    // terminal for its console I/O, inherited from the creator
+  uint8_t cpu;   // whose run queue it is on, or last ran on
+  bool pinned;   // never moved to another CPU
+  uint8_t *kstack;  // ring-3 tasks: identity-mapped stack for kernel entry
+  uint32_t brk;     // ring-3 tasks: end of the SYS_SBRK heap
+  bool fpu_used;    // has x87 state; in fpu[] unless it owns the FPU
+  uint8_t fpu[108];  // fnsave image
+  uint8_t *stack_lo, *stack_hi;  // reserved range, in the task's own space
+  uint32_t vruntime;  // weighted CPU time in 1/1024 ticks
+  int heap_idx;       // slot in the CFS heap while runnable
+  uint32_t ticks;     // timer ticks spent running
+  uint32_t switches;  // times switched in
+  uint32_t created, first_run;  // ticks, for latency/turnaround stats
+  uint32_t wake_tick;
+  struct task *waiter;      // task blocked in task_join() on us
+  struct task *next, *prev; // run queue / sleep queue / free list
+} task_t;
+
+extern volatile uint32_t ticks;
+
+// ---- CPUs (smp.c); each runs its own tasks off its own run queues ----
+#define MAX_CPUS 8
+#define VEC_LAPIC_TIMER 0x30  // tick on the APs; the BSP keeps the PIT
+#define VEC_RESCHED 0x31      // IPI: a task was queued for you
+#define VEC_SPURIOUS 0x3F
+#define NVECTORS 0x40  // stubs in isr_table
+
+typedef struct {
+  int id;           // index in cpus[]
+  uint8_t apic_id;
+  volatile bool online;
+  task_t *running;  // `idle` when nothing else is runnable
+  task_t idle;      // runs idle_loop() on the CPU's boot stack
+  uint32_t *active_pd;  // loaded in CR3
+  uint32_t nr_ready;    // tasks on its run queue
+  uint32_t slice_left;
+  bool need_resched;
+  uint32_t ticks, idle_ticks;
+  uint32_t switches;
+  uint32_t steals;  // tasks taken from other CPUs' queues
+  task_t *fpu_owner;  // whose state is in this CPU's FPU
+  bool fpu_ts;        // CR0.TS as last set
+  tss_t tss, pf_tss;
+  uint8_t pf_stack[PAGE_SIZE] __attribute__((aligned(16)));
+} cpu_t;
+
+extern cpu_t cpus[MAX_CPUS];
+extern int ncpus;        // from the MADT; 1 without ACPI
+extern bool ioapic_ok;   // ISA IRQs come through the IOAPIC, not the 8259
+extern uint32_t lapic_base, ioapic_base;
+extern uint32_t lapic_timer_count;  // initial count for one tick
+
+// The task register tells CPUs apart: each loads its own TSS, and the #PF
+// task runs on the one right after it. Before ltr it reads 0: the BSP.
+static inline cpu_t *this_cpu(void) {
+  uint16_t tr = task_register();
+  return &cpus[tr ? (tr - GDT_TSS) >> 4 : 0];
+}
+// The task running on this CPU, which is the caller. IRQs are off across
+// the lookup: a preemption between reading the task register and loading
+// `running` could move the caller and return another CPU's task.
+static inline task_t *current(void) {
+  uint32_t f = irq_save();
+  task_t *t = this_cpu()->running;
+  irq_restore(f);
+  return t;
+}
+
+void smp_detect(void);  // paging off: find CPUs and APICs in the MADT
+void apic_init(void);   // BSP: map the APICs, route IRQs, time the LAPIC
+void smp_boot(void);    // INIT-SIPI-SIPI each AP in turn
+void lapic_init(bool timer);
+void lapic_eoi(void);
+void lapic_ipi(uint8_t apic_id, uint8_t vector);
+void pit_wait(uint32_t us);  // busy-waits on PIT channel 2, at most 54 ms
+void ap_main(int id);   // kernel.c: where an AP lands after ap_boot.asm
+
+// Task states, run queues, the sleep queue and every wait queue in sync.c
+// are guarded by sched_lock. It is held across ctx_switch(); the task
+// switched to releases it.
+typedef struct spinlock spinlock_t;
+extern spinlock_t sched_lock;
+
+void task_block(void);  // sched_lock held; returns after task_wake()
+void task_wake(task_t *t);
+bool task_movable(const task_t *t);
+
+// ---- locks (sync.c) ----
+typedef struct lock_stats {
+  const char *name;
+  const char *kind;       // "spin", "mutex", "amutex", "sem"
+  uint32_t acquires;
+  uint32_t contended;     // acquisitions that had to wait
+  uint32_t spins;         // pause loops spun, spinlocks
+  uint32_t sleeps;        // times a waiter blocked
+  uint64_t hold_cycles;   // spinlocks and mutexes
+  uint32_t hold_max;
+  uint64_t since;         // rdtsc at the current acquisition
+  adapt_t *adapt;         // adaptive mutexes: predictor and threshold
+  struct lock_stats *next;
+} lock_stats_t;
+
+typedef struct {
+  task_t *head, *tail;
+} waitq_t;
+
+struct spinlock {
+  volatile uint16_t next;   // ticket for the next taker
+  volatile uint16_t owner;  // ticket being served
+  lock_stats_t stats;
+};
+
+typedef struct {
+  task_t *owner;
+  waitq_t wq;
+  lock_stats_t stats;
+} mutex_t;
+
+#define AMUTEX_PARK_INIT 4000  // cycles, until the first parked waiter is timed
+
+typedef struct {
+  task_t *owner;
+  waitq_t wq;
+  uint64_t released;  // rdtsc at the last unlock
+  adapt_t adapt;
+  lock_stats_t stats;
+} amutex_t;
+
+typedef struct {
+  int32_t count;
+  waitq_t wq;
+  lock_stats_t stats;
+} sem_t;
+
+typedef struct {
+  waitq_t wq;
+} cond_t;
+
+void spin_init(spinlock_t *l, const char *name);
+void spin_lock(spinlock_t *l);
+bool spin_trylock(spinlock_t *l);
+void spin_unlock(spinlock_t *l);
+uint32_t spin_lock_irqsave(spinlock_t *l);
+void spin_unlock_irqrestore(spinlock_t *l, uint32_t f);
+void mutex_init(mutex_t *m, const char *name);
+void mutex_lock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+void amutex_init(amutex_t *m, const char *name);
+void amutex_lock(amutex_t *m);
+void amutex_unlock(amutex_t *m);
+void sem_init(sem_t *s, const char *name, int32_t count);
+void sem_down(sem_t *s);
+void sem_up(sem_t *s);
+void cond_init(cond_t *c);
+void cond_wait(cond_t *c, mutex_t *m);
+void cond_signal(cond_t *c);
+void cond_broadcast(cond_t *c);
+lock_stats_t *lock_stats_list(void);
+void lock_stats_reset(void);
+
+// ---- interrupts and system calls (isr.asm, syscall.c) ----
+typedef struct {
+  uint32_t es, ds;
+  uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // pushad
+  uint32_t vector, err;
+  uint32_t eip, cs, eflags;
+  uint32_t user_esp, user_ss;  // only when entered from ring 3
+} regs_t;
+
+#define SYSCALL_HIST 16     // log2 buckets of cycles per call
+#define SYSCALL_HIST_MIN 6  // bucket 0: under 2^7 cycles
+
+typedef struct {
+  uint32_t calls;
+  uint64_t cycles;
+  uint32_t max;
+  uint32_t hist[SYSCALL_HIST];
+} syscall_stats_t;
+
+extern syscall_stats_t syscall_stats[];
+
+void syscall_init(void);
+void syscall_dispatch(regs_t *r);
+const char *syscall_name(int n);
+
+// ---- shell input (line.c) ----
+#define LINE_IGNORE 0
+#define LINE_ECHO 1   // the key was added: echo it
+#define LINE_ERASE 2  // the last character was removed: "\b \b"
+#define LINE_DONE 3   // Enter: the line is complete and terminated
+
+int line_key(char *buf, int *len, int max, char c);
+const char *cmd_arg(const char *line, const char *cmd);
+const char *next_word(const char *s, char *w, int max);
+
+// ---- serial port (serial.c) ----
+extern bool serial_ok;   // a UART answered on COM1
+extern bool serial_con;  // and on COM2: terminal 1 is copied there
+
+void serial_init(void);
+void serial_write(const void *p, uint32_t n);
+void serial_con_putc(char c);
+void serial_write_polled(const char *s);
+
+// ---- tracing (trace.c); the record and dump formats are in trace.h ----
+extern uint32_t trace_mask;  // 1 << TR_* for each type being recorded
+
+void trace_init(void);
+void trace_emit(uint32_t type, uint32_t arg);
+void trace_sample(const regs_t *r);
+uint32_t trace_category(const char *name);  // mask bits, 0 if unknown
+const char *trace_categories(void);
+uint32_t trace_count(int cpu);  // records written since the last clear
+void trace_clear(void);
+bool trace_dump(void);  // false without a serial port
+const char *task_name(int tid);  // kernel.c: the slot's last name
+
+// Costs one load and a branch while the type isn't being recorded.
+static inline void trace(uint32_t type, uint32_t arg) {
+  if (trace_mask & (1u << (type & TR_TYPE))) trace_emit(type, arg);
+}
+
+// A scheduling policy. The core (schedule() in kernel.c) owns task state,
+// the running tasks and which CPU a task is queued on (t->cpu); a class
+// only orders the runnable ones on each CPU. Called with sched_lock held.
+typedef struct {
+  const char *name;
+  void (*enqueue)(task_t *t);
+  void (*dequeue)(task_t *t);          // remove a runnable task
+  task_t *(*pick_next)(int cpu);       // dequeue the next task to run
+  task_t *(*steal)(int cpu);           // dequeue one task_movable() allows
+  uint32_t (*slice)(task_t *t);        // ticks t may run once picked
+  void (*tick)(task_t *t);             // charge one tick to the running task
+  bool (*preempt)(task_t *woken, task_t *curr);
+} sched_class_t;
+
+#ifndef SCHED_QUANTUM
+#define SCHED_QUANTUM 10  // timer ticks per round-robin slice
+#endif
+#ifndef SCHED_DEFAULT
+#define SCHED_DEFAULT "rr"
+#endif
+
+extern const sched_class_t *sched;
+extern uint32_t sched_quantum;
+const sched_class_t *sched_find(const char *name);
+const char *sched_names(void);
+
+#endif
@@ -5,6 +5,16 @@ GLOBAL _start
 
 _start:
     cli                         ; keep IRQs off during mode switch
+    xor  ax, ax                 ; the loader leaves DS at its own segment;
+    mov  ds, ax                 ; lgdt below reads through DS
+
+    in   al, 0x92               ; fast A20 gate, so memory above 1 MB
+    test al, 2                  ; isn't aliased onto low memory
+    jnz  .a20_on
+    or   al, 2
+    and  al, 0xFE               ; bit 0 would reset the machine
+    out  0x92, al
+.a20_on:
     lgdt [gdt_descriptor]       ; load 32‑bit flat GDT
 
     mov  eax, cr0
@@ -22,6 +32,13 @@ protected_start:
     mov ss, ax
     mov esp, 0x9FC00            ; temp 32‑bit stack (below 640k)
 
+    extern _bss_start, _bss_end ; .bss isn't in kernel.bin: zero it here
+    cld
+    mov  edi, _bss_start
+    mov  ecx, _bss_end
+    sub  ecx, edi
+    xor  eax, eax
+    rep  stosb
 
     extern kmain
     call  kmain                 ; jump into C kernel
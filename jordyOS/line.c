@@ -0,0 +1,46 @@
+#include "kernel.h"
+
+// The shell's line editing and command parsing, apart from the keyboard
+// and the screen so the host build can run them too. read_line() in
+// kernel.c feeds keys through line_key() and echoes what it says.
+
+// Applies key c to the line in buf, which holds *len characters and has
+// room for max - 1. On Enter the line is terminated and LINE_DONE
+// returned; otherwise the return value says how to echo the key.
+int line_key(char *buf, int *len, int max, char c) {
+  if (c == '\n') {
+    buf[*len] = '\0';
+    return LINE_DONE;
+  }
+  if ((c == 8 || c == 127) && *len > 0) {
+    (*len)--;
+    return LINE_ERASE;
+  }
+  if (c >= 32 && c < 127 && *len < max - 1) {
+    buf[(*len)++] = c;
+    return LINE_ECHO;
+  }
+  return LINE_IGNORE;
+}
+
+// Returns the argument text if `line` is `cmd` or `cmd <args>`, else NULL.
+const char *cmd_arg(const char *line, const char *cmd) {
+  while (*cmd && *line == *cmd) {
+    line++;
+    cmd++;
+  }
+  if (*cmd || (*line && *line != ' ')) return NULL;
+  while (*line == ' ') line++;
+  return line;
+}
+
+// Copies the first word of s into w (at most max - 1 characters) and
+// returns the text after it, past any spaces.
+const char *next_word(const char *s, char *w, int max) {
+  int n = 0;
+  for (; *s && *s != ' '; s++)
+    if (n < max - 1) w[n++] = *s;
+  w[n] = '\0';
+  while (*s == ' ') s++;
+  return s;
+}
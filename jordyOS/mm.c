@@ -0,0 +1,282 @@
+#include "kernel.h"
+
+// Physical memory: a bitmap page-frame allocator over the BIOS E820 map
+// (collected by the bootloader at 0x500), and a size-class slab allocator
+// behind kmalloc()/kfree().
+
+typedef struct __attribute__((packed)) {
+  uint64_t base, len;
+  uint32_t type, acpi;
+} e820_entry_t;
+
+// Left at 0x500 by the bootloader; placed by linker.ld.
+extern const struct {
+  uint32_t count;
+  e820_entry_t map[];
+} e820_info;
+#define E820_USABLE 1
+
+#define PMM_LOW_RESERVED 0x100000u  // kernel, BIOS and VGA live below 1 MB
+#define PMM_LIMIT 0x40000000u       // manage at most the first 1 GB
+
+static uint32_t *pmm_bitmap;  // one bit per page, 1 = used
+uint32_t pmm_npages;
+static uint32_t pmm_hint;     // word index where the last search ended
+static spinlock_t pmm_lock, slab_lock;  // the latter for kmalloc
+uint32_t pmm_total_pages, pmm_free_pages;
+
+static void pmm_mark(uint32_t pg, bool used) {
+  if (used)
+    pmm_bitmap[pg >> 5] |= 1u << (pg & 31);
+  else
+    pmm_bitmap[pg >> 5] &= ~(1u << (pg & 31));
+}
+static bool pmm_used(uint32_t pg) {
+  return pmm_bitmap[pg >> 5] & (1u << (pg & 31));
+}
+
+void pmm_init(void) {
+  spin_init(&pmm_lock, "pmm");
+  spin_init(&slab_lock, "kmalloc");
+  e820_entry_t fallback = {PMM_LOW_RESERVED, 15u << 20, E820_USABLE, 1};
+  const e820_entry_t *map = e820_info.map;
+  uint32_t n = e820_info.count;
+  if (n == 0 || n > 32) {  // no E820: assume 16 MB, which QEMU always has
+    map = &fallback;
+    n = 1;
+  }
+
+  uint64_t top = 0;
+  for (uint32_t i = 0; i < n; i++)
+    if (map[i].type == E820_USABLE && map[i].base + map[i].len > top)
+      top = map[i].base + map[i].len;
+  if (top > PMM_LIMIT) top = PMM_LIMIT;
+  pmm_npages = (uint32_t)(top >> PAGE_SHIFT);
+  uint32_t words = (pmm_npages + 31) / 32;
+  uint32_t bm_pages = (words * 4 + PAGE_SIZE - 1) / PAGE_SIZE;
+
+  // The bitmap itself goes at the start of the first usable region above
+  // 1 MB that can hold it.
+  uint32_t bm_base = 0;
+  for (uint32_t i = 0; i < n && !bm_base; i++) {
+    if (map[i].type != E820_USABLE) continue;
+    uint64_t b = map[i].base, e = b + map[i].len;
+    if (b < PMM_LOW_RESERVED) b = PMM_LOW_RESERVED;
+    b = (b + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+    if (e > top) e = top;
+    if (b + (uint64_t)bm_pages * PAGE_SIZE <= e) bm_base = (uint32_t)b;
+  }
+  pmm_bitmap = (uint32_t *)bm_base;
+  memset(pmm_bitmap, 0xFF, words * 4);
+
+  for (uint32_t i = 0; i < n; i++) {
+    if (map[i].type != E820_USABLE) continue;
+    uint64_t b = map[i].base, e = map[i].base + map[i].len;
+    if (b < PMM_LOW_RESERVED) b = PMM_LOW_RESERVED;
+    if (e > top) e = top;
+    for (uint64_t a = (b + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1);
+         a + PAGE_SIZE <= e; a += PAGE_SIZE) {
+      uint32_t pg = (uint32_t)(a >> PAGE_SHIFT);
+      if (pmm_used(pg)) {
+        pmm_mark(pg, false);
+        pmm_free_pages++;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < bm_pages; i++) {
+    pmm_mark((bm_base >> PAGE_SHIFT) + i, true);
+    pmm_free_pages--;
+  }
+  pmm_total_pages = pmm_free_pages;
+}
+
+void *pmm_alloc_page(void) {
+  uint32_t f = spin_lock_irqsave(&pmm_lock);
+  uint32_t words = (pmm_npages + 31) / 32;
+  for (uint32_t k = 0; k < words; k++) {
+    uint32_t w = (pmm_hint + k) % words;
+    if (pmm_bitmap[w] == 0xFFFFFFFFu) continue;
+    uint32_t pg = w * 32 + __builtin_ctz(~pmm_bitmap[w]);
+    if (pg >= pmm_npages) continue;
+    pmm_mark(pg, true);
+    pmm_free_pages--;
+    pmm_hint = w;
+    spin_unlock_irqrestore(&pmm_lock, f);
+    trace(TR_PAGES, 1);
+    return (void *)(pg << PAGE_SHIFT);
+  }
+  spin_unlock_irqrestore(&pmm_lock, f);
+  return NULL;
+}
+
+// First fit over the bitmap; only used for multi-page allocations.
+void *pmm_alloc_pages(uint32_t count) {
+  if (count == 1) return pmm_alloc_page();
+  uint32_t f = spin_lock_irqsave(&pmm_lock);
+  uint32_t run = 0;
+  for (uint32_t pg = 0; pg < pmm_npages; pg++) {
+    if ((pg & 31) == 0 && pmm_bitmap[pg >> 5] == 0xFFFFFFFFu) {
+      run = 0;
+      pg += 31;
+      continue;
+    }
+    run = pmm_used(pg) ? 0 : run + 1;
+    if (run == count) {
+      uint32_t first = pg + 1 - count;
+      for (uint32_t i = first; i <= pg; i++) pmm_mark(i, true);
+      pmm_free_pages -= count;
+      spin_unlock_irqrestore(&pmm_lock, f);
+      trace(TR_PAGES, count);
+      return (void *)(first << PAGE_SHIFT);
+    }
+  }
+  spin_unlock_irqrestore(&pmm_lock, f);
+  return NULL;
+}
+
+void pmm_free_pages_at(void *p, uint32_t count) {
+  trace(TR_PAGES_FREE, count);
+  uint32_t f = spin_lock_irqsave(&pmm_lock);
+  uint32_t pg = (uint32_t)p >> PAGE_SHIFT;
+  for (uint32_t i = 0; i < count; i++) pmm_mark(pg + i, false);
+  pmm_free_pages += count;
+  spin_unlock_irqrestore(&pmm_lock, f);
+}
+
+// ---- slab allocator: every slab is one page whose header sits at the
+// page start, so kfree() finds it by masking the pointer. Allocations too
+// big for the largest class get a run of pages with the same header. ----
+#define SLAB_MAGIC 0x51AB
+#define SLAB_BIG 0xFFFF
+#define SLAB_HDR 32  // keeps objects 16-byte aligned
+
+typedef struct slab {
+  uint16_t magic;
+  uint16_t cls;  // size class index, or SLAB_BIG
+  uint16_t inuse, total;
+  uint32_t npages;  // SLAB_BIG only
+  void *free;
+  struct slab *next, *prev;  // partial list of the class
+} slab_t;
+
+static const uint16_t class_size[NSLAB_CLASSES] = {16,  32,  64,   128,
+                                                   256, 512, 1024, 2048};
+static slab_t *partial[NSLAB_CLASSES];
+slab_stats_t slab_stats[NSLAB_CLASSES];
+uint32_t kmalloc_big_pages;
+
+static void partial_add(int c, slab_t *s) {
+  s->prev = NULL;
+  s->next = partial[c];
+  if (s->next) s->next->prev = s;
+  partial[c] = s;
+}
+static void partial_del(int c, slab_t *s) {
+  if (s->prev)
+    s->prev->next = s->next;
+  else
+    partial[c] = s->next;
+  if (s->next) s->next->prev = s->prev;
+}
+
+static slab_t *slab_new(int c) {
+  slab_t *s = pmm_alloc_page();
+  if (!s) return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cls = c;
+  s->inuse = 0;
+  s->total = (PAGE_SIZE - SLAB_HDR) / class_size[c];
+  s->npages = 1;
+  s->free = NULL;
+  for (int i = s->total - 1; i >= 0; i--) {
+    void **o = (void **)((uint8_t *)s + SLAB_HDR + i * class_size[c]);
+    *o = s->free;
+    s->free = o;
+  }
+  slab_stats[c].slabs++;
+  return s;
+}
+
+void *kmalloc(size_t n) {
+  if (n == 0) return NULL;
+  trace(TR_KMALLOC, n);
+  int c = 0;
+  while (c < NSLAB_CLASSES && class_size[c] < n) c++;
+  uint32_t f = spin_lock_irqsave(&slab_lock);
+  if (c == NSLAB_CLASSES) {
+    uint32_t pages = (n + SLAB_HDR + PAGE_SIZE - 1) / PAGE_SIZE;
+    slab_t *s = pmm_alloc_pages(pages);
+    if (s) {
+      s->magic = SLAB_MAGIC;
+      s->cls = SLAB_BIG;
+      s->npages = pages;
+      kmalloc_big_pages += pages;
+    }
+    spin_unlock_irqrestore(&slab_lock, f);
+    return s ? (uint8_t *)s + SLAB_HDR : NULL;
+  }
+  slab_t *s = partial[c];
+  if (!s) {
+    s = slab_new(c);
+    if (!s) {
+      spin_unlock_irqrestore(&slab_lock, f);
+      return NULL;
+    }
+    partial_add(c, s);
+  }
+  void **o = s->free;
+  s->free = *o;
+  if (++s->inuse == s->total) partial_del(c, s);
+  slab_stats[c].inuse++;
+  spin_unlock_irqrestore(&slab_lock, f);
+  return o;
+}
+
+void kfree(void *p) {
+  if (!p) return;
+  slab_t *s = (slab_t *)((uint32_t)p & ~(PAGE_SIZE - 1));
+  if (s->magic != SLAB_MAGIC) return;
+  trace(TR_KFREE, s->cls == SLAB_BIG ? s->npages * PAGE_SIZE - SLAB_HDR
+                                     : class_size[s->cls]);
+  uint32_t f = spin_lock_irqsave(&slab_lock);
+  if (s->cls == SLAB_BIG) {
+    kmalloc_big_pages -= s->npages;
+    s->magic = 0;
+    pmm_free_pages_at(s, s->npages);
+    spin_unlock_irqrestore(&slab_lock, f);
+    return;
+  }
+  int c = s->cls;
+  if (s->inuse == s->total) partial_add(c, s);
+  *(void **)p = s->free;
+  s->free = p;
+  slab_stats[c].inuse--;
+  // Hand empty slabs back to the page allocator unless it's the only one
+  // left for the class, which avoids page churn on alloc/free pairs.
+  if (--s->inuse == 0 && (partial[c] != s || s->next)) {
+    partial_del(c, s);
+    s->magic = 0;
+    slab_stats[c].slabs--;
+    pmm_free_pages_at(s, 1);
+  }
+  spin_unlock_irqrestore(&slab_lock, f);
+}
+
+size_t ksize(const void *p) {
+  const slab_t *s = (const slab_t *)((uint32_t)p & ~(PAGE_SIZE - 1));
+  if (s->cls == SLAB_BIG) return s->npages * PAGE_SIZE - SLAB_HDR;
+  return class_size[s->cls];
+}
+
+void *krealloc(void *p, size_t n) {
+  if (!p) return kmalloc(n);
+  size_t old = ksize(p);
+  if (n <= old) return p;
+  void *q = kmalloc(n);
+  if (!q) return NULL;
+  memcpy(q, p, old);
+  kfree(p);
+  return q;
+}
+
+uint32_t slab_class_size(int c) { return class_size[c]; }
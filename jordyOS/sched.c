@@ -0,0 +1,220 @@
+#include "kernel.h"
+
+// Scheduling classes. Both keep only *runnable* tasks, in one set of
+// queues per CPU; the running task is off them until schedule() hands it
+// back through enqueue(). A task is queued on t->cpu.
+
+uint32_t sched_quantum = SCHED_QUANTUM;
+
+// ---- rr: one FIFO per priority plus a bitmap of non-empty levels, so
+// picking the next task is a single bsf regardless of MAX_TASKS ----
+typedef struct {
+  struct {
+    task_t *head, *tail;
+  } q[NPRIO];
+  uint32_t bitmap;
+} rr_queue_t;
+static rr_queue_t rr[MAX_CPUS];
+
+static void rr_enqueue(task_t *t) {
+  rr_queue_t *r = &rr[t->cpu];
+  t->next = NULL;
+  t->prev = r->q[t->prio].tail;
+  if (t->prev)
+    t->prev->next = t;
+  else
+    r->q[t->prio].head = t;
+  r->q[t->prio].tail = t;
+  r->bitmap |= 1u << t->prio;
+}
+static void rr_dequeue(task_t *t) {
+  rr_queue_t *r = &rr[t->cpu];
+  if (t->prev)
+    t->prev->next = t->next;
+  else
+    r->q[t->prio].head = t->next;
+  if (t->next)
+    t->next->prev = t->prev;
+  else
+    r->q[t->prio].tail = t->prev;
+  if (!r->q[t->prio].head) r->bitmap &= ~(1u << t->prio);
+}
+static task_t *rr_pick_next(int cpu) {
+  if (!rr[cpu].bitmap) return NULL;
+  task_t *t = rr[cpu].q[__builtin_ctz(rr[cpu].bitmap)].head;
+  rr_dequeue(t);
+  return t;
+}
+// The highest-priority task that may move, so the thief runs what the
+// victim would have run next.
+static task_t *rr_steal(int cpu) {
+  for (uint32_t m = rr[cpu].bitmap; m; m &= m - 1)
+    for (task_t *t = rr[cpu].q[__builtin_ctz(m)].head; t; t = t->next)
+      if (task_movable(t)) {
+        rr_dequeue(t);
+        return t;
+      }
+  return NULL;
+}
+static uint32_t rr_slice(task_t *t) {
+  (void)t;
+  return sched_quantum;
+}
+static void rr_tick(task_t *t) { t->vruntime += 1024; }
+static bool rr_preempt(task_t *woken, task_t *curr) {
+  return woken->prio < curr->prio;
+}
+
+const sched_class_t sched_rr = {"rr",     rr_enqueue, rr_dequeue, rr_pick_next,
+                                rr_steal, rr_slice,   rr_tick,    rr_preempt};
+
+// ---- cfs: the CFS class from cpu/CFS-vs-RRML1-sim.py. Runnable tasks
+// sit in a binary min-heap keyed on vruntime; a picked task runs for
+// max(min_gran, target * weight / total_weight) ticks and is charged
+// NICE_0_LOAD / weight ticks of vruntime per tick it runs. Each CPU has
+// its own heap and min_vruntime; a task that moves keeps its vruntime,
+// and cfs_enqueue()'s floor keeps it from lagging far behind the new
+// CPU's tasks. ----
+#define CFS_TARGET 80   // sched period in ticks (sim: target=80)
+#define CFS_MIN_GRAN 5  // shortest slice in ticks (sim: min_gran=5)
+#define NICE_0_LOAD 1024
+
+// Linux's sched_prio_to_weight[]; priority p maps to nice p - 16.
+static const uint32_t prio_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291, 29154, 23254, 18705, 14949, 11916,
+    9548,  7620,  6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+    1024,  820,   655,   526,   423,   335,   272,   215,   172,   137,
+    110,   87,    70,    56,    45,    36,    29,    23,    18,    15};
+
+typedef struct {
+  task_t *heap[MAX_TASKS];
+  int n;
+  uint32_t total_weight;  // of queued tasks
+  uint32_t min_vruntime;
+} cfs_queue_t;
+static cfs_queue_t cfs[MAX_CPUS];
+
+static uint32_t cfs_weight(task_t *t) { return prio_to_weight[t->prio + 4]; }
+
+// vruntime wraps; compare by signed distance.
+static bool vr_before(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+
+static void heap_set(task_t **heap, int i, task_t *t) {
+  heap[i] = t;
+  t->heap_idx = i;
+}
+static void heap_up(task_t **heap, int i) {
+  task_t *t = heap[i];
+  while (i > 0) {
+    int p = (i - 1) / 2;
+    if (!vr_before(t->vruntime, heap[p]->vruntime)) break;
+    heap_set(heap, i, heap[p]);
+    i = p;
+  }
+  heap_set(heap, i, t);
+}
+static void heap_down(task_t **heap, int n, int i) {
+  task_t *t = heap[i];
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= n) break;
+    if (c + 1 < n && vr_before(heap[c + 1]->vruntime, heap[c]->vruntime)) c++;
+    if (!vr_before(heap[c]->vruntime, t->vruntime)) break;
+    heap_set(heap, i, heap[c]);
+    i = c;
+  }
+  heap_set(heap, i, t);
+}
+
+static void update_min_vruntime(int cpu) {
+  cfs_queue_t *q = &cfs[cpu];
+  task_t *running = cpus[cpu].running;
+  uint32_t v = q->min_vruntime;
+  bool have = false;
+  if (running && running != &cpus[cpu].idle &&
+      running->state == TASK_RUNNING) {
+    v = running->vruntime;
+    have = true;
+  }
+  if (q->n && (!have || vr_before(q->heap[0]->vruntime, v)))
+    v = q->heap[0]->vruntime;
+  if (vr_before(q->min_vruntime, v)) q->min_vruntime = v;
+}
+
+static void cfs_enqueue(task_t *t) {
+  cfs_queue_t *q = &cfs[t->cpu];
+  // New and long-sleeping tasks start half a period behind the pack rather
+  // than at their stale vruntime, so they neither starve nor get starved.
+  uint32_t floor = q->min_vruntime - CFS_TARGET * NICE_0_LOAD / 2;
+  if (vr_before(t->vruntime, floor)) t->vruntime = floor;
+  heap_set(q->heap, q->n++, t);
+  heap_up(q->heap, q->n - 1);
+  q->total_weight += cfs_weight(t);
+}
+static void cfs_dequeue(task_t *t) {
+  cfs_queue_t *q = &cfs[t->cpu];
+  int i = t->heap_idx;
+  q->total_weight -= cfs_weight(t);
+  if (--q->n == i) return;
+  task_t *m = q->heap[q->n];
+  heap_set(q->heap, i, m);
+  heap_up(q->heap, i);
+  heap_down(q->heap, q->n, m->heap_idx);
+}
+static task_t *cfs_pick_next(int cpu) {
+  if (!cfs[cpu].n) return NULL;
+  task_t *t = cfs[cpu].heap[0];
+  cfs_dequeue(t);
+  update_min_vruntime(cpu);
+  return t;
+}
+// Heap order is close enough to vruntime order for picking a victim.
+static task_t *cfs_steal(int cpu) {
+  for (int i = 0; i < cfs[cpu].n; i++) {
+    task_t *t = cfs[cpu].heap[i];
+    if (task_movable(t)) {
+      cfs_dequeue(t);
+      return t;
+    }
+  }
+  return NULL;
+}
+static uint32_t cfs_slice(task_t *t) {
+  uint32_t w = cfs_weight(t);
+  uint32_t s = CFS_TARGET * w / (cfs[t->cpu].total_weight + w);  // +w: t
+  return s < CFS_MIN_GRAN ? CFS_MIN_GRAN : s;
+}
+static void cfs_tick(task_t *t) {
+  t->vruntime += (NICE_0_LOAD << 10) / cfs_weight(t);
+  update_min_vruntime(t->cpu);
+}
+static bool cfs_preempt(task_t *woken, task_t *curr) {
+  // A one-tick wakeup granularity keeps two tasks from ping-ponging.
+  return vr_before(woken->vruntime + NICE_0_LOAD, curr->vruntime);
+}
+
+const sched_class_t sched_cfs = {"cfs",         cfs_enqueue, cfs_dequeue,
+                                 cfs_pick_next, cfs_steal,   cfs_slice,
+                                 cfs_tick,      cfs_preempt};
+
+static const sched_class_t *const classes[] = {&sched_rr, &sched_cfs};
+const sched_class_t *sched = &sched_rr;
+
+const sched_class_t *sched_find(const char *name) {
+  for (size_t i = 0; i < sizeof classes / sizeof classes[0]; i++)
+    if (!strcmp(classes[i]->name, name)) return classes[i];
+  return NULL;
+}
+
+// The class names joined with '|', for usage messages.
+const char *sched_names(void) {
+  static char buf[32];
+  if (!buf[0]) {
+    char *p = buf;
+    for (size_t i = 0; i < sizeof classes / sizeof classes[0]; i++) {
+      if (i) *p++ = '|';
+      p = strcpy(p, classes[i]->name) + strlen(classes[i]->name);
+    }
+  }
+  return buf;
+}
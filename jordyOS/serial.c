@@ -0,0 +1,76 @@
+#include "kernel.h"
+
+// COM1, polled, at 115200 8N1. It only carries data out to the host (trace
+// dumps, run with `qemu -serial file:...`), so there is no receive side and
+// no IRQ.
+//
+// COM2, when a UART answers there, gets a copy of everything written to
+// terminal 1 (console.c), so a headless run can watch the shell; QEMU only
+// adds it for a second -serial (tools/qemu-batch.py).
+
+#define COM1 0x3F8
+#define COM2 0x2F8
+#define UART_DATA 0  // DLAB=0: THR/RBR; DLAB=1: divisor low byte
+#define UART_IER 1   // DLAB=1: divisor high byte
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define LSR_THRE 0x20  // transmit holding register empty
+
+bool serial_ok, serial_con;
+static mutex_t serial_lock;  // one writer at a time; a dump takes a while
+
+// Returns whether a UART is there.
+static bool uart_init(uint16_t port) {
+  outb(port + UART_IER, 0x00);  // no interrupts
+  outb(port + UART_LCR, 0x80);  // DLAB
+  outb(port + UART_DATA, 1);    // divisor 1: 115200 baud
+  outb(port + UART_IER, 0);
+  outb(port + UART_LCR, 0x03);  // 8 bits, no parity, 1 stop bit
+  outb(port + UART_FCR, 0xC7);  // FIFOs on and cleared, 14-byte trigger
+  // Loopback: a byte sent comes straight back if there is a UART at all.
+  outb(port + UART_MCR, 0x1E);
+  outb(port + UART_DATA, 0xAE);
+  bool ok = inb(port + UART_DATA) == 0xAE;
+  outb(port + UART_MCR, 0x03);  // DTR, RTS; OUT2 off keeps the IRQ masked
+  return ok;
+}
+
+void serial_init(void) {
+  mutex_init(&serial_lock, "serial");
+  serial_ok = uart_init(COM1);
+  serial_con = uart_init(COM2);
+}
+
+void serial_write(const void *p, uint32_t n) {
+  if (!serial_ok) return;
+  const uint8_t *b = p;
+  mutex_lock(&serial_lock);
+  while (n--) {
+    while (!(inb(COM1 + UART_LSR) & LSR_THRE)) __asm__ volatile("pause");
+    outb(COM1 + UART_DATA, *b++);
+  }
+  mutex_unlock(&serial_lock);
+}
+
+// Polled and taking no lock, for reports that can't wait for serial_lock or
+// the console's. Goes to COM1, or to COM2 when only that answered.
+void serial_write_polled(const char *s) {
+  if (serial_ok) {
+    for (; *s; s++) {
+      while (!(inb(COM1 + UART_LSR) & LSR_THRE)) __asm__ volatile("pause");
+      outb(COM1 + UART_DATA, *s);
+    }
+  } else if (serial_con) {
+    for (; *s; s++) serial_con_putc(*s);
+  }
+}
+
+// Called by console.c under its spinlock, maybe from an IRQ, so it only
+// polls. Newlines go out as CR LF for a terminal on the other end.
+void serial_con_putc(char c) {
+  if (c == '\n') serial_con_putc('\r');
+  while (!(inb(COM2 + UART_LSR) & LSR_THRE)) __asm__ volatile("pause");
+  outb(COM2 + UART_DATA, c);
+}
@@ -0,0 +1,290 @@
+#include "kernel.h"
+
+// Multiprocessor bring-up. smp_detect() reads the CPUs and the APICs out of
+// ACPI's MADT while paging is still off, since the tables sit wherever the
+// BIOS put them. apic_init() then enables the BSP's local APIC, routes the
+// PIT and the keyboard through the IOAPIC to the BSP, and times the LAPIC
+// timer against PIT channel 2 for the APs' ticks. smp_boot() wakes each AP
+// in turn with INIT-SIPI-SIPI into ap_boot.asm, which brings it up to
+// ap_main() in kernel.c.
+//
+// Without a MADT (or with only one CPU in it) the kernel runs on the BSP
+// alone, on the 8259 exactly as before.
+
+cpu_t cpus[MAX_CPUS];
+int ncpus = 1;
+bool ioapic_ok;
+uint32_t lapic_base, ioapic_base;
+uint32_t lapic_timer_count;
+
+static uint32_t ioapic_gsi_base;
+static struct {
+  uint32_t gsi;
+  uint16_t flags;  // MPS INTI flags: polarity in bits 0-1, trigger in 2-3
+} isa_irq[16];     // from the MADT's interrupt source overrides
+
+// ---- ACPI tables ----
+typedef struct __attribute__((packed)) {
+  char sig[8];  // "RSD PTR "
+  uint8_t checksum;
+  char oem[6];
+  uint8_t rev;
+  uint32_t rsdt;
+} rsdp_t;
+
+typedef struct __attribute__((packed)) {
+  char sig[4];
+  uint32_t len;
+  uint8_t rev, checksum;
+  char oem[6], oem_table[8];
+  uint32_t oem_rev, creator, creator_rev;
+} sdt_t;
+
+typedef struct __attribute__((packed)) {
+  sdt_t h;  // "APIC"
+  uint32_t lapic;
+  uint32_t flags;
+  uint8_t entries[];  // type, length, body
+} madt_t;
+
+#define MADT_LAPIC 0
+#define MADT_IOAPIC 1
+#define MADT_ISO 2  // interrupt source override
+
+static bool sum_ok(const void *p, uint32_t len) {
+  uint8_t s = 0;
+  for (uint32_t i = 0; i < len; i++) s += ((const uint8_t *)p)[i];
+  return s == 0;
+}
+
+static const rsdp_t *rsdp_scan(uint32_t from, uint32_t len) {
+  for (uint32_t a = from; a + sizeof(rsdp_t) <= from + len; a += 16)
+    if (!memcmp((const void *)a, "RSD PTR ", 8) && sum_ok((const void *)a, 20))
+      return (const rsdp_t *)a;
+  return NULL;
+}
+
+extern const uint16_t ebda_seg;  // placed by linker.ld
+
+// The RSDP is in the first KB of the EBDA or in the BIOS ROM area.
+static const madt_t *madt_find(void) {
+  uint32_t ebda = (uint32_t)ebda_seg << 4;
+  const rsdp_t *rp = NULL;
+  if (ebda >= 0x80000 && ebda < 0xA0000) rp = rsdp_scan(ebda, 1024);
+  if (!rp) rp = rsdp_scan(0xE0000, 0x20000);
+  if (!rp) return NULL;
+  const sdt_t *rsdt = (const sdt_t *)rp->rsdt;
+  if (memcmp(rsdt->sig, "RSDT", 4) || !sum_ok(rsdt, rsdt->len)) return NULL;
+  const uint32_t *ent = (const uint32_t *)(rsdt + 1);
+  for (uint32_t i = 0; i < (rsdt->len - sizeof *rsdt) / 4; i++) {
+    const sdt_t *t = (const sdt_t *)ent[i];
+    if (!memcmp(t->sig, "APIC", 4) && sum_ok(t, t->len))
+      return (const madt_t *)t;
+  }
+  return NULL;
+}
+
+void smp_detect(void) {
+  for (int i = 0; i < MAX_CPUS; i++) cpus[i].id = i;
+  for (int i = 0; i < 16; i++) isa_irq[i].gsi = i;
+  const madt_t *madt = madt_find();
+  if (!madt) return;
+
+  // The BSP goes first in cpus[] whatever its place in the table.
+  uint32_t a = 1, b, c, d;
+  __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "=c"(c), "=d"(d));
+  cpus[0].apic_id = b >> 24;
+  lapic_base = madt->lapic;
+  int n = 1;
+  const uint8_t *p = madt->entries, *end = (const uint8_t *)madt + madt->h.len;
+  for (; p + 2 <= end && p[1] >= 2; p += p[1]) {
+    switch (p[0]) {
+    case MADT_LAPIC:  // ACPI id, APIC id, flags (bit 0: enabled)
+      if ((*(const uint32_t *)(p + 4) & 1) && p[3] != cpus[0].apic_id &&
+          n < MAX_CPUS)
+        cpus[n++].apic_id = p[3];
+      break;
+    case MADT_IOAPIC:  // id, reserved, address, first GSI
+      if (!ioapic_base) {
+        ioapic_base = *(const uint32_t *)(p + 4);
+        ioapic_gsi_base = *(const uint32_t *)(p + 8);
+      }
+      break;
+    case MADT_ISO:  // bus, ISA IRQ, GSI, flags
+      if (p[3] < 16) {
+        isa_irq[p[3]].gsi = *(const uint32_t *)(p + 4);
+        isa_irq[p[3]].flags = *(const uint16_t *)(p + 8);
+      }
+      break;
+    }
+  }
+  ncpus = n;
+}
+
+// ---- local APIC ----
+#define LAPIC_TPR 0x80
+#define LAPIC_EOI 0xB0
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LO 0x300
+#define LAPIC_ICR_HI 0x310
+#define LAPIC_TIMER 0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR 0x390
+#define LAPIC_TIMER_DIV 0x3E0
+
+#define SVR_ENABLE 0x100
+#define ICR_PENDING 0x1000
+#define ICR_ASSERT 0x4000
+#define ICR_INIT 0x500
+#define ICR_SIPI 0x600
+#define TIMER_PERIODIC 0x20000
+#define TIMER_MASKED 0x10000
+#define TIMER_DIV16 0x3
+
+static uint32_t lapic_read(uint32_t reg) {
+  return *(volatile uint32_t *)(lapic_base + reg);
+}
+static void lapic_write(uint32_t reg, uint32_t v) {
+  *(volatile uint32_t *)(lapic_base + reg) = v;
+}
+
+// Software-enables the calling CPU's LAPIC, and with `timer` starts its
+// periodic tick at PIT_HZ.
+void lapic_init(bool timer) {
+  if (!lapic_base) return;
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, SVR_ENABLE | VEC_SPURIOUS);
+  if (!timer) return;
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIV16);
+  lapic_write(LAPIC_TIMER, TIMER_PERIODIC | VEC_LAPIC_TIMER);
+  lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+void lapic_eoi(void) {
+  if (lapic_base) lapic_write(LAPIC_EOI, 0);
+}
+
+// Callers have IRQs off, so nothing else on this CPU writes the ICR
+// between the two halves.
+static void lapic_icr(uint8_t apic_id, uint32_t lo) {
+  while (lapic_read(LAPIC_ICR_LO) & ICR_PENDING) __asm__ volatile("pause");
+  lapic_write(LAPIC_ICR_HI, (uint32_t)apic_id << 24);
+  lapic_write(LAPIC_ICR_LO, lo);
+}
+
+void lapic_ipi(uint8_t apic_id, uint8_t vector) {
+  lapic_icr(apic_id, ICR_ASSERT | vector);  // fixed delivery
+}
+
+// Busy-waits `us` microseconds (at most 54 ms) on PIT channel 2, which
+// leaves channel 0's tick alone and needs no IRQs.
+void pit_wait(uint32_t us) {
+  uint32_t count = us * (PIT_BASE_HZ / 1000) / 1000;
+  if (count > 0xFFFF) count = 0xFFFF;
+  if (count == 0) count = 1;
+  uint8_t gate = inb(0x61) & ~0x03;  // channel 2 gate low, speaker off
+  outb(0x61, gate);
+  outb(0x43, 0xB0);  // channel 2, lo/hi, mode 0: OUT rises at zero
+  outb(0x42, count & 0xFF);
+  outb(0x42, count >> 8);
+  outb(0x61, gate | 1);
+  while (!(inb(0x61) & 0x20)) __asm__ volatile("pause");
+}
+
+// ---- I/O APIC ----
+#define IOAPIC_VER 0x01
+#define IOAPIC_REDTBL 0x10
+#define RED_ACTIVE_LOW 0x2000
+#define RED_LEVEL 0x8000
+
+static uint32_t ioapic_read(uint32_t reg) {
+  *(volatile uint32_t *)ioapic_base = reg;
+  return *(volatile uint32_t *)(ioapic_base + 0x10);
+}
+static void ioapic_write(uint32_t reg, uint32_t v) {
+  *(volatile uint32_t *)ioapic_base = reg;
+  *(volatile uint32_t *)(ioapic_base + 0x10) = v;
+}
+
+// Sends ISA IRQ `irq` to `vector` on the CPU with `apic_id`, following any
+// override the MADT gave for its pin, polarity and trigger mode.
+static bool ioapic_route(int irq, uint8_t vector, uint8_t apic_id) {
+  uint32_t pin = isa_irq[irq].gsi - ioapic_gsi_base;
+  if (pin > (ioapic_read(IOAPIC_VER) >> 16 & 0xFF)) return false;
+  uint32_t lo = vector;  // fixed delivery, physical destination, unmasked
+  uint16_t fl = isa_irq[irq].flags;
+  if ((fl & 3) == 3) lo |= RED_ACTIVE_LOW;
+  if ((fl >> 2 & 3) == 3) lo |= RED_LEVEL;
+  ioapic_write(IOAPIC_REDTBL + 2 * pin + 1, (uint32_t)apic_id << 24);
+  ioapic_write(IOAPIC_REDTBL + 2 * pin, lo);
+  return true;
+}
+
+void apic_init(void) {
+  if (!lapic_base || !vm_mmio(lapic_base)) {
+    lapic_base = 0;
+    ncpus = 1;
+    return;
+  }
+  lapic_init(false);
+
+  // LAPIC timer counts per tick, over 10 ms of PIT channel 2.
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIV16);
+  lapic_write(LAPIC_TIMER, TIMER_MASKED);  // one-shot, no IRQ
+  lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+  pit_wait(10000);
+  uint32_t n = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  lapic_timer_count = n * 100 / PIT_HZ;
+  if (lapic_timer_count == 0) lapic_timer_count = 1;
+
+  if (ioapic_base && vm_mmio(ioapic_base) &&
+      ioapic_route(0, IRQ_BASE, cpus[0].apic_id) &&
+      ioapic_route(1, IRQ_BASE + 1, cpus[0].apic_id)) {
+    outb(0x21, 0xFF);  // mask both 8259s; their IRQs now come this way
+    outb(0xA1, 0xFF);
+    ioapic_ok = true;
+  }
+}
+
+// ---- AP startup ----
+#define AP_BOOT 0x91000  // trampoline page, as in ap_boot.asm
+#define AP_STACK_PAGES 2
+
+typedef struct __attribute__((packed)) {
+  uint32_t cr3, cr4;
+  uint32_t esp;
+  uint32_t cpu;
+  void (*entry)(int);
+} ap_params_t;
+
+extern const uint8_t ap_boot[], ap_boot_end[];
+extern const ap_params_t ap_params;  // inside ap_boot[]
+
+// One AP at a time, so they can share the trampoline and its parameters.
+// IRQs are still off on the BSP; the delays all come from pit_wait().
+void smp_boot(void) {
+  if (ncpus < 2) return;
+  memcpy((void *)AP_BOOT, ap_boot, ap_boot_end - ap_boot);
+  ap_params_t *p = (ap_params_t *)(AP_BOOT + ((const uint8_t *)&ap_params -
+                                              ap_boot));
+  uint32_t cr4;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+  p->cr3 = (uint32_t)kernel_pd;
+  p->cr4 = cr4;
+  p->entry = ap_main;
+  for (int i = 1; i < ncpus; i++) {
+    uint8_t *stack = pmm_alloc_pages(AP_STACK_PAGES);
+    if (!stack) break;
+    p->esp = (uint32_t)(stack + AP_STACK_PAGES * PAGE_SIZE);
+    p->cpu = i;
+    lapic_icr(cpus[i].apic_id, ICR_ASSERT | ICR_INIT);
+    pit_wait(10000);
+    for (int k = 0; k < 2 && !cpus[i].online; k++) {
+      lapic_icr(cpus[i].apic_id, ICR_ASSERT | ICR_SIPI | AP_BOOT >> 12);
+      pit_wait(200);
+    }
+    // An AP that never shows up keeps its stack, in case it is just slow.
+    for (int ms = 0; ms < 100 && !cpus[i].online; ms++) pit_wait(1000);
+  }
+}
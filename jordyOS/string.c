@@ -0,0 +1,143 @@
+#include "util.h"
+
+// String and memory routines. Bulk copies and fills use rep movsl/stosl
+// after aligning the destination; strlen/strcmp look at a word at a time.
+// Only util.h is included so bench/strbench.c can build this file for the
+// host and compare it against the old byte loops.
+
+// Word loads that may alias any object.
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+// Nonzero iff some byte of v is zero.
+#define HAS_ZERO(v) (((v) - 0x01010101u) & ~(v) & 0x80808080u)
+
+// Below this many bytes, rep's startup cost outweighs a plain word loop.
+#define REP_MIN 64
+
+void *memcpy(void *dst, const void *src, size_t n) {
+  uint8_t *d = dst;
+  const uint8_t *s = src;
+  if (n >= REP_MIN) {
+    for (; (uintptr_t)d & 3; n--) *d++ = *s++;
+    size_t words = n >> 2;
+    n &= 3;
+    __asm__ volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+  }
+  for (; n >= 4; n -= 4, d += 4, s += 4) *(word_t *)d = *(const word_t *)s;
+  while (n--) *d++ = *s++;
+  return dst;
+}
+
+void *memset(void *dst, int c, size_t n) {
+  uint8_t *d = dst;
+  uint32_t v = (uint8_t)c * 0x01010101u;
+  if (n >= REP_MIN) {
+    for (; (uintptr_t)d & 3; n--) *d++ = v;
+    size_t words = n >> 2;
+    n &= 3;
+    __asm__ volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(v) : "memory");
+  }
+  for (; n >= 4; n -= 4, d += 4) *(word_t *)d = v;
+  while (n--) *d++ = v;
+  return dst;
+}
+
+// Overlap with dst above src is copied backwards a word at a time: each
+// load is below every byte already stored. (Backward rep movs with DF set
+// skips the fast-string microcode and is slower than this loop.)
+void *memmove(void *dst, const void *src, size_t n) {
+  if ((uintptr_t)dst - (uintptr_t)src >= n) return memcpy(dst, src, n);
+  uint8_t *d = (uint8_t *)dst + n;
+  const uint8_t *s = (const uint8_t *)src + n;
+  for (; n >= 4; n -= 4) {
+    d -= 4;
+    s -= 4;
+    *(word_t *)d = *(const word_t *)s;
+  }
+  while (n--) *--d = *--s;
+  return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n) {
+  const uint8_t *p = a, *q = b;
+  for (; n >= 4 && *(const word_t *)p == *(const word_t *)q; n -= 4) {
+    p += 4;
+    q += 4;
+  }
+  for (; n; n--, p++, q++)
+    if (*p != *q) return *p - *q;
+  return 0;
+}
+
+// Aligned word loads never cross a page, so reading past the terminator
+// can't fault.
+size_t strlen(const char *s) {
+  const char *p = s;
+  for (; (uintptr_t)p & 3; p++)
+    if (!*p) return p - s;
+  while (!HAS_ZERO(*(const word_t *)p)) p += 4;
+  while (*p) p++;
+  return p - s;
+}
+
+int strcmp(const char *a, const char *b) {
+  if ((((uintptr_t)a ^ (uintptr_t)b) & 3) == 0) {
+    for (; (uintptr_t)a & 3; a++, b++)
+      if (!*a || *a != *b) goto bytes;
+    for (;;) {
+      uint32_t x = *(const word_t *)a;
+      if (x != *(const word_t *)b || HAS_ZERO(x)) break;
+      a += 4;
+      b += 4;
+    }
+  }
+bytes:
+  while (*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *(const unsigned char *)a - *(const unsigned char *)b;
+}
+
+char *strcpy(char *dst, const char *src) {
+  char *orig_dst = dst;
+  while ((*dst++ = *src++));
+  return orig_dst;
+}
+
+char *strncpy(char *dst, const char *src, size_t n) {
+  size_t i;
+  for (i = 0; i < n && src[i] != '\0'; i++) {
+    dst[i] = src[i];
+  }
+  for (; i < n; i++) {
+    dst[i] = '\0';
+  }
+  return dst;
+}
+
+int32_t atoi(const char *s) {
+  bool neg = false;
+  if (*s == '-') {
+    neg = true;
+    s++;
+  }
+  uint32_t v = 0;  // unsigned, so INT32_MIN's digits don't overflow
+  while (*s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+  return (int32_t)(neg ? 0u - v : v);
+}
+void itoa(int32_t n, char *buf) {
+  bool neg = n < 0;
+  uint32_t u = neg ? 0u - (uint32_t)n : (uint32_t)n;  // INT32_MIN too
+  char t[12];
+  int i = 0;
+  do {
+    t[i++] = '0' + (u % 10);
+    u /= 10;
+  } while (u > 0);
+  if (i == 0) t[i++] = '0';
+  if (neg) t[i++] = '-';
+  int j = 0;
+  while (i > 0) buf[j++] = t[--i];
+  buf[j] = 0;
+}
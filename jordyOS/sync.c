@@ -0,0 +1,272 @@
+#include "kernel.h"
+
+// Locks. Ticket spinlocks guard short sections that IRQ handlers may also
+// enter (take them with the _irqsave variants there). Everything else uses
+// mutexes, counting semaphores and condition variables, whose waiters
+// sleep on a FIFO wait queue through task_block()/task_wake() instead of
+// spinning. A released mutex or semaphore is handed straight to the first
+// waiter, so a task can't barge in ahead of the queue. Their state and
+// wait queues are guarded by sched_lock, the same lock task_block() needs.
+//
+// Adaptive mutexes (amutex_*) let a waiter spin first when adapt.h's
+// predictor expects the lock back sooner than parking would take.
+//
+// Every lock counts acquisitions, how many had to wait, spins, sleeps and
+// cycles held; the shell's `locks` lists them.
+
+static lock_stats_t *lock_list;
+
+// Pushed with a compare-and-swap: sched_lock registers itself here too.
+static void lock_register(lock_stats_t *s, const char *name,
+                          const char *kind) {
+  memset(s, 0, sizeof *s);
+  s->name = name;
+  s->kind = kind;
+  s->next = lock_list;
+  while (!__atomic_compare_exchange_n(&lock_list, &s->next, s, false,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+lock_stats_t *lock_stats_list(void) {
+  return __atomic_load_n(&lock_list, __ATOMIC_ACQUIRE);
+}
+
+void lock_stats_reset(void) {
+  uint32_t f = irq_save();
+  for (lock_stats_t *s = lock_stats_list(); s; s = s->next) {
+    s->acquires = s->contended = s->spins = s->sleeps = 0;
+    s->hold_cycles = 0;
+    s->hold_max = 0;
+    if (s->adapt) s->adapt->spun = s->adapt->parked = 0;
+  }
+  irq_restore(f);
+}
+
+// Called by the holder just before it lets go.
+static void hold_end(lock_stats_t *s) {
+  uint32_t dt = (uint32_t)(rdtsc() - s->since);
+  s->hold_cycles += dt;
+  if (dt > s->hold_max) s->hold_max = dt;
+}
+
+// ---- ticket spinlocks ----
+void spin_init(spinlock_t *l, const char *name) {
+  l->next = l->owner = 0;
+  lock_register(&l->stats, name, "spin");
+}
+
+void spin_lock(spinlock_t *l) {
+  uint16_t me = __atomic_fetch_add(&l->next, 1, __ATOMIC_ACQUIRE);
+  uint32_t spins = 0;
+  while (__atomic_load_n(&l->owner, __ATOMIC_ACQUIRE) != me) {
+    __asm__ volatile("pause");
+    spins++;
+  }
+  // Ours now, so the counters need no more care.
+  l->stats.acquires++;
+  l->stats.contended += spins != 0;
+  l->stats.spins += spins;
+  l->stats.since = rdtsc();
+}
+
+// Takes the lock only if nobody holds or waits for it.
+bool spin_trylock(spinlock_t *l) {
+  uint16_t me = __atomic_load_n(&l->owner, __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&l->next, &me, (uint16_t)(me + 1), false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return false;
+  l->stats.acquires++;
+  l->stats.since = rdtsc();
+  return true;
+}
+
+void spin_unlock(spinlock_t *l) {
+  hold_end(&l->stats);
+  __atomic_store_n(&l->owner, l->owner + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t spin_lock_irqsave(spinlock_t *l) {
+  uint32_t f = irq_save();
+  spin_lock(l);
+  return f;
+}
+
+void spin_unlock_irqrestore(spinlock_t *l, uint32_t f) {
+  spin_unlock(l);
+  irq_restore(f);
+}
+
+// ---- wait queues, linked through task_t.next (free while blocked) ----
+static void waitq_push(waitq_t *q, task_t *t) {
+  t->next = NULL;
+  if (q->tail)
+    q->tail->next = t;
+  else
+    q->head = t;
+  q->tail = t;
+}
+
+static task_t *waitq_pop(waitq_t *q) {
+  task_t *t = q->head;
+  if (t && (q->head = t->next) == NULL) q->tail = NULL;
+  return t;
+}
+
+// ---- mutexes ----
+void mutex_init(mutex_t *m, const char *name) {
+  m->owner = NULL;
+  m->wq.head = m->wq.tail = NULL;
+  lock_register(&m->stats, name, "mutex");
+}
+
+void mutex_lock(mutex_t *m) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *self = current();
+  if (m->owner) {
+    m->stats.contended++;
+    waitq_push(&m->wq, self);
+    while (m->owner != self) {  // set by mutex_release()
+      m->stats.sleeps++;
+      task_block();
+    }
+  } else {
+    m->owner = self;  // NULL during boot, when nothing can contend
+  }
+  m->stats.acquires++;
+  m->stats.since = rdtsc();
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// mutex_unlock() with sched_lock already held.
+static void mutex_release(mutex_t *m) {
+  hold_end(&m->stats);
+  task_t *t = waitq_pop(&m->wq);
+  m->owner = t;
+  if (t) task_wake(t);
+}
+
+void mutex_unlock(mutex_t *m) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  mutex_release(m);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// ---- adaptive mutexes: spin or park as adapt.h decides ----
+void amutex_init(amutex_t *m, const char *name) {
+  m->owner = NULL;
+  m->wq.head = m->wq.tail = NULL;
+  m->released = 0;
+  adapt_init(&m->adapt, AMUTEX_PARK_INIT, true);
+  lock_register(&m->stats, name, "amutex");
+  m->stats.adapt = &m->adapt;
+}
+
+void amutex_lock(amutex_t *m) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *self = current(), *o;
+  if (!m->owner) {
+    m->owner = self;
+  } else {
+    uint64_t t0 = rdtsc();
+    uint32_t limit = adapt_spin_limit(&m->adapt), spins = 0;
+    m->stats.contended++;
+    // Spinning only pays while the owner runs on another CPU; one that is
+    // queued or asleep can't let go before we would have parked anyway.
+    // The spin reads the owner without sched_lock, and then rechecks.
+    spin_unlock_irqrestore(&sched_lock, f);
+    while ((o = *(task_t *volatile *)&m->owner) != NULL && o != self &&
+           *(volatile task_state_t *)&o->state == TASK_RUNNING &&
+           rdtsc() - t0 < limit) {
+      __asm__ volatile("pause");
+      spins++;
+    }
+    f = spin_lock_irqsave(&sched_lock);
+    m->stats.spins += spins;
+    bool parked = m->owner != NULL;
+    if (parked) {
+      waitq_push(&m->wq, self);
+      while (m->owner != self) {  // set by amutex_unlock()
+        m->stats.sleeps++;
+        task_block();
+      }
+    } else {
+      m->owner = self;
+    }
+    adapt_wait(&m->adapt, (uint32_t)(m->released - t0), parked,
+               (uint32_t)(rdtsc() - m->released));
+  }
+  m->stats.acquires++;
+  m->stats.since = rdtsc();
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+void amutex_unlock(amutex_t *m) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  hold_end(&m->stats);
+  m->released = rdtsc();
+  task_t *t = waitq_pop(&m->wq);
+  m->owner = t;
+  if (t) task_wake(t);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// ---- counting semaphores ----
+void sem_init(sem_t *s, const char *name, int32_t count) {
+  s->count = count;
+  s->wq.head = s->wq.tail = NULL;
+  lock_register(&s->stats, name, "sem");
+}
+
+void sem_down(sem_t *s) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  s->stats.acquires++;
+  if (s->count > 0) {
+    s->count--;
+  } else {
+    // sem_up() gives its unit to us directly rather than to the count.
+    s->stats.contended++;
+    s->stats.sleeps++;
+    waitq_push(&s->wq, current());
+    task_block();
+  }
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+void sem_up(sem_t *s) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *t = waitq_pop(&s->wq);
+  if (t)
+    task_wake(t);
+  else
+    s->count++;
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+// ---- condition variables, used with a mutex ----
+void cond_init(cond_t *c) { c->wq.head = c->wq.tail = NULL; }
+
+// sched_lock is held from queueing to blocking, so a signal can't slip in
+// between the unlock and the sleep.
+void cond_wait(cond_t *c, mutex_t *m) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  waitq_push(&c->wq, current());
+  mutex_release(m);
+  task_block();
+  spin_unlock_irqrestore(&sched_lock, f);
+  mutex_lock(m);
+}
+
+void cond_signal(cond_t *c) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *t = waitq_pop(&c->wq);
+  if (t) task_wake(t);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
+
+void cond_broadcast(cond_t *c) {
+  uint32_t f = spin_lock_irqsave(&sched_lock);
+  task_t *t;
+  while ((t = waitq_pop(&c->wq)) != NULL) task_wake(t);
+  spin_unlock_irqrestore(&sched_lock, f);
+}
@@ -0,0 +1,150 @@
+#include "kernel.h"
+#include "syscall.h"
+
+// int 0x80 dispatch. Each entry checks the caller's pointers against its
+// address space before handing them to the sys_* function that kernel
+// tasks call directly. Every call is counted and timed with rdtsc into a
+// log2 histogram, shown by the shell's `syscalls`.
+
+#if USER_HEAP != STACK_TOP - 0x400000 + PAGE_SIZE
+#error "USER_HEAP must be the second page of the stack page table"
+#endif
+
+syscall_stats_t syscall_stats[NSYSCALLS];
+static spinlock_t stats_lock;  // calls on other CPUs update them too
+
+void syscall_init(void) { spin_init(&stats_lock, "syscall"); }
+
+// The NUL-terminated string at `a`, or NULL if it isn't all readable.
+static const char *ustr(uint32_t a) {
+  return vm_user_strlen(current()->pd, a, FS_NBLOCKS * FS_BLOCK_SIZE) >= 0
+             ? (const char *)a
+             : NULL;
+}
+static bool ubuf(uint32_t a, int32_t len, bool write) {
+  return len >= 0 && vm_user_ok(current()->pd, a, len, write);
+}
+
+static int32_t do_write(const uint32_t *a) {
+  if (!ustr(a[0])) return SYS_EFAULT;
+  sys_write((const char *)a[0]);
+  return 0;
+}
+static int32_t do_getc(const uint32_t *a) {
+  (void)a;
+  return (uint8_t)sys_getc();
+}
+static int32_t do_yield(const uint32_t *a) {
+  (void)a;
+  sys_yield();
+  return 0;
+}
+static int32_t do_exit(const uint32_t *a) {
+  (void)a;
+  sys_exit_task();
+  return 0;
+}
+static int32_t do_sleep(const uint32_t *a) {
+  sys_sleep(a[0]);
+  return 0;
+}
+static int32_t do_clear(const uint32_t *a) {
+  (void)a;
+  sys_clear_screen();
+  return 0;
+}
+
+// Grows the heap by a[0] bytes; returns the old break, or -1.
+static int32_t do_sbrk(const uint32_t *a) {
+  task_t *self = current();
+  uint32_t old = self->brk, brk = old + a[0];
+  if (brk < old || brk > (uint32_t)self->stack_lo - PAGE_SIZE) return -1;
+  vm_reserve(self->pd, old, brk);
+  self->brk = brk;
+  return (int32_t)old;
+}
+
+static int32_t do_list_files(const uint32_t *a) {
+  if (!ubuf(a[0], a[1], true)) return SYS_EFAULT;
+  return sys_list_files((char *)a[0], a[1]);
+}
+static int32_t do_read_file(const uint32_t *a) {
+  if (!ustr(a[0]) || !ubuf(a[1], a[2], true)) return SYS_EFAULT;
+  return sys_read_file((const char *)a[0], (char *)a[1], a[2]);
+}
+static int32_t do_write_file(const uint32_t *a) {
+  if (!ustr(a[0]) || !ubuf(a[1], a[2], false)) return SYS_EFAULT;
+  return sys_write_file((const char *)a[0], (const char *)a[1], a[2]);
+}
+static int32_t do_delete_file(const uint32_t *a) {
+  if (!ustr(a[0])) return SYS_EFAULT;
+  return sys_delete_file((const char *)a[0]);
+}
+static int32_t do_file_size(const uint32_t *a) {
+  if (!ustr(a[0])) return SYS_EFAULT;
+  return sys_file_size((const char *)a[0]);
+}
+static int32_t do_pread(const uint32_t *a) {
+  if (!ustr(a[0]) || !ubuf(a[1], a[2], true)) return SYS_EFAULT;
+  return sys_pread((const char *)a[0], (void *)a[1], a[2], a[3]);
+}
+static int32_t do_pwrite(const uint32_t *a) {
+  if (!ustr(a[0]) || !ubuf(a[1], a[2], false)) return SYS_EFAULT;
+  return sys_pwrite((const char *)a[0], (const void *)a[1], a[2], a[3]);
+}
+static int32_t do_truncate(const uint32_t *a) {
+  if (!ustr(a[0])) return SYS_EFAULT;
+  return sys_truncate((const char *)a[0], a[1]);
+}
+
+static const struct {
+  const char *name;
+  int32_t (*fn)(const uint32_t *args);
+} table[NSYSCALLS] = {
+    [SYS_WRITE] = {"write", do_write},
+    [SYS_GETC] = {"getc", do_getc},
+    [SYS_YIELD] = {"yield", do_yield},
+    [SYS_EXIT] = {"exit", do_exit},
+    [SYS_SLEEP] = {"sleep", do_sleep},
+    [SYS_CLEAR] = {"clear", do_clear},
+    [SYS_SBRK] = {"sbrk", do_sbrk},
+    [SYS_LIST_FILES] = {"list_files", do_list_files},
+    [SYS_READ_FILE] = {"read_file", do_read_file},
+    [SYS_WRITE_FILE] = {"write_file", do_write_file},
+    [SYS_DELETE_FILE] = {"delete_file", do_delete_file},
+    [SYS_FILE_SIZE] = {"file_size", do_file_size},
+    [SYS_PREAD] = {"pread", do_pread},
+    [SYS_PWRITE] = {"pwrite", do_pwrite},
+    [SYS_TRUNCATE] = {"truncate", do_truncate},
+};
+
+const char *syscall_name(int n) {
+  return n >= 0 && n < NSYSCALLS ? table[n].name : NULL;
+}
+
+// Called from isr_dispatch() for int 0x80, through a trap gate, so IRQs
+// stay on as they would for a direct call.
+void syscall_dispatch(regs_t *r) {
+  uint32_t n = r->eax;
+  if (n >= NSYSCALLS) {
+    r->eax = (uint32_t)SYS_ENOSYS;
+    return;
+  }
+  uint32_t args[4] = {r->ebx, r->ecx, r->edx, r->esi};
+  trace(TR_SYSCALL, n);
+  uint64_t t0 = rdtsc();
+  r->eax = (uint32_t)table[n].fn(args);
+  uint32_t dt = (uint32_t)(rdtsc() - t0);
+  trace(TR_SYSCALL | TR_END, n);
+
+  syscall_stats_t *s = &syscall_stats[n];
+  int b = 31 - __builtin_clz(dt | 1) - SYSCALL_HIST_MIN;
+  if (b < 0) b = 0;
+  if (b >= SYSCALL_HIST) b = SYSCALL_HIST - 1;
+  uint32_t f = spin_lock_irqsave(&stats_lock);
+  s->calls++;
+  s->cycles += dt;
+  if (dt > s->max) s->max = dt;
+  s->hist[b]++;
+  spin_unlock_irqrestore(&stats_lock, f);
+}
@@ -0,0 +1,42 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+// System call ABI between ring-3 tasks and the kernel: `int 0x80` with the
+// call number in EAX and up to four arguments in EBX, ECX, EDX and ESI; the
+// result comes back in EAX. Kept free of kernel headers so the user side
+// (usys.c) can use it too.
+
+#define SYSCALL_VECTOR 0x80
+
+#define SYS_WRITE 0
+#define SYS_GETC 1
+#define SYS_YIELD 2
+#define SYS_EXIT 3
+#define SYS_SLEEP 4
+#define SYS_CLEAR 5
+#define SYS_SBRK 6
+#define SYS_LIST_FILES 7
+#define SYS_READ_FILE 8
+#define SYS_WRITE_FILE 9
+#define SYS_DELETE_FILE 10
+#define SYS_FILE_SIZE 11
+#define SYS_PREAD 12
+#define SYS_PWRITE 13
+#define SYS_TRUNCATE 14
+#define NSYSCALLS 15
+
+#define SYS_EFAULT -14  // a pointer argument the caller can't access
+#define SYS_ENOSYS -38
+
+// Programs are ELF32 executables linked to run from USER_BASE (app.ld);
+// their segments must lie below USER_END, where the APICs' registers are
+// mapped.
+#define USER_BASE 0x40000000u
+#define USER_END 0xFEC00000u
+
+// The heap SYS_SBRK grows starts here in every ring-3 address space, just
+// above the unmapped page at the bottom of the stack page table. Pages are
+// reserved only as SYS_SBRK reaches them.
+#define USER_HEAP 0xFF801000u
+
+#endif
@@ -0,0 +1,412 @@
+// Unit tests for the portable kernel code in libkhost.a (hal.h): the file
+// system through the block cache, string.c's number conversions, line
+// editing and command parsing, and the scheduling classes' pick-next.
+//
+//   make test                    build and run them all
+//   ./ktest [-v] [filter]        those whose name contains filter
+//
+// Each test runs in a child process, so every one starts with a fresh
+// cache, file system and run queues, and a crash fails only that test.
+// Disk tests put their image in a temporary file; -v keeps the kernel's
+// own messages (fs: mounted ...) instead of discarding them.
+
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../kernel.h"
+
+static int failures;
+
+#define CHECK(cond)                                                    \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      printf("    %s:%d: CHECK(%s)\n", __FILE__, __LINE__, #cond);     \
+      failures++;                                                      \
+    }                                                                  \
+  } while (0)
+#define CHECK_EQ(a, b)                                                 \
+  do {                                                                 \
+    long long a_ = (a), b_ = (b);                                      \
+    if (a_ != b_) {                                                    \
+      printf("    %s:%d: %s == %lld, expected %lld\n", __FILE__,       \
+             __LINE__, #a, a_, b_);                                    \
+      failures++;                                                      \
+    }                                                                  \
+  } while (0)
+#define CHECK_STR(a, b)                                                \
+  do {                                                                 \
+    const char *a_ = (a), *b_ = (b);                                   \
+    if (!a_ || strcmp(a_, b_)) {                                       \
+      printf("    %s:%d: %s == \"%s\", expected \"%s\"\n", __FILE__,   \
+             __LINE__, #a, a_ ? a_ : "(null)", b_);                    \
+      failures++;                                                      \
+    }                                                                  \
+  } while (0)
+
+// ---- setup ----
+static char disk_path[64];
+
+static void ram_fs(void) {
+  bcache_init();
+  fs_init();
+}
+
+static void disk_fs(void) {
+  if (hal_disk_open(disk_path) < 0) {
+    perror(disk_path);
+    exit(1);
+  }
+  bcache_init();
+  fs_init();
+}
+
+static bool all_zero(const uint8_t *p, int n) {
+  for (int i = 0; i < n; i++)
+    if (p[i]) return false;
+  return true;
+}
+
+static uint8_t pattern[5 * FS_BLOCK_SIZE + 100], got[sizeof pattern];
+
+// ---- string.c ----
+static void t_itoa_atoi(void) {
+  static const int32_t v[] = {0,     1,          -1,         9,
+                              10,    -10,        99999,      1000000,
+                              -4096, 2147483647, -2147483647 - 1};
+  char nb[12];
+  for (size_t i = 0; i < sizeof v / sizeof v[0]; i++) {
+    itoa(v[i], nb);
+    char want[16];
+    snprintf(want, sizeof want, "%ld", (long)v[i]);
+    CHECK_STR(nb, want);
+    CHECK_EQ(atoi(nb), v[i]);
+  }
+  CHECK_EQ(atoi(""), 0);
+  CHECK_EQ(atoi("-"), 0);
+  CHECK_EQ(atoi("42abc"), 42);
+  CHECK_EQ(atoi("abc"), 0);
+  CHECK_EQ(atoi("007"), 7);
+}
+
+// ---- line.c ----
+static void t_line_key(void) {
+  char buf[8];
+  int len = 0;
+  CHECK_EQ(line_key(buf, &len, sizeof buf, 'a'), LINE_ECHO);
+  CHECK_EQ(line_key(buf, &len, sizeof buf, 'b'), LINE_ECHO);
+  CHECK_EQ(line_key(buf, &len, sizeof buf, '\b'), LINE_ERASE);
+  CHECK_EQ(line_key(buf, &len, sizeof buf, 127), LINE_ERASE);
+  CHECK_EQ(len, 0);
+  CHECK_EQ(line_key(buf, &len, sizeof buf, '\b'), LINE_IGNORE);  // empty
+  CHECK_EQ(line_key(buf, &len, sizeof buf, '\t'), LINE_IGNORE);
+  for (const char *k = "abcdefghij"; *k; k++) line_key(buf, &len, sizeof buf, *k);
+  CHECK_EQ(len, (int)sizeof buf - 1);  // full: the rest are ignored
+  CHECK_EQ(line_key(buf, &len, sizeof buf, 'z'), LINE_IGNORE);
+  CHECK_EQ(line_key(buf, &len, sizeof buf, '\n'), LINE_DONE);
+  CHECK_STR(buf, "abcdefg");
+}
+
+static void t_cmd_arg(void) {
+  CHECK_STR(cmd_arg("trace", "trace"), "");
+  CHECK_STR(cmd_arg("trace on", "trace"), "on");
+  CHECK_STR(cmd_arg("trace   on sw", "trace"), "on sw");
+  CHECK(cmd_arg("tracer", "trace") == NULL);
+  CHECK(cmd_arg("trac", "trace") == NULL);
+  CHECK(cmd_arg("", "trace") == NULL);
+  CHECK(cmd_arg(" trace", "trace") == NULL);
+}
+
+static void t_next_word(void) {
+  char w[6];
+  const char *rest = next_word("run  calc now", w, sizeof w);
+  CHECK_STR(w, "run");
+  CHECK_STR(rest, "calc now");
+  rest = next_word("toolongword x", w, sizeof w);
+  CHECK_STR(w, "toolo");  // cut to max - 1
+  CHECK_STR(rest, "x");
+  rest = next_word("", w, sizeof w);
+  CHECK_STR(w, "");
+  CHECK_STR(rest, "");
+}
+
+// ---- fs.c through bcache.c ----
+static void t_fs_roundtrip(void) {
+  ram_fs();
+  for (size_t i = 0; i < sizeof pattern; i++) pattern[i] = (uint8_t)(i * 7 + 3);
+  CHECK_EQ(sys_pwrite("a", pattern, sizeof pattern, 0), (int)sizeof pattern);
+  CHECK_EQ(sys_file_size("a"), (int)sizeof pattern);
+  CHECK_EQ(sys_pread("a", got, sizeof got, 0), (int)sizeof pattern);
+  CHECK(!memcmp(got, pattern, sizeof pattern));
+
+  // Across block boundaries, and short at the end of the file.
+  memset(got, 0, sizeof got);
+  CHECK_EQ(sys_pread("a", got, 2000, FS_BLOCK_SIZE - 10), 2000);
+  CHECK(!memcmp(got, pattern + FS_BLOCK_SIZE - 10, 2000));
+  CHECK_EQ(sys_pread("a", got, 500, sizeof pattern - 100), 100);
+  CHECK_EQ(sys_pread("a", got, 10, sizeof pattern + 5), 0);
+
+  // Overwrite in the middle; the rest stays.
+  CHECK_EQ(sys_pwrite("a", "XYZ", 3, 1500), 3);
+  CHECK_EQ(sys_pread("a", got, sizeof got, 0), (int)sizeof pattern);
+  CHECK(!memcmp(got, pattern, 1500));
+  CHECK(!memcmp(got + 1500, "XYZ", 3));
+  CHECK(!memcmp(got + 1503, pattern + 1503, sizeof pattern - 1503));
+
+  CHECK_EQ(sys_pread("missing", got, 1, 0), -1);
+  CHECK_EQ(sys_pwrite("a-name-far-too-long", "x", 1, 0), -2);
+}
+
+static void t_fs_holes(void) {
+  ram_fs();
+  // A write past the end leaves a hole that reads back as zeros.
+  CHECK_EQ(sys_pwrite("h", "end", 3, 5000), 3);
+  CHECK_EQ(sys_file_size("h"), 5003);
+  memset(got, 0xAA, sizeof got);
+  CHECK_EQ(sys_pread("h", got, 5003, 0), 5003);
+  CHECK(all_zero(got, 5000));
+  CHECK(!memcmp(got + 5000, "end", 3));
+}
+
+static void t_fs_truncate(void) {
+  ram_fs();
+  memset(pattern, 0x5A, sizeof pattern);
+  CHECK_EQ(sys_pwrite("t", pattern, 3000, 0), 3000);
+  CHECK_EQ(sys_truncate("t", 1200), 0);
+  CHECK_EQ(sys_file_size("t"), 1200);
+  // Growing again must not bring the old bytes back.
+  CHECK_EQ(sys_truncate("t", 3000), 0);
+  CHECK_EQ(sys_file_size("t"), 3000);
+  memset(got, 0xAA, sizeof got);
+  CHECK_EQ(sys_pread("t", got, 3000, 0), 3000);
+  CHECK(!memcmp(got, pattern, 1200));
+  CHECK(all_zero(got + 1200, 1800));
+  CHECK_EQ(sys_truncate("t", 0), 0);
+  CHECK_EQ(sys_pread("t", got, 10, 0), 0);
+  CHECK_EQ(sys_truncate("missing", 10), -1);
+
+  // sys_write_file() replaces the contents and trims the rest.
+  CHECK_EQ(sys_write_file("w", "longer text", 11), 0);
+  CHECK_EQ(sys_write_file("w", "short", 5), 0);
+  char small[16] = {0};
+  CHECK_EQ(sys_read_file("w", small, sizeof small), 5);
+  CHECK_STR(small, "short");
+}
+
+static void t_fs_delete(void) {
+  ram_fs();
+  uint32_t free0 = fs_free_blocks;
+  memset(pattern, 1, sizeof pattern);
+  CHECK_EQ(sys_pwrite("d", pattern, sizeof pattern, 0), (int)sizeof pattern);
+  CHECK(fs_free_blocks < free0);
+  CHECK_EQ(sys_delete_file("d"), 0);
+  CHECK_EQ(fs_free_blocks, free0);  // every block given back
+  CHECK_EQ(sys_file_size("d"), -1);
+  CHECK_EQ(sys_delete_file("d"), -1);
+  // A new file of the same name starts empty.
+  CHECK_EQ(sys_pwrite("d", "x", 1, 0), 1);
+  CHECK_EQ(sys_file_size("d"), 1);
+}
+
+// Deleting leaves a tombstone in the directory's probe chain; creates must
+// reuse them, or churn would fill the table with no live files in it.
+static void t_fs_tombstones(void) {
+  ram_fs();
+  char name[16];
+  CHECK_EQ(sys_pwrite("keep", "k", 1, 0), 1);
+  for (int i = 0; i < 4 * FS_DIR_SLOTS; i++) {
+    snprintf(name, sizeof name, "f%d", i);
+    CHECK_EQ(sys_pwrite(name, "x", 1, 0), 1);
+    CHECK_EQ(sys_delete_file(name), 0);
+    if (failures) return;
+  }
+  // Names whose chains run through the tombstones are still found.
+  CHECK_EQ(sys_file_size("keep"), 1);
+  char list[256];
+  CHECK_EQ(sys_list_files(list, sizeof list), 4);
+  CHECK_STR(list, "keep");
+  for (int i = 0; i < MAX_FILES - 1; i++) {
+    snprintf(name, sizeof name, "g%d", i);
+    CHECK_EQ(sys_pwrite(name, "y", 1, 0), 1);
+  }
+  CHECK_EQ(sys_pwrite("one-too-many", "z", 1, 0), -4);  // out of inodes
+}
+
+// ---- persistence, on an image file opened with hal_disk_open() ----
+static void t_disk_persist_write(void) {
+  disk_fs();
+  for (size_t i = 0; i < sizeof pattern; i++) pattern[i] = (uint8_t)(i ^ 0x3C);
+  CHECK_EQ(sys_pwrite("saved", pattern, sizeof pattern, 0),
+           (int)sizeof pattern);
+  CHECK_EQ(sys_pwrite("gone", "x", 1, 0), 1);
+  CHECK_EQ(sys_delete_file("gone"), 0);
+  CHECK(bsync() >= 0);
+  CHECK_EQ(bcache_ndirty(), 0);
+}
+
+static void t_disk_persist_read(void) {
+  disk_fs();
+  for (size_t i = 0; i < sizeof pattern; i++) pattern[i] = (uint8_t)(i ^ 0x3C);
+  CHECK_EQ(sys_file_size("saved"), (int)sizeof pattern);
+  CHECK_EQ(sys_pread("saved", got, sizeof got, 0), (int)sizeof pattern);
+  CHECK(!memcmp(got, pattern, sizeof pattern));
+  CHECK_EQ(sys_file_size("gone"), -1);
+  CHECK_EQ(bcache_stats.errors, 0);
+}
+
+// A disk that can't be read is left alone: no format, calls fail with
+// FS_EIO. The image shrinks under the open descriptor, so every read of
+// block 0 comes back short.
+static void t_disk_read_error(void) {
+  if (truncate(disk_path, 512) < 0) {
+    perror(disk_path);
+    exit(1);
+  }
+  if (hal_disk_open(disk_path) < 0) exit(1);
+  ata_sectors = 2 * FS_NBLOCKS;  // as if the drive were still that size
+  bcache_init();
+  fs_init();
+  CHECK(bcache_stats.errors > 0);
+  CHECK_EQ(sys_pwrite("x", "x", 1, 0), FS_EIO);
+  CHECK_EQ(sys_file_size("x"), FS_EIO);
+  CHECK(bsync() >= 0);
+  struct stat st;
+  CHECK(stat(disk_path, &st) == 0 && st.st_size == 512);  // nothing written
+}
+
+// ---- sched.c ----
+static task_t tasks[8];
+
+static void t_sched_rr(void) {
+  const sched_class_t *c = sched_find("rr");
+  CHECK(c != NULL);
+  static const uint8_t prio[8] = {16, 3, 16, 31, 3, 0, 16, 20};
+  for (int i = 0; i < 8; i++) {
+    tasks[i].tid = i;
+    tasks[i].prio = prio[i];
+    c->enqueue(&tasks[i]);
+  }
+  // Highest priority (lowest number) first, FIFO within a level.
+  static const int order[8] = {5, 1, 4, 0, 2, 6, 7, 3};
+  for (int i = 0; i < 8; i++) {
+    task_t *t = c->pick_next(0);
+    CHECK(t != NULL);
+    if (t) CHECK_EQ(t->tid, order[i]);
+  }
+  CHECK(c->pick_next(0) == NULL);
+
+  // Dequeue from the middle keeps the rest in order.
+  for (int i = 0; i < 3; i++) {
+    tasks[i].prio = PRIO_DEFAULT;
+    c->enqueue(&tasks[i]);
+  }
+  c->dequeue(&tasks[1]);
+  CHECK_EQ(c->pick_next(0)->tid, 0);
+  CHECK_EQ(c->pick_next(0)->tid, 2);
+  CHECK(c->pick_next(0) == NULL);
+  CHECK(c->preempt(&tasks[5], &tasks[0]));  // prio 0 beats 16
+  CHECK(!c->preempt(&tasks[0], &tasks[5]));
+}
+
+static void t_sched_cfs(void) {
+  const sched_class_t *c = sched_find("cfs");
+  CHECK(c != NULL);
+  static const uint32_t vr[6] = {500, 100, 900, 300, 100000, 200};
+  for (int i = 0; i < 6; i++) {
+    tasks[i].tid = i;
+    tasks[i].prio = PRIO_DEFAULT;
+    tasks[i].vruntime = vr[i];
+    c->enqueue(&tasks[i]);
+  }
+  // Always the lowest vruntime.
+  static const int order[6] = {1, 5, 3, 0, 2, 4};
+  for (int i = 0; i < 6; i++) {
+    task_t *t = c->pick_next(0);
+    CHECK(t != NULL);
+    if (t) CHECK_EQ(t->tid, order[i]);
+  }
+  CHECK(c->pick_next(0) == NULL);
+
+  // A tick costs a high-priority task less vruntime than a low one.
+  tasks[0].vruntime = tasks[1].vruntime = 0;
+  tasks[0].prio = PRIO_DEFAULT - 5;
+  tasks[1].prio = PRIO_DEFAULT + 5;
+  c->tick(&tasks[0]);
+  c->tick(&tasks[1]);
+  CHECK(tasks[0].vruntime < 1024);
+  CHECK(tasks[1].vruntime > 1024);
+  // And its slice is longer when they share a queue.
+  c->enqueue(&tasks[1]);
+  CHECK(c->slice(&tasks[0]) > c->slice(&tasks[1]));
+}
+
+typedef struct {
+  const char *name;
+  void (*fn)(void);
+  bool disk;  // needs disk_path
+} test_t;
+
+// In order: the persist_read test reads what persist_write left.
+static const test_t tests[] = {
+    {"itoa_atoi", t_itoa_atoi, false},
+    {"line_key", t_line_key, false},
+    {"cmd_arg", t_cmd_arg, false},
+    {"next_word", t_next_word, false},
+    {"fs_roundtrip", t_fs_roundtrip, false},
+    {"fs_holes", t_fs_holes, false},
+    {"fs_truncate", t_fs_truncate, false},
+    {"fs_delete", t_fs_delete, false},
+    {"fs_tombstones", t_fs_tombstones, false},
+    {"disk_persist_write", t_disk_persist_write, true},
+    {"disk_persist_read", t_disk_persist_read, true},
+    {"disk_read_error", t_disk_read_error, true},
+    {"sched_rr", t_sched_rr, false},
+    {"sched_cfs", t_sched_cfs, false},
+};
+
+int main(int argc, char **argv) {
+  bool verbose = false;
+  const char *filter = "";
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v"))
+      verbose = true;
+    else
+      filter = argv[i];
+  }
+  strcpy(disk_path, "/tmp/ktest-XXXXXX");
+  int fd = mkstemp(disk_path);
+  if (fd < 0 || ftruncate(fd, (off_t)FS_NBLOCKS * FS_BLOCK_SIZE) < 0) {
+    perror("disk image");
+    return 1;
+  }
+  close(fd);
+
+  int run = 0, failed = 0;
+  for (size_t i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+    const test_t *t = &tests[i];
+    if (!strstr(t->name, filter)) continue;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      if (!verbose) freopen("/dev/null", "w", stderr);
+      t->fn();
+      fflush(stdout);
+      _exit(failures ? 1 : 0);
+    }
+    int st = 0;
+    waitpid(pid, &st, 0);
+    bool ok = WIFEXITED(st) && WEXITSTATUS(st) == 0;
+    if (WIFSIGNALED(st)) printf("    killed by signal %d\n", WTERMSIG(st));
+    printf("%-4s %s\n", ok ? "ok" : "FAIL", t->name);
+    run++;
+    failed += !ok;
+  }
+  unlink(disk_path);
+  printf("%d of %d tests passed\n", run - failed, run);
+  return failed ? 1 : 0;
+}
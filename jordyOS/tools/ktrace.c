@@ -0,0 +1,710 @@
+// Host tool: reads what the shell's `trace dump` sent over COM1 (layout in
+// trace.h) and shows where the kernel's time went.
+//
+//   ./ktrace [-f|-g|-t] serial.out [kernel.elf [calc.elf ...]]
+//
+// Without an option it prints a summary: events by type, the time spent in
+// system calls, file system calls and IRQs, each task's CPU time, and the
+// functions the profiling samples landed in, by themselves ("self") and
+// with their callers ("total", PROFILE=1 kernels only).
+//   -f  the samples as folded stacks, for flamegraph.pl
+//   -g  the samples as a flame graph SVG
+//   -t  the whole trace as Chrome trace-event JSON, a timeline for
+//       chrome://tracing or ui.perfetto.dev
+// Kernel addresses are named from kernel.elf; samples taken in ring 3 from
+// the program ELF named like the task. If serial.out holds several dumps,
+// the last complete one is read.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../syscall.h"
+#include "../trace.h"
+
+// ---- symbols: STT_FUNC entries of an ELF32 .symtab ----
+typedef struct {
+  uint8_t ident[16];
+  uint16_t type, machine;
+  uint32_t version, entry, phoff, shoff, flags;
+  uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+} elf_hdr_t;
+
+typedef struct {
+  uint32_t name, type, flags, addr, offset, size, link, info, align, entsize;
+} elf_shdr_t;
+
+typedef struct {
+  uint32_t name, value, size;
+  uint8_t info, other;
+  uint16_t shndx;
+} elf_sym_t;
+
+#define SHT_SYMTAB 2
+#define STT_FUNC 2
+
+typedef struct {
+  uint32_t addr, size;
+  const char *name;
+} sym_t;
+
+typedef struct {
+  char prog[TRACE_NAME_LEN];  // task name it applies to; "" for the kernel
+  sym_t *syms;
+  size_t n;
+} symtab_t;
+
+#define MAX_ELFS 16
+static symtab_t tabs[MAX_ELFS];  // [0]: the kernel
+static int ntabs;
+
+static uint8_t *slurp(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *p = malloc(*len ? *len : 1);
+  if (p && fread(p, 1, *len, f) != *len) {
+    free(p);
+    p = NULL;
+  }
+  fclose(f);
+  return p;
+}
+
+static int sym_cmp(const void *a, const void *b) {
+  uint32_t x = ((const sym_t *)a)->addr, y = ((const sym_t *)b)->addr;
+  return x < y ? -1 : x > y;
+}
+
+// The image stays allocated: the names point into it.
+static bool load_elf(const char *path, symtab_t *t) {
+  size_t len;
+  uint8_t *img = slurp(path, &len);
+  const elf_hdr_t *eh = (const elf_hdr_t *)img;
+  if (!img || len < sizeof *eh || memcmp(img, "\177ELF", 4) || img[4] != 1 ||
+      eh->shentsize != sizeof(elf_shdr_t) ||
+      eh->shoff + (size_t)eh->shnum * sizeof(elf_shdr_t) > len) {
+    fprintf(stderr, "%s: not an ELF32 file\n", path);
+    return false;
+  }
+  const elf_shdr_t *sh = (const elf_shdr_t *)(img + eh->shoff);
+  for (int i = 0; i < eh->shnum; i++) {
+    if (sh[i].type != SHT_SYMTAB || sh[i].link >= eh->shnum) continue;
+    const elf_shdr_t *str = &sh[sh[i].link];
+    if (sh[i].offset + (size_t)sh[i].size > len ||
+        str->offset + (size_t)str->size > len)
+      continue;
+    const elf_sym_t *s = (const elf_sym_t *)(img + sh[i].offset);
+    size_t n = sh[i].size / sizeof *s;
+    t->syms = calloc(n, sizeof *t->syms);
+    for (size_t k = 0; k < n; k++)
+      if ((s[k].info & 0xF) == STT_FUNC && s[k].value &&
+          s[k].name < str->size)
+        t->syms[t->n++] = (sym_t){s[k].value, s[k].size,
+                                  (const char *)img + str->offset + s[k].name};
+    qsort(t->syms, t->n, sizeof *t->syms, sym_cmp);
+  }
+  if (t->n == 0) fprintf(stderr, "%s: no function symbols\n", path);
+  return true;
+}
+
+// The function containing `a`, or `a` in hex.
+static const char *addr_name(const symtab_t *t, uint32_t a, char *buf) {
+  if (t && t->n) {
+    size_t lo = 0, hi = t->n;
+    while (hi - lo > 1) {
+      size_t mid = (lo + hi) / 2;
+      if (t->syms[mid].addr <= a)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    const sym_t *s = &t->syms[lo];
+    if (s->addr <= a && (!s->size || a < s->addr + s->size)) return s->name;
+  }
+  sprintf(buf, "0x%x", a);
+  return buf;
+}
+
+// ---- the dump ----
+#define MAX_TIDS 4096
+
+static trace_hdr_t hdr;
+static char (*names)[TRACE_NAME_LEN];
+static trace_rec_t *recs;  // all CPUs, by time
+static size_t nrecs;
+
+typedef struct {
+  trace_rec_t r;
+  size_t seq;
+} ev_t;
+
+// By time, and in recorded order for a tie, which only a CPU's own
+// records can have.
+static int ev_cmp(const void *a, const void *b) {
+  const ev_t *x = a, *y = b;
+  if (x->r.tsc != y->r.tsc) return x->r.tsc < y->r.tsc ? -1 : 1;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static bool load_dump(const char *path) {
+  size_t len;
+  uint8_t *buf = slurp(path, &len);
+  if (!buf) {
+    perror(path);
+    return false;
+  }
+  for (size_t off = len >= sizeof hdr ? len - sizeof hdr + 1 : 0; off-- > 0;) {
+    memcpy(&hdr, buf + off, sizeof hdr);
+    if (hdr.magic != TRACE_MAGIC || hdr.version != TRACE_VERSION ||
+        hdr.ntasks > MAX_TIDS || hdr.nrecs > len || hdr.tsc_khz == 0)
+      continue;
+    size_t names_len = (size_t)hdr.ntasks * TRACE_NAME_LEN;
+    if (sizeof hdr + names_len + hdr.nrecs * sizeof(trace_rec_t) > len - off)
+      continue;  // cut short
+    const uint8_t *p = buf + off + sizeof hdr;
+    names = malloc(names_len + 1);
+    memcpy(names, p, names_len);
+    for (uint32_t i = 0; i < hdr.ntasks; i++)
+      names[i][TRACE_NAME_LEN - 1] = '\0';
+    p += names_len;
+    nrecs = hdr.nrecs;
+    ev_t *ev = malloc((nrecs ? nrecs : 1) * sizeof *ev);
+    for (size_t i = 0; i < nrecs; i++) {
+      memcpy(&ev[i].r, p + i * sizeof(trace_rec_t), sizeof(trace_rec_t));
+      ev[i].seq = i;
+    }
+    qsort(ev, nrecs, sizeof *ev, ev_cmp);
+    recs = malloc((nrecs ? nrecs : 1) * sizeof *recs);
+    for (size_t i = 0; i < nrecs; i++) recs[i] = ev[i].r;
+    free(ev);
+    free(buf);
+    return true;
+  }
+  fprintf(stderr, "%s: no complete trace dump\n", path);
+  return false;
+}
+
+static const char *task(int tid, char *buf) {
+  if (tid < 0) return "idle";
+  if ((uint32_t)tid < hdr.ntasks && names[tid][0]) return names[tid];
+  sprintf(buf, "tid %d", tid);
+  return buf;
+}
+
+static double usec(uint64_t tsc) {
+  return (double)(tsc - (nrecs ? recs[0].tsc : 0)) * 1000.0 / hdr.tsc_khz;
+}
+
+static const char *const type_names[NTRACE_TYPES] = {
+    [TR_SWITCH] = "switch",     [TR_SYSCALL] = "syscall",
+    [TR_IRQ] = "irq",           [TR_FS] = "fs",
+    [TR_KMALLOC] = "kmalloc",   [TR_KFREE] = "kfree",
+    [TR_PAGES] = "pages",       [TR_PAGES_FREE] = "pages_free",
+    [TR_SAMPLE] = "sample",     [TR_FRAME] = "frame"};
+
+static const char *const sys_names[NSYSCALLS] = {
+    [SYS_WRITE] = "write",           [SYS_GETC] = "getc",
+    [SYS_YIELD] = "yield",           [SYS_EXIT] = "exit",
+    [SYS_SLEEP] = "sleep",           [SYS_CLEAR] = "clear",
+    [SYS_SBRK] = "sbrk",             [SYS_LIST_FILES] = "list_files",
+    [SYS_READ_FILE] = "read_file",   [SYS_WRITE_FILE] = "write_file",
+    [SYS_DELETE_FILE] = "delete_file", [SYS_FILE_SIZE] = "file_size",
+    [SYS_PREAD] = "pread",           [SYS_PWRITE] = "pwrite",
+    [SYS_TRUNCATE] = "truncate"};
+
+static const char *const fs_names[NTR_FS_OPS] = {
+    [TR_FS_LIST] = "list",   [TR_FS_SIZE] = "size",
+    [TR_FS_PREAD] = "pread", [TR_FS_PWRITE] = "pwrite",
+    [TR_FS_TRUNCATE] = "truncate", [TR_FS_DELETE] = "delete"};
+
+static const char *span_name(int type, uint32_t arg, char *buf) {
+  if (type == TR_SYSCALL && arg < NSYSCALLS)
+    sprintf(buf, "sys_%s", sys_names[arg]);
+  else if (type == TR_FS && arg < NTR_FS_OPS)
+    sprintf(buf, "fs_%s", fs_names[arg]);
+  else if (type == TR_IRQ && arg == 0x20)
+    strcpy(buf, "irq timer");
+  else if (type == TR_IRQ && arg == 0x21)
+    strcpy(buf, "irq keyboard");
+  else if (type == TR_IRQ && arg == 0x30)
+    strcpy(buf, "irq lapic timer");
+  else if (type == TR_IRQ && arg == 0x31)
+    strcpy(buf, "irq resched");
+  else
+    sprintf(buf, "%s 0x%x", type_names[type], arg);
+  return buf;
+}
+
+// ---- spans: CPU time from switches; system calls, file system calls and
+// IRQs from their begin/end pairs ----
+#define KEYS (MAX_TIDS + 1)  // tid + 1; the CPU for IRQs
+#define DEPTH 8
+
+typedef struct {
+  uint64_t t0;
+  uint32_t arg;
+} open_t;
+
+typedef struct {
+  uint32_t n;
+  double total, max;  // us
+} span_stats_t;
+
+static span_stats_t span_stats[NTRACE_TYPES][256];
+static double task_time[KEYS];  // by tid + 1 (idle first), us
+
+static void charge(int tid, double us) {
+  if (tid >= -1 && tid < MAX_TIDS) task_time[tid + 1] += us;
+}
+static uint32_t type_count[NTRACE_TYPES];
+static uint64_t alloc_bytes, free_bytes, pages_in, pages_out;
+
+// Called for each span as it closes: `lane` is the CPU for task runs and
+// IRQs, the tid for system and file system calls.
+typedef void span_fn(int type, int lane, const char *name, uint64_t t0,
+                     uint64_t t1);
+
+static void walk(span_fn *fn) {
+  static open_t open[3][KEYS][DEPTH];  // SYSCALL, IRQ, FS
+  static int depth[3][KEYS];
+  int running[256];
+  uint64_t since[256];
+  bool seen[256] = {0};
+  char nb[64];
+  for (size_t i = 0; i < nrecs; i++) {
+    const trace_rec_t *r = &recs[i];
+    int type = r->type & TR_TYPE;
+    if (type >= NTRACE_TYPES) continue;
+    type_count[type]++;
+    if (!seen[r->cpu]) {
+      seen[r->cpu] = true;
+      running[r->cpu] = r->tid;
+      since[r->cpu] = r->tsc;
+    }
+    switch (type) {
+      case TR_SWITCH:
+        charge(r->tid, usec(r->tsc) - usec(since[r->cpu]));
+        fn(TR_SWITCH, r->cpu, task(r->tid, nb), since[r->cpu], r->tsc);
+        running[r->cpu] = (int32_t)r->arg;
+        since[r->cpu] = r->tsc;
+        break;
+      case TR_SYSCALL:
+      case TR_IRQ:
+      case TR_FS: {
+        int k = type == TR_SYSCALL ? 0 : type == TR_IRQ ? 1 : 2;
+        int key = type == TR_IRQ ? r->cpu : r->tid + 1;
+        if (key < 0 || key >= KEYS) break;
+        open_t *o = open[k][key];
+        int *d = &depth[k][key];
+        if (!(r->type & TR_END)) {
+          if (*d < DEPTH) o[*d] = (open_t){r->tsc, r->arg};
+          (*d)++;
+        } else if (*d > 0) {  // an end whose start was overwritten: skip
+          (*d)--;
+          if (*d < DEPTH && o[*d].arg == r->arg) {
+            fn(type, type == TR_IRQ ? r->cpu : r->tid,
+               span_name(type, r->arg, nb), o[*d].t0, r->tsc);
+            span_stats_t *s = &span_stats[type][r->arg & 0xFF];
+            double us = usec(r->tsc) - usec(o[*d].t0);
+            s->n++;
+            s->total += us;
+            if (us > s->max) s->max = us;
+          }
+        }
+        break;
+      }
+      case TR_KMALLOC:
+        alloc_bytes += r->arg;
+        break;
+      case TR_KFREE:
+        free_bytes += r->arg;
+        break;
+      case TR_PAGES:
+        pages_in += r->arg;
+        break;
+      case TR_PAGES_FREE:
+        pages_out += r->arg;
+        break;
+    }
+  }
+  // Whatever was still running when the dump was taken.
+  uint64_t end = nrecs ? recs[nrecs - 1].tsc : 0;
+  for (int c = 0; c < 256; c++)
+    if (seen[c]) {
+      charge(running[c], usec(end) - usec(since[c]));
+      fn(TR_SWITCH, c, task(running[c], nb), since[c], end);
+    }
+}
+
+// ---- profiling samples ----
+#define MAX_FRAMES 16
+
+typedef struct {
+  uint64_t tsc;
+  int16_t tid;
+  bool user;
+  int n;  // pc[0] was interrupted; pc[1..] are return addresses
+  uint32_t pc[MAX_FRAMES];
+} sample_t;
+
+static sample_t *samples;
+static size_t nsamples;
+
+static void collect_samples(void) {
+  long last[256];
+  for (int c = 0; c < 256; c++) last[c] = -1;
+  samples = calloc(nrecs ? nrecs : 1, sizeof *samples);
+  for (size_t i = 0; i < nrecs; i++) {
+    const trace_rec_t *r = &recs[i];
+    int type = r->type & TR_TYPE;
+    if (type == TR_SAMPLE) {
+      sample_t *s = &samples[nsamples];
+      s->tsc = r->tsc;
+      s->tid = r->tid;
+      s->user = r->type & TR_USER;
+      s->pc[s->n++] = r->arg;
+      last[r->cpu] = nsamples++;
+    } else if (type == TR_FRAME && last[r->cpu] >= 0) {
+      sample_t *s = &samples[last[r->cpu]];
+      if (s->n < MAX_FRAMES) s->pc[s->n++] = r->arg;
+    } else {
+      last[r->cpu] = -1;
+    }
+  }
+}
+
+static const symtab_t *sample_syms(const sample_t *s) {
+  if (!s->user) return ntabs ? &tabs[0] : NULL;
+  char nb[16];
+  const char *t = task(s->tid, nb);
+  for (int i = 1; i < ntabs; i++)
+    if (!strcmp(tabs[i].prog, t)) return &tabs[i];
+  return NULL;
+}
+
+// Frame i of a sample by name. Return addresses are looked up one byte
+// back, in the call instruction, in case the call was a function's last.
+static const char *frame_name(const sample_t *s, int i, char *buf) {
+  const symtab_t *t = sample_syms(s);
+  if (s->user && !t) return "[user]";
+  return addr_name(t, s->pc[i] - (i > 0), buf);
+}
+
+// "task;outermost;...;leaf", as flamegraph.pl wants it.
+static void fold(const sample_t *s, char *out, size_t cap) {
+  char nb[64];
+  size_t n = snprintf(out, cap, "%s", task(s->tid, nb));
+  for (int i = s->n - 1; i >= 0 && n < cap; i--)
+    n += snprintf(out + n, cap - n, ";%s", frame_name(s, i, nb));
+}
+
+static int str_cmp(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Folded stacks, sorted so equal ones are adjacent.
+static char **folded(void) {
+  char **f = malloc((nsamples ? nsamples : 1) * sizeof *f);
+  for (size_t i = 0; i < nsamples; i++) {
+    f[i] = malloc(1024);
+    fold(&samples[i], f[i], 1024);
+  }
+  qsort(f, nsamples, sizeof *f, str_cmp);
+  return f;
+}
+
+static void print_folded(void) {
+  char **f = folded();
+  for (size_t i = 0, j; i < nsamples; i = j) {
+    for (j = i; j < nsamples && !strcmp(f[i], f[j]); j++) {}
+    printf("%s %zu\n", f[i], j - i);
+  }
+}
+
+// ---- flame graph: folded stacks merged into a tree, drawn root at the
+// bottom, each frame as wide as its share of the samples ----
+typedef struct node {
+  char *name;
+  size_t count;
+  struct node *child, *next;
+} node_t;
+
+static node_t *node_child(node_t *p, const char *name, size_t len) {
+  node_t **pp = &p->child;
+  for (; *pp; pp = &(*pp)->next)
+    if (strlen((*pp)->name) == len && !memcmp((*pp)->name, name, len))
+      return *pp;
+  node_t *n = calloc(1, sizeof *n);
+  n->name = strndup(name, len);
+  *pp = n;
+  return n;
+}
+
+static int tree_depth(const node_t *n) {
+  int d = 0;
+  for (const node_t *c = n->child; c; c = c->next) {
+    int cd = tree_depth(c);
+    if (cd > d) d = cd;
+  }
+  return d + 1;
+}
+
+#define SVG_W 1200
+#define ROW_H 16
+#define CHAR_W 7
+
+static double px_per_sample;
+static int svg_h;
+
+static void svg_escape(const char *s) {
+  for (; *s; s++)
+    if (*s == '<')
+      fputs("&lt;", stdout);
+    else if (*s == '>')
+      fputs("&gt;", stdout);
+    else if (*s == '&')
+      fputs("&amp;", stdout);
+    else
+      putchar(*s);
+}
+
+static void svg_node(const node_t *n, double x, int depth) {
+  double w = n->count * px_per_sample;
+  if (w < 0.5) return;
+  int y = svg_h - (depth + 1) * ROW_H;
+  uint32_t h = 2166136261u;
+  for (const char *s = n->name; *s; s++) h = (h ^ (uint8_t)*s) * 16777619u;
+  printf("<g><title>");
+  svg_escape(n->name);
+  printf(" (%zu samples, %.2f%%)</title>", n->count,
+         100.0 * n->count / nsamples);
+  printf("<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"%d\" "
+         "fill=\"rgb(%u,%u,%u)\" rx=\"2\"/>",
+         x, y, w, ROW_H - 1, 205 + h % 50, 80 + (h >> 8) % 130,
+         (h >> 16) % 55);
+  int fit = (int)(w / CHAR_W) - 1;
+  if (fit >= 3) {
+    printf("<text x=\"%.1f\" y=\"%d\">", x + 3, y + ROW_H - 4);
+    if ((int)strlen(n->name) <= fit) {
+      svg_escape(n->name);
+    } else {
+      char *t = strndup(n->name, fit - 2);
+      svg_escape(t);
+      fputs("..", stdout);
+      free(t);
+    }
+    printf("</text>");
+  }
+  printf("</g>\n");
+  for (const node_t *c = n->child; c; c = c->next) {
+    svg_node(c, x, depth + 1);
+    x += c->count * px_per_sample;
+  }
+}
+
+static void print_svg(void) {
+  node_t root = {.name = "all", .count = nsamples};
+  char **f = folded();
+  for (size_t i = 0; i < nsamples; i++) {
+    node_t *n = &root;
+    for (const char *s = f[i]; *s;) {
+      size_t len = strcspn(s, ";");
+      n = node_child(n, s, len);
+      n->count++;
+      s += len + (s[len] == ';');
+    }
+  }
+  int depth = tree_depth(&root);
+  svg_h = (depth + 2) * ROW_H;
+  px_per_sample = nsamples ? (double)(SVG_W - 20) / nsamples : 0;
+  printf("<?xml version=\"1.0\"?>\n"
+         "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" "
+         "height=\"%d\" font-family=\"monospace\" font-size=\"11\">\n"
+         "<text x=\"10\" y=\"%d\">jordyOS kernel profile, %zu samples"
+         "</text>\n",
+         SVG_W, svg_h, ROW_H - 4, nsamples);
+  svg_node(&root, 10, 0);
+  printf("</svg>\n");
+}
+
+// ---- timeline: one track per CPU with the task running and its IRQs,
+// one per task with its system and file system calls ----
+static bool json_first = true;
+
+static void json_str(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+static void json_span(int type, int lane, const char *name, uint64_t t0,
+                      uint64_t t1) {
+  int pid = type == TR_SWITCH || type == TR_IRQ ? 0 : 1;
+  printf("%s{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"name\":", json_first ? "" : ",\n",
+         pid, lane);
+  json_str(name);
+  printf(",\"cat\":\"%s\",\"ts\":%.3f,\"dur\":%.3f}", type_names[type],
+         usec(t0), usec(t1) - usec(t0));
+  json_first = false;
+}
+
+static void print_json(void) {
+  char nb[64];
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  printf("{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\","
+         "\"args\":{\"name\":\"CPUs\"}},\n"
+         "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+         "\"args\":{\"name\":\"tasks\"}}");
+  for (uint32_t c = 0; c < hdr.ncpus; c++)
+    printf(",\n{\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"name\":\"thread_name\","
+           "\"args\":{\"name\":\"cpu %u\"}}",
+           c, c);
+  for (uint32_t t = 0; t < hdr.ntasks; t++)
+    if (names[t][0]) {
+      printf(",\n{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\","
+             "\"args\":{\"name\":",
+             t);
+      json_str(task(t, nb));
+      printf("}}");
+    }
+  json_first = false;
+  walk(json_span);
+  for (size_t i = 0; i < nsamples; i++) {
+    const sample_t *s = &samples[i];
+    printf(",\n{\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"name\":",
+           s->tid);
+    json_str(frame_name(s, 0, nb));
+    printf(",\"cat\":\"sample\",\"ts\":%.3f}", usec(s->tsc));
+  }
+  printf("\n]}\n");
+}
+
+// ---- summary ----
+static void no_span(int type, int lane, const char *name, uint64_t t0,
+                    uint64_t t1) {
+  (void)type, (void)lane, (void)name, (void)t0, (void)t1;
+}
+
+typedef struct {
+  const char *name;
+  size_t self, total;
+} hot_t;
+
+static int hot_cmp(const void *a, const void *b) {
+  const hot_t *x = a, *y = b;
+  if (x->self != y->self) return x->self < y->self ? 1 : -1;
+  return x->total < y->total ? 1 : x->total > y->total ? -1 : 0;
+}
+
+static void print_hot(void) {
+  hot_t *hot = calloc(nsamples * MAX_FRAMES + 1, sizeof *hot);
+  size_t nhot = 0;
+  for (size_t i = 0; i < nsamples; i++) {
+    const sample_t *s = &samples[i];
+    const char *seen[MAX_FRAMES];
+    int nseen = 0;
+    for (int f = 0; f < s->n; f++) {
+      char nb[32];
+      const char *name = frame_name(s, f, nb);
+      if (name == nb) name = strdup(nb);
+      bool dup = false;
+      for (int k = 0; k < nseen; k++) dup |= !strcmp(seen[k], name);
+      size_t h = 0;
+      while (h < nhot && strcmp(hot[h].name, name)) h++;
+      if (h == nhot) hot[nhot++].name = name;
+      if (f == 0) hot[h].self++;
+      if (!dup) hot[h].total++;  // recursion counts once per sample
+      seen[nseen++] = name;
+    }
+  }
+  qsort(hot, nhot, sizeof *hot, hot_cmp);
+  printf("\n%zu samples\n%7s %7s  %s\n", nsamples, "self%", "total%",
+         "function");
+  for (size_t i = 0; i < nhot && i < 25; i++)
+    printf("%6.2f%% %6.2f%%  %s\n", 100.0 * hot[i].self / nsamples,
+           100.0 * hot[i].total / nsamples, hot[i].name);
+}
+
+static void print_summary(void) {
+  double span = nrecs ? usec(recs[nrecs - 1].tsc) : 0;
+  printf("%zu events from %u CPUs over %.3f ms (%u overwritten), "
+         "TSC %.1f MHz\n",
+         nrecs, hdr.ncpus, span / 1000, hdr.dropped, hdr.tsc_khz / 1000.0);
+  walk(no_span);
+  for (int t = 1; t < NTRACE_TYPES; t++)
+    if (hdr.mask & (1u << t))
+      printf("  %-10s %u\n", type_names[t], type_count[t]);
+  if (type_count[TR_KMALLOC] || type_count[TR_PAGES])
+    printf("kmalloc %llu bytes, kfree %llu bytes, pages %llu in, %llu out\n",
+           (unsigned long long)alloc_bytes, (unsigned long long)free_bytes,
+           (unsigned long long)pages_in, (unsigned long long)pages_out);
+
+  printf("\n%-20s %8s %10s %10s %12s\n", "span", "count", "avg us",
+         "max us", "total us");
+  const int kinds[] = {TR_SYSCALL, TR_FS, TR_IRQ};
+  for (int k = 0; k < 3; k++)
+    for (int a = 0; a < 256; a++) {
+      const span_stats_t *s = &span_stats[kinds[k]][a];
+      char nb[64];
+      if (s->n)
+        printf("%-20s %8u %10.2f %10.2f %12.1f\n",
+               span_name(kinds[k], a, nb), s->n, s->total / s->n, s->max,
+               s->total);
+    }
+
+  if (type_count[TR_SWITCH]) {
+    printf("\n%-12s %12s %7s\n", "task", "cpu us", "share");
+    double all = 0;
+    for (int t = 0; t < KEYS; t++) all += task_time[t];
+    for (int t = 0; t < KEYS; t++)
+      if (task_time[t] > 0) {
+        char nb[16];
+        printf("%-12s %12.1f %6.2f%%\n", task(t - 1, nb), task_time[t],
+               100 * task_time[t] / all);
+      }
+  }
+  if (nsamples) print_hot();
+}
+
+int main(int argc, char **argv) {
+  char mode = 's';
+  int a = 1;
+  if (a < argc && argv[a][0] == '-' && strchr("fgt", argv[a][1]) &&
+      argv[a][1] && !argv[a][2])
+    mode = argv[a++][1];
+  if (a >= argc) {
+    fprintf(stderr, "usage: %s [-f|-g|-t] serial.out [kernel.elf [prog.elf..]]\n",
+            argv[0]);
+    return 1;
+  }
+  if (!load_dump(argv[a++])) return 1;
+  for (; a < argc && ntabs < MAX_ELFS; a++) {
+    symtab_t *t = &tabs[ntabs];
+    if (ntabs > 0) {  // programs: by base name, without ".elf"
+      const char *base = strrchr(argv[a], '/');
+      base = base ? base + 1 : argv[a];
+      size_t n = strcspn(base, ".");
+      if (n >= TRACE_NAME_LEN) n = TRACE_NAME_LEN - 1;
+      memcpy(t->prog, base, n);
+    }
+    if (!load_elf(argv[a], t)) return 1;
+    ntabs++;
+  }
+  collect_samples();
+  if (mode == 'f')
+    print_folded();
+  else if (mode == 'g')
+    print_svg();
+  else if (mode == 't')
+    print_json();
+  else
+    print_summary();
+  return 0;
+}
@@ -0,0 +1,208 @@
+// Host tool: puts files on a jordyOS disk image (layout in fs.h).
+//
+//   ./mkfs disk.img calc.elf edit.elf
+//
+// A missing image is created at 8 MB. An image without a valid superblock
+// is formatted exactly as fs.c's fs_format() would; otherwise its files are
+// kept. Each file is stored under its base name without ".elf", replacing
+// any file of that name, so the shell can run it by typing the name.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../fs.h"
+
+static uint8_t *img;
+static fs_super_t sb;
+
+static uint8_t *block(uint32_t b) { return img + (size_t)b * FS_BLOCK_SIZE; }
+
+// Both bitmaps are arrays of little-endian words, bit i of word i / 32;
+// on disk that is byte i / 8, bit i % 8.
+static bool bit_get(uint32_t first, uint32_t i) {
+  return block(first)[i / 8] & (1u << (i % 8));
+}
+static void bit_set(uint32_t first, uint32_t i, bool on) {
+  uint8_t *p = &block(first)[i / 8];
+  *p = on ? *p | (1u << (i % 8)) : *p & ~(1u << (i % 8));
+}
+
+static fs_inode_t *inode(int ino) {
+  return (fs_inode_t *)(block(sb.inode_start + ino / FS_INODES_PER_BLOCK) +
+                        ino % FS_INODES_PER_BLOCK * sizeof(fs_inode_t));
+}
+static fs_dirent_t *dirent(int slot) {
+  return (fs_dirent_t *)(block(sb.dir_start + slot / FS_DIRENTS_PER_BLOCK) +
+                         slot % FS_DIRENTS_PER_BLOCK * sizeof(fs_dirent_t));
+}
+
+static void format(uint32_t nblocks) {
+  memset(img, 0, (size_t)nblocks * FS_BLOCK_SIZE);
+  memset(&sb, 0, sizeof sb);
+  sb.magic = FS_MAGIC;
+  sb.version = FS_VERSION;
+  sb.nblocks = nblocks;
+  sb.ninodes = FS_NINODES;
+  sb.inode_bitmap = 1;
+  sb.block_bitmap = 2;
+  sb.inode_start =
+      sb.block_bitmap + (nblocks + FS_BITS_PER_BLOCK - 1) / FS_BITS_PER_BLOCK;
+  sb.dir_start = sb.inode_start + (FS_NINODES + FS_INODES_PER_BLOCK - 1) /
+                                      FS_INODES_PER_BLOCK;
+  sb.data_start = sb.dir_start + (FS_DIR_SLOTS + FS_DIRENTS_PER_BLOCK - 1) /
+                                     FS_DIRENTS_PER_BLOCK;
+  memcpy(block(0), &sb, sizeof sb);
+  for (int i = 0; i < FS_DIR_SLOTS; i++) dirent(i)->ino = FS_DIR_EMPTY;
+  for (uint32_t b = 0; b < sb.data_start; b++) bit_set(sb.block_bitmap, b, 1);
+}
+
+// Same hash and probing as fs.c's dir_slot().
+static uint32_t fnv1a(const char *s) {
+  uint32_t h = 2166136261u;
+  while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+  return h;
+}
+
+static int dir_slot(const char *name, bool insert) {
+  uint32_t i = fnv1a(name) & (FS_DIR_SLOTS - 1);
+  int tomb = -1;
+  for (int n = 0; n < FS_DIR_SLOTS; n++, i = (i + 1) & (FS_DIR_SLOTS - 1)) {
+    fs_dirent_t *d = dirent(i);
+    if (d->ino == FS_DIR_EMPTY) return insert ? (tomb >= 0 ? tomb : (int)i) : -1;
+    if (d->ino == FS_DIR_DELETED) {
+      if (tomb < 0) tomb = i;
+    } else if (!insert && !strcmp(d->name, name)) {
+      return i;
+    }
+  }
+  return insert ? tomb : -1;
+}
+
+static void file_delete(const char *name) {
+  int s = dir_slot(name, false);
+  if (s < 0) return;
+  int ino = dirent(s)->ino;
+  fs_inode_t *ip = inode(ino);
+  for (uint32_t e = 0; e < ip->nextents; e++)
+    for (uint32_t b = 0; b < ip->ext[e].len; b++)
+      bit_set(sb.block_bitmap, ip->ext[e].start + b, 0);
+  memset(ip, 0, sizeof *ip);
+  bit_set(sb.inode_bitmap, ino, 0);
+  dirent(s)->ino = FS_DIR_DELETED;
+}
+
+// Stores `len` bytes as `name` in the first free runs of blocks.
+static bool file_add(const char *name, const uint8_t *data, uint32_t len) {
+  file_delete(name);
+  int ino = 0;
+  while (ino < FS_NINODES && bit_get(sb.inode_bitmap, ino)) ino++;
+  int s = ino < FS_NINODES ? dir_slot(name, true) : -1;
+  if (s < 0) return false;
+  fs_inode_t ip = {.size = len};
+  uint32_t need = (len + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE, done = 0;
+  for (uint32_t b = sb.data_start; b < sb.nblocks && done < need; b++) {
+    if (bit_get(sb.block_bitmap, b)) continue;
+    fs_extent_t *last = ip.nextents ? &ip.ext[ip.nextents - 1] : NULL;
+    if (last && last->start + last->len == b) {
+      last->len++;
+    } else if (ip.nextents < FS_NEXTENTS) {
+      ip.ext[ip.nextents].start = b;
+      ip.ext[ip.nextents++].len = 1;
+    } else {
+      break;
+    }
+    uint32_t n = len - done * FS_BLOCK_SIZE;
+    memset(block(b), 0, FS_BLOCK_SIZE);
+    memcpy(block(b), data + done * FS_BLOCK_SIZE,
+           n < FS_BLOCK_SIZE ? n : FS_BLOCK_SIZE);
+    bit_set(sb.block_bitmap, b, 1);
+    done++;
+  }
+  if (done < need) {  // give back what was taken
+    for (uint32_t e = 0; e < ip.nextents; e++)
+      for (uint32_t b = 0; b < ip.ext[e].len; b++)
+        bit_set(sb.block_bitmap, ip.ext[e].start + b, 0);
+    return false;
+  }
+  *inode(ino) = ip;
+  bit_set(sb.inode_bitmap, ino, 1);
+  memset(dirent(s)->name, 0, FS_NAME_LEN);
+  strcpy(dirent(s)->name, name);
+  dirent(s)->ino = ino;
+  return true;
+}
+
+static uint8_t *slurp(const char *path, long *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+  fseek(f, 0, SEEK_END);
+  *len = ftell(f);
+  rewind(f);
+  uint8_t *p = malloc(*len ? *len : 1);
+  if (p && fread(p, 1, *len, f) != (size_t)*len) {
+    free(p);
+    p = NULL;
+  }
+  fclose(f);
+  return p;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s disk.img [file...]\n", argv[0]);
+    return 1;
+  }
+  long size = 0;
+  img = slurp(argv[1], &size);
+  uint32_t nblocks = img ? size / FS_BLOCK_SIZE : FS_NBLOCKS;
+  if (nblocks > FS_NBLOCKS) nblocks = FS_NBLOCKS;
+  if (nblocks < 64) {
+    fprintf(stderr, "%s: image too small\n", argv[1]);
+    return 1;
+  }
+  if (!img) size = (long)nblocks * FS_BLOCK_SIZE;
+  img = realloc(img, size);
+  if (!img) return 1;
+
+  memcpy(&sb, block(0), sizeof sb);
+  if (sb.magic != FS_MAGIC || sb.version != FS_VERSION ||
+      sb.ninodes != FS_NINODES || sb.nblocks > nblocks) {
+    format(nblocks);
+    printf("mkfs: formatted %s, %u blocks\n", argv[1], nblocks);
+  }
+
+  for (int i = 2; i < argc; i++) {
+    const char *base = strrchr(argv[i], '/');
+    base = base ? base + 1 : argv[i];
+    char name[FS_NAME_LEN];
+    size_t n = strlen(base);
+    if (n > 4 && !strcmp(base + n - 4, ".elf")) n -= 4;
+    if (n == 0 || n >= FS_NAME_LEN) {
+      fprintf(stderr, "%s: name too long\n", argv[i]);
+      return 1;
+    }
+    memcpy(name, base, n);
+    name[n] = '\0';
+    long len;
+    uint8_t *data = slurp(argv[i], &len);
+    if (!data) {
+      perror(argv[i]);
+      return 1;
+    }
+    if (!file_add(name, data, len)) {
+      fprintf(stderr, "%s: no room on %s\n", argv[i], argv[1]);
+      return 1;
+    }
+    printf("mkfs: %s -> %s, %ld bytes\n", argv[i], name, len);
+    free(data);
+  }
+
+  FILE *f = fopen(argv[1], "wb");
+  if (!f || fwrite(img, 1, size, f) != (size_t)size || fclose(f)) {
+    perror(argv[1]);
+    return 1;
+  }
+  return 0;
+}
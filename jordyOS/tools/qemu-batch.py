@@ -0,0 +1,229 @@
+#!/usr/bin/env python3
+"""Runs jordyOS headless under QEMU from a key script and times the shell.
+
+    tools/qemu-batch.py [--smp N] [--csv] [--timeout S] script.keys
+
+QEMU gets no display. Keys go in through the monitor's `sendkey`. The
+shell's terminal comes back on COM2, which serial.c mirrors terminal 1 to
+when a second -serial is given. COM1 still goes to serial.out, so a
+`trace dump` in the script can be read with ktrace afterwards. The script
+is one command per line, and `#` starts a comment:
+
+    prompt          wait for the next "sh> "
+    expect TEXT     wait until TEXT appears on the terminal
+    type TEXT       type TEXT without pressing Enter
+    run CMD         type CMD, press Enter and time it until the next prompt
+    sleep MS        wait MS milliseconds
+
+The `run` latency starts as the Enter key is sent to the monitor, so it
+counts QEMU's key delivery as well as the kernel's work. A summary per
+command is printed at the end. The exit status is 1 if an expect timed
+out or QEMU quit early.
+"""
+
+import argparse
+import os
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+PROMPT = "sh> "
+
+# sendkey names for the characters the shell's keymap has.
+KEYS = {" ": "spc", "\n": "ret", "-": "minus", "=": "equal", ".": "dot",
+        ",": "comma", "/": "slash", ";": "semicolon", "'": "apostrophe",
+        "[": "bracket_left", "]": "bracket_right", "\\": "backslash",
+        "`": "grave_accent", "*": "kp_multiply", "+": "kp_add"}
+
+
+class Console:
+    """Collects what QEMU writes to COM2 (its stdout) on a thread."""
+
+    def __init__(self, stream, log):
+        self.text = ""
+        self.pos = 0  # everything before this has been matched already
+        self.cond = threading.Condition()
+        self.log = log
+        self.done = False
+        threading.Thread(target=self._read, args=(stream,), daemon=True).start()
+
+    def _read(self, stream):
+        while True:
+            data = os.read(stream.fileno(), 4096)
+            with self.cond:
+                if not data:
+                    self.done = True
+                    self.cond.notify_all()
+                    return
+                s = data.decode("latin-1").replace("\r", "")
+                self.text += s
+                if self.log:
+                    self.log.write(s)
+                    self.log.flush()
+                self.cond.notify_all()
+
+    def expect(self, needle, timeout):
+        """Waits for needle after the last match; returns the time it was
+        seen, or None on a timeout or exit."""
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                i = self.text.find(needle, self.pos)
+                if i >= 0:
+                    self.pos = i + len(needle)
+                    return time.monotonic()
+                left = deadline - time.monotonic()
+                if left <= 0 or self.done:
+                    return None
+                self.cond.wait(left)
+
+
+class Monitor:
+    """The QEMU human monitor on a Unix socket, one command at a time."""
+
+    def __init__(self, path, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+                self.sock.connect(path)
+                break
+            except OSError:
+                self.sock.close()
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.05)
+        self._wait()
+
+    def _wait(self):
+        buf = b""
+        while not buf.endswith(b"(qemu) "):
+            data = self.sock.recv(4096)
+            if not data:
+                raise EOFError("monitor closed")
+            buf += data
+
+    def cmd(self, line):
+        self.sock.sendall(line.encode() + b"\n")
+        self._wait()
+
+    def key(self, ch, hold_ms):
+        if ch.isupper():
+            name = "shift-" + ch.lower()
+        else:
+            name = KEYS.get(ch, ch)
+        self.cmd("sendkey %s %d" % (name, hold_ms))
+
+
+def parse(path):
+    steps = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.split("#", 1)[0].strip()
+            if not line:
+                continue
+            op, _, arg = line.partition(" ")
+            if op not in ("prompt", "expect", "type", "run", "sleep"):
+                sys.exit("%s:%d: unknown command %r" % (path, n, op))
+            steps.append((n, op, arg.strip()))
+    return steps
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    ap.add_argument("script")
+    ap.add_argument("--os", default="os.img")
+    ap.add_argument("--disk", default="disk.img")
+    ap.add_argument("--smp", type=int, default=2)
+    ap.add_argument("--serial", default="serial.out",
+                    help="file for COM1 (trace dumps)")
+    ap.add_argument("--log", help="also save the terminal output here")
+    ap.add_argument("--timeout", type=float, default=30,
+                    help="seconds an expect or prompt may take")
+    ap.add_argument("--hold", type=int, default=10,
+                    help="milliseconds each key is held down")
+    ap.add_argument("--csv", action="store_true",
+                    help="one line per run instead of a summary")
+    args = ap.parse_args()
+    steps = parse(args.script)
+
+    tmp = tempfile.mkdtemp(prefix="jordyos-")
+    mon_path = os.path.join(tmp, "monitor.sock")
+    qemu = subprocess.Popen(
+        ["qemu-system-i386", "-display", "none", "-m", "32",
+         "-smp", str(args.smp),
+         "-drive", "if=floppy,format=raw,file=" + args.os, "-boot", "a",
+         "-drive", "if=ide,index=0,format=raw,file=" + args.disk,
+         "-serial", "file:" + args.serial, "-serial", "stdio",
+         "-monitor", "unix:%s,server=on,wait=off" % mon_path],
+        stdin=subprocess.DEVNULL, stdout=subprocess.PIPE)
+    log = open(args.log, "w") if args.log else None
+    con = Console(qemu.stdout, log)
+    ok = True
+    runs = []  # (command, seconds)
+    try:
+        mon = Monitor(mon_path, args.timeout)
+        for n, op, arg in steps:
+            if op == "sleep":
+                time.sleep(int(arg) / 1000)
+            elif op == "type":
+                for ch in arg:
+                    mon.key(ch, args.hold)
+            elif op in ("prompt", "expect"):
+                if con.expect(arg if op == "expect" else PROMPT,
+                              args.timeout) is None:
+                    print("%s:%d: timed out waiting for %r" %
+                          (args.script, n, arg or PROMPT), file=sys.stderr)
+                    ok = False
+                    break
+            else:  # run
+                for ch in arg:
+                    mon.key(ch, args.hold)
+                t0 = time.monotonic()
+                mon.key("\n", args.hold)
+                t1 = con.expect(PROMPT, args.timeout)
+                if t1 is None:
+                    print("%s:%d: %r did not return to the prompt" %
+                          (args.script, n, arg), file=sys.stderr)
+                    ok = False
+                    break
+                runs.append((arg, t1 - t0))
+        mon.sock.sendall(b"quit\n")
+    except (OSError, EOFError) as e:
+        print("qemu: %s" % e, file=sys.stderr)
+        ok = False
+    finally:
+        try:
+            qemu.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            qemu.kill()
+        if log:
+            log.close()
+        try:
+            os.unlink(mon_path)
+        except OSError:
+            pass
+        os.rmdir(tmp)
+
+    if args.csv:
+        print("command,ms")
+        for c, s in runs:
+            print("%s,%.3f" % (c, s * 1000))
+    elif runs:
+        by = {}
+        for c, s in runs:
+            by.setdefault(c, []).append(s * 1000)
+        print("%-24s %5s %10s %10s %10s" % ("command", "runs", "min ms",
+                                            "median ms", "max ms"))
+        for c, ms in by.items():
+            print("%-24s %5d %10.2f %10.2f %10.2f" %
+                  (c, len(ms), min(ms), statistics.median(ms), max(ms)))
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,158 @@
+#include "kernel.h"
+
+// Kernel tracing. Each CPU records events into its own ring of
+// trace_rec_t, stamped with rdtsc, and overwrites the oldest once the ring
+// is full. Only the owning CPU writes a ring, with IRQs off for the few
+// stores a record takes, so recording needs no lock. The timer tick adds
+// profiling samples of the interrupted EIP (and, built with PROFILE=1,
+// the return addresses above it). `trace dump` streams the rings over COM1
+// for tools/ktrace.c to turn into a profile, flame graph or timeline.
+
+#define TRACE_PAGES 16  // per CPU: 4096 records
+#define TRACE_RING (TRACE_PAGES * PAGE_SIZE / sizeof(trace_rec_t))
+#define TRACE_DEPTH 8   // return addresses walked per sample
+
+typedef struct {
+  trace_rec_t *rec;
+  uint32_t head;          // records written since the last clear
+  volatile bool writing;  // inside trace_emit(); see trace_stop()
+} __attribute__((aligned(64))) trace_ring_t;
+
+#define B(type) (1u << (type))
+static const struct {
+  const char *name;
+  uint32_t mask;
+} categories[] = {
+    {"switch", B(TR_SWITCH)},
+    {"syscall", B(TR_SYSCALL)},
+    {"irq", B(TR_IRQ)},
+    {"fs", B(TR_FS)},
+    {"alloc", B(TR_KMALLOC) | B(TR_KFREE) | B(TR_PAGES) | B(TR_PAGES_FREE)},
+    {"prof", B(TR_SAMPLE) | B(TR_FRAME)},
+};
+
+uint32_t trace_mask;
+static trace_ring_t rings[MAX_CPUS];
+static uint32_t tsc_khz;
+extern char _text[], _etext[];  // linker.ld
+
+// After smp_detect() and pmm_init(); IRQs still off.
+void trace_init(void) {
+  uint64_t t0 = rdtsc();
+  pit_wait(10000);
+  tsc_khz = (uint32_t)((rdtsc() - t0) / 10);
+  for (int i = 0; i < ncpus; i++) rings[i].rec = pmm_alloc_pages(TRACE_PAGES);
+}
+
+// Called through trace() once the type's bit is known to be on. `writing`
+// goes up before trace_mask is read again, and trace_stop() clears the
+// mask before it looks at `writing`, so a record is either seen whole by
+// a dump or not started until the dump is done.
+void trace_emit(uint32_t type, uint32_t arg) {
+  uint32_t f = irq_save();
+  cpu_t *c = this_cpu();
+  trace_ring_t *r = &rings[c->id];
+  __atomic_store_n(&r->writing, true, __ATOMIC_SEQ_CST);
+  if (r->rec && (__atomic_load_n(&trace_mask, __ATOMIC_SEQ_CST) &
+                 B(type & TR_TYPE))) {
+    trace_rec_t *e = &r->rec[r->head++ % TRACE_RING];
+    e->tsc = rdtsc();
+    e->type = type;
+    e->cpu = c->id;
+    e->tid = c->running ? c->running->tid : -1;
+    e->arg = arg;
+  }
+  __atomic_store_n(&r->writing, false, __ATOMIC_RELEASE);
+  irq_restore(f);
+}
+
+// From the timer tick on each CPU: the PIT on the BSP, the LAPIC timer on
+// the APs.
+void trace_sample(const regs_t *r) {
+  if (!(trace_mask & B(TR_SAMPLE))) return;
+  bool user = (r->cs & 3) != 0;
+  trace_emit(TR_SAMPLE | (user ? TR_USER : 0), r->eip);
+#ifdef TRACE_STACKS
+  // Built with frame pointers: follow the ebp chain up the interrupted
+  // task's kernel stack. Each frame has to sit above the last and below
+  // the top of the stack, and return into kernel text, so a stale ebp
+  // ends the walk instead of faulting.
+  task_t *t = current();
+  if (user || t == NULL || t->tid < 0) return;
+  uint32_t top = t->kstack ? (uint32_t)(t->kstack + KSTACK_PAGES * PAGE_SIZE)
+                           : (uint32_t)t->stack_hi;
+  uint32_t lo = (uint32_t)&r->user_esp, fp = r->ebp;
+  for (int d = 0; d < TRACE_DEPTH; d++) {
+    if (fp < lo || fp + 8 > top || (fp & 3)) break;
+    const uint32_t *frame = (const uint32_t *)fp;
+    if (frame[1] < (uint32_t)_text || frame[1] >= (uint32_t)_etext) break;
+    trace_emit(TR_FRAME, frame[1]);
+    lo = fp + 8;
+    fp = frame[0];
+  }
+#endif
+}
+
+uint32_t trace_category(const char *name) {
+  if (!strcmp(name, "all")) {
+    uint32_t m = 0;
+    for (size_t i = 0; i < sizeof categories / sizeof categories[0]; i++)
+      m |= categories[i].mask;
+    return m;
+  }
+  for (size_t i = 0; i < sizeof categories / sizeof categories[0]; i++)
+    if (!strcmp(name, categories[i].name)) return categories[i].mask;
+  return 0;
+}
+
+const char *trace_categories(void) {
+  return "switch syscall irq fs alloc prof";
+}
+
+uint32_t trace_count(int cpu) { return rings[cpu].head; }
+
+// Turns recording off and waits for CPUs still inside trace_emit(), so
+// the rings hold still. Returns the mask to put back afterwards.
+static uint32_t trace_stop(void) {
+  uint32_t mask = __atomic_exchange_n(&trace_mask, 0, __ATOMIC_SEQ_CST);
+  for (int i = 0; i < ncpus; i++)
+    while (__atomic_load_n(&rings[i].writing, __ATOMIC_SEQ_CST))
+      __asm__ volatile("pause");
+  return mask;
+}
+
+void trace_clear(void) {
+  uint32_t mask = trace_stop();
+  for (int i = 0; i < ncpus; i++) rings[i].head = 0;
+  trace_mask = mask;
+}
+
+// Recording pauses for the dump, which goes out as the header, the task
+// names and then each CPU's ring from its oldest record (trace.h).
+bool trace_dump(void) {
+  if (!serial_ok) return false;
+  uint32_t mask = trace_stop();
+  trace_hdr_t h = {TRACE_MAGIC, TRACE_VERSION, tsc_khz, ncpus, MAX_TASKS,
+                   0, 0, mask};
+  for (int i = 0; i < ncpus; i++) {
+    uint32_t n = rings[i].head < TRACE_RING ? rings[i].head : TRACE_RING;
+    h.nrecs += n;
+    h.dropped += rings[i].head - n;
+  }
+  serial_write(&h, sizeof h);
+  for (int tid = 0; tid < MAX_TASKS; tid++) {
+    char name[TRACE_NAME_LEN] = {0};
+    strncpy(name, task_name(tid), TRACE_NAME_LEN - 1);
+    serial_write(name, sizeof name);
+  }
+  for (int i = 0; i < ncpus; i++) {
+    trace_ring_t *r = &rings[i];
+    uint32_t n = r->head < TRACE_RING ? r->head : TRACE_RING;
+    uint32_t from = (r->head - n) % TRACE_RING;
+    uint32_t first = n < TRACE_RING - from ? n : TRACE_RING - from;
+    serial_write(&r->rec[from], first * sizeof(trace_rec_t));
+    serial_write(r->rec, (n - first) * sizeof(trace_rec_t));
+  }
+  trace_mask = mask;
+  return true;
+}
@@ -0,0 +1,63 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Trace records and the dump that `trace dump` sends over COM1, shared by
+// the kernel (trace.c) and the host tool that reads it (tools/ktrace.c).
+//
+// A dump is a trace_hdr_t, then `ntasks` task names indexed by tid, then
+// `nrecs` trace_rec_t, CPU by CPU, each CPU's oldest first. Everything is
+// little-endian, as written by the i386.
+
+#include <stdint.h>
+
+#define TRACE_MAGIC 0x4352544Au  // "JTRC"
+#define TRACE_VERSION 1
+#define TRACE_NAME_LEN 12  // TASK_NAME_LEN
+
+enum {
+  TR_SWITCH = 1,  // tid is switched out for the task in arg
+  TR_SYSCALL,     // arg: system call number (int 0x80 only)
+  TR_IRQ,         // arg: vector
+  TR_FS,          // arg: TR_FS_* operation
+  TR_KMALLOC,     // arg: bytes asked for
+  TR_KFREE,       // arg: bytes of the slab object or big allocation
+  TR_PAGES,       // arg: pages taken from the page allocator
+  TR_PAGES_FREE,  // arg: pages given back
+  TR_SAMPLE,      // arg: EIP interrupted by the timer tick
+  TR_FRAME,       // arg: a return address under the sample before it
+  NTRACE_TYPES
+};
+#define TR_TYPE 0x1F  // type bits of trace_rec_t.type
+#define TR_USER 0x40  // TR_SAMPLE: interrupted in ring 3
+#define TR_END 0x80   // TR_SYSCALL, TR_IRQ, TR_FS: end of the span
+
+enum {
+  TR_FS_LIST,
+  TR_FS_SIZE,
+  TR_FS_PREAD,
+  TR_FS_PWRITE,
+  TR_FS_TRUNCATE,
+  TR_FS_DELETE,
+  NTR_FS_OPS
+};
+
+typedef struct {
+  uint64_t tsc;  // rdtsc on the recording CPU
+  uint8_t type;  // TR_* | TR_USER | TR_END
+  uint8_t cpu;
+  int16_t tid;   // task running at the time; -1 for the CPU's idle task
+  uint32_t arg;
+} trace_rec_t;
+
+typedef struct {
+  uint32_t magic;    // TRACE_MAGIC
+  uint32_t version;  // TRACE_VERSION
+  uint32_t tsc_khz;  // rdtsc ticks per millisecond, timed at boot
+  uint32_t ncpus;
+  uint32_t ntasks;   // names that follow
+  uint32_t nrecs;    // records after the names
+  uint32_t dropped;  // overwritten before the dump
+  uint32_t mask;     // (1 << TR_*) of the types that were recorded
+} trace_hdr_t;
+
+#endif
@@ -0,0 +1,147 @@
+#include "syscall.h"
+#include "util.h"
+
+// The app side of the system call interface, built with -DUSER like the
+// apps: util.h renames every sys_* below to usys_*, so these int 0x80 stubs
+// don't clash with the kernel's handlers of the same name. Linked into
+// every program along with string.o (see app.ld and the Makefile).
+
+static inline uint32_t syscall(uint32_t n, uint32_t a, uint32_t b, uint32_t c,
+                               uint32_t d) {
+  uint32_t r;
+  __asm__ volatile("int %1"
+                   : "=a"(r)
+                   : "i"(SYSCALL_VECTOR), "0"(n), "b"(a), "c"(b), "d"(c),
+                     "S"(d)
+                   : "memory");
+  return r;
+}
+
+int main(void);
+
+// Program entry (app.ld): user_start leaves us on the top of a fresh stack.
+void _start(void) {
+  main();
+  sys_exit_task();
+}
+
+void sys_write(const char *s) { syscall(SYS_WRITE, (uint32_t)s, 0, 0, 0); }
+char sys_getc(void) { return (char)syscall(SYS_GETC, 0, 0, 0, 0); }
+void sys_yield(void) { syscall(SYS_YIELD, 0, 0, 0, 0); }
+void sys_exit_task(void) {
+  syscall(SYS_EXIT, 0, 0, 0, 0);
+  for (;;);
+}
+void sys_sleep(uint32_t ms) { syscall(SYS_SLEEP, ms, 0, 0, 0); }
+void sys_clear_screen(void) { syscall(SYS_CLEAR, 0, 0, 0, 0); }
+
+int sys_list_files(char *ob, int bl) {
+  return syscall(SYS_LIST_FILES, (uint32_t)ob, bl, 0, 0);
+}
+int sys_read_file(const char *fn, char *buf, int len) {
+  return syscall(SYS_READ_FILE, (uint32_t)fn, (uint32_t)buf, len, 0);
+}
+int sys_write_file(const char *fn, const char *d, int len) {
+  return syscall(SYS_WRITE_FILE, (uint32_t)fn, (uint32_t)d, len, 0);
+}
+int sys_delete_file(const char *fn) {
+  return syscall(SYS_DELETE_FILE, (uint32_t)fn, 0, 0, 0);
+}
+int sys_file_size(const char *fn) {
+  return syscall(SYS_FILE_SIZE, (uint32_t)fn, 0, 0, 0);
+}
+int sys_pread(const char *fn, void *buf, int len, int off) {
+  return syscall(SYS_PREAD, (uint32_t)fn, (uint32_t)buf, len, off);
+}
+int sys_pwrite(const char *fn, const void *buf, int len, int off) {
+  return syscall(SYS_PWRITE, (uint32_t)fn, (uint32_t)buf, len, off);
+}
+int sys_truncate(const char *fn, int size) {
+  return syscall(SYS_TRUNCATE, (uint32_t)fn, size, 0, 0);
+}
+
+// ---- malloc/free: a first-fit free list (K&R style) over the SYS_SBRK
+// heap. Its list head is an ordinary static: elf.c gives every instance
+// its own zeroed .bss. ----
+typedef struct hdr {
+  struct hdr *next;  // free list, sorted by address and circular
+  uint32_t units;    // block size in sizeof(hdr_t), header included
+} hdr_t;
+
+static hdr_t base;  // zero-size list head
+static hdr_t *freep;
+
+#define GROW_UNITS (4096 / sizeof(hdr_t))
+
+static void *sbrk(uint32_t n) { return (void *)syscall(SYS_SBRK, n, 0, 0, 0); }
+
+static hdr_t *heap_grow(uint32_t units) {
+  if (units < GROW_UNITS) units = GROW_UNITS;
+  hdr_t *h = sbrk(units * sizeof(hdr_t));
+  if (h == (hdr_t *)-1) return NULL;
+  h->units = units;
+  sys_free(h + 1);
+  return freep;
+}
+
+void *sys_malloc(size_t n) {
+  if (!freep) base.next = freep = &base;
+  uint32_t units = (n + sizeof(hdr_t) - 1) / sizeof(hdr_t) + 1;
+  hdr_t *prev = freep;
+  for (hdr_t *p = prev->next;; prev = p, p = p->next) {
+    if (p->units >= units) {
+      if (p->units == units) {
+        prev->next = p->next;
+      } else {  // hand out the tail
+        p->units -= units;
+        p += p->units;
+        p->units = units;
+      }
+      freep = prev;
+      return p + 1;
+    }
+    if (p == freep && (p = heap_grow(units)) == NULL) return NULL;
+  }
+}
+
+void sys_free(void *ptr) {
+  if (!ptr) return;
+  hdr_t *b = (hdr_t *)ptr - 1, *p;
+  for (p = freep; !(b > p && b < p->next); p = p->next)
+    if (p >= p->next && (b > p || b < p->next)) break;  // at either end
+  if (b + b->units == p->next) {
+    b->units += p->next->units;
+    b->next = p->next->next;
+  } else {
+    b->next = p->next;
+  }
+  if (p + p->units == b) {
+    p->units += b->units;
+    p->next = b->next;
+  } else {
+    p->next = b;
+  }
+  freep = p;
+}
+
+// read_line() for apps: echoes through SYS_WRITE instead of the console.
+void read_line(char *buf, int max) {
+  int len = 0;
+  char echo[2] = {0, 0};
+  for (;;) {
+    char c = sys_getc();
+    if (c == '\n') {
+      sys_write("\n");
+      break;
+    }
+    if ((c == 8 || c == 127) && len > 0) {
+      len--;
+      sys_write("\b \b");
+    } else if (c >= 32 && c < 127 && len < max - 1) {
+      buf[len++] = c;
+      echo[0] = c;
+      sys_write(echo);
+    }
+  }
+  buf[len] = 0;
+}
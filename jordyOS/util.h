@@ -5,7 +5,29 @@
 #include <stdbool.h>
 #include <stddef.h> // For size_t
 
-#define MAX_FILES 5
+#ifdef USER
+// Apps run in ring 3 and reach the kernel through the int 0x80 stubs in
+// usys.c; the kernel's sys_* functions are the handlers behind them.
+#define sys_write usys_write
+#define sys_getc usys_getc
+#define sys_yield usys_yield
+#define sys_exit_task usys_exit_task
+#define sys_sleep usys_sleep
+#define sys_clear_screen usys_clear_screen
+#define sys_malloc usys_malloc
+#define sys_free usys_free
+#define sys_list_files usys_list_files
+#define sys_read_file usys_read_file
+#define sys_write_file usys_write_file
+#define sys_delete_file usys_delete_file
+#define sys_file_size usys_file_size
+#define sys_pread usys_pread
+#define sys_pwrite usys_pwrite
+#define sys_truncate usys_truncate
+#define read_line uread_line
+#endif
+
+#define MAX_FILES 64
 #define MAX_FILENAME_LEN 16 
 void    read_line(char *buf, int max);
 int     strcmp(const char *a, const char *b);
@@ -16,13 +38,18 @@ char* strcpy(char *dst, const char *src);
 char* strncpy(char *dst, const char *src, size_t n);
 void* memset(void *s, int c, size_t n);
 void* memcpy(void *dest, const void *src, size_t n);
+void* memmove(void *dest, const void *src, size_t n);
+int     memcmp(const void *a, const void *b, size_t n);
 
 
 void sys_write(const char *s);
 char sys_getc(void);
 void sys_yield(void);
 void sys_exit_task(void);
+void sys_sleep(uint32_t ms);
 void sys_clear_screen(void); 
+void *sys_malloc(size_t n);
+void sys_free(void *p);
 int sys_list_files(char* out_buffer, int buffer_len);
 
 int sys_read_file(const char* filename, char* data_buffer, int data_buffer_len);
@@ -31,5 +58,13 @@ int sys_write_file(const char* filename, const char* data, int data_len);
 
 int sys_delete_file(const char* filename);
 
+// Offset-based access; sys_pwrite creates the file if needed.
+// The file calls return FS_EIO when the disk fails or isn't mounted.
+#define FS_EIO -5
+int sys_file_size(const char* filename);
+int sys_pread(const char* filename, void* buf, int len, int offset);
+int sys_pwrite(const char* filename, const void* buf, int len, int offset);
+int sys_truncate(const char* filename, int size);
+
 
 #endif 
@@ -0,0 +1,270 @@
+#include "kernel.h"
+
+// Paging: all of RAM is identity-mapped through page tables shared by every
+// address space, so kernel pointers mean the same thing in every task. Each
+// task additionally gets a private page table for its stack region below
+// STACK_TOP, whose pages are committed on first touch by the #PF task.
+//
+// Ring-3 programs also get private tables for their image, loaded at
+// USER_BASE by elf.c. Ring 3 may only touch those pages and its own stack
+// and heap; the identity map is supervisor-only. The local and I/O APICs'
+// registers are identity-mapped too, by tables shared like the kernel's.
+
+#define PTE_P 0x001
+#define PTE_W 0x002
+#define PTE_U 0x004
+#define PTE_PWT 0x008
+#define PTE_PCD 0x010
+#define PTE_G 0x100
+#define PTE_LAZY 0x200  // not present; fault in a zeroed page on access
+#define PTE_ADDR(e) ((uint32_t *)((e) & ~(PAGE_SIZE - 1)))
+#define STACK_PDE ((STACK_TOP - 1) >> 22)
+
+#define CR0_PG 0x80000000u
+#define CR4_PGE 0x80u
+
+uint32_t *kernel_pd;
+static uint32_t kernel_pdes;
+static bool pge_ok;
+bool vm_pge;
+uint32_t vm_spaces, vm_private_pages, vm_faults;  // any CPU: atomic adds
+
+#define COUNT(v, n) __atomic_add_fetch(&(v), (n), __ATOMIC_RELAXED)
+
+// ---- GDT and TSSs, a pair per CPU in cpu_t. The main TSS gives ring-3
+// tasks their kernel stack (esp0, set on every switch) and is the save
+// area for the hardware task switch into the #PF handler, which runs as
+// its own task so that it has a good stack even when the faulting task has
+// just run off the end of its own. ----
+extern void pf_task(void);
+
+static uint64_t gdt[GDT_TSS / 8 + 2 * MAX_CPUS] = {
+    0,
+    0x00CF9A000000FFFFull,  // 0x08: code, base 0, limit 4 GB
+    0x00CF92000000FFFFull,  // 0x10: data
+    0x00CFFA000000FFFFull,  // 0x18: ring-3 code
+    0x00CFF2000000FFFFull,  // 0x20: ring-3 data
+};
+
+static uint64_t tss_desc(tss_t *t) {
+  uint32_t base = (uint32_t)t, limit = sizeof *t - 1;
+  return (limit & 0xFFFF) | (uint64_t)(base & 0xFFFFFF) << 16 |
+         (uint64_t)0x89 << 40 |  // present, ring 0, 32-bit TSS (available)
+         (uint64_t)(limit >> 16 & 0xF) << 48 | (uint64_t)(base >> 24) << 56;
+}
+
+// Fills in CPU `cpu`'s TSSs and loads the GDT and its task register.
+void vm_cpu_init(int cpu) {
+  cpu_t *c = &cpus[cpu];
+  c->tss.ss0 = GDT_KDATA;
+  c->tss.cr3 = (uint32_t)kernel_pd;
+  c->tss.iomap = sizeof c->tss;
+  c->pf_tss.cr3 = (uint32_t)kernel_pd;
+  c->pf_tss.eip = (uint32_t)pf_task;
+  c->pf_tss.esp = (uint32_t)(c->pf_stack + sizeof c->pf_stack);
+  c->pf_tss.eflags = 0x2;  // IRQs stay off in the handler
+  c->pf_tss.cs = GDT_KCODE;
+  c->pf_tss.ss = c->pf_tss.ds = c->pf_tss.es = c->pf_tss.fs = c->pf_tss.gs =
+      GDT_KDATA;
+  c->pf_tss.iomap = sizeof c->pf_tss;
+  uint32_t sel = GDT_TSS + 16 * cpu;
+  gdt[sel >> 3] = tss_desc(&c->tss);
+  gdt[(sel >> 3) + 1] = tss_desc(&c->pf_tss);
+  c->active_pd = kernel_pd;
+
+  struct __attribute__((packed)) {
+    uint16_t limit;
+    uint32_t base;
+  } gdtr = {sizeof gdt - 1, (uint32_t)gdt};
+  // Selectors 0x08/0x10 are unchanged, so no segment reload is needed.
+  __asm__ volatile("lgdt %0; ltr %w1" : : "m"(gdtr), "r"(sel));
+}
+
+void vm_init(void) {
+  kernel_pd = pmm_alloc_page();
+  memset(kernel_pd, 0, PAGE_SIZE);
+  kernel_pdes = (pmm_npages + 1023) / 1024;
+  for (uint32_t i = 0; i < kernel_pdes; i++) {
+    uint32_t *pt = pmm_alloc_page();
+    for (uint32_t j = 0; j < 1024; j++)
+      pt[j] = ((i * 1024 + j) << PAGE_SHIFT) | PTE_G | PTE_W | PTE_P;
+    // PTEs alone decide what ring 3 sees.
+    kernel_pd[i] = (uint32_t)pt | PTE_U | PTE_W | PTE_P;
+  }
+  vm_cpu_init(0);
+
+  uint32_t a = 1, b, c, d;
+  __asm__ volatile("cpuid" : "+a"(a), "=b"(b), "=c"(c), "=d"(d));
+  pge_ok = d & (1u << 13);
+  vm_set_pge(pge_ok);
+
+  uint32_t cr0;
+  __asm__ volatile("mov %0, %%cr3" : : "r"(kernel_pd));
+  __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+  __asm__ volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG) : "memory");
+}
+
+// Identity-maps the device registers page at `pa`, uncached, in a table
+// every address space shares. Call it before any vm_create().
+void *vm_mmio(uint32_t pa) {
+  uint32_t d = pa >> 22;
+  if (d < kernel_pdes) return (void *)pa;  // inside RAM's map already
+  if (!(kernel_pd[d] & PTE_P)) {
+    uint32_t *pt = pmm_alloc_page();
+    if (!pt) return NULL;
+    memset(pt, 0, PAGE_SIZE);
+    kernel_pd[d] = (uint32_t)pt | PTE_W | PTE_P;
+  }
+  PTE_ADDR(kernel_pd[d])[(pa >> PAGE_SHIFT) & 1023] =
+      (pa & ~(PAGE_SIZE - 1)) | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+  return (void *)pa;
+}
+
+// Kernel pages marked global survive CR3 reloads; switching this off makes
+// every context switch flush them too. It only changes the calling CPU.
+void vm_set_pge(bool on) {
+  if (!pge_ok) return;
+  uint32_t cr4;
+  __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+  cr4 = on ? cr4 | CR4_PGE : cr4 & ~CR4_PGE;
+  __asm__ volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+  vm_pge = on;
+}
+
+// A new address space: the kernel's page tables plus a private stack table
+// with `stack_pages` pages reserved under STACK_TOP. Only the top page is
+// committed; the unreserved page below the last one is the guard. A `user`
+// space's stack is open to ring 3.
+uint32_t *vm_create(uint32_t stack_pages, bool user) {
+  uint32_t *pd = pmm_alloc_page(), *pt = pmm_alloc_page();
+  void *top = pmm_alloc_page();
+  if (!pd || !pt || !top) {
+    if (pd) pmm_free_pages_at(pd, 1);
+    if (pt) pmm_free_pages_at(pt, 1);
+    if (top) pmm_free_pages_at(top, 1);
+    return NULL;
+  }
+  if (stack_pages > STACK_MAX_PAGES) stack_pages = STACK_MAX_PAGES;
+  memcpy(pd, kernel_pd, PAGE_SIZE);
+  memset(pt, 0, PAGE_SIZE);
+  uint32_t u = user ? PTE_U : 0;
+  for (uint32_t i = 1; i < stack_pages; i++) pt[1023 - i] = PTE_LAZY | u;
+  pt[1023] = (uint32_t)top | u | PTE_W | PTE_P;
+  pd[STACK_PDE] = (uint32_t)pt | PTE_U | PTE_W | PTE_P;
+  COUNT(vm_spaces, 1);
+  COUNT(vm_private_pages, 1);
+  return pd;
+}
+
+// Frees every private table of `pd` and the pages they map.
+void vm_destroy(uint32_t *pd) {
+  for (uint32_t d = kernel_pdes; d < 1024; d++) {
+    if (!(pd[d] & PTE_P) || pd[d] == kernel_pd[d]) continue;
+    uint32_t *pt = PTE_ADDR(pd[d]);
+    for (int i = 0; i < 1024; i++)
+      if (pt[i] & PTE_P) {
+        pmm_free_pages_at(PTE_ADDR(pt[i]), 1);
+        COUNT(vm_private_pages, -1);
+      }
+    pmm_free_pages_at(pt, 1);
+  }
+  pmm_free_pages_at(pd, 1);
+  COUNT(vm_spaces, -1);
+}
+
+// Commits a zeroed ring-3 page at `va` in `pd`, adding a private table for
+// it if needed, and returns the page's kernel address. A page that is
+// already there is returned as it is, made writable if `write`. NULL if
+// `va` is in a table shared with the kernel or the stack's, or memory runs
+// out.
+void *vm_map_user(uint32_t *pd, uint32_t va, bool write) {
+  uint32_t d = va >> 22;
+  if (d < kernel_pdes || kernel_pd[d] || d == STACK_PDE) return NULL;
+  if (!(pd[d] & PTE_P)) {
+    uint32_t *pt = pmm_alloc_page();
+    if (!pt) return NULL;
+    memset(pt, 0, PAGE_SIZE);
+    pd[d] = (uint32_t)pt | PTE_U | PTE_W | PTE_P;
+  }
+  uint32_t *pte = &PTE_ADDR(pd[d])[(va >> PAGE_SHIFT) & 1023];
+  if (!(*pte & PTE_P)) {
+    void *pg = pmm_alloc_page();
+    if (!pg) return NULL;
+    memset(pg, 0, PAGE_SIZE);
+    *pte = (uint32_t)pg | PTE_U | PTE_P;
+    COUNT(vm_private_pages, 1);
+  }
+  if (write) *pte |= PTE_W;
+  return PTE_ADDR(*pte);
+}
+
+// Kernel address of `va` in address space `pd`, or NULL if it isn't mapped.
+void *vm_phys(uint32_t *pd, uint32_t va) {
+  uint32_t pde = pd[va >> 22];
+  if (!(pde & PTE_P)) return NULL;
+  uint32_t pte = PTE_ADDR(pde)[(va >> PAGE_SHIFT) & 1023];
+  if (!(pte & PTE_P)) return NULL;
+  return (uint8_t *)PTE_ADDR(pte) + (va & (PAGE_SIZE - 1));
+}
+
+// Demand-zero fill for a fault at `addr` in the active address space.
+// Returns false if the address isn't a reserved-but-uncommitted page.
+bool vm_fault(uint32_t addr) {
+  uint32_t pde = this_cpu()->active_pd[addr >> 22];
+  if (!(pde & PTE_P)) return false;
+  uint32_t *pte = &PTE_ADDR(pde)[(addr >> PAGE_SHIFT) & 1023];
+  if ((*pte & PTE_P) || !(*pte & PTE_LAZY)) return false;
+  void *pg = pmm_alloc_page();
+  if (!pg) return false;
+  memset(pg, 0, PAGE_SIZE);
+  *pte = (uint32_t)pg | (*pte & PTE_U) | PTE_W | PTE_P;
+  COUNT(vm_private_pages, 1);
+  COUNT(vm_faults, 1);
+  return true;
+}
+
+// Reserves the pages covering [from, to) in the private table of `pd` for
+// ring 3, to be committed on first touch like the stack.
+void vm_reserve(uint32_t *pd, uint32_t from, uint32_t to) {
+  uint32_t *pt = PTE_ADDR(pd[STACK_PDE]);
+  for (uint32_t a = from & ~(PAGE_SIZE - 1); a < to; a += PAGE_SIZE) {
+    uint32_t *pte = &pt[(a >> PAGE_SHIFT) & 1023];
+    if (!*pte) *pte = PTE_LAZY | PTE_U;
+  }
+}
+
+// Whether ring 3 may read (or write) the page at `va` in `pd`; reserved
+// pages count, since touching them just faults them in.
+static bool user_page_ok(uint32_t *pd, uint32_t va, bool write) {
+  uint32_t pde = pd[va >> 22];
+  if ((pde & (PTE_P | PTE_U)) != (PTE_P | PTE_U)) return false;
+  uint32_t pte = PTE_ADDR(pde)[(va >> PAGE_SHIFT) & 1023];
+  if (!(pte & PTE_U) || !(pte & (PTE_P | PTE_LAZY))) return false;
+  return !write || (pte & (PTE_W | PTE_LAZY));
+}
+
+// Checks a system call's buffer argument, in the caller's address space
+// `pd`, before the kernel touches it.
+bool vm_user_ok(uint32_t *pd, uint32_t va, uint32_t len, bool write) {
+  if (len == 0) return true;
+  uint32_t end = va + len - 1;
+  if (end < va) return false;
+  for (uint32_t a = va & ~(PAGE_SIZE - 1);; a += PAGE_SIZE) {
+    if (!user_page_ok(pd, a, write)) return false;
+    if (end - a < PAGE_SIZE) return true;
+  }
+}
+
+// Length of the string at `va` in `pd`, or -1 if it runs into a page ring 3
+// can't read or is longer than `max`.
+int32_t vm_user_strlen(uint32_t *pd, uint32_t va, uint32_t max) {
+  for (uint32_t n = 0; n <= max;) {
+    if (!user_page_ok(pd, va + n, false)) return -1;
+    const char *p = (const char *)(va + n);
+    uint32_t left = PAGE_SIZE - ((va + n) & (PAGE_SIZE - 1));
+    for (uint32_t i = 0; i < left; i++)
+      if (!p[i]) return n + i;
+    n += left;
+  }
+  return -1;
+}
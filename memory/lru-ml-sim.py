@@ -1,13 +1,18 @@
+import os
 import random
-from collections import deque, defaultdict
+import sys
+import tempfile
+from collections import OrderedDict, deque, defaultdict
 
 import numpy as np
-import pandas as pd
 import matplotlib.pyplot as plt
-from sklearn.linear_model import LogisticRegression
+from sklearn.linear_model import LogisticRegression, SGDClassifier
 from sklearn.pipeline import make_pipeline
 from sklearn.preprocessing import StandardScaler
 
+import pagesim
+import tracefile
+
 def generate_mixed_trace(total_len=1_000_000,
                          hot_set_size=100,
                          cold_scan_size=1_000,
@@ -32,18 +37,19 @@ def generate_mixed_trace(total_len=1_000_000,
         cold_base += cold_scan_size
     return trace
 
+# Pure-Python policies, used when the native engine (pagesim.py) can't be
+# built. The dict keeps insertion order, so moving a page to the end on a
+# hit makes the LRU O(1).
 def simulate_lru(seq, k):
-    cache, present, hits = deque(), set(), 0
+    cache, hits = OrderedDict(), 0
     for p in seq:
-        if p in present:
+        if p in cache:
             hits += 1
-            cache.remove(p)
-            cache.append(p)
+            cache.move_to_end(p)
         else:
             if len(cache) == k:
-                present.remove(cache.popleft())
-            cache.append(p)
-            present.add(p)
+                cache.popitem(last=False)
+            cache[p] = True
     return hits
 
 def simulate_fifo(seq, k):
@@ -74,25 +80,138 @@ def simulate_random(seq, k, seed=0):
             present.add(p)
     return hits
 
-def build_feature_table(seq, horizon=2_000, unseen=100_000):
-    last_seen, cnts, rows = {}, defaultdict(int), []
-    for i, page in enumerate(seq):
-        rec  = i - last_seen[page] if page in last_seen else unseen
-        freq = cnts[page]
-        label = 1 if page in seq[i+1 : i+1+horizon] else 0
-        rows.append((rec, freq, label))
-        last_seen[page] = i
-        cnts[page] += 1
-    return pd.DataFrame(rows, columns=['recency', 'frequency', 'label'])
+# ---- features ----
+# The table is built a chunk at a time in two passes, so the trace (a list,
+# an array or a np.memmap) never has to fit in memory whole. Labels come
+# first, from a pass backwards that finds each access's next use; then
+# recency and frequency from a pass forwards. Pages carried between chunks
+# live in sorted arrays (page -> index, count), so each chunk is a few
+# numpy sorts instead of a Python loop per access.
+
+COLUMNS = {'recency': np.int64, 'frequency': np.int32, 'label': np.uint8}
+NEVER = np.iinfo(np.int64).max
+
+def _runs(c):
+    """c's positions sorted by page, and where each page's run starts."""
+    order = np.argsort(c, kind='stable')
+    s = c[order]
+    start = np.empty(len(s), dtype=bool)
+    start[:1] = True
+    start[1:] = s[1:] != s[:-1]
+    return order, s, start
+
+def _lookup(keys, q):
+    """Where each of q sits in the sorted keys, and whether it's there."""
+    pos = np.minimum(np.searchsorted(keys, q), max(len(keys) - 1, 0))
+    found = keys[pos] == q if len(keys) else np.zeros(len(q), dtype=bool)
+    return found, pos
+
+def _merge(keys, vals, new_keys, new_vals):
+    """keys -> vals updated with new_keys -> new_vals."""
+    k, i = np.unique(np.concatenate((new_keys, keys)), return_index=True)
+    return k, np.concatenate((new_vals, vals))[i]
+
+def build_feature_table(seq, horizon=2_000, unseen=100_000, path=None,
+                        chunk=1 << 20):
+    """Recency, frequency and a "used again within horizon" label for each
+    access, as columns. With a path they are .npy files there, memory-mapped
+    and reopened by load_feature_table(); otherwise arrays in memory."""
+    n = len(seq)
+    if path:
+        os.makedirs(path, exist_ok=True)
+        t = {c: np.lib.format.open_memmap(os.path.join(path, c + '.npy'),
+                                          mode='w+', dtype=d, shape=(n,))
+             for c, d in COLUMNS.items()}
+    else:
+        t = {c: np.empty(n, dtype=d) for c, d in COLUMNS.items()}
 
-def train_logreg(df, train_frac=0.6):
-    cut = int(len(df)*train_frac)
-    X, y = df[['recency','frequency']][:cut], df['label'][:cut]
+    # Backwards: the next use of each access is the next one in its page's
+    # run, or for the last of a run the first use in a later chunk.
+    keys, first = np.empty(0, np.int64), np.empty(0, np.int64)
+    for end in range(n, 0, -chunk):
+        beg = max(end - chunk, 0)
+        order, s, start = _runs(np.asarray(seq[beg:end], dtype=np.int64))
+        nxt = np.full(end - beg, NEVER)
+        same = ~start[1:]
+        nxt[order[:-1][same]] = beg + order[1:][same]
+        last = np.append(start[1:], True)
+        found, pos = _lookup(keys, s[last])
+        nxt[order[last][found]] = first[pos[found]]
+        t['label'][beg:end] = nxt - np.arange(beg, end) <= horizon
+        keys, first = _merge(keys, first, s[start], beg + order[start])
+
+    # Forwards: recency from the previous use, frequency from the uses
+    # before this one, both picking up where the last chunk left off.
+    keys, seen = np.empty(0, np.int64), np.empty((0, 2), np.int64)
+    for beg in range(0, n, chunk):
+        end = min(beg + chunk, n)
+        order, s, start = _runs(np.asarray(seq[beg:end], dtype=np.int64))
+        idx = beg + order
+        run = np.cumsum(start) - 1
+        heads = np.flatnonzero(start)
+        found, pos = _lookup(keys, s[start])
+        before = np.zeros((len(heads), 2), np.int64)
+        before[:, 0] = -1
+        before[found] = seen[pos[found]]
+        prev = np.empty(end - beg, np.int64)
+        prev[1:] = idx[:-1]
+        prev[start] = before[:, 0]
+        rec, freq = np.empty(end - beg, np.int64), np.empty(end - beg, np.int64)
+        rec[order] = np.where(prev >= 0, idx - prev, unseen)
+        freq[order] = before[run, 1] + np.arange(end - beg) - heads[run]
+        t['recency'][beg:end] = rec
+        t['frequency'][beg:end] = freq
+        last = np.append(start[1:], True)
+        after = np.column_stack((idx[last], before[:, 1] + np.diff(
+            np.append(heads, end - beg))))
+        keys, seen = _merge(keys, seen, s[start], after)
+
+    if path:
+        for col in t.values():
+            col.flush()
+    return t
+
+def load_feature_table(path):
+    """A table written by build_feature_table(path=...), memory-mapped."""
+    return {c: np.load(os.path.join(path, c + '.npy'), mmap_mode='r')
+            for c in COLUMNS}
+
+def train_logreg(ft, train_frac=0.6):
+    cut = int(len(ft['label'])*train_frac)
+    X = np.column_stack((ft['recency'][:cut], ft['frequency'][:cut]))
+    y = ft['label'][:cut]
     model = make_pipeline(StandardScaler(),
                           LogisticRegression(max_iter=1000))
     model.fit(X, y)
     return model
 
+def train_online(ft, train_frac=0.6, chunk=1 << 20, epochs=3, seed=0):
+    """The same logistic model fitted a chunk at a time with SGD, for tables
+    bigger than memory: one pass to fit the scaler, then `epochs` passes of
+    shuffled chunks."""
+    cut = int(len(ft['label'])*train_frac)
+    rng = np.random.default_rng(seed)
+
+    def chunks():
+        for beg in range(0, cut, chunk):
+            end = min(beg + chunk, cut)
+            X = np.column_stack((ft['recency'][beg:end],
+                                 ft['frequency'][beg:end])).astype(float)
+            yield X, np.asarray(ft['label'][beg:end])
+
+    scaler = StandardScaler()
+    for X, _ in chunks():
+        scaler.partial_fit(X)
+    clf = SGDClassifier(loss='log_loss', random_state=seed)
+    for _ in range(epochs):
+        for X, y in chunks():
+            p = rng.permutation(len(y))
+            clf.partial_fit(scaler.transform(X[p]), y[p], classes=[0, 1])
+    return make_pipeline(scaler, clf)
+
+# The reference version, scoring every cached page on every miss; run_sweep
+# uses pagesim.simulate_ml(), which keeps the pages in a heap ordered by the
+# model's exported weights.
 def simulate_ml(seq, k, model, unseen=100_000):
     cache, present, hits = [], set(), 0
     last_seen, cnts = {}, defaultdict(int)
@@ -116,20 +235,33 @@ def simulate_ml(seq, k, model, unseen=100_000):
         cnts[page] += 1
     return hits
 
-def run_sweep():
+def run_sweep(online=False):
     TOTAL = 1_000_000
     trace = generate_mixed_trace(total_len=TOTAL)
 
-    ft   = build_feature_table(trace)
-    ml   = train_logreg(ft)
+    if online:
+        # The large-trace path: columns on disk, trained chunk by chunk.
+        with tempfile.TemporaryDirectory() as tmp:
+            ml = train_online(build_feature_table(trace, path=tmp))
+    else:
+        ml = train_logreg(build_feature_table(trace))
 
-    for CACHE in [64, 128, 256, 512]:
-        hits = {
-            'LRU'   : simulate_lru(trace, CACHE),
-            'FIFO'  : simulate_fifo(trace, CACHE),
-            'Random': simulate_random(trace, CACHE),
-            'ML'    : simulate_ml(trace, CACHE, ml),
+    sizes = [64, 128, 256, 512]
+    if pagesim.available():
+        results = pagesim.sweep(trace, ['LRU', 'FIFO', 'Random', 'CLOCK'],
+                                sizes)
+        w = pagesim.export_logreg(ml)
+        results['ML'] = [pagesim.simulate_ml(trace, k, w) for k in sizes]
+    else:
+        results = {
+            'LRU'   : [simulate_lru(trace, k) for k in sizes],
+            'FIFO'  : [simulate_fifo(trace, k) for k in sizes],
+            'Random': [simulate_random(trace, k) for k in sizes],
+            'ML'    : [simulate_ml(trace, k, ml) for k in sizes],
         }
+
+    for i, CACHE in enumerate(sizes):
+        hits = {m: h[i] for m, h in results.items()}
         misses = {m: TOTAL - h for m, h in hits.items()}
 
         print(f"\n=== Cache = {CACHE} lines ===")
@@ -155,5 +287,62 @@ def run_sweep():
         plt.tight_layout()
         plt.show()
 
+def run_mrc(rate=1.0, max_size=4_096):
+    """LRU at every cache size from one stack-distance pass, in place of a
+    simulation per size; rate < 1 samples it SHARDS-style."""
+    TOTAL = 1_000_000
+    trace = generate_mixed_trace(total_len=TOTAL)
+    curve = pagesim.mrc(trace, max_size=max_size, rate=rate)
+
+    print(f"\n=== LRU miss-ratio curve (rate {rate}, "
+          f"{curve.sampled:,} of {TOTAL:,} accesses followed) ===")
+    sizes = [16, 32, 64, 128, 256, 512, 1024, 2048, 4096]
+    for k, h in zip(sizes, curve.hits(sizes)):
+        print(f"LRU {k:>5}: hits {h:7,}  misses {TOTAL - h:7,} "
+              f"| hit‑rate {h / TOTAL * 100:5.2f}%")
+
+    ks = np.arange(1, max_size + 1)
+    fig, ax = plt.subplots(figsize=(8, 4))
+    ax.plot(ks, curve.miss_ratio(ks) * 100)
+    ax.set_xscale("log", base=2)
+    ax.set_xlabel("Cache size (lines)")
+    ax.set_ylabel("Miss ratio (%)")
+    ax.set_title(f"LRU Miss-Ratio Curve  (Trace = {TOTAL:,}, rate = {rate})")
+    plt.tight_layout()
+    plt.show()
+
+def run_replay(path, rate=1.0, sizes=(64, 256, 1_024, 4_096, 16_384)):
+    """Every policy on a recorded trace (a .ptr file from tracefile.py),
+    streamed a chunk at a time: memory stays flat however long it is."""
+    if not pagesim.available():
+        sys.exit("replay needs the native engine (pagesim.c)")
+    trace = tracefile.TraceFile(path)
+    TOTAL = len(trace)
+    with tempfile.TemporaryDirectory() as tmp:
+        ml = train_online(build_feature_table(trace, path=tmp))
+    results = pagesim.sweep(trace, ['LRU', 'FIFO', 'Random', 'CLOCK'], sizes)
+    w = pagesim.export_logreg(ml)
+    results['ML'] = [pagesim.simulate_ml(trace, k, w) for k in sizes]
+    curve = pagesim.mrc(trace, max_size=max(sizes), rate=rate)
+
+    print(f"\n=== {path}: {TOTAL:,} accesses ===")
+    print("cache " + "".join(f"{m:>9}" for m in results) + "   LRU (MRC)")
+    for i, k in enumerate(sizes):
+        print(f"{k:>5} " + "".join(f"{h[i] / TOTAL * 100:8.2f}%"
+                                   for h in results.values()) +
+              f"   {curve.hit_ratio(k) * 100:8.2f}%")
+
 if __name__ == "__main__":
-    run_sweep()
+    # python3 lru-ml-sim.py            the four policies at four sizes
+    # python3 lru-ml-sim.py online     the same, with the ML model trained
+    #                                  from memory-mapped columns by SGD
+    # python3 lru-ml-sim.py mrc [rate] LRU's whole miss-ratio curve
+    # python3 lru-ml-sim.py replay FILE.ptr [rate]
+    #                                  every policy on a recorded trace
+    if sys.argv[1:2] == ["mrc"]:
+        run_mrc(float(sys.argv[2]) if len(sys.argv) > 2 else 1.0)
+    elif sys.argv[1:2] == ["replay"]:
+        run_replay(sys.argv[2], float(sys.argv[3]) if len(sys.argv) > 3
+                   else 1.0)
+    else:
+        run_sweep(online=sys.argv[1:2] == ["online"])
@@ -1,5 +1,5 @@
 import random
-from collections import deque, defaultdict
+from collections import OrderedDict, deque, defaultdict
 import numpy as np
 import pandas as pd
 import matplotlib.pyplot as plt
@@ -7,6 +7,8 @@ from sklearn.linear_model import LogisticRegression
 from sklearn.pipeline import make_pipeline
 from sklearn.preprocessing import StandardScaler
 
+import pagesim
+
 
 def generate_trace(total=300_000,
                    hot_set=100,
@@ -33,16 +35,17 @@ def generate_trace(total=300_000,
     return trace
 
 
+# Fallbacks for when pagesim.py's native engine can't be built.
 def lru(seq, k):
-    cache, present, hits = deque(), set(), 0
+    cache, hits = OrderedDict(), 0
     for p in seq:
-        if p in present:
+        if p in cache:
             hits += 1
-            cache.remove(p); cache.append(p)
+            cache.move_to_end(p)
         else:
             if len(cache) == k:
-                present.remove(cache.popleft())
-            cache.append(p); present.add(p)
+                cache.popitem(last=False)
+            cache[p] = True
     return hits
 
 def fifo(seq, k):
@@ -72,11 +75,16 @@ def rand(seq, k, seed=0):
     return hits
 
 def feature_table(seq, horizon=2_000, unseen=100_000):
+    # next use of every access, from one pass backwards
+    nxt, after = [0] * len(seq), {}
+    for i in range(len(seq) - 1, -1, -1):
+        nxt[i] = after.get(seq[i], len(seq) + horizon)
+        after[seq[i]] = i
     last, cnt, rows = {}, defaultdict(int), []
     for i, pg in enumerate(seq):
         rec  = i - last[pg] if pg in last else unseen
         freq = cnt[pg]
-        label = 1 if pg in seq[i+1:i+1+horizon] else 0
+        label = 1 if nxt[i] - i <= horizon else 0
         rows.append((rec, freq, label))
         last[pg] = i; cnt[pg] += 1
     return pd.DataFrame(rows, columns=['recency', 'frequency', 'label'])
@@ -112,14 +120,23 @@ TRACE  = generate_trace(total=TOTAL)
 MODEL  = train_logreg(feature_table(TRACE))
 
 sizes  = [64, 128, 256, 512]
-pols   = ['LRU', 'FIFO', 'Random', 'ML']
+pols   = ['LRU', 'FIFO', 'Random', 'CLOCK', 'ML']
 hits   = {p: [] for p in pols}
 
-for k in sizes:
-    hits['LRU'].append(lru(TRACE, k)          / TOTAL * 100)
-    hits['FIFO'].append(fifo(TRACE, k)        / TOTAL * 100)
-    hits['Random'].append(rand(TRACE, k)      / TOTAL * 100)
-    hits['ML'].append(ml_eviction(TRACE, k, MODEL) / TOTAL * 100)
+if pagesim.available():
+    for p, h in pagesim.sweep(TRACE, pols[:4], sizes).items():
+        hits[p] = [x / TOTAL * 100 for x in h]
+    W = pagesim.export_logreg(MODEL)
+    hits['ML'] = [pagesim.simulate_ml(TRACE, k, W) / TOTAL * 100
+                  for k in sizes]
+else:
+    pols.remove('CLOCK')
+    del hits['CLOCK']
+    for k in sizes:
+        hits['LRU'].append(lru(TRACE, k)          / TOTAL * 100)
+        hits['FIFO'].append(fifo(TRACE, k)        / TOTAL * 100)
+        hits['Random'].append(rand(TRACE, k)      / TOTAL * 100)
+        hits['ML'].append(ml_eviction(TRACE, k, MODEL) / TOTAL * 100)
 
 fig, ax = plt.subplots(figsize=(8, 5))
 for p in pols:
@@ -0,0 +1,635 @@
+/*
+ * Native page-replacement engine behind pagesim.py.
+ *
+ * pagesim_run() replays a trace of page numbers through a cache of k
+ * frames and returns the number of hits. All the state lives in flat
+ * arrays sized from k: an open-addressing hash from page to frame, and per
+ * frame its page, LRU links or CLOCK reference bit. A hit or a miss is
+ * O(1) for every policy (CLOCK amortised), against the O(k) deque.remove()
+ * of the Python LRU.
+ *
+ *   cc -O2 -shared -fPIC -o libpagesim.so pagesim.c
+ *
+ * pagesim.py does this itself the first time it is imported.
+ *
+ * pagesim_stack_dist() is the one-pass alternative for LRU: Mattson's
+ * stack distances, whose histogram gives the hits at every cache size at
+ * once.
+ *
+ * pagesim_run_ml() is the logistic-regression policy of lru-ml-sim.py,
+ * from the model's weights.
+ *
+ * Each also comes as a handle that is fed the trace piece by piece
+ * (pagesim_new/feed/free, pagesim_sd_*, pagesim_ml_*), so a trace file
+ * can be replayed a chunk at a time in constant memory (tracefile.py).
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { PS_LRU, PS_FIFO, PS_RANDOM, PS_CLOCK };
+
+#define EMPTY UINT32_MAX
+
+/* Page -> frame, linear probing at a load factor of at most 1/4: on
+ * traces that miss a lot, the shorter probe runs are worth twice the
+ * speed of a half-full table. */
+typedef struct {
+  uint64_t *key;
+  uint32_t *val;
+  uint64_t mask;
+  int shift;
+} map_t;
+
+static uint64_t slot_of(const map_t *m, uint64_t key) {
+  return (key * 0x9E3779B97F4A7C15ull) >> m->shift;
+}
+
+/* Room for k entries. */
+static int map_init(map_t *m, int64_t k) {
+  int bits = 1;
+  while ((1ll << bits) < 4 * k) bits++;
+  m->mask = (1ull << bits) - 1;
+  m->shift = 64 - bits;
+  m->key = malloc(sizeof(uint64_t) << bits);
+  m->val = malloc(sizeof(uint32_t) << bits);
+  if (!m->key || !m->val) return -1;
+  for (uint64_t i = 0; i <= m->mask; i++) m->val[i] = EMPTY;
+  return 0;
+}
+
+static void map_free(map_t *m) {
+  free(m->key);
+  free(m->val);
+}
+
+/* The slot holding key, or the empty one where it would go. */
+static uint64_t map_find(const map_t *m, uint64_t key) {
+  uint64_t i = slot_of(m, key);
+  while (m->val[i] != EMPTY && m->key[i] != key) i = (i + 1) & m->mask;
+  return i;
+}
+
+/* The frame holding key, or EMPTY. */
+static uint32_t map_get(const map_t *m, uint64_t key) {
+  return m->val[map_find(m, key)];
+}
+
+static void map_put(map_t *m, uint64_t key, uint32_t val) {
+  uint64_t i = slot_of(m, key);
+  while (m->val[i] != EMPTY) i = (i + 1) & m->mask;
+  m->key[i] = key;
+  m->val[i] = val;
+}
+
+/* Backward-shift deletion: later entries of the probe run move up into the
+ * hole, so lookups never need tombstones. */
+static void map_del(map_t *m, uint64_t key) {
+  uint64_t i = slot_of(m, key);
+  while (m->key[i] != key || m->val[i] == EMPTY) i = (i + 1) & m->mask;
+  for (uint64_t j = i;;) {
+    m->val[i] = EMPTY;
+    for (;;) {
+      j = (j + 1) & m->mask;
+      if (m->val[j] == EMPTY) return;
+      uint64_t home = slot_of(m, m->key[j]);
+      /* Stays put if its home lies cyclically in (i, j]. */
+      if (i <= j ? (i < home && home <= j) : (i < home || home <= j)) continue;
+      m->key[i] = m->key[j];
+      m->val[i] = m->val[j];
+      i = j;
+      break;
+    }
+  }
+}
+
+/* Twice the size, for a map whose entries are never deleted. */
+static int map_grow(map_t *m) {
+  map_t old = *m;
+  if (map_init(m, (int64_t)(old.mask + 1) / 2)) {
+    map_free(m);
+    *m = old;
+    return -1;
+  }
+  for (uint64_t i = 0; i <= old.mask; i++)
+    if (old.val[i] != EMPTY) map_put(m, old.key[i], old.val[i]);
+  map_free(&old);
+  return 0;
+}
+
+/* xorshift64*, for PS_RANDOM. */
+static uint64_t next_rand(uint64_t *s) {
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545F4914F6CDD1Dull;
+}
+
+static uint64_t page_at(const void *trace, int width, int64_t i) {
+  return width == 4 ? ((const uint32_t *)trace)[i]
+                    : ((const uint64_t *)trace)[i];
+}
+
+/* One simulation, fed a trace in as many pieces as the caller likes. */
+typedef struct {
+  int policy;
+  uint32_t k, used, hand;
+  uint32_t head, tail; /* LRU: most and least recent */
+  uint64_t rng;
+  int64_t hits;
+  map_t m;
+  uint64_t *page;
+  uint32_t *prev, *next;
+  uint8_t *ref;
+} sim_t;
+
+void pagesim_free(sim_t *s) {
+  if (!s) return;
+  map_free(&s->m);
+  free(s->page);
+  free(s->prev);
+  free(s->next);
+  free(s->ref);
+  free(s);
+}
+
+/* A cache of k empty frames under policy, or NULL for bad arguments or no
+ * memory. seed drives PS_RANDOM's victim choice. */
+sim_t *pagesim_new(int policy, int64_t k, uint64_t seed) {
+  if (k <= 0 || k >= EMPTY || policy < PS_LRU || policy > PS_CLOCK)
+    return NULL;
+  sim_t *s = calloc(1, sizeof *s);
+  if (!s) return NULL;
+  s->page = malloc(k * sizeof *s->page);
+  s->prev = malloc(k * sizeof *s->prev);
+  s->next = malloc(k * sizeof *s->next);
+  s->ref = calloc(k, 1);
+  if (map_init(&s->m, k) || !s->page || !s->prev || !s->next || !s->ref) {
+    pagesim_free(s);
+    return NULL;
+  }
+  s->policy = policy;
+  s->k = k;
+  s->head = s->tail = EMPTY;
+  s->rng = seed * 2 + 1; /* xorshift needs nonzero state */
+  return s;
+}
+
+/*
+ * Replays trace[0..n) (width 4 or 8 bytes per page number) and returns the
+ * hits so far, or -1 for bad arguments.
+ */
+int64_t pagesim_feed(sim_t *s, const void *trace, int64_t n, int width) {
+  if (n < 0 || (width != 4 && width != 8)) return -1;
+  int policy = s->policy;
+  uint32_t k = s->k, used = s->used, hand = s->hand;
+  uint32_t head = s->head, tail = s->tail;
+  uint64_t rng = s->rng;
+  int64_t hits = s->hits;
+  map_t *m = &s->m;
+  uint64_t *page = s->page;
+  uint32_t *prev = s->prev, *next = s->next;
+  uint8_t *ref = s->ref;
+  for (int64_t i = 0; i < n; i++) {
+    uint64_t p = page_at(trace, width, i);
+    uint32_t f = map_get(m, p);
+    if (f != EMPTY) {
+      hits++;
+      if (policy == PS_CLOCK) {
+        ref[f] = 1;
+      } else if (policy == PS_LRU && f != head) {
+        next[prev[f]] = next[f];
+        if (f == tail)
+          tail = prev[f];
+        else
+          prev[next[f]] = prev[f];
+        prev[f] = EMPTY;
+        next[f] = head;
+        prev[head] = f;
+        head = f;
+      }
+      continue;
+    }
+    if (used < k) {
+      f = used++;
+    } else {
+      switch (policy) {
+        case PS_LRU:
+          f = tail;
+          tail = prev[f];
+          if (tail == EMPTY)
+            head = EMPTY;
+          else
+            next[tail] = EMPTY;
+          break;
+        case PS_FIFO:  /* frames fill in order, so the oldest is at hand */
+          f = hand;
+          hand = hand + 1 == k ? 0 : hand + 1;
+          break;
+        case PS_RANDOM:
+          f = next_rand(&rng) % k;
+          break;
+        case PS_CLOCK:  /* second chance: clear bits until one is clear */
+          while (ref[hand]) {
+            ref[hand] = 0;
+            hand = hand + 1 == k ? 0 : hand + 1;
+          }
+          f = hand;
+          hand = hand + 1 == k ? 0 : hand + 1;
+          break;
+      }
+      map_del(m, page[f]);
+    }
+    page[f] = p;
+    map_put(m, p, f);
+    if (policy == PS_LRU) {
+      prev[f] = EMPTY;
+      next[f] = head;
+      if (head == EMPTY)
+        tail = f;
+      else
+        prev[head] = f;
+      head = f;
+    }
+  }
+  s->used = used;
+  s->hand = hand;
+  s->head = head;
+  s->tail = tail;
+  s->rng = rng;
+  s->hits = hits;
+  return hits;
+}
+
+/*
+ * The whole trace at once: the hits, or -1 for bad arguments or no memory.
+ */
+int64_t pagesim_run(int policy, const void *trace, int64_t n, int width,
+                    int64_t k, uint64_t seed) {
+  sim_t *s = pagesim_new(policy, k, seed);
+  if (!s) return -1;
+  int64_t hits = pagesim_feed(s, trace, n, width);
+  pagesim_free(s);
+  return hits;
+}
+
+/* ---- stack distances ---- */
+
+/* A page's stack distance at an access is how many distinct pages were
+ * touched since its last one, itself included: an LRU cache of k frames
+ * hits exactly when it is <= k. Every page seen has one mark in a Fenwick
+ * tree, at the position of its last access, so the distance is the count
+ * of marks after that position. Positions only grow; when they run out
+ * the live marks are packed to the front, so memory follows the number of
+ * distinct pages rather than the length of the trace. */
+typedef struct {
+  int32_t *tree; /* Fenwick tree over positions, 1-based inside */
+  uint64_t *page; /* page whose last access is at a position */
+  uint8_t *live;  /* position holds a mark */
+  uint32_t cap, next, marks;
+} dstack_t;
+
+static int stack_alloc(dstack_t *s, uint32_t cap) {
+  int32_t *t = calloc((size_t)cap + 1, sizeof *t);
+  uint64_t *p = realloc(s->page, cap * sizeof *p);
+  if (p) s->page = p;
+  uint8_t *l = realloc(s->live, cap);
+  if (l) s->live = l;
+  if (!t || !p || !l) {
+    free(t);
+    return -1;
+  }
+  free(s->tree);
+  s->tree = t;
+  s->cap = cap;
+  return 0;
+}
+
+static void mark(dstack_t *s, uint32_t pos, int32_t d) {
+  for (uint32_t i = pos + 1; i <= s->cap; i += i & -i) s->tree[i] += d;
+}
+
+/* Marks at positions <= pos. */
+static uint32_t marks_upto(const dstack_t *s, uint32_t pos) {
+  uint32_t n = 0;
+  for (uint32_t i = pos + 1; i; i -= i & -i) n += s->tree[i];
+  return n;
+}
+
+/* Packs the marks to positions 0..marks-1, growing the tree if they would
+ * fill more than half of it, and repoints the map at the new positions. */
+static int stack_pack(dstack_t *s, map_t *m) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < s->next; i++)
+    if (s->live[i]) s->page[n++] = s->page[i];
+  if (n > s->cap / 2 && (s->cap > UINT32_MAX / 2 || stack_alloc(s, s->cap * 2)))
+    return -1;
+  memset(s->tree, 0, ((size_t)s->cap + 1) * sizeof *s->tree);
+  memset(s->live, 0, s->cap);
+  for (uint32_t i = 0; i < n; i++) {
+    s->live[i] = 1;
+    s->tree[i + 1] = 1;
+    m->val[map_find(m, s->page[i])] = i;
+  }
+  for (uint32_t i = 1; i <= s->cap; i++) { /* linear-time Fenwick build */
+    uint32_t up = i + (i & -i);
+    if (up <= s->cap) s->tree[up] += s->tree[i];
+  }
+  s->next = n;
+  return 0;
+}
+
+/* SHARDS samples by a hash of the page independent of the map's. */
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+/* A stack-distance pass, fed a trace in as many pieces as the caller likes. */
+typedef struct {
+  double rate;
+  uint64_t limit; /* mix(page) below this is sampled */
+  int64_t max_dist;
+  int64_t *hist;
+  int64_t cold, beyond, seen;
+  map_t m;
+  dstack_t s;
+} sd_t;
+
+void pagesim_sd_free(sd_t *d) {
+  if (!d) return;
+  map_free(&d->m);
+  free(d->s.tree);
+  free(d->s.page);
+  free(d->s.live);
+  free(d->hist);
+  free(d);
+}
+
+/*
+ * Stack distances for every reuse, histogrammed up to max_dist, or NULL for
+ * bad arguments or no memory.
+ *
+ * With rate < 1 this is SHARDS: only pages whose hash falls under rate
+ * are followed, and their distances, measured among sampled pages only,
+ * are divided by rate. The histogram then describes the sampled accesses,
+ * and hit ratios read from it estimate the full trace's.
+ */
+sd_t *pagesim_sd_new(double rate, int64_t max_dist) {
+  if (!(rate > 0 && rate <= 1) || max_dist < 1) return NULL;
+  sd_t *d = calloc(1, sizeof *d);
+  if (!d) return NULL;
+  d->hist = calloc(max_dist + 1, sizeof *d->hist);
+  if (!d->hist || map_init(&d->m, 1024) || stack_alloc(&d->s, 4096)) {
+    pagesim_sd_free(d);
+    return NULL;
+  }
+  d->rate = rate;
+  d->limit = rate >= 1 ? UINT64_MAX : (uint64_t)(rate * 0x1p64);
+  d->max_dist = max_dist;
+  return d;
+}
+
+/* Adds trace[0..n). Returns 0, or -1 for bad arguments or no memory. */
+int pagesim_sd_feed(sd_t *d, const void *trace, int64_t n, int width) {
+  if (n < 0 || (width != 4 && width != 8)) return -1;
+  map_t *m = &d->m;
+  dstack_t *s = &d->s;
+  for (int64_t i = 0; i < n; i++) {
+    uint64_t p = page_at(trace, width, i);
+    if (d->limit != UINT64_MAX && mix(p) >= d->limit) continue;
+    d->seen++;
+    if (s->next == s->cap && stack_pack(s, m)) return -1;
+    if ((s->marks + 1) * 4ull > m->mask + 1 && map_grow(m)) return -1;
+    uint64_t j = map_find(m, p);
+    uint32_t pos = m->val[j];
+    if (pos == EMPTY) {
+      d->cold++;
+      s->marks++;
+      m->key[j] = p;
+    } else {
+      uint64_t dist = s->marks - marks_upto(s, pos) + 1;
+      if (d->rate < 1) dist = (uint64_t)(dist / d->rate);
+      if (dist <= (uint64_t)d->max_dist)
+        d->hist[dist]++;
+      else
+        d->beyond++;
+      mark(s, pos, -1);
+      s->live[pos] = 0;
+    }
+    m->val[j] = s->next;
+    s->page[s->next] = p;
+    s->live[s->next] = 1;
+    mark(s, s->next++, 1);
+  }
+  return 0;
+}
+
+/* hist[d] (d = 1..max_dist) counts accesses at distance d, so LRU with k
+ * frames hits hist[1] + ... + hist[k] times. out[0] gets the first
+ * accesses to pages (cold misses), out[1] the accesses beyond max_dist and
+ * out[2] the number of accesses looked at. */
+void pagesim_sd_result(const sd_t *d, int64_t *hist, int64_t *out) {
+  memcpy(hist, d->hist, (d->max_dist + 1) * sizeof *hist);
+  out[0] = d->cold;
+  out[1] = d->beyond;
+  out[2] = d->seen;
+}
+
+/* The whole trace at once; 0, or -1 for bad arguments or no memory. */
+int pagesim_stack_dist(const void *trace, int64_t n, int width, double rate,
+                       int64_t *hist, int64_t max_dist, int64_t *out) {
+  sd_t *d = pagesim_sd_new(rate, max_dist);
+  if (!d) return -1;
+  int ret = pagesim_sd_feed(d, trace, n, width);
+  if (ret == 0) pagesim_sd_result(d, hist, out);
+  pagesim_sd_free(d);
+  return ret;
+}
+
+/* ---- logistic-regression eviction ---- */
+
+/*
+ * The model scores a cached page at access i as
+ *
+ *   w_rec * (i - last) + w_freq * count + bias
+ *
+ * from the page's last access and its accesses so far, and evicts the
+ * lowest score (the sigmoid on top doesn't change the order). The
+ * w_rec * i term is the same for every page, so the order only depends on
+ * key = w_freq * count - w_rec * last, which changes just when the page
+ * itself is accessed. An exact policy then needs no scoring per miss: a
+ * min-heap of frames by key has the victim on top, and a hit re-sifts one
+ * frame. Sampled mode instead looks at K random frames and takes the
+ * lowest, which bounds the work per miss and needs no heap.
+ */
+typedef struct {
+  double *key;    /* per frame */
+  uint32_t *heap; /* frames, lowest key first */
+  uint32_t *hpos; /* frame -> its index in heap */
+  uint32_t n;
+} heap_t;
+
+static void heap_set(heap_t *h, uint32_t i, uint32_t f) {
+  h->heap[i] = f;
+  h->hpos[f] = i;
+}
+
+static void sift_up(heap_t *h, uint32_t i) {
+  uint32_t f = h->heap[i];
+  while (i > 0 && h->key[h->heap[(i - 1) / 2]] > h->key[f]) {
+    heap_set(h, i, h->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_set(h, i, f);
+}
+
+static void sift_down(heap_t *h, uint32_t i) {
+  uint32_t f = h->heap[i];
+  for (;;) {
+    uint32_t c = 2 * i + 1;
+    if (c >= h->n) break;
+    if (c + 1 < h->n && h->key[h->heap[c + 1]] < h->key[h->heap[c]]) c++;
+    if (h->key[h->heap[c]] >= h->key[f]) break;
+    heap_set(h, i, h->heap[c]);
+    i = c;
+  }
+  heap_set(h, i, f);
+}
+
+/* Pages seen so far, cached or not: the counts outlive evictions. */
+typedef struct {
+  int64_t *count;
+  uint32_t *frame; /* EMPTY when not cached */
+  uint32_t n, cap;
+} pages_t;
+
+static int pages_add(pages_t *p) {
+  if (p->n == p->cap) {
+    uint32_t cap = p->cap ? p->cap * 2 : 1024;
+    int64_t *c = realloc(p->count, cap * sizeof *c);
+    if (c) p->count = c;
+    uint32_t *f = realloc(p->frame, cap * sizeof *f);
+    if (f) p->frame = f;
+    if (!c || !f) return -1;
+    p->cap = cap;
+  }
+  p->count[p->n] = 0;
+  p->frame[p->n] = EMPTY;
+  return p->n++;
+}
+
+/* One ML simulation, fed a trace in as many pieces as the caller likes. */
+typedef struct {
+  double w_rec, w_freq;
+  uint32_t k;
+  int64_t sample, t, hits; /* t: accesses so far */
+  uint64_t rng;
+  map_t m;      /* page -> index in pg */
+  pages_t pg;
+  heap_t h;
+  uint32_t *owner; /* frame -> index in pg */
+} ml_t;
+
+void pagesim_ml_free(ml_t *s) {
+  if (!s) return;
+  map_free(&s->m);
+  free(s->pg.count);
+  free(s->pg.frame);
+  free(s->h.key);
+  free(s->h.heap);
+  free(s->h.hpos);
+  free(s->owner);
+  free(s);
+}
+
+/*
+ * k frames evicting the page the logistic model w = {w_rec, w_freq} rates
+ * least likely to be reused. sample = 0 is exact (the heap); sample = K
+ * picks the lowest of K frames drawn at random with seed. NULL for bad
+ * arguments or no memory.
+ */
+ml_t *pagesim_ml_new(int64_t k, const double *w, int64_t sample,
+                     uint64_t seed) {
+  if (k <= 0 || k >= EMPTY || sample < 0) return NULL;
+  ml_t *s = calloc(1, sizeof *s);
+  if (!s) return NULL;
+  s->owner = malloc(k * sizeof *s->owner);
+  s->h.key = malloc(k * sizeof *s->h.key);
+  s->h.heap = malloc(k * sizeof *s->h.heap);
+  s->h.hpos = malloc(k * sizeof *s->h.hpos);
+  if (map_init(&s->m, 1024) || !s->owner || !s->h.key || !s->h.heap ||
+      !s->h.hpos) {
+    pagesim_ml_free(s);
+    return NULL;
+  }
+  s->w_rec = w[0];
+  s->w_freq = w[1];
+  s->k = k;
+  s->sample = sample;
+  s->rng = seed * 2 + 1;
+  return s;
+}
+
+/* Replays trace[0..n) and returns the hits so far, or -1 for bad arguments
+ * or no memory. */
+int64_t pagesim_ml_feed(ml_t *s, const void *trace, int64_t n, int width) {
+  if (n < 0 || (width != 4 && width != 8)) return -1;
+  map_t *m = &s->m;
+  pages_t *pg = &s->pg;
+  heap_t *h = &s->h;
+  for (int64_t i = 0; i < n; i++, s->t++) {
+    uint64_t p = page_at(trace, width, i);
+    if ((pg->n + 1) * 4ull > m->mask + 1 && map_grow(m)) return -1;
+    uint64_t j = map_find(m, p);
+    if (m->val[j] == EMPTY) {
+      int id = pages_add(pg);
+      if (id < 0) return -1;
+      m->key[j] = p;
+      m->val[j] = id;
+    }
+    uint32_t id = m->val[j], f = pg->frame[id];
+    if (f != EMPTY) {
+      s->hits++;
+    } else {
+      if (h->n < s->k) {
+        f = h->n++;
+        heap_set(h, f, f);
+      } else {
+        if (s->sample == 0) {
+          f = h->heap[0];
+        } else {
+          f = next_rand(&s->rng) % s->k;
+          for (int64_t c = 1; c < s->sample; c++) {
+            uint32_t g = next_rand(&s->rng) % s->k;
+            if (h->key[g] < h->key[f]) f = g;
+          }
+        }
+        pg->frame[s->owner[f]] = EMPTY;
+      }
+      s->owner[f] = id;
+      pg->frame[id] = f;
+    }
+    pg->count[id]++;
+    h->key[f] = s->w_freq * pg->count[id] - s->w_rec * s->t;
+    if (s->sample == 0) {
+      sift_up(h, h->hpos[f]);
+      sift_down(h, h->hpos[f]);
+    }
+  }
+  return s->hits;
+}
+
+/* The whole trace at once: the hits, or -1 for bad arguments or no memory. */
+int64_t pagesim_run_ml(const void *trace, int64_t n, int width, int64_t k,
+                       const double *w, int64_t sample, uint64_t seed) {
+  ml_t *s = pagesim_ml_new(k, w, sample, seed);
+  if (!s) return -1;
+  int64_t hits = pagesim_ml_feed(s, trace, n, width);
+  pagesim_ml_free(s);
+  return hits;
+}
@@ -0,0 +1,355 @@
+"""ctypes binding for pagesim.c, the native page-replacement engine.
+
+    import pagesim
+    hits = pagesim.simulate(trace, 'LRU', 256)
+    table = pagesim.sweep(trace, ['LRU', 'FIFO'], [64, 128, 256, 512])
+    curve = pagesim.mrc(trace)          # LRU at every size, one pass
+    curve.hits([64, 128, 256, 512])
+    w = pagesim.export_logreg(model)    # a trained scaler + LogisticRegression
+    hits = pagesim.simulate_ml(trace, 256, w)            # exact
+    hits = pagesim.simulate_ml(trace, 256, w, sample=16) # lowest of 16
+
+The library is compiled with $CC (default cc) next to this file the first
+time it is needed, and again whenever pagesim.c is newer. A trace can be
+a list of ints, a numpy array or a tracefile.TraceFile. uint32 and uint64
+arrays are passed straight through without a copy. A TraceFile is fed
+through a chunk at a time, so memory stays constant however long it is.
+`sweep` runs its simulations on a thread pool, because ctypes lets go of
+the GIL while the C code runs.
+
+Random uses its own generator, so its hit counts differ slightly from
+random.Random(seed) in the Python simulators.
+
+`mrc` reads LRU's miss-ratio curve off a stack-distance histogram.
+That takes one O(N log M) pass, where M is the number of distinct pages,
+instead of one simulation per size. With rate < 1 it follows SHARDS and
+samples pages by hash, which costs about rate times as much and gives an
+estimate of the curve. The estimate is poor below about 1/rate frames,
+since a sampled distance of 1 already stands for 1/rate pages.
+
+`simulate_ml` runs the ML policy of lru-ml-sim.py from the model's
+exported weights. It is exact with sample=0 (a heap, O(log k) per access)
+and approximate with sample=K, which takes the lowest-scored of K random
+frames, as Redis does, for O(K) per miss.
+
+`python3 pagesim.py [accesses]` checks the engine against the Python
+policies and reports accesses per second for each one.
+"""
+
+import ctypes
+import os
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import numpy as np
+
+POLICIES = {'LRU': 0, 'FIFO': 1, 'Random': 2, 'CLOCK': 3}
+
+_HERE = os.path.dirname(os.path.abspath(__file__))
+_SRC = os.path.join(_HERE, 'pagesim.c')
+_LIB = os.path.join(_HERE, 'libpagesim.so')
+_lib = None
+
+
+def _load():
+    global _lib
+    if _lib is not None:
+        return _lib
+    if (not os.path.exists(_LIB)
+            or os.path.getmtime(_LIB) < os.path.getmtime(_SRC)):
+        tmp = '%s.%d' % (_LIB, os.getpid())
+        subprocess.check_call([os.environ.get('CC', 'cc'), '-O2', '-shared',
+                               '-fPIC', '-o', tmp, _SRC])
+        os.replace(tmp, _LIB)
+    lib = ctypes.CDLL(_LIB)
+    P, I64, PTR = ctypes.c_void_p, ctypes.c_int64, ctypes.c_void_p
+    for name, res, args in (
+            ('pagesim_new', P, [ctypes.c_int, I64, ctypes.c_uint64]),
+            ('pagesim_feed', I64, [P, PTR, I64, ctypes.c_int]),
+            ('pagesim_free', None, [P]),
+            ('pagesim_sd_new', P, [ctypes.c_double, I64]),
+            ('pagesim_sd_feed', ctypes.c_int, [P, PTR, I64, ctypes.c_int]),
+            ('pagesim_sd_result', None, [P, PTR, PTR]),
+            ('pagesim_sd_free', None, [P]),
+            ('pagesim_ml_new', P, [I64, PTR, I64, ctypes.c_uint64]),
+            ('pagesim_ml_feed', I64, [P, PTR, I64, ctypes.c_int]),
+            ('pagesim_ml_free', None, [P])):
+        getattr(lib, name).restype = res
+        getattr(lib, name).argtypes = args
+    _lib = lib
+    return lib
+
+
+def available():
+    """True if the engine builds and loads. Otherwise callers can fall
+    back to the Python simulators."""
+    try:
+        _load()
+        return True
+    except (OSError, subprocess.CalledProcessError) as e:
+        print(f"pagesim: native engine unavailable ({e})", file=sys.stderr)
+        return False
+
+
+def as_trace(seq):
+    """seq as a contiguous uint32/uint64 array. Convert once and reuse it
+    across calls instead of handing over a list each time."""
+    a = np.asarray(seq)
+    if a.dtype not in (np.uint32, np.uint64):
+        a = a.astype(np.uint64)
+    return np.ascontiguousarray(a)
+
+
+def _pieces(trace):
+    """trace as arrays to feed the engine: a trace file (tracefile.py)
+    chunk by chunk, anything else in one go."""
+    if hasattr(trace, 'chunks'):
+        for c in trace.chunks():
+            yield as_trace(c)
+    else:
+        yield as_trace(trace)
+
+
+def _replay(new, feed, free, trace, what):
+    """Feeds trace to the handle new() returns; feed's last result."""
+    h = new()
+    if not h:
+        raise ValueError(f"pagesim: bad arguments or out of memory ({what})")
+    try:
+        r = 0
+        for a in _pieces(trace):
+            r = feed(h, a.ctypes.data, len(a), a.itemsize)
+            if r < 0:
+                raise ValueError(f"pagesim: out of memory ({what})")
+        return r
+    finally:
+        free(h)
+
+
+def simulate(trace, policy, k, seed=0):
+    """Hits when trace is replayed with k frames under policy."""
+    lib = _load()
+    return _replay(lambda: lib.pagesim_new(POLICIES[policy], k, seed),
+                   lib.pagesim_feed, lib.pagesim_free, trace,
+                   f"{policy}, k={k}")
+
+
+def sweep(trace, policies, sizes, seed=0, threads=None):
+    """{policy: [hits for each size]}, simulated in parallel."""
+    a = trace if hasattr(trace, 'chunks') else as_trace(trace)
+    jobs = [(p, k) for p in policies for k in sizes]
+    with ThreadPoolExecutor(threads or os.cpu_count()) as pool:
+        res = list(pool.map(lambda j: simulate(a, j[0], j[1], seed), jobs))
+    out = {p: [] for p in policies}
+    for (p, _), h in zip(jobs, res):
+        out[p].append(h)
+    return out
+
+
+def export_logreg(model):
+    """(w_rec, w_freq, bias) of a logistic model on (recency, frequency),
+    with a StandardScaler in front of it folded in. model is a
+    make_pipeline(StandardScaler(), <linear classifier>) or the classifier
+    alone."""
+    steps = [s for _, s in getattr(model, 'steps', [(None, model)])]
+    clf = steps[-1]
+    w = clf.coef_[0].astype(float)
+    b = float(clf.intercept_[0])
+    for sc in reversed(steps[:-1]):
+        b -= float(np.sum(w * sc.mean_ / sc.scale_))
+        w = w / sc.scale_
+    return float(w[0]), float(w[1]), b
+
+
+def simulate_ml(trace, k, weights, sample=0, seed=0):
+    """Hits of the logistic-regression policy with k frames. weights come
+    from export_logreg(). sample=K evicts the lowest of K random frames
+    instead of the lowest of all."""
+    lib = _load()
+    w = np.ascontiguousarray(weights[:2], dtype=np.float64)
+    return _replay(lambda: lib.pagesim_ml_new(k, w.ctypes.data, sample, seed),
+                   lib.pagesim_ml_feed, lib.pagesim_ml_free, trace,
+                   f"ML, k={k}, sample={sample}")
+
+
+class MissRatioCurve:
+    """LRU's hit and miss ratios at every size up to max_size."""
+
+    def __init__(self, hist, cold, beyond, sampled, n, rate):
+        self.n = n                  # accesses in the trace
+        self.sampled = sampled      # of which were followed (all at rate 1)
+        self.cold = cold            # first touches among the sampled
+        self.beyond = beyond        # sampled reuses further than max_size
+        self.rate = rate
+        self.max_size = len(hist) - 1
+        self.hist = hist            # hist[d]: sampled accesses at distance d
+        self._cum = np.cumsum(hist)
+
+    def hit_ratio(self, k):
+        k = np.asarray(k)
+        if np.any(k > self.max_size):
+            raise ValueError(f"sizes above max_size={self.max_size}")
+        return self._cum[k] / max(self.sampled, 1)
+
+    def miss_ratio(self, k):
+        return 1 - self.hit_ratio(k)
+
+    def hits(self, k):
+        """Hits with k frames: exact at rate 1, else an estimate."""
+        return np.rint(self.hit_ratio(k) * self.n).astype(np.int64)
+
+
+def mrc(trace, max_size=1 << 16, rate=1.0):
+    """LRU's miss-ratio curve for every size up to max_size, from one pass
+    over trace's stack distances (SHARDS-sampled when rate < 1)."""
+    lib = _load()
+    hist = np.zeros(max_size + 1, dtype=np.int64)
+    out = np.zeros(3, dtype=np.int64)
+    n = 0
+
+    def feed(h, data, count, width):
+        nonlocal n
+        n += count
+        return lib.pagesim_sd_feed(h, data, count, width)
+
+    def result(h):
+        lib.pagesim_sd_result(h, hist.ctypes.data, out.ctypes.data)
+        lib.pagesim_sd_free(h)
+
+    _replay(lambda: lib.pagesim_sd_new(rate, max_size), feed, result, trace,
+            f"rate={rate}, max_size={max_size}")
+    return MissRatioCurve(hist, int(out[0]), int(out[1]), int(out[2]), n,
+                          rate)
+
+
+# ---- self-check and throughput ----
+
+def _py_lru(seq, k):
+    from collections import OrderedDict
+    cache, hits = OrderedDict(), 0
+    for p in seq:
+        if p in cache:
+            hits += 1
+            cache.move_to_end(p)
+        else:
+            if len(cache) == k:
+                cache.popitem(last=False)
+            cache[p] = True
+    return hits
+
+
+def _py_fifo(seq, k):
+    from collections import deque
+    cache, present, hits = deque(), set(), 0
+    for p in seq:
+        if p in present:
+            hits += 1
+        else:
+            if len(cache) == k:
+                present.remove(cache.popleft())
+            cache.append(p)
+            present.add(p)
+    return hits
+
+
+def _py_clock(seq, k):
+    pages, ref, where, hand, hits = [], [], {}, 0, 0
+    for p in seq:
+        if p in where:
+            hits += 1
+            ref[where[p]] = 1
+        elif len(pages) < k:
+            where[p] = len(pages)
+            pages.append(p)
+            ref.append(0)
+        else:
+            while ref[hand]:
+                ref[hand] = 0
+                hand = (hand + 1) % k
+            del where[pages[hand]]
+            pages[hand], ref[hand], where[p] = p, 0, hand
+            hand = (hand + 1) % k
+    return hits
+
+
+def _py_ml(seq, k, w):
+    """simulate_ml() of lru-ml-sim.py with the model as a linear score."""
+    cache, where, last, cnt, hits = [], {}, {}, {}, 0
+    for i, p in enumerate(seq):
+        if p in where:
+            hits += 1
+        elif len(cache) < k:
+            where[p] = len(cache)
+            cache.append(p)
+        else:
+            sc = [w[0] * (i - last[q]) + w[1] * cnt[q] for q in cache]
+            v = int(np.argmin(sc))
+            del where[cache[v]]
+            cache[v], where[p] = p, v
+        last[p], cnt[p] = i, cnt.get(p, 0) + 1
+    return hits
+
+
+def _bench(n):
+    rng = np.random.default_rng(1)
+    # 90% of accesses to a 1,000-page hot set, the rest spread over 10^7.
+    hot = rng.random(n) < 0.9
+    trace = np.where(hot, rng.integers(0, 1_000, n),
+                     rng.integers(1_000, 10_000_000, n)).astype(np.uint32)
+
+    small = trace[:200_000]
+    for name, ref in (('LRU', _py_lru), ('FIFO', _py_fifo),
+                      ('CLOCK', _py_clock)):
+        for k in (1, 7, 64, 512):
+            want, got = ref(small.tolist(), k), simulate(small, name, k)
+            if want != got:
+                sys.exit(f"{name} k={k}: native {got} != python {want}")
+    print("native LRU/FIFO/CLOCK match the Python policies")
+    ks = [1, 7, 64, 512, 4096]
+    if list(mrc(small, 4096).hits(ks)) != [_py_lru(small.tolist(), k)
+                                         for k in ks]:
+        sys.exit("stack distances disagree with LRU")
+    print("stack-distance hits match LRU")
+    w = (-0.00137, 0.0731, 0.5)
+    for k in (1, 7, 64):
+        want, got = _py_ml(small[:50_000].tolist(), k, w), simulate_ml(
+            small[:50_000], k, w)
+        if want != got:
+            sys.exit(f"ML k={k}: native {got} != python {want}")
+    print("native ML matches a linear-score argmin")
+
+    for k in (64, 4096, 262_144):
+        for p in POLICIES:
+            t = time.perf_counter()
+            hits = simulate(trace, p, k)
+            dt = time.perf_counter() - t
+            print(f"{p:<6} k={k:<7} {n / dt / 1e6:8.1f} M accesses/s  "
+                  f"hit-rate {hits / n * 100:5.2f}%")
+
+    for k in (64, 4096, 262_144):
+        for sample in (0, 5, 16):
+            t = time.perf_counter()
+            hits = simulate_ml(trace, k, w, sample)
+            dt = time.perf_counter() - t
+            name = f"ML~{sample}" if sample else "ML"
+            print(f"{name:<6} k={k:<7} {n / dt / 1e6:8.1f} M accesses/s  "
+                  f"hit-rate {hits / n * 100:5.2f}%")
+
+    ks = [64, 4096, 262_144]
+    exact = None
+    for rate in (1.0, 0.1, 0.01):
+        t = time.perf_counter()
+        curve = mrc(trace, 1 << 18, rate)
+        dt = time.perf_counter() - t
+        hr = curve.hit_ratio(ks)
+        exact = hr if exact is None else exact
+        err = np.max(np.abs(hr - exact)) * 100
+        print(f"MRC rate={rate:<5} {n / dt / 1e6:8.1f} M accesses/s  "
+              f"hit-rates {' '.join(f'{h * 100:5.2f}%' for h in hr)}  "
+              f"max error {err:.2f} points")
+
+
+if __name__ == "__main__":
+    _bench(int(sys.argv[1]) if len(sys.argv) > 1 else 20_000_000)
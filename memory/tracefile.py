@@ -0,0 +1,320 @@
+"""Compact page-trace files, so the simulators can replay real workloads.
+
+A .ptr file holds page numbers in chunks that can each be decoded on their
+own. Each chunk holds the differences between consecutive pages. They
+are zigzag-encoded so small negative steps stay small, then written as
+LEB128 varints. A sequential or looping program then costs one or two
+bytes per access instead of eight. The file is laid out as:
+
+    header   magic "PGTRACE1", version, page shift, accesses, chunks,
+             offset of the index (all little-endian, 40 bytes)
+    chunks   one per CHUNK accesses, the first delta taken from page 0
+    index    per chunk: byte offset, byte length, first access, accesses
+
+TraceFile memory-maps a file and decodes one chunk at a time with numpy,
+so reading costs the same whatever the file's size. It also supports
+len() and slicing, so build_feature_table() can take it in place of a
+list. pagesim's simulate, sweep, simulate_ml and mrc take it directly
+and feed the engine a chunk at a time.
+
+    python3 tracefile.py convert lackey|perf|text|npy IN OUT.ptr [options]
+    python3 tracefile.py info FILE.ptr
+    python3 tracefile.py bench FILE.ptr
+
+Importers:
+  lackey  valgrind --tool=lackey --trace-mem=yes prog 2> lackey.out
+          (loads, stores and modifies; --instr adds instruction fetches)
+  perf    perf mem record prog; perf script -F addr > perf.out
+          (the data address, the last hex field of each line)
+  text    one page number per line
+  npy     a numpy array of page numbers
+Addresses become pages by dropping the low --page-shift bits (12).
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+import time
+
+import numpy as np
+
+import pagesim
+
+MAGIC = b'PGTRACE1'
+VERSION = 1
+CHUNK = 1 << 20
+_HEADER = struct.Struct('<8sIIQQQ')
+_INDEX = np.dtype([('offset', '<u8'), ('nbytes', '<u8'),
+                   ('start', '<u8'), ('count', '<u8')])
+
+
+# ---- varint coding ----
+
+def encode(pages):
+    """pages (< 2^63) as zigzag varint deltas."""
+    d = np.diff(np.asarray(pages, dtype=np.int64), prepend=0)
+    z = ((d << 1) ^ (d >> 63)).view(np.uint64)
+    nb = np.ones(len(z), dtype=np.int64)
+    for j in range(1, 10):
+        nb += z >= np.uint64(1) << np.uint64(7 * j)
+    out = np.empty(int(nb.sum()), dtype=np.uint8)
+    at = np.cumsum(nb) - nb
+    for j in range(int(nb.max(initial=0))):
+        m = nb > j
+        byte = (z[m] >> np.uint64(7 * j)) & np.uint64(0x7F)
+        out[at[m] + j] = byte | np.where(nb[m] > j + 1, np.uint64(0x80),
+                                         np.uint64(0))
+    return out
+
+
+def decode(buf):
+    """The pages in one chunk's bytes."""
+    buf = np.asarray(buf, dtype=np.uint8)
+    ends = np.flatnonzero(buf < 0x80)
+    starts = np.empty(len(ends), dtype=np.int64)
+    starts[:1] = 0
+    starts[1:] = ends[:-1] + 1
+    lens = ends - starts + 1
+    z = (buf[starts] & 0x7F).astype(np.uint64)
+    for j in range(1, int(lens.max(initial=0))):
+        m = np.flatnonzero(lens > j)
+        z[m] |= (buf[starts[m] + j] & 0x7F).astype(np.uint64) << \
+            np.uint64(7 * j)
+    d = (z >> np.uint64(1)).view(np.int64) ^ -(z & np.uint64(1)).view(np.int64)
+    return np.cumsum(d).view(np.uint64)
+
+
+# ---- files ----
+
+class TraceWriter:
+    """Appends pages to a .ptr file, a chunk at a time.
+
+        with TraceWriter('app.ptr') as w:
+            for block in blocks:
+                w.write(block)
+    """
+
+    def __init__(self, path, page_shift=12, chunk=CHUNK):
+        self.f = open(path, 'wb')
+        self.page_shift, self.chunk = page_shift, chunk
+        self.pending, self.npending = [], 0
+        self.index, self.count = [], 0
+        self.f.write(b'\0' * _HEADER.size)
+
+    def write(self, pages):
+        pages = np.asarray(pages, dtype=np.uint64)
+        while len(pages):
+            take = pages[:self.chunk - self.npending]
+            self.pending.append(take)
+            self.npending += len(take)
+            pages = pages[len(take):]
+            if self.npending == self.chunk:
+                self._flush()
+
+    def _flush(self):
+        if not self.npending:
+            return
+        data = encode(np.concatenate(self.pending))
+        self.index.append((self.f.tell(), len(data), self.count,
+                           self.npending))
+        self.f.write(data.tobytes())
+        self.count += self.npending
+        self.pending, self.npending = [], 0
+
+    def close(self):
+        self._flush()
+        at = self.f.tell()
+        self.f.write(np.array(self.index, dtype=_INDEX).tobytes())
+        self.f.seek(0)
+        self.f.write(_HEADER.pack(MAGIC, VERSION, self.page_shift,
+                                  self.count, len(self.index), at))
+        self.f.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def write(path, pages, page_shift=12, chunk=CHUNK):
+    """Saves a whole trace (a list or array of page numbers)."""
+    with TraceWriter(path, page_shift, chunk) as w:
+        w.write(pages)
+
+
+class TraceFile:
+    """A .ptr file, memory-mapped; pages come out one chunk at a time."""
+
+    def __init__(self, path):
+        self.path = path
+        self.map = np.memmap(path, dtype=np.uint8, mode='r')
+        magic, ver, self.page_shift, self.count, nchunks, at = \
+            _HEADER.unpack(self.map[:_HEADER.size].tobytes())
+        if magic != MAGIC or ver != VERSION:
+            raise ValueError(f"{path}: not a version {VERSION} page trace")
+        self.index = np.frombuffer(self.map, dtype=_INDEX, count=nchunks,
+                                   offset=at)
+
+    def __len__(self):
+        return self.count
+
+    def chunk(self, i):
+        e = self.index[i]
+        return decode(self.map[e['offset']:e['offset'] + e['nbytes']])
+
+    def chunks(self, start=0, stop=None):
+        """Decoded chunks covering accesses [start, stop), trimmed to it."""
+        stop = self.count if stop is None else min(stop, self.count)
+        if start >= stop:
+            return
+        first = np.searchsorted(self.index['start'], start, side='right') - 1
+        for i in range(first, len(self.index)):
+            beg = int(self.index[i]['start'])
+            if beg >= stop:
+                break
+            pages = self.chunk(i)
+            yield pages[max(start - beg, 0):stop - beg]
+
+    def __getitem__(self, s):
+        if isinstance(s, slice):
+            start, stop, step = s.indices(self.count)
+            if step != 1:
+                raise ValueError("TraceFile slices must be contiguous")
+            parts = list(self.chunks(start, stop))
+            return np.concatenate(parts) if parts else \
+                np.empty(0, dtype=np.uint64)
+        i = s + self.count if s < 0 else s
+        if not 0 <= i < self.count:
+            raise IndexError(s)
+        return next(self.chunks(i, i + 1))[0]
+
+
+# ---- importers ----
+# Each yields arrays of page numbers. The text is read in large blocks, and
+# one regex call finds every address in a block. That skips the per-line
+# splitting and matching, but each address is still converted by int()
+# in a Python loop. Converting them in bulk with numpy measured slower:
+# building the array of tokens alone costs about half as much as the loop.
+
+_LACKEY = re.compile(rb'^ ?[LSM] +([0-9A-Fa-f]+),', re.M)
+_LACKEY_I = re.compile(rb'^ ?[ILSM] +([0-9A-Fa-f]+),', re.M)
+_PERF = re.compile(rb'(?:0x)?([0-9A-Fa-f]+)[ \t]*$', re.M)
+_TEXT = re.compile(rb'^[ \t]*([0-9]+)[ \t]*$', re.M)
+
+
+def _blocks(path, size=64 << 20):
+    """The file in blocks of whole lines."""
+    with open(path, 'rb') as f:
+        rest = b''
+        while True:
+            data = f.read(size)
+            if not data:
+                if rest:
+                    yield rest
+                return
+            data = rest + data
+            cut = data.rfind(b'\n') + 1
+            rest = data[cut:]
+            yield data[:cut]
+
+
+def _scan(path, regex, base, shift):
+    for block in _blocks(path):
+        found = regex.findall(block)
+        if found:
+            addr = np.array([int(x, base) for x in found], dtype=np.uint64)
+            yield addr >> np.uint64(shift)
+
+
+def import_lackey(path, page_shift=12, instr=False):
+    return _scan(path, _LACKEY_I if instr else _LACKEY, 16, page_shift)
+
+
+def import_perf(path, page_shift=12):
+    return _scan(path, _PERF, 16, page_shift)
+
+
+def import_text(path):
+    return _scan(path, _TEXT, 10, 0)
+
+
+def import_npy(path):
+    a = np.load(path, mmap_mode='r')
+    for beg in range(0, len(a), CHUNK):
+        yield np.asarray(a[beg:beg + CHUNK], dtype=np.uint64)
+
+
+# ---- command line ----
+
+def _convert(args):
+    if args.kind == 'lackey':
+        src = import_lackey(args.input, args.page_shift, args.instr)
+    elif args.kind == 'perf':
+        src = import_perf(args.input, args.page_shift)
+    elif args.kind == 'text':
+        src = import_text(args.input)
+    else:
+        src = import_npy(args.input)
+    shift = args.page_shift if args.kind in ('lackey', 'perf') else 0
+    t = time.perf_counter()
+    with TraceWriter(args.output, shift, args.chunk) as w:
+        for pages in src:
+            w.write(pages)
+    dt = time.perf_counter() - t
+    _info(args.output)
+    print(f"converted in {dt:.2f} s")
+
+
+def _info(path):
+    t = TraceFile(path)
+    size = os.path.getsize(path)
+    print(f"{path}: {len(t):,} accesses in {len(t.index)} chunks, "
+          f"{size:,} bytes ({size * 8 / max(len(t), 1):.2f} bits/access), "
+          f"page shift {t.page_shift}")
+
+
+def _bench(path):
+    """Decoding alone, then decoding feeding an LRU simulation, as replays
+    in pagesim see it."""
+    t = TraceFile(path)
+    size = os.path.getsize(path)
+    runs = [('decode', lambda: sum(len(c) for c in t.chunks()))]
+    if pagesim.available():
+        runs.append(('LRU 4096 replay', lambda: pagesim.simulate(t, 'LRU',
+                                                                 4096)))
+    for name, run in runs:
+        start = time.perf_counter()
+        r = run()
+        dt = time.perf_counter() - start
+        print(f"{name:<16} {len(t) / dt / 1e6:8.1f} M accesses/s  "
+              f"{size / dt / 1e6:8.1f} MB/s  -> {r:,}")
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description="Convert, describe and time page-trace files.")
+    sub = ap.add_subparsers(dest='cmd', required=True)
+    c = sub.add_parser('convert', help="import a trace into .ptr")
+    c.add_argument('kind', choices=['lackey', 'perf', 'text', 'npy'])
+    c.add_argument('input')
+    c.add_argument('output')
+    c.add_argument('--page-shift', type=int, default=12)
+    c.add_argument('--instr', action='store_true',
+                   help="lackey: include instruction fetches")
+    c.add_argument('--chunk', type=int, default=CHUNK)
+    sub.add_parser('info', help="size and layout").add_argument('file')
+    sub.add_parser('bench', help="read throughput").add_argument('file')
+    args = ap.parse_args()
+    if args.cmd == 'convert':
+        _convert(args)
+    elif args.cmd == 'info':
+        _info(args.file)
+    else:
+        _bench(args.file)
+
+
+if __name__ == "__main__":
+    sys.exit(main())